@@ -3,10 +3,13 @@
 #include "src\common\Directory.cpp"
 #include "src\common\FileStream.cpp"
 #include "src\common\FileTree.cpp"
+#include "src\common\FrameCache.cpp"
 #include "src\common\ListFile.cpp"
 #include "src\common\Mime.cpp"
+#include "src\common\PerfectHash.cpp"
 #include "src\common\RootHandler.cpp"
 #include "src\common\Sockets.cpp"
+#include "src\common\Threads.cpp"
 #include "src\hashes\md5.cpp"
 #include "src\hashes\sha1.cpp"
 #include "src\overwatch\aes.cpp"
@@ -28,3 +31,5 @@
 #include "src\CascRootFile_Text.cpp"
 #include "src\CascRootFile_TVFS.cpp"
 #include "src\CascRootFile_WoW.cpp"
+#include "src\CascSnapshot.cpp"
+#include "src\CascESpec.cpp"
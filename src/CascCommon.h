@@ -30,6 +30,7 @@
 #include "common/Common.h"
 #include "common/Array.h"
 #include "common/ArraySparse.h"
+#include "common/PerfectHash.h"
 #include "common/Map.h"
 #include "common/FileTree.h"
 #include "common/FileStream.h"
@@ -40,6 +41,8 @@
 #include "common/Path.h"
 #include "common/RootHandler.h"
 #include "common/Sockets.h"
+#include "common/Threads.h"
+#include "common/FrameCache.h"
 
 // Headers for hashes used in CascLib
 #include "hashes/md5.h"
@@ -65,10 +68,18 @@
 #define CASC_MAGIC_STORAGE  0x524F545343534143      // 'CASCSTOR'
 #define CASC_MAGIC_FILE     0x454C494643534143      // 'CASCFILE'
 #define CASC_MAGIC_FIND     0x444E494643534143      // 'CASCFIND'
+#define CASC_MAGIC_HANDLE   0x4C444E4843534143      // 'CASCHNDL'
 
 // The maximum size of an online file
 #define CASC_MAX_ONLINE_FILE_SIZE   0x40000000
 
+// The maximum number of sorted runs of EKey entries in one index file. V1 index files have two
+#define CASC_INDEX_MAX_RUNS         2
+
+// Readahead: number of frames decoded in advance and number of sequential reads that enable it
+#define CASC_READAHEAD_FRAMES       4
+#define CASC_READAHEAD_MIN_READS    2
+
 //-----------------------------------------------------------------------------
 // In-memory structures
 
@@ -93,6 +104,7 @@ typedef enum _CSTRTG
     CascCacheInvalid,                               // Do not cache anything. Used as invalid value
     CascCacheNothing,                               // Do not cache anything. Used on internal files, where the content is loaded directly to the user buffer
     CascCacheLastFrame,                             // Only cache one file frame
+    CascCacheMultiFrame,                            // Cache multiple file frames, up to a byte budget. The least recently used frames are dropped first
 } CSTRTG, *PCSTRTG;
 
 // Tag file entry, loaded from the DOWNLOAD file
@@ -113,7 +125,16 @@ typedef struct _CASC_BUILD_FILE
 // Information about index file
 typedef struct _CASC_INDEX
 {
-    CASC_BLOB FileData;
+    CASC_BLOB FileData;                             // Content of the index file, if it could not be mapped to memory
+    TFileStream * pStream;                          // The index file mapped to memory
+    LPBYTE pbFileData;                              // Data of the index file, either mapped or loaded
+    size_t cbFileData;                              // Size of the index file data, in bytes
+    LPBYTE pbSortedEntries[CASC_INDEX_MAX_RUNS];    // Runs of EKey entries sorted by EKey, searched directly
+    size_t nSortedEntries[CASC_INDEX_MAX_RUNS];     // Number of EKey entries in each run
+    size_t EntryLength;                             // Length of one EKey entry, in bytes
+    BYTE FileOffsetBits;                            // Number of bits of the file offset, from the index header
+    BYTE EKeyLength;                                // Length of the EKey, from the index header
+    bool bSortedEKeys;                              // If true, the entries can be searched directly
     LPTSTR szFileName;                              // Full name of the index file
     DWORD NewSubIndex;                              // New subindex
     DWORD OldSubIndex;                              // Old subindex
@@ -156,6 +177,27 @@ typedef struct _CASC_ARCINDEX_FOOTER
 
 } CASC_ARCINDEX_FOOTER, *PCASC_ARCINDEX_FOOTER;
 
+// The archive-group index of an online storage. Merged index of all archives, sorted by EKey.
+// If the CDN config has no "archive-group", it is built locally and cached under the CDN config key
+typedef struct _CASC_ARCHIVE_GROUP
+{
+    CASC_BLOB FileData;                             // Content of the group index, if it could not be mapped to memory
+    TFileStream * pStream;                          // The group index mapped to memory
+    LPBYTE pbPages;                                 // Pointer to the first index page
+    LPBYTE pbToc;                                   // Pointer to the table of contents (last EKey of each page)
+    size_t nPageCount;                              // Number of index pages. Zero if the group index is not loaded
+    CASC_ARCINDEX_FOOTER Footer;                    // Footer of the group index
+} CASC_ARCHIVE_GROUP, *PCASC_ARCHIVE_GROUP;
+
+// Archive indexes of an online storage, as loaded by LoadIndexFiles. The loading runs on a worker thread
+// while the main thread already opens files, so the results are only moved to the storage by LinkIndexFiles
+typedef struct _CASC_ARCHIVE_INDEXES
+{
+    CASC_ARCHIVE_GROUP GroupIndex;                  // The archive-group index, if loaded
+    BYTE FileOffsetBits;                            // Number of bits of the storage offset, from the index footers
+    BYTE EKeyLength;                                // Length of the EKey, from the index footers
+} CASC_ARCHIVE_INDEXES, *PCASC_ARCHIVE_INDEXES;
+
 // Normalized header of the ENCODING file
 typedef struct _CASC_ENCODING_HEADER
 {
@@ -170,6 +212,13 @@ typedef struct _CASC_ENCODING_HEADER
     DWORD  ESpecBlockSize;                          // Size of the ESpec string block, in bytes
 } CASC_ENCODING_HEADER, *PCASC_ENCODING_HEADER;
 
+// Information about file encoding, parsed from the ESpec string
+typedef struct _CASC_ESPEC_INFO
+{
+    ULONGLONG KeyName;                              // If nonzero, the whole file is encrypted by this key
+    DWORD FrameCount;                               // Number of BLTE frames (zero if not known)
+} CASC_ESPEC_INFO, *PCASC_ESPEC_INFO;
+
 typedef struct _CASC_DOWNLOAD_HEADER
 {
     USHORT Magic;                                   // FILE_MAGIC_DOWNLOAD ('DL')
@@ -248,6 +297,31 @@ typedef struct _CASC_FILE_SPAN
 
 } CASC_FILE_SPAN, *PCASC_FILE_SPAN;
 
+// Decoded file frame in the multi-frame cache of a file. The data follow the structure
+typedef struct _CASC_CACHED_FRAME
+{
+    struct _CASC_CACHED_FRAME * pPrev;              // The more recently used frame
+    struct _CASC_CACHED_FRAME * pNext;              // The less recently used frame
+    ULONGLONG StartOffset;                          // Starting offset of the frame in the file
+    ULONGLONG EndOffset;                            // Ending offset of the frame in the file
+    LPBYTE pbData;                                  // Decoded data of the frame
+
+} CASC_CACHED_FRAME, *PCASC_CACHED_FRAME;
+
+// File frame decoded in advance on a worker thread. Except for pFileFrame, the members
+// may only be accessed after the work group completes
+typedef struct _CASC_READAHEAD_FRAME
+{
+    CASC_WORK_GROUP Group;                          // The work group of the decoding work item
+    struct TCascFile * hf;                          // The file the frame belongs to
+    PCASC_CKEY_ENTRY pCKeyEntry;                    // CKey entry of the file span
+    PCASC_FILE_SPAN pFileSpan;                      // The file span
+    PCASC_FILE_FRAME pFileFrame;                    // The frame being decoded. NULL if the slot is free
+    LPBYTE pbData;                                  // Decoded data of the frame
+    DWORD dwErrCode;                                // Result of the decoding
+
+} CASC_READAHEAD_FRAME, *PCASC_READAHEAD_FRAME;
+
 // Archive information for a remote file
 typedef struct _CASC_ARCHIVE_INFO
 {
@@ -269,14 +343,8 @@ struct TCascStorage
     TCascStorage * AddRef();
     TCascStorage * Release();
 
-    static TCascStorage * IsValid(HANDLE hStorage)
-    {
-        TCascStorage * hs = (TCascStorage *)hStorage;
-
-        return (hs != INVALID_HANDLE_VALUE &&
-                hs != NULL &&
-                hs->ClassName == CASC_MAGIC_STORAGE) ? hs : NULL;
-    }
+    // Returns the storage of a handle from CascOpenStorage(Ex). See TCascStorageHandle
+    static TCascStorage * IsValid(HANDLE hStorage);
 
     DWORD SetProductCodeName(LPCSTR szNewCodeName, size_t nLength = 0)
     {
@@ -299,7 +367,10 @@ struct TCascStorage
 
     // Class members
     PCASC_OPEN_STORAGE_ARGS pArgs;                  // Open storage arguments. Only valid during opening the storage
+    TCascStorage * pNextShared;                     // Next storage in the registry of shared storages (CASC_FEATURE_SHARED_STORAGE)
     CASC_LOCK StorageLock;                          // Lock for multi-threaded operations
+    CASC_WORKER_POOL WorkerPool;                    // Worker threads. Without threads, work items run on the calling thread
+    CASC_FRAME_CACHE FrameCache;                    // Decoded frames shared by all file handles. Only if requested in CASC_OPEN_STORAGE_ARGS
 
     LPCTSTR szIndexFormat;                          // Format of the index file name
     LPTSTR  szCodeName;                             // On local storage, this select a product in a multi-product storage. For online storage, this selects a product
@@ -309,6 +380,7 @@ struct TCascStorage
     LPTSTR  szFilesPath;                            // The directory where raw files are
     LPTSTR  szConfigPath;                           // The directory with configs
     LPTSTR  szMainFile;                             // Main storage file (".build.info", ".build.db", "versions")
+    LPTSTR  szSnapshotPath;                         // Directory for the snapshot files (CASC_FEATURE_SNAPSHOT). NULL = per-user cache directory
     LPTSTR  szCdnHostUrl;                           // URL of the ribbit/http server where to download the "versions" and "cdns" files
     LPTSTR  szCdnServers;                           // List of CDN servers, separated by space
     LPTSTR  szCdnPath;                              // Remote CDN sub path for the product
@@ -318,6 +390,8 @@ struct TCascStorage
     DWORD dwBuildNumber;                            // Product build number
     DWORD dwRefCount;                               // Number of references
     DWORD dwFeatures;                               // List of CASC features. See CASC_FEATURE_XXX
+    DWORD dwOpenFlags;                              // CASC_OPEN_STORAGE_ARGS::dwFlags the storage was opened with
+    DWORD dwLocaleMask;                             // CASC_OPEN_STORAGE_ARGS::dwLocaleMask the storage was opened with
 
     CBLD_TYPE BuildFileType;                        // Type of the build file
 
@@ -332,7 +406,7 @@ struct TCascStorage
 
     TFileStream * DataFiles[CASC_MAX_DATA_FILES];   // Array of open data files
     CASC_INDEX IndexFiles[CASC_INDEX_COUNT];        // Array of found index files
-    CASC_MAP IndexEKeyMap;
+    CASC_FIXED_MAP<CASC_EKEY_SIZE> IndexEKeyMap;    // Map of EKey -> FILE_EKEY_ENTRY (for local storages)
 
     CASC_CKEY_ENTRY EncodingCKey;                   // Information about ENCODING file
     CASC_CKEY_ENTRY DownloadCKey;                   // Information about DOWNLOAD file
@@ -347,19 +421,65 @@ struct TCascStorage
     CASC_ARRAY IndexArray;                          // Array of CASC_EKEY_ENTRY, loaded from online indexes
     CASC_ARRAY CKeyArray;                           // Array of CASC_CKEY_ENTRY, loaded from ENCODING file
     CASC_ARRAY TagsArray;                           // Array of CASC_DOWNLOAD_TAG2
+    CASC_ARRAY TagBitmaps;                          // Bitmap for each tag, one bit for each item in CKeyArray. Only if tags are supported
     CASC_MAP IndexMap;                              // Map of EKey -> IndexArray (for online archives)
-    CASC_MAP CKeyMap;                               // Map of CKey -> CKeyArray
-    CASC_MAP EKeyMap;                               // Map of EKey -> CKeyArray
+    CASC_ARCHIVE_GROUP ArchiveGroupIndex;           // The archive-group index (for online archives)
+    CASC_ARCHIVE_INDEXES LoadedIndexes;             // Archive indexes loaded by LoadIndexFiles, not linked to the storage yet
+    CASC_CONCURRENT_MAP<MD5_HASH_SIZE> CKeyMap;     // Map of CKey -> CKeyArray
+    CASC_CONCURRENT_MAP<CASC_EKEY_SIZE> EKeyMap;    // Map of EKey -> CKeyArray. The first 9 bytes of EKey are unique
+    CASC_BLOB EncodingData;                         // The ENCODING manifest, kept in memory for CASC_FEATURE_LAZY_ENCODING
+    CASC_ENCODING_HEADER EncodingHeader;            // Header of the ENCODING manifest, for CASC_FEATURE_LAZY_ENCODING
+    DWORD volatile dwLazyEncoding;                  // Nonzero while CKey entries are created on demand. Read with CascReadAcquire
+    CASC_BLOB ESpecData;                            // The ESpec strings from the ENCODING manifest
+    CASC_ARRAY ESpecOffsets;                        // Array of DWORD, offset of each ESpec string in ESpecData
+    CASC_ARRAY ESpecIndexes;                        // Array of DWORD, ESpec index for each item in CKeyArray
     size_t LocalFiles;                              // Number of files that are present locally
     size_t TotalFiles;                              // Total number of files in the storage, some may not be present locally
     size_t EKeyEntries;                             // Number of CKeyEntry-ies loaded from text build file
     size_t EKeyLength;                              // EKey length from the index files
     DWORD FileOffsetBits;                           // Number of bits in the storage offset which mean data segment offset
 
-    CASC_KEY_MAP KeyMap;                            // Growable map of encryption keys
+    CASC_KEY_MAP KeyMap;                            // Encryption keys for the files opened by the library itself
     ULONGLONG  LastFailKeyName;                     // The value of the encryption key that recently was NOT found.
 };
 
+// The handle given to the caller by CascOpenStorage(Ex). Every open gets its own handle,
+// even if the storage is shared by several opens (CASC_FEATURE_SHARED_STORAGE).
+// The encryption keys belong to the handle, so that the keys added by one caller
+// are not visible to other callers of the same storage
+struct TCascStorageHandle
+{
+    TCascStorageHandle(TCascStorage * ahs);
+    ~TCascStorageHandle();
+
+    TCascStorageHandle * AddRef();
+    TCascStorageHandle * Release();
+
+    static TCascStorageHandle * IsValid(HANDLE hStorage)
+    {
+        TCascStorageHandle * hsh = (TCascStorageHandle *)hStorage;
+
+        return (hsh != INVALID_HANDLE_VALUE &&
+                hsh != NULL &&
+                hsh->ClassName == CASC_MAGIC_HANDLE) ? hsh : NULL;
+    }
+
+    // Class recognizer. Has constant value of 'CASCHNDL' (CASC_MAGIC_HANDLE)
+    ULONGLONG ClassName;
+
+    TCascStorage * hs;                              // The storage. Can be shared with other handles
+    CASC_KEY_MAP KeyMap;                            // Encryption keys of this handle
+    ULONGLONG LastFailKeyName;                      // The value of the encryption key that recently was NOT found
+    DWORD dwRefCount;                               // The caller's reference plus one for each file open through the handle
+};
+
+inline TCascStorage * TCascStorage::IsValid(HANDLE hStorage)
+{
+    TCascStorageHandle * hsh = TCascStorageHandle::IsValid(hStorage);
+
+    return (hsh != NULL) ? hsh->hs : NULL;
+}
+
 struct TCascFile
 {
     TCascFile(TCascStorage * hs, PCASC_CKEY_ENTRY pCKeyEntry);
@@ -368,6 +488,10 @@ struct TCascFile
     DWORD OpenFileSpans(LPCTSTR szSpanList);
     void InitFileSpans(PCASC_FILE_SPAN pSpans, DWORD dwSpanCount);
     void InitCacheStrategy();
+    void FreeFileCache();
+    void FreeReadaheadFrame(PCASC_READAHEAD_FRAME pReadahead);
+    void FreeReadahead();
+    LPBYTE FindEncryptionKey(ULONGLONG KeyName);
 
     static TCascFile * IsValid(HANDLE hFile)
     {
@@ -384,6 +508,7 @@ struct TCascFile
 
     // Class members
     TCascStorage * hs;                              // Pointer to storage structure
+    TCascStorageHandle * hsh;                       // Storage handle the file was open through. NULL for files open by the library itself
 
     PCASC_CKEY_ENTRY pCKeyEntry;                    // Pointer to the first CKey entry. Each entry describes one file span
     PCASC_FILE_SPAN pFileSpan;                      // Pointer to the first file span entry
@@ -396,11 +521,25 @@ struct TCascFile
     DWORD bCloseFileStream:1;                       // If true, file stream needs to be closed during CascCloseFile
     DWORD bOvercomeEncrypted:1;                     // If true, then CascReadFile will fill the part that is encrypted (and key was not found) with zeros
     DWORD bFreeCKeyEntries:1;                       // If true, destructor will free the array of CKey entries
+    DWORD bParallelDecode:1;                        // If true, reading the whole large file decodes the frames on the worker threads
 
     ULONGLONG FileCacheStart;                       // Starting offset of the file cached area
     ULONGLONG FileCacheEnd;                         // Ending offset of the file cached area
     LPBYTE pbFileCache;                             // Pointer to file cached area
     CSTRTG CacheStrategy;                           // Caching strategy. See CSTRTG enum for more info
+
+    PCASC_CACHED_FRAME pFirstCachedFrame;           // CascCacheMultiFrame: The most recently used frame
+    PCASC_CACHED_FRAME pLastCachedFrame;            // CascCacheMultiFrame: The least recently used frame
+    size_t cbFrameCache;                            // CascCacheMultiFrame: Size of the decoded data in the cache
+    size_t cbFrameCacheMax;                         // CascCacheMultiFrame: Byte budget of the cache
+    DWORD dwCachedFrames;                           // CascCacheMultiFrame: Number of frames in the cache
+    ULONGLONG CacheHits;                            // Number of reads (or their parts) handled from the file cache
+    ULONGLONG CacheMisses;                          // Number of frames that had to be loaded and decoded
+
+    CASC_READAHEAD_FRAME Readahead[CASC_READAHEAD_FRAMES];  // Frames being decoded in advance when the file is read sequentially
+    ULONGLONG ReadaheadOffset;                      // Offset of the next frame to be decoded in advance
+    ULONGLONG SequentialOffset;                     // Offset where the next read starts if the file is read sequentially
+    DWORD dwSequentialReads;                        // Number of sequential reads in a row
 };
 
 struct TCascSearch
@@ -476,6 +615,9 @@ inline void FreeCascBlob(PCASC_BLOB pBlob)
 bool  InvokeProgressCallback(TCascStorage * hs, CASC_PROGRESS_MSG Message, LPCSTR szObject, DWORD CurrentValue, DWORD TotalValue);
 DWORD GetFileSpanInfo(PCASC_CKEY_ENTRY pCKeyEntry, PULONGLONG PtrContentSize, PULONGLONG PtrEncodedSize = NULL);
 DWORD FetchCascFile(TCascStorage * hs, CPATH_TYPE PathType, LPBYTE pbEKey, LPCTSTR szExtension, CASC_PATH<TCHAR> & LocalPath, PCASC_ARCHIVE_INFO pArchiveInfo = NULL);
+DWORD FindCachedCascFile(TCascStorage * hs, CPATH_TYPE PathType, LPBYTE pbEKey, LPCTSTR szExtension, CASC_PATH<TCHAR> & LocalPath);
+DWORD ForcePathExist(LPCTSTR szFileName, bool bIsFileName);
+DWORD SaveCascFile(TCascStorage * hs, CPATH_TYPE PathType, LPBYTE pbEKey, LPCTSTR szExtension, LPBYTE pbFileData, size_t cbFileData);
 DWORD CheckCascBuildFileExact(CASC_BUILD_FILE & BuildFile, LPCTSTR szLocalPath);
 DWORD CheckCascBuildFileDirs(CASC_BUILD_FILE & BuildFile, LPCTSTR szLocalPath);
 DWORD CheckOnlineStorage(PCASC_OPEN_STORAGE_ARGS pArgs, CASC_BUILD_FILE & BuildFile, bool bOnlineStorage);
@@ -485,6 +627,7 @@ DWORD LoadMainFile(TCascStorage * hs);
 DWORD LoadCdnConfigFile(TCascStorage * hs);
 DWORD LoadCdnBuildFile(TCascStorage * hs);
 
+DWORD CreateTagBitmaps(TCascStorage * hs, size_t nTagCount, size_t nEntryCount);
 DWORD LoadInternalFileToMemory(TCascStorage * hs, PCASC_CKEY_ENTRY pCKeyEntry, CASC_BLOB & FileData);
 DWORD LoadFileToMemory(LPCTSTR szFileName, CASC_BLOB & FileData);
 bool OpenFileByCKeyEntry(TCascStorage * hs, PCASC_CKEY_ENTRY pCKeyEntry, DWORD dwOpenFlags, HANDLE * PtrFileHandle);
@@ -495,24 +638,47 @@ bool SetCacheStrategy(HANDLE hFile, CSTRTG CacheStrategy);
 
 void * ProbeOutputBuffer(void * pvBuffer, size_t cbLength, size_t cbMinLength, size_t * pcbLengthNeeded);
 
+size_t GetCKeyEntryIndex(TCascStorage * hs, PCASC_CKEY_ENTRY pCKeyEntry);
+ULONGLONG GetTagBitMask(TCascStorage * hs, PCASC_CKEY_ENTRY pCKeyEntry);
+
 PCASC_CKEY_ENTRY FindCKeyEntry_CKey(TCascStorage * hs, LPBYTE pbCKey, PDWORD PtrIndex = NULL);
 PCASC_CKEY_ENTRY FindCKeyEntry_EKey(TCascStorage * hs, LPBYTE pbEKey, PDWORD PtrIndex = NULL);
+PCASC_CKEY_ENTRY LoadEncodingEntry(TCascStorage * hs, LPBYTE pbCKey);
+void LoadEncodingEntries(TCascStorage * hs);
+DWORD FreezeKeyMaps(TCascStorage * hs);
 
 size_t GetTagBitmapLength(LPBYTE pbFilePtr, LPBYTE pbFileEnd, DWORD EntryCount);
 
 DWORD CascDecompress(LPBYTE pvOutBuffer, PDWORD pcbOutBuffer, LPBYTE pvInBuffer, DWORD cbInBuffer);
 DWORD CascDirectCopy(LPBYTE pbOutBuffer, PDWORD pcbOutBuffer, LPBYTE pbInBuffer, DWORD cbInBuffer);
 
-DWORD CascLoadEncryptionKeys(TCascStorage * hs);
-DWORD CascDecrypt(TCascStorage * hs, LPBYTE pbOutBuffer, PDWORD pcbOutBuffer, LPBYTE pbInBuffer, DWORD cbInBuffer, DWORD dwFrameIndex);
+DWORD CascLoadEncryptionKeys(CASC_KEY_MAP & KeyMap);
+DWORD CascDecrypt(TCascFile * hf, LPBYTE pbOutBuffer, PDWORD pcbOutBuffer, LPBYTE pbInBuffer, DWORD cbInBuffer, DWORD dwFrameIndex);
 
 //-----------------------------------------------------------------------------
 // Support for index files
 
+bool FindEKeyEntryLocation(TCascStorage * hs, LPBYTE pbEKey, ULONGLONG & StorageOffset, DWORD & EncodedSize);
 bool CopyEKeyEntry(TCascStorage * hs, PCASC_CKEY_ENTRY pCKeyEntry);
+bool FindArchiveIndexEntry(TCascStorage * hs, LPBYTE pbEKey, CASC_EKEY_ENTRY & EKeyEntry);
 
 DWORD LoadIndexFiles(TCascStorage * hs);
+DWORD LinkIndexFiles(TCascStorage * hs);
 void  FreeIndexFiles(TCascStorage * hs);
+void  FreeArchiveGroupIndex(CASC_ARCHIVE_GROUP & Group);
+
+//-----------------------------------------------------------------------------
+// Support for storage snapshots (CascSnapshot.cpp)
+
+DWORD LoadStorageSnapshot(TCascStorage * hs);
+DWORD SaveStorageSnapshot(TCascStorage * hs);
+
+//-----------------------------------------------------------------------------
+// Support for encoding specifications (CascESpec.cpp)
+
+DWORD LoadEncodingESpecs(TCascStorage * hs, CASC_ENCODING_HEADER & EnHeader, LPBYTE pbFileData, size_t cbFileData);
+DWORD LoadEncodingESpecIndexes(TCascStorage * hs);
+bool  GetESpecInfo(TCascStorage * hs, PCASC_CKEY_ENTRY pCKeyEntry, CASC_ESPEC_INFO & ESpecInfo);
 
 //-----------------------------------------------------------------------------
 // Support for ROOT file
@@ -748,11 +748,11 @@ bool CASC_KEY_MAP::AddKey(ULONGLONG KeyName, LPBYTE Key)
 //-----------------------------------------------------------------------------
 // Public functions
 
-DWORD CascLoadEncryptionKeys(TCascStorage * hs)
+DWORD CascLoadEncryptionKeys(CASC_KEY_MAP & KeyMap)
 {
     for(size_t i = 0; i < _countof(StaticCascKeys); i++)
     {
-        if(!hs->KeyMap.AddKey(StaticCascKeys[i].KeyName, StaticCascKeys[i].Key))
+        if(!KeyMap.AddKey(StaticCascKeys[i].KeyName, StaticCascKeys[i].Key))
         {
             return ERROR_NOT_ENOUGH_MEMORY;
         }
@@ -763,18 +763,18 @@ DWORD CascLoadEncryptionKeys(TCascStorage * hs)
 
 bool WINAPI CascAddEncryptionKey(HANDLE hStorage, ULONGLONG KeyName, LPBYTE Key)
 {
-    TCascStorage * hs;
+    TCascStorageHandle * hsh;
 
     // Validate the storage handle
-    hs = TCascStorage::IsValid(hStorage);
-    if(hs == NULL)
+    hsh = TCascStorageHandle::IsValid(hStorage);
+    if(hsh == NULL)
     {
         SetCascError(ERROR_INVALID_HANDLE);
         return false;
     }
 
     // Add the key to the map and return result
-    return hs->KeyMap.AddKey(KeyName, Key);
+    return hsh->KeyMap.AddKey(KeyName, Key);
 }
 
 bool WINAPI CascAddStringEncryptionKey(HANDLE hStorage, ULONGLONG KeyName, LPCSTR szKey)
@@ -800,47 +800,47 @@ bool WINAPI CascAddStringEncryptionKey(HANDLE hStorage, ULONGLONG KeyName, LPCST
 
 LPBYTE WINAPI CascFindEncryptionKey(HANDLE hStorage, ULONGLONG KeyName)
 {
-    TCascStorage * hs;
+    TCascStorageHandle * hsh;
 
     // Validate the storage handle
-    hs = TCascStorage::IsValid(hStorage);
-    if(hs == NULL)
+    hsh = TCascStorageHandle::IsValid(hStorage);
+    if(hsh == NULL)
     {
         SetCascError(ERROR_INVALID_HANDLE);
         return NULL;
     }
 
     // Return the result from the map's search function
-    return hs->KeyMap.FindKey(KeyName);
+    return hsh->KeyMap.FindKey(KeyName);
 }
 
 bool WINAPI CascGetNotFoundEncryptionKey(HANDLE hStorage, ULONGLONG * KeyName)
 {
-    TCascStorage * hs;
+    TCascStorageHandle * hsh;
 
     // Validate the storage handle
-    if((hs = TCascStorage::IsValid(hStorage)) == NULL)
+    if((hsh = TCascStorageHandle::IsValid(hStorage)) == NULL)
     {
         SetCascError(ERROR_INVALID_HANDLE);
         return false;
     }
 
     // If there was no decryption key error, just return false with ERROR_SUCCESS
-    if(hs->LastFailKeyName == 0)
+    if(hsh->LastFailKeyName == 0)
     {
         SetCascError(ERROR_SUCCESS);
         return false;
     }
 
     // Give the name of the key that failed most recently
-    KeyName[0] = hs->LastFailKeyName;
+    KeyName[0] = hsh->LastFailKeyName;
     return true;
 }
 
 bool WINAPI CascImportKeysFromString(HANDLE hStorage, LPCSTR szKeyList)
 {
     // Verify parameters
-    if(TCascStorage::IsValid(hStorage) == NULL || szKeyList == NULL || szKeyList[0] == 0)
+    if(TCascStorageHandle::IsValid(hStorage) == NULL || szKeyList == NULL || szKeyList[0] == 0)
     {
         SetCascError(ERROR_INVALID_PARAMETER);
         return false;
@@ -943,7 +943,7 @@ DWORD CascDirectCopy(LPBYTE pbOutBuffer, PDWORD pcbOutBuffer, LPBYTE pbInBuffer,
     return ERROR_SUCCESS;
 }
 
-DWORD CascDecrypt(TCascStorage * hs, LPBYTE pbOutBuffer, PDWORD pcbOutBuffer, LPBYTE pbInBuffer, DWORD cbInBuffer, DWORD dwFrameIndex)
+DWORD CascDecrypt(TCascFile * hf, LPBYTE pbOutBuffer, PDWORD pcbOutBuffer, LPBYTE pbInBuffer, DWORD cbInBuffer, DWORD dwFrameIndex)
 {
     ULONGLONG KeyName = 0;
     LPBYTE pbBufferEnd = pbInBuffer + cbInBuffer;
@@ -994,12 +994,9 @@ DWORD CascDecrypt(TCascStorage * hs, LPBYTE pbOutBuffer, PDWORD pcbOutBuffer, LP
         return ERROR_INSUFFICIENT_BUFFER;
 
     // Check if we know the key
-    pbKey = hs->KeyMap.FindKey(KeyName);
+    pbKey = hf->FindEncryptionKey(KeyName);
     if(pbKey == NULL)
-    {
-        hs->LastFailKeyName = KeyName;
         return ERROR_FILE_ENCRYPTED;
-    }
 
     // Shuffle the Vector with the block index
     // Note that there's no point to go beyond 32 bits, unless the file has
@@ -498,8 +498,24 @@ void CascDumpFile(HANDLE hFile, const char * szDumpFile)
     }
 }
 
+static void DumpMapStats(FILE * fp, const char * szMapName, CASC_MAP_STATS & Stats)
+{
+    size_t AvgProbe100 = Stats.ItemCount ? (Stats.TotalProbeLength * 100 / Stats.ItemCount) : 0;
+
+    fprintf(fp, "%-11s Items: %u, Size: %u, Load: %u%%, Avg probe: %u.%02u, Max probe: %u%s\n",
+        szMapName,
+        (DWORD)(Stats.ItemCount),
+        (DWORD)(Stats.HashTableSize),
+        (DWORD)(Stats.LoadFactor),
+        (DWORD)(AvgProbe100 / 100),
+        (DWORD)(AvgProbe100 % 100),
+        (DWORD)(Stats.MaxProbeLength),
+        Stats.bGrowing ? " (growing)" : (Stats.bFrozen ? " (frozen)" : ""));
+}
+
 void CascDumpStorage(HANDLE hStorage, const char * szDumpFile)
 {
+    CASC_MAP_STATS Stats;
     TCascStorage * hs;
     FILE * fp = stdout;
     char szStringBuff[0x800];
@@ -530,6 +546,16 @@ void CascDumpStorage(HANDLE hStorage, const char * szDumpFile)
         DumpKey(fp, "INSTALL file:   %s\n", hs->InstallCKey.CKey, CASC_CKEY_SIZE);
         fprintf(fp, "\n");
 
+        // Dump the statistics of the hash maps
+        fprintf(fp, "=== Hash Maps ===============================================================\n");
+        hs->CKeyMap.GetStats(Stats);
+        DumpMapStats(fp, "CKey map:", Stats);
+        hs->EKeyMap.GetStats(Stats);
+        DumpMapStats(fp, "EKey map:", Stats);
+        hs->IndexMap.GetStats(Stats);
+        DumpMapStats(fp, "Index map:", Stats);
+        fprintf(fp, "\n");
+
         // Dump the complete ENCODING manifest
 //      DumpEncodingManifest(hs, fp);
 
@@ -0,0 +1,420 @@
+/*****************************************************************************/
+/* CascESpec.cpp                          Copyright (c) Ladislav Zezula 2026 */
+/*---------------------------------------------------------------------------*/
+/* Encoding specifications (ESpec) from the ENCODING manifest                */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 17.10.26  1.00  Lad  Created                                              */
+/*****************************************************************************/
+
+#define __CASCLIB_SELF__
+#include "CascLib.h"
+#include "CascCommon.h"
+
+//-----------------------------------------------------------------------------
+// Local defines
+//
+// The ESpec string describes how the file was encoded. Examples:
+//
+//  "n"                                 - Single frame, not compressed
+//  "z"                                 - Single frame, zlib-compressed
+//  "b:{256K*=z}"                       - 256 KB frames, all zlib-compressed
+//  "b:{1768=z,66443=n,*=z}"            - Three frames of given sizes
+//  "b:{16K*=e:{A1B2C3D4E5F60718,01020304,z}}"
+//                                      - 16 KB frames, encrypted by key 1807F6E5D4C3B2A1
+//
+// https://wowdev.wiki/BLTE#Encoding_Specification_.28ESpec.29
+//
+
+// Parameter for filling the ESpec indexes from the EKey pages
+struct CASC_ESPEC_PAGES
+{
+    TCascStorage * hs;
+    CASC_ENCODING_HEADER * pEnHeader;
+    LPBYTE pbEKeyPages;                             // The first EKey page
+    PDWORD ESpecIndexes;                            // ESpec index for each entry in the CKey array
+    size_t nEntryCount;                             // Number of items in ESpecIndexes
+};
+
+//-----------------------------------------------------------------------------
+// ESpec string parsing
+
+static const char * SkipESpecGroup(const char * szESpec)
+{
+    int nLevel = 0;
+
+    // Skip everything up to the matching closing brace
+    while(szESpec[0] != 0)
+    {
+        if(szESpec[0] == '{')
+            nLevel++;
+        if(szESpec[0] == '}')
+            nLevel--;
+        szESpec++;
+
+        if(nLevel <= 0)
+            break;
+    }
+    return szESpec;
+}
+
+static const char * ParseESpecSize(const char * szESpec, ULONGLONG & RefSize)
+{
+    RefSize = 0;
+
+    while('0' <= szESpec[0] && szESpec[0] <= '9')
+        RefSize = (RefSize * 10) + (*szESpec++ - '0');
+
+    if(szESpec[0] == 'K')
+    {
+        RefSize <<= 10;
+        szESpec++;
+    }
+    else if(szESpec[0] == 'M')
+    {
+        RefSize <<= 20;
+        szESpec++;
+    }
+    return szESpec;
+}
+
+// The key name has its bytes in the order of the BLTE frame. CascDecrypt reads
+// them as a little-endian integer, so the ESpec key name is converted the same way
+static const char * ParseESpecKeyName(const char * szESpec, ULONGLONG & RefKeyName)
+{
+    RefKeyName = 0;
+    for(size_t i = 0; i < sizeof(ULONGLONG); i++, szESpec += 2)
+    {
+        if(!IsHexadecimalDigit((BYTE)szESpec[0]) || !IsHexadecimalDigit((BYTE)szESpec[1]))
+            break;
+        RefKeyName |= (ULONGLONG)((AsciiToHexTable[(BYTE)szESpec[0]] << 4) | AsciiToHexTable[(BYTE)szESpec[1]]) << (i * 8);
+    }
+    return szESpec;
+}
+
+// Parses one element of the ESpec. The frame count is only calculated for block tables
+static const char * ParseESpecElement(const char * szESpec, ULONGLONG ContentSize, CASC_ESPEC_INFO & ESpecInfo)
+{
+    char chType = szESpec[0];
+
+    // Initialize the info
+    ESpecInfo.KeyName = 0;
+    ESpecInfo.FrameCount = 0;
+
+    // Empty element
+    if(chType == 0)
+        return szESpec;
+    szESpec++;
+
+    // Block table: "b:{<size>[*[<count>]]=<element>,...}" or "b:<size>[*[<count>]]=<element>"
+    if(chType == 'b' && szESpec[0] == ':')
+    {
+        ULONGLONG BlockSize;
+        ULONGLONG BlockCount;
+        ULONGLONG FrameCount = 0;
+        ULONGLONG KeyName = 0;
+        bool bHasGroup = false;
+        bool bAllEncrypted = true;
+
+        // Skip the colon and the eventual opening brace
+        if(*(++szESpec) == '{')
+        {
+            bHasGroup = true;
+            szESpec++;
+        }
+
+        while(szESpec[0] != 0 && szESpec[0] != '}')
+        {
+            CASC_ESPEC_INFO BlockInfo;
+
+            // Parse the block size. The '*' means "the rest of the file"
+            if(szESpec[0] == '*')
+            {
+                BlockSize = ContentSize;
+                BlockCount = 1;
+                szESpec++;
+            }
+            else
+            {
+                szESpec = ParseESpecSize(szESpec, BlockSize);
+                BlockCount = 1;
+
+                // Parse the block count. A missing count means "repeat until end of the file"
+                if(szESpec[0] == '*')
+                {
+                    szESpec++;
+                    if('0' <= szESpec[0] && szESpec[0] <= '9')
+                        szESpec = ParseESpecSize(szESpec, BlockCount);
+                    else
+                        BlockCount = (BlockSize != 0) ? (ContentSize + BlockSize - 1) / BlockSize : 1;
+                }
+            }
+
+            // Each block consumes up to (BlockSize * BlockCount) bytes of the content
+            if(BlockSize != 0 && ContentSize != 0)
+            {
+                BlockCount = CASCLIB_MIN(BlockCount, (ContentSize + BlockSize - 1) / BlockSize);
+                ContentSize -= CASCLIB_MIN(ContentSize, BlockSize * BlockCount);
+                FrameCount += BlockCount;
+            }
+
+            // Parse the element of the block
+            if(szESpec[0] != '=')
+                break;
+            szESpec = ParseESpecElement(szESpec + 1, 0, BlockInfo);
+
+            // The whole file is encrypted if all blocks are encrypted by the same key
+            if(BlockInfo.KeyName == 0 || (KeyName != 0 && KeyName != BlockInfo.KeyName))
+                bAllEncrypted = false;
+            KeyName = BlockInfo.KeyName;
+
+            // Move to the next block
+            if(szESpec[0] != ',' || bHasGroup == false)
+                break;
+            szESpec++;
+        }
+
+        // Skip the closing brace
+        if(bHasGroup && szESpec[0] == '}')
+            szESpec++;
+
+        ESpecInfo.KeyName = bAllEncrypted ? KeyName : 0;
+        ESpecInfo.FrameCount = (DWORD)FrameCount;
+        return szESpec;
+    }
+
+    // Encryption: "e:{<key name>,<IV>,<element>}"
+    if(chType == 'e' && szESpec[0] == ':' && szESpec[1] == '{')
+    {
+        const char * szGroup = szESpec + 1;
+
+        szESpec = ParseESpecKeyName(szESpec + 2, ESpecInfo.KeyName);
+        return SkipESpecGroup(szGroup);
+    }
+
+    // All other elements ("n", "z", "z:9", "z:{9,mpq}", "c:{...}", "g:{...}")
+    if(szESpec[0] == ':')
+    {
+        if(*(++szESpec) == '{')
+            return SkipESpecGroup(szESpec);
+        while(szESpec[0] != 0 && szESpec[0] != ',' && szESpec[0] != '}')
+            szESpec++;
+    }
+    return szESpec;
+}
+
+//-----------------------------------------------------------------------------
+// Local functions
+
+static PFILE_CKEY_PAGE GetEKeyPageTable(CASC_ENCODING_HEADER & EnHeader, LPBYTE pbFileData)
+{
+    LPBYTE pbCKeyPages = pbFileData + sizeof(FILE_ENCODING_HEADER) + EnHeader.ESpecBlockSize;
+
+    // The EKey page table follows the CKey page table and all CKey pages
+    pbCKeyPages += EnHeader.CKeyPageCount * sizeof(FILE_CKEY_PAGE);
+    return (PFILE_CKEY_PAGE)(pbCKeyPages + ((size_t)EnHeader.CKeyPageCount * EnHeader.CKeyPageSize));
+}
+
+static DWORD FillESpecIndexesFromPage(void * pvParam, size_t nPageIndex)
+{
+    CASC_ESPEC_PAGES * pPages = (CASC_ESPEC_PAGES *)pvParam;
+    CASC_ENCODING_HEADER & EnHeader = pPages->pEnHeader[0];
+    PCASC_CKEY_ENTRY pCKeyEntry;
+    PFILE_ESPEC_ENTRY pESpecEntry;
+    TCascStorage * hs = pPages->hs;
+    LPBYTE pbESpecEntry = pPages->pbEKeyPages + (nPageIndex * EnHeader.EKeyPageSize);
+    LPBYTE pbEndOfPage = pbESpecEntry + EnHeader.EKeyPageSize;
+    size_t nEntryIndex;
+
+    // The rest of the page is padded with zeros
+    while((pbESpecEntry + sizeof(FILE_ESPEC_ENTRY)) <= pbEndOfPage)
+    {
+        pESpecEntry = (PFILE_ESPEC_ENTRY)pbESpecEntry;
+        if(!CascIsValidMD5(pESpecEntry->ESpecKey))
+            break;
+
+        // Only the map lookup is done here. Each entry is written by one thread only
+        if((pCKeyEntry = (PCASC_CKEY_ENTRY)hs->EKeyMap.FindObject(pESpecEntry->ESpecKey)) != NULL)
+        {
+            nEntryIndex = (pCKeyEntry - (PCASC_CKEY_ENTRY)hs->CKeyArray.ItemArray());
+            if(nEntryIndex < pPages->nEntryCount)
+                pPages->ESpecIndexes[nEntryIndex] = ConvertBytesToInteger_4(pESpecEntry->ESpecIndexBE);
+        }
+
+        pbESpecEntry += sizeof(FILE_ESPEC_ENTRY);
+    }
+    return ERROR_SUCCESS;
+}
+
+// Lazy ENCODING: Binary search of the EKey in the EKey pages
+static DWORD FindESpecIndex(TCascStorage * hs, LPBYTE pbEKey)
+{
+    CASC_ENCODING_HEADER & EnHeader = hs->EncodingHeader;
+    PFILE_ESPEC_ENTRY pESpecEntry;
+    PFILE_CKEY_PAGE pPageHeader;
+    LPBYTE pbESpecEntry;
+    LPBYTE pbEndOfPage;
+    DWORD dwPageIndex = 0;
+    DWORD dwPageCount = EnHeader.EKeyPageCount;
+    DWORD dwMiddle;
+    int nResult;
+
+    // Find the first page whose first key is greater than the EKey
+    pPageHeader = GetEKeyPageTable(EnHeader, hs->EncodingData.pbData);
+    while(dwPageIndex < dwPageCount)
+    {
+        dwMiddle = dwPageIndex + (dwPageCount - dwPageIndex) / 2;
+        if(memcmp(pPageHeader[dwMiddle].FirstKey, pbEKey, MD5_HASH_SIZE) <= 0)
+            dwPageIndex = dwMiddle + 1;
+        else
+            dwPageCount = dwMiddle;
+    }
+
+    // Search the page before it
+    if(dwPageIndex != 0)
+    {
+        pbESpecEntry = (LPBYTE)(pPageHeader + EnHeader.EKeyPageCount) + ((dwPageIndex - 1) * EnHeader.EKeyPageSize);
+        pbEndOfPage = pbESpecEntry + EnHeader.EKeyPageSize;
+
+        while((pbESpecEntry + sizeof(FILE_ESPEC_ENTRY)) <= pbEndOfPage)
+        {
+            pESpecEntry = (PFILE_ESPEC_ENTRY)pbESpecEntry;
+            if(!CascIsValidMD5(pESpecEntry->ESpecKey))
+                break;
+
+            if((nResult = memcmp(pESpecEntry->ESpecKey, pbEKey, MD5_HASH_SIZE)) >= 0)
+                return (nResult == 0) ? ConvertBytesToInteger_4(pESpecEntry->ESpecIndexBE) : CASC_INVALID_INDEX;
+            pbESpecEntry += sizeof(FILE_ESPEC_ENTRY);
+        }
+    }
+
+    return CASC_INVALID_INDEX;
+}
+
+// Assigns ESpec index to each CKey entry loaded from the ENCODING manifest
+static DWORD LoadESpecIndexes(TCascStorage * hs, CASC_ENCODING_HEADER & EnHeader, LPBYTE pbFileData)
+{
+    CASC_ESPEC_PAGES Pages;
+    size_t nEntryCount = hs->CKeyArray.ItemCount();
+    PDWORD ESpecIndexes;
+    DWORD dwErrCode;
+
+    // Create the array of ESpec indexes, one for each entry loaded so far
+    if(nEntryCount == 0 || hs->ESpecIndexes.ItemCount() != 0)
+        return ERROR_SUCCESS;
+    if((dwErrCode = hs->ESpecIndexes.Create<DWORD>(nEntryCount)) != ERROR_SUCCESS)
+        return dwErrCode;
+    ESpecIndexes = (PDWORD)hs->ESpecIndexes.Insert(nEntryCount, false);
+    memset(ESpecIndexes, 0xFF, nEntryCount * sizeof(DWORD));
+
+    // Fill the indexes. The EKey pages are independent, so we can use the worker threads
+    Pages.hs = hs;
+    Pages.pEnHeader = &EnHeader;
+    Pages.pbEKeyPages = (LPBYTE)(GetEKeyPageTable(EnHeader, pbFileData) + EnHeader.EKeyPageCount);
+    Pages.ESpecIndexes = ESpecIndexes;
+    Pages.nEntryCount = nEntryCount;
+    return hs->WorkerPool.ParallelFor(EnHeader.EKeyPageCount, FillESpecIndexesFromPage, &Pages);
+}
+
+static DWORD GetESpecIndex(TCascStorage * hs, PCASC_CKEY_ENTRY pCKeyEntry)
+{
+    size_t nEntryIndex;
+
+    // Only the ESpecs of the files from the ENCODING manifest are known
+    if((pCKeyEntry->Flags & CASC_CE_IN_ENCODING) == 0)
+        return CASC_INVALID_INDEX;
+    nEntryIndex = GetCKeyEntryIndex(hs, pCKeyEntry);
+
+    // Indexes of all loaded entries are in the array
+    if(nEntryIndex < hs->ESpecIndexes.ItemCount())
+        return *(PDWORD)hs->ESpecIndexes.ItemAt(nEntryIndex);
+    return CASC_INVALID_INDEX;
+}
+
+//-----------------------------------------------------------------------------
+// Public functions
+
+// Loads the ESpec strings and assigns ESpec index to each CKey entry loaded from ENCODING
+DWORD LoadEncodingESpecs(TCascStorage * hs, CASC_ENCODING_HEADER & EnHeader, LPBYTE pbFileData, size_t cbFileData)
+{
+    LPBYTE pbESpecBlock = pbFileData + sizeof(FILE_ENCODING_HEADER);
+    LPBYTE pbESpecEnd = pbESpecBlock + EnHeader.ESpecBlockSize;
+    ULONGLONG cbNeeded;
+    DWORD dwErrCode;
+
+    // The ESpec strings and the EKey pages must be present entirely
+    cbNeeded = sizeof(FILE_ENCODING_HEADER) + EnHeader.ESpecBlockSize;
+    cbNeeded += (ULONGLONG)EnHeader.CKeyPageCount * (sizeof(FILE_CKEY_PAGE) + EnHeader.CKeyPageSize);
+    cbNeeded += (ULONGLONG)EnHeader.EKeyPageCount * (sizeof(FILE_CKEY_PAGE) + EnHeader.EKeyPageSize);
+    if(cbNeeded > cbFileData || EnHeader.ESpecBlockSize == 0)
+        return ERROR_BAD_FORMAT;
+
+    // Copy the ESpec strings. Make sure that the last one is terminated
+    if((dwErrCode = hs->ESpecData.SetData(pbESpecBlock, EnHeader.ESpecBlockSize)) != ERROR_SUCCESS)
+        return dwErrCode;
+    hs->ESpecData.pbData[EnHeader.ESpecBlockSize] = 0;
+
+    // Remember the offset of each string
+    if((dwErrCode = hs->ESpecOffsets.Create<DWORD>(0x100)) != ERROR_SUCCESS)
+        return dwErrCode;
+    for(LPBYTE pbESpec = pbESpecBlock; pbESpec < pbESpecEnd; )
+    {
+        DWORD dwOffset = (DWORD)(pbESpec - pbESpecBlock);
+
+        if(hs->ESpecOffsets.Insert(&dwOffset, 1) == NULL)
+            return ERROR_NOT_ENOUGH_MEMORY;
+
+        // Move to the next string
+        while(pbESpec < pbESpecEnd && pbESpec[0] != 0)
+            pbESpec++;
+        pbESpec++;
+    }
+
+    // With lazy ENCODING, the EKey pages are searched on demand
+    if(hs->dwFeatures & CASC_FEATURE_LAZY_ENCODING)
+        return ERROR_SUCCESS;
+    return LoadESpecIndexes(hs, EnHeader, pbFileData);
+}
+
+// Lazy ENCODING: Assigns the ESpec indexes before the ENCODING manifest is freed.
+// The caller must hold the storage lock
+DWORD LoadEncodingESpecIndexes(TCascStorage * hs)
+{
+    if(hs->EncodingData.pbData == NULL || hs->ESpecOffsets.ItemCount() == 0)
+        return ERROR_SUCCESS;
+    return LoadESpecIndexes(hs, hs->EncodingHeader, hs->EncodingData.pbData);
+}
+
+// Retrieves the information about how the file is encoded. Returns false if not known
+bool GetESpecInfo(TCascStorage * hs, PCASC_CKEY_ENTRY pCKeyEntry, CASC_ESPEC_INFO & ESpecInfo)
+{
+    const char * szESpec;
+    DWORD dwESpecIndex = CASC_INVALID_INDEX;
+
+    // No ESpecs at all
+    if(hs->ESpecOffsets.ItemCount() == 0)
+        return false;
+
+    // Lazy ENCODING: search the EKey pages. The manifest can be freed by another thread, so lock it
+    if(CascReadAcquire(&hs->dwLazyEncoding))
+    {
+        CascLock(hs->StorageLock);
+        if(hs->EncodingData.pbData != NULL && (pCKeyEntry->Flags & CASC_CE_IN_ENCODING))
+            dwESpecIndex = FindESpecIndex(hs, pCKeyEntry->EKey);
+        CascUnlock(hs->StorageLock);
+    }
+    else
+    {
+        dwESpecIndex = GetESpecIndex(hs, pCKeyEntry);
+    }
+
+    // Parse the ESpec string
+    if(dwESpecIndex < hs->ESpecOffsets.ItemCount())
+    {
+        szESpec = (const char *)hs->ESpecData.pbData + *(PDWORD)hs->ESpecOffsets.ItemAt(dwESpecIndex);
+        ParseESpecElement(szESpec, pCKeyEntry->ContentSize, ESpecInfo);
+        return true;
+    }
+    return false;
+}
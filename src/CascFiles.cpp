@@ -1048,7 +1048,7 @@ static DWORD LoadCsvFile(TCascStorage * hs, PARSE_REGION_LINE PfnParseRegionLine
     return dwErrCode;
 }
 
-static DWORD ForcePathExist(LPCTSTR szFileName, bool bIsFileName)
+DWORD ForcePathExist(LPCTSTR szFileName, bool bIsFileName)
 {
     DWORD dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
     bool bFirstSeparator = false;
@@ -1079,7 +1079,8 @@ static DWORD ForcePathExist(LPCTSTR szFileName, bool bIsFileName)
                     if(bFirstSeparator == true)
                     {
                         // Is it there?
-                        if(DirectoryExists(szLocalPath) == false && MakeDirectory(szLocalPath) == false)
+                        // Another thread may have created the folder in the meantime
+                        if(DirectoryExists(szLocalPath) == false && MakeDirectory(szLocalPath) == false && DirectoryExists(szLocalPath) == false)
                         {
                             dwErrCode = ERROR_PATH_NOT_FOUND;
                             break;
@@ -1094,7 +1095,7 @@ static DWORD ForcePathExist(LPCTSTR szFileName, bool bIsFileName)
             }
 
             // Now check the final path
-            if(DirectoryExists(szLocalPath) || MakeDirectory(szLocalPath))
+            if(DirectoryExists(szLocalPath) || MakeDirectory(szLocalPath) || DirectoryExists(szLocalPath))
             {
                 dwErrCode = ERROR_SUCCESS;
             }
@@ -1372,20 +1373,20 @@ DWORD FetchCascFile(
 
 DWORD FetchCascFile(TCascStorage * hs, CPATH_TYPE PathType, LPBYTE pbEKey, LPCTSTR szExtension, CASC_PATH<TCHAR> & LocalPath, PCASC_ARCHIVE_INFO pArchiveInfo)
 {
-    PCASC_EKEY_ENTRY pEKeyEntry;
+    CASC_EKEY_ENTRY EKeyEntry;
     LPBYTE pbArchiveKey;
     DWORD dwErrCode = ERROR_SUCCESS;
 
     // Data files may be stored in archives, therefore we need to check
-    if((pbEKey != NULL) && (pEKeyEntry = (PCASC_EKEY_ENTRY)hs->IndexMap.FindObject(pbEKey)) != NULL)
+    if((pbEKey != NULL) && FindArchiveIndexEntry(hs, pbEKey, EKeyEntry))
     {
         // Can't complete if the caller doesn't know the archive info
         if(pArchiveInfo != NULL)
         {
             // Fill-in the archive info
-            pArchiveInfo->ArchiveIndex = (DWORD)(pEKeyEntry->StorageOffset >> hs->FileOffsetBits);
-            pArchiveInfo->ArchiveOffs = (DWORD)(pEKeyEntry->StorageOffset & ((ValueOne64 << hs->FileOffsetBits) - 1));
-            pArchiveInfo->EncodedSize = pEKeyEntry->EncodedSize;
+            pArchiveInfo->ArchiveIndex = (DWORD)(EKeyEntry.StorageOffset >> hs->FileOffsetBits);
+            pArchiveInfo->ArchiveOffs = (DWORD)(EKeyEntry.StorageOffset & ((ValueOne64 << hs->FileOffsetBits) - 1));
+            pArchiveInfo->EncodedSize = EKeyEntry.EncodedSize;
 
             // Fill-in the archive key
             pbArchiveKey = pbEKey = hs->ArchivesKey.pbData + (MD5_HASH_SIZE * pArchiveInfo->ArchiveIndex);
@@ -1429,6 +1430,58 @@ DWORD FetchCascFile(TCascStorage * hs, CPATH_TYPE PathType, LPBYTE pbEKey, LPCTS
     return dwErrCode;
 }
 
+// Constructs the path of a file generated locally (e.g. the archive-group index).
+// It is the same place where FetchCascFile looks for downloaded files
+static DWORD MakeCachedFilePath(TCascStorage * hs, CPATH_TYPE PathType, LPBYTE pbEKey, LPCTSTR szExtension, CASC_PATH<TCHAR> & LocalPath)
+{
+    LPCTSTR szRootPath = (hs->szDataPath != NULL) ? hs->szDataPath : hs->szRootPath;
+
+    // There must be a folder for the file
+    if(szRootPath == NULL)
+        return ERROR_PATH_NOT_FOUND;
+
+    // Construct the local path
+    LocalPath.Create(szRootPath, GetSubFolder(PathType), NULL);
+    LocalPath.AppendEKey(pbEKey);
+    LocalPath.AppendString(szExtension, false);
+    return ERROR_SUCCESS;
+}
+
+// Looks for a locally generated file. Never downloads anything
+DWORD FindCachedCascFile(TCascStorage * hs, CPATH_TYPE PathType, LPBYTE pbEKey, LPCTSTR szExtension, CASC_PATH<TCHAR> & LocalPath)
+{
+    DWORD dwErrCode;
+
+    if((dwErrCode = MakeCachedFilePath(hs, PathType, pbEKey, szExtension, LocalPath)) != ERROR_SUCCESS)
+        return dwErrCode;
+    return FileAlreadyExists(LocalPath) ? ERROR_SUCCESS : ERROR_FILE_NOT_FOUND;
+}
+
+// Stores a locally generated file to the cache. The file is written under a temporary name
+// and then renamed, so that other processes never load an incomplete file
+DWORD SaveCascFile(TCascStorage * hs, CPATH_TYPE PathType, LPBYTE pbEKey, LPCTSTR szExtension, LPBYTE pbFileData, size_t cbFileData)
+{
+    CASC_PATH<TCHAR> LocalPath;
+    LPTSTR szTempName;
+    DWORD dwErrCode;
+
+    if((dwErrCode = MakeCachedFilePath(hs, PathType, pbEKey, szExtension, LocalPath)) != ERROR_SUCCESS)
+        return dwErrCode;
+    if((szTempName = CreateTempFileName(LocalPath)) == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    if((dwErrCode = SaveLocalFile(szTempName, pbFileData, cbFileData)) == ERROR_SUCCESS)
+    {
+        if(!RenameFile(szTempName, LocalPath))
+            dwErrCode = ERROR_CAN_NOT_COMPLETE;
+    }
+
+    if(dwErrCode != ERROR_SUCCESS)
+        _tremove(szTempName);
+    CASC_FREE(szTempName);
+    return dwErrCode;
+}
+
 static DWORD FetchAndLoadConfigFile(TCascStorage * hs, PCASC_BLOB pFileKey, PARSE_TEXT_FILE PfnParseProc)
 {
     CASC_PATH<TCHAR> LocalPath;
@@ -1497,8 +1550,14 @@ bool InvokeProgressCallback(TCascStorage * hs, CASC_PROGRESS_MSG Message, LPCSTR
     PCASC_OPEN_STORAGE_ARGS pArgs = hs->pArgs;
     bool bResult = false;
 
+    // Parts of the storage may be loaded by worker threads.
+    // Make sure that the callback is never entered by two threads at once.
     if(pArgs && pArgs->PfnProgressCallback)
+    {
+        CascLock(hs->StorageLock);
         bResult = pArgs->PfnProgressCallback(pArgs->PtrProgressParam, Message, szObject, CurrentValue, TotalValue);
+        CascUnlock(hs->StorageLock);
+    }
     return bResult;
 }
 
@@ -24,6 +24,49 @@ static LPCTSTR szIndexFormat_V2 = _T("%02x%08x.idx");
 
 typedef bool (*EKEY_ENTRY_CALLBACK)(TCascStorage * hs, CASC_INDEX_HEADER & InHeader, LPBYTE pbEKeyEntry);
 
+// One archive index of an online storage. Archive indexes are loaded on the worker threads
+// and their entries are merged to the index array of the storage in the order of the archives
+struct CASC_ARCINDEX_SEGMENT
+{
+    CASC_ARCINDEX_SEGMENT()
+    {
+        FileOffsetBits = 0;
+        EKeyLength = 0;
+    }
+
+    CASC_ARRAY EKeyEntries;                         // Entries loaded from the archive index
+    BYTE FileOffsetBits;                            // Number of bits of the storage offset, from the footer
+    BYTE EKeyLength;                                // Length of the EKey, from the footer
+};
+
+// Shared state of the archive index workers
+struct CASC_ARCINDEX_LOAD
+{
+    CASC_ARCINDEX_LOAD(TCascStorage * hs_, CASC_ARCINDEX_SEGMENT * pSegments_, size_t nArchiveCount_)
+    {
+        CascInitLock(Lock);
+        hs = hs_;
+        pSegments = pSegments_;
+        nArchiveCount = nArchiveCount_;
+        nArchivesStarted = 0;
+        dwErrCode = ERROR_SUCCESS;
+        bStopLoading = false;
+    }
+
+    ~CASC_ARCINDEX_LOAD()
+    {
+        CascFreeLock(Lock);
+    }
+
+    TCascStorage * hs;
+    CASC_ARCINDEX_SEGMENT * pSegments;              // One segment per archive
+    CASC_LOCK Lock;                                 // Keeps the progress callbacks in order
+    size_t nArchiveCount;                           // Number of archives
+    size_t nArchivesStarted;                        // Number of archives reported to the progress callback
+    DWORD dwErrCode;                                // The first error from the workers
+    bool bStopLoading;                              // Set on error or when the callback cancelled the operation
+};
+
 //-----------------------------------------------------------------------------
 // Local functions
 
@@ -162,6 +205,17 @@ static void SaveFileOffsetBitsAndEKeyLength(TCascStorage * hs, BYTE FileOffsetBi
     assert(hs->EKeyLength == EKeyLength);
 }
 
+static void SaveFileOffsetBitsAndEKeyLength(CASC_ARCHIVE_INDEXES & Indexes, BYTE FileOffsetBits, BYTE EKeyLength)
+{
+    if(Indexes.FileOffsetBits == 0)
+        Indexes.FileOffsetBits = FileOffsetBits;
+    assert(Indexes.FileOffsetBits == FileOffsetBits);
+
+    if(Indexes.EKeyLength == 0)
+        Indexes.EKeyLength = EKeyLength;
+    assert(Indexes.EKeyLength == EKeyLength);
+}
+
 // Verifies a guarded block - data availability and checksum match
 static LPBYTE CaptureGuardedBlock1(LPBYTE pbFileData, LPBYTE pbFileEnd)
 {
@@ -290,6 +344,7 @@ static DWORD LoadIndexItems(TCascStorage * hs, CASC_INDEX_HEADER & InHeader, EKE
 static DWORD CaptureIndexHeader_V1(CASC_INDEX_HEADER & InHeader, LPBYTE pbFileData, size_t cbFileData, DWORD BucketIndex)
 {
     PFILE_INDEX_HEADER_V1 pIndexHeader = (PFILE_INDEX_HEADER_V1)pbFileData;
+    FILE_INDEX_HEADER_V1 IndexHeader;
     LPBYTE pbKeyEntries;
     LPBYTE pbFileEnd = pbFileData + cbFileData;
     size_t cbKeyEntries;
@@ -303,15 +358,14 @@ static DWORD CaptureIndexHeader_V1(CASC_INDEX_HEADER & InHeader, LPBYTE pbFileDa
     if(pIndexHeader->SpanSizeBytes != 0x04 || pIndexHeader->SpanOffsetBytes != 0x05 || pIndexHeader->KeyBytes != 0x09)
         return ERROR_NOT_SUPPORTED;
 
-    // Verify the header hash
-    HeaderHash = pIndexHeader->HeaderHash;
-    pIndexHeader->HeaderHash = 0;
-    if(hashlittle(pbFileData, sizeof(FILE_INDEX_HEADER_V1), 0) != HeaderHash)
+    // Verify the header hash. It is calculated with the hash field set to zero.
+    // Use a copy of the header, because the index file may be mapped as read-only
+    IndexHeader = pIndexHeader[0];
+    HeaderHash = IndexHeader.HeaderHash;
+    IndexHeader.HeaderHash = 0;
+    if(hashlittle(&IndexHeader, sizeof(FILE_INDEX_HEADER_V1), 0) != HeaderHash)
         return ERROR_BAD_FORMAT;
 
-    // Return the header hash back
-    pIndexHeader->HeaderHash = HeaderHash;
-
     // Copy the fields
     InHeader.Revision        = pIndexHeader->Revision;
     InHeader.BucketIndex     = pIndexHeader->BucketIndex;
@@ -470,6 +524,138 @@ static DWORD LoadIndexFile(TCascStorage * hs, EKEY_ENTRY_CALLBACK PfnEKeyEntry,
     return ERROR_BAD_FORMAT;
 }
 
+// Returns the index file (bucket) where the EKey is stored
+static DWORD GetIndexBucket(LPBYTE pbEKey)
+{
+    BYTE HashValue = 0;
+
+    for(size_t i = 0; i < CASC_EKEY_SIZE; i++)
+        HashValue ^= pbEKey[i];
+    return (HashValue & 0x0F) ^ (HashValue >> 0x04);
+}
+
+// Finds the runs of EKey entries that are sorted by EKey. If the entire index file
+// consists of such runs and all entries belong to the bucket, we can search
+// the index file directly instead of inserting all entries to a map.
+// This must look at every entry, because it decides whether the map is needed
+static bool CaptureSortedEKeys(CASC_INDEX & IndexFile, DWORD BucketIndex)
+{
+    CASC_INDEX_HEADER InHeader;
+    LPBYTE pbFileEnd = IndexFile.pbFileData + IndexFile.cbFileData;
+    LPBYTE pbEKeyEntry = NULL;
+    LPBYTE pbEKeyEnd = NULL;
+    size_t nRunCount = 0;
+    DWORD BlockSize = 0;
+
+    // Index file version 2: Only the variant with a single guarded block of entries is continuous
+    if(CaptureIndexHeader_V2(InHeader, IndexFile.pbFileData, IndexFile.cbFileData, BucketIndex) == ERROR_SUCCESS)
+    {
+        pbEKeyEntry = IndexFile.pbFileData + InHeader.HeaderLength + InHeader.HeaderPadding;
+        if((pbEKeyEntry = CaptureGuardedBlock2(pbEKeyEntry, pbFileEnd, InHeader.EntryLength, &BlockSize)) != NULL)
+            pbEKeyEnd = pbEKeyEntry + BlockSize;
+    }
+
+    // Index file version 1: Two blocks of entries that follow the header
+    else if(CaptureIndexHeader_V1(InHeader, IndexFile.pbFileData, IndexFile.cbFileData, BucketIndex) == ERROR_SUCCESS)
+    {
+        pbEKeyEntry = IndexFile.pbFileData + InHeader.HeaderLength + InHeader.HeaderPadding;
+        pbEKeyEnd = pbEKeyEntry + (InHeader.EKeyCount * InHeader.EntryLength);
+    }
+
+    // Did we find a continuous array of entries?
+    if(pbEKeyEntry == NULL || pbEKeyEnd == NULL)
+        return false;
+
+    // Remember the values from the index header. They are saved to the storage later,
+    // because the index files are processed in parallel
+    IndexFile.FileOffsetBits = InHeader.SegmentBits;
+    IndexFile.EKeyLength = InHeader.KeyBytes;
+    IndexFile.EntryLength = InHeader.EntryLength;
+
+    // Split the entries to runs. A new run starts when the EKey is lower than the previous one
+    for(LPBYTE pbPrevEntry = NULL; (pbEKeyEntry + InHeader.EntryLength) <= pbEKeyEnd; pbEKeyEntry += InHeader.EntryLength)
+    {
+        if(GetIndexBucket(pbEKeyEntry) != BucketIndex)
+            return false;
+
+        if(pbPrevEntry == NULL || memcmp(pbPrevEntry, pbEKeyEntry, CASC_EKEY_SIZE) > 0)
+        {
+            if(nRunCount >= CASC_INDEX_MAX_RUNS)
+                return false;
+            IndexFile.pbSortedEntries[nRunCount++] = pbEKeyEntry;
+        }
+
+        IndexFile.nSortedEntries[nRunCount - 1]++;
+        pbPrevEntry = pbEKeyEntry;
+    }
+
+    return true;
+}
+
+// Searches a run of sorted EKey entries. The EKeys are uniformly distributed,
+// so we interpolate the position for the first few steps and then continue with binary search
+static LPBYTE SearchSortedEKeys(LPBYTE pbSortedEntries, size_t nSortedEntries, size_t EntryLength, LPBYTE pbEKey)
+{
+    ULONGLONG KeyValue = ConvertBytesToInteger_8(pbEKey);
+    ULONGLONG LowValue;
+    ULONGLONG HighValue;
+    size_t nLow = 0;
+    size_t nHigh = nSortedEntries;
+    size_t nMid;
+    int nResult;
+
+    // The EKeys are evenly distributed, so a few interpolation steps get close to the entry
+    for(size_t nStep = 0; nStep < 4 && nLow < nHigh; nStep++)
+    {
+        LowValue = ConvertBytesToInteger_8(pbSortedEntries + nLow * EntryLength);
+        HighValue = ConvertBytesToInteger_8(pbSortedEntries + (nHigh - 1) * EntryLength);
+        if(KeyValue < LowValue || KeyValue > HighValue)
+            return NULL;
+
+        // Use the upper 32 bits of the values, so the multiplication does not overflow
+        nMid = nLow + (size_t)((((KeyValue - LowValue) >> 32) * (nHigh - nLow - 1)) / (((HighValue - LowValue) >> 32) + 1));
+
+        // Compare the EKey
+        nResult = memcmp(pbSortedEntries + nMid * EntryLength, pbEKey, CASC_EKEY_SIZE);
+        if(nResult < 0)
+        {
+            nLow = nMid + 1;
+            continue;
+        }
+
+        if(nResult > 0)
+        {
+            nHigh = nMid;
+            continue;
+        }
+
+        // If the EKey is there multiple times, the map of EKeys would return the first one
+        while(nMid > 0 && memcmp(pbSortedEntries + (nMid - 1) * EntryLength, pbEKey, CASC_EKEY_SIZE) == 0)
+            nMid--;
+        return pbSortedEntries + nMid * EntryLength;
+    }
+
+    // Search the rest of the range. This also returns the first of multiple equal EKeys
+    return CascSearchSortedKeys(pbSortedEntries + nLow * EntryLength, nHigh - nLow, EntryLength, pbEKey, CASC_EKEY_SIZE);
+}
+
+static LPBYTE FindSortedEKeyEntry(TCascStorage * hs, LPBYTE pbEKey)
+{
+    CASC_INDEX & IndexFile = hs->IndexFiles[GetIndexBucket(pbEKey)];
+    LPBYTE pbEKeyEntry;
+
+    for(size_t i = 0; i < CASC_INDEX_MAX_RUNS; i++)
+    {
+        if(IndexFile.nSortedEntries[i] != 0)
+        {
+            pbEKeyEntry = SearchSortedEKeys(IndexFile.pbSortedEntries[i], IndexFile.nSortedEntries[i], IndexFile.EntryLength, pbEKey);
+            if(pbEKeyEntry != NULL)
+                return pbEKeyEntry;
+        }
+    }
+    return NULL;
+}
+
 // Checks the EKey entry for EKey of the ENCODING manifest
 static bool InsertEncodingEKeyToMap(TCascStorage * hs, CASC_INDEX_HEADER &, LPBYTE pbEKeyEntry)
 {
@@ -479,22 +665,27 @@ static bool InsertEncodingEKeyToMap(TCascStorage * hs, CASC_INDEX_HEADER &, LPBY
 
 static DWORD ProcessLocalIndexFiles(TCascStorage * hs, EKEY_ENTRY_CALLBACK PfnEKeyEntry, DWORD dwIndexCount)
 {
+    DWORD dwIndexProcessed = 0;
     DWORD dwErrCode = ERROR_SUCCESS;
 
     // Load each index file
-    for(DWORD i = 0; i < dwIndexCount; i++)
+    for(DWORD i = 0; i < CASC_INDEX_COUNT; i++)
     {
         CASC_INDEX & IndexFile = hs->IndexFiles[i];
 
+        // Storages downloaded by Blizzget tool don't have all index files present
+        if(IndexFile.pbFileData == NULL)
+            continue;
+
         // Inform the user about what we are doing
-        if(InvokeProgressCallback(hs, CascProgressLoadingIndexes, NULL, i, dwIndexCount))
+        if(InvokeProgressCallback(hs, CascProgressLoadingIndexes, NULL, dwIndexProcessed++, dwIndexCount))
         {
             dwErrCode = ERROR_CANCELLED;
             break;
         }
 
         // Load the index file
-        if((dwErrCode = LoadIndexFile(hs, PfnEKeyEntry, IndexFile.FileData.pbData, IndexFile.FileData.cbData, i)) != ERROR_SUCCESS)
+        if((dwErrCode = LoadIndexFile(hs, PfnEKeyEntry, IndexFile.pbFileData, IndexFile.cbFileData, i)) != ERROR_SUCCESS)
             break;
     }
 
@@ -507,11 +698,56 @@ static DWORD ProcessLocalIndexFiles(TCascStorage * hs, EKEY_ENTRY_CALLBACK PfnEK
     return dwErrCode;
 }
 
+static DWORD OpenLocalIndexFile(CASC_INDEX & IndexFile)
+{
+    // Map the index file to memory. The pages are shared with the other processes
+    // and the index file is not copied to the heap. Note that all pages are still
+    // read at open, because CaptureSortedEKeys checks every entry
+    IndexFile.pStream = FileStream_OpenFile(IndexFile.szFileName, BASE_PROVIDER_MAP | STREAM_PROVIDER_FLAT | STREAM_FLAG_READ_ONLY);
+    if(IndexFile.pStream != NULL)
+    {
+        if((IndexFile.pbFileData = FileStream_GetMappedData(IndexFile.pStream, &IndexFile.cbFileData)) != NULL)
+            return ERROR_SUCCESS;
+
+        FileStream_Close(IndexFile.pStream);
+        IndexFile.pStream = NULL;
+    }
+
+    // WoW6 actually reads THE ENTIRE file to memory. Verified on Mac build (x64).
+    if(LoadFileToMemory(IndexFile.szFileName, IndexFile.FileData) != ERROR_SUCCESS)
+        return GetCascError();
+    IndexFile.pbFileData = IndexFile.FileData.pbData;
+    IndexFile.cbFileData = IndexFile.FileData.cbData;
+    return ERROR_SUCCESS;
+}
+
+// Opens one index file. The index files are independent of each other, so they are opened
+// and verified on the worker threads, if any. Called for each bucket index
+static DWORD OpenLocalIndexFileWorker(void * pvParam, size_t nIndex)
+{
+    TCascStorage * hs = (TCascStorage *)pvParam;
+    CASC_INDEX & IndexFile = hs->IndexFiles[nIndex];
+    DWORD dwErrCode;
+
+    // Create the file name
+    if((IndexFile.szFileName = CreateIndexFileName(hs, (DWORD)nIndex, IndexFile.NewSubIndex)) == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    // Map or load the index file. Storages downloaded by Blizzget tool don't have all index files present
+    if((dwErrCode = OpenLocalIndexFile(IndexFile)) != ERROR_SUCCESS)
+        return (dwErrCode == ERROR_FILE_NOT_FOUND) ? ERROR_SUCCESS : dwErrCode;
+
+    // Check whether the index file can be searched directly
+    IndexFile.bSortedEKeys = CaptureSortedEKeys(IndexFile, (DWORD)nIndex);
+    return ERROR_SUCCESS;
+}
+
 static DWORD LoadLocalIndexFiles(TCascStorage * hs)
 {
     ULONGLONG TotalSize = 0;
     DWORD dwIndexCount = 0;
     DWORD dwErrCode;
+    bool bSortedEKeys = true;
 
     // Inform the user about what we are doing
     if(InvokeProgressCallback(hs, CascProgressLoadingIndexes, NULL, 0, 0))
@@ -524,35 +760,37 @@ static DWORD LoadLocalIndexFiles(TCascStorage * hs)
         if(hs->szIndexFormat == NULL)
             return ERROR_FILE_NOT_FOUND;
 
-        // Load each index file
+        // Open and verify all index files
+        if((dwErrCode = hs->WorkerPool.ParallelFor(CASC_INDEX_COUNT, OpenLocalIndexFileWorker, hs)) != ERROR_SUCCESS)
+            return dwErrCode;
+
+        // Sum the index files
         for(DWORD i = 0; i < CASC_INDEX_COUNT; i++)
         {
             CASC_INDEX & IndexFile = hs->IndexFiles[i];
 
-            // Create the file name
-            if((IndexFile.szFileName = CreateIndexFileName(hs, i, IndexFile.NewSubIndex)) == NULL)
-                return ERROR_NOT_ENOUGH_MEMORY;
-
-            // WoW6 actually reads THE ENTIRE file to memory. Verified on Mac build (x64).
-            dwErrCode = LoadFileToMemory(IndexFile.szFileName, IndexFile.FileData);
-            if(dwErrCode != ERROR_SUCCESS)
+            if(IndexFile.pbFileData != NULL)
             {
-                // Storages downloaded by Blizzget tool don't have all index files present
-                if((dwErrCode = GetCascError()) == ERROR_FILE_NOT_FOUND)
-                {
-                    dwErrCode = ERROR_SUCCESS;
-                    break;
-                }
-                return dwErrCode;
+                // Remember the values from the index header
+                if(IndexFile.bSortedEKeys)
+                    SaveFileOffsetBitsAndEKeyLength(hs, IndexFile.FileOffsetBits, IndexFile.EKeyLength);
+
+                // Add to the total size of the index files
+                bSortedEKeys = (bSortedEKeys && IndexFile.bSortedEKeys);
+                TotalSize += IndexFile.cbFileData;
+                dwIndexCount++;
             }
+        }
 
-            // Add to the total size of the index files
-            TotalSize += IndexFile.FileData.cbData;
-            dwIndexCount++;
+        // If all index files consist of sorted EKey entries, we search them directly
+        if(bSortedEKeys && dwIndexCount != 0)
+        {
+            hs->LocalFiles = hs->CKeyArray.ItemCount();
+            return ERROR_SUCCESS;
         }
 
         // Build the map of EKey -> IndexEKeyEntry
-        dwErrCode = hs->IndexEKeyMap.Create((size_t)(TotalSize / sizeof(FILE_EKEY_ENTRY)), CASC_EKEY_SIZE, 0);
+        dwErrCode = hs->IndexEKeyMap.Create((size_t)(TotalSize / sizeof(FILE_EKEY_ENTRY)), 0);
         if(dwErrCode == ERROR_SUCCESS)
         {
             dwErrCode = ProcessLocalIndexFiles(hs, InsertEncodingEKeyToMap, dwIndexCount);
@@ -647,7 +885,7 @@ static DWORD VerifyIndexSize(CASC_ARCINDEX_FOOTER  & InFooter, LPBYTE pbIndexFil
     return ERROR_SUCCESS;
 }
 
-static DWORD LoadArchiveIndexPage(TCascStorage * hs, CASC_ARCINDEX_FOOTER & InFooter, LPBYTE pbIndexPage, LPBYTE pbIndexPageEnd, size_t nArchive)
+static DWORD LoadArchiveIndexPage(CASC_ARRAY & EKeyEntries, CASC_ARCINDEX_FOOTER & InFooter, LPBYTE pbIndexPage, LPBYTE pbIndexPageEnd, size_t nArchive)
 {
     CASC_EKEY_ENTRY EKeyEntry;
     DWORD dwErrCode;
@@ -660,7 +898,7 @@ static DWORD LoadArchiveIndexPage(TCascStorage * hs, CASC_ARCINDEX_FOOTER & InFo
             break;
 
         // Insert a new entry to the index array
-        if((hs->IndexArray.Insert(&EKeyEntry, 1)) == NULL)
+        if((EKeyEntries.Insert(&EKeyEntry, 1)) == NULL)
             return ERROR_NOT_ENOUGH_MEMORY;
 
         // Move to the next entry
@@ -670,7 +908,7 @@ static DWORD LoadArchiveIndexPage(TCascStorage * hs, CASC_ARCINDEX_FOOTER & InFo
     return ERROR_SUCCESS;
 }
 
-static DWORD LoadArchiveIndexFile(TCascStorage * hs, LPBYTE pbIndexFile, size_t cbIndexFile, size_t nArchive)
+static DWORD LoadArchiveIndexFile(CASC_ARCINDEX_SEGMENT & Segment, LPBYTE pbIndexFile, size_t cbIndexFile, size_t nArchive)
 {
     CASC_ARCINDEX_FOOTER InFooter;
     LPBYTE pbIndexEnd = NULL;
@@ -682,18 +920,24 @@ static DWORD LoadArchiveIndexFile(TCascStorage * hs, LPBYTE pbIndexFile, size_t
         return dwErrCode;
 
     // Remember the file offset and EKey length
-    SaveFileOffsetBitsAndEKeyLength(hs, InFooter.OffsetBytes * 8, InFooter.EKeyLength);
+    Segment.FileOffsetBits = InFooter.OffsetBytes * 8;
+    Segment.EKeyLength = InFooter.EKeyLength;
 
     // Verify the size of the index file
     dwErrCode = VerifyIndexSize(InFooter, pbIndexFile, cbIndexFile, &pbIndexEnd);
     if(dwErrCode != ERROR_SUCCESS)
         return dwErrCode;
 
+    // The footer tells us the number of entries
+    dwErrCode = Segment.EKeyEntries.Create(sizeof(CASC_EKEY_ENTRY), CASCLIB_MAX(InFooter.ElementCount, 1));
+    if(dwErrCode != ERROR_SUCCESS)
+        return dwErrCode;
+
     // Parse all pages
     while (pbIndexFile < pbIndexEnd)
     {
         // Load the entire page
-        dwErrCode = LoadArchiveIndexPage(hs, InFooter, pbIndexFile, pbIndexFile + InFooter.PageLength, nArchive);
+        dwErrCode = LoadArchiveIndexPage(Segment.EKeyEntries, InFooter, pbIndexFile, pbIndexFile + InFooter.PageLength, nArchive);
         if(dwErrCode != ERROR_SUCCESS)
             break;
 
@@ -731,75 +975,527 @@ static DWORD BuildMapOfArchiveIndices(TCascStorage * hs)
     return dwErrCode;
 }
 
-static DWORD LoadArchiveIndexFiles(TCascStorage * hs)
+// Fetches and parses one archive index. Called for each archive, possibly on a worker thread
+static DWORD LoadArchiveIndexWorker(void * pvParam, size_t nArchive)
 {
+    CASC_ARCINDEX_LOAD * pLoad = (CASC_ARCINDEX_LOAD *)pvParam;
+    CASC_PATH<TCHAR> LocalPath;
+    TCascStorage * hs = pLoad->hs;
     CASC_BLOB FileData;
-    size_t nArchiveCount = (hs->ArchivesKey.cbData / MD5_HASH_SIZE);
-    DWORD dwErrCode = ERROR_SUCCESS;
+    LPBYTE pbIndexHash = hs->ArchivesKey.pbData + (nArchive * MD5_HASH_SIZE);
+    DWORD dwErrCode;
+    bool bStopLoading;
+
+    // Inform the user about what we are doing. The lock keeps the reported values increasing
+    CascLock(pLoad->Lock);
+    if(pLoad->bStopLoading == false)
+    {
+        if(InvokeProgressCallback(hs, CascProgressDownloadingArchiveIndexes, NULL, (DWORD)(pLoad->nArchivesStarted), (DWORD)(pLoad->nArchiveCount)))
+        {
+            pLoad->dwErrCode = ERROR_CANCELLED;
+            pLoad->bStopLoading = true;
+        }
+        pLoad->nArchivesStarted++;
+    }
+    bStopLoading = pLoad->bStopLoading;
+    CascUnlock(pLoad->Lock);
+
+    // Don't bother with the remaining archives if the loading failed
+    if(bStopLoading)
+        return ERROR_CANCELLED;
+
+    // Fetch and parse the archive index
+    dwErrCode = FetchCascFile(hs, PathTypeData, pbIndexHash, _T(".index"), LocalPath);
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        // Load the index file to memory
+        if((dwErrCode = LoadFileToMemory(LocalPath, FileData)) == ERROR_SUCCESS)
+        {
+            dwErrCode = LoadArchiveIndexFile(pLoad->pSegments[nArchive], FileData.pbData, FileData.cbData, nArchive);
+        }
+    }
+
+    // Stop the other workers on error. Keep the error for the caller
+    if(dwErrCode != ERROR_SUCCESS)
+    {
+        CascLock(pLoad->Lock);
+        if(pLoad->bStopLoading == false)
+            pLoad->dwErrCode = dwErrCode;
+        pLoad->bStopLoading = true;
+        CascUnlock(pLoad->Lock);
+    }
+    return dwErrCode;
+}
 
-    // Create the array object for the indices
-    dwErrCode = hs->IndexArray.Create(sizeof(CASC_EKEY_ENTRY), 0x10000);
+// Merges the entries of all archive indexes to the index array, in the order of the archives
+static DWORD MergeArchiveIndexSegments(TCascStorage * hs, CASC_ARCINDEX_SEGMENT * pSegments, size_t nArchiveCount)
+{
+    size_t nItemCount = 0;
+    DWORD dwErrCode;
+
+    // Allocate the index array for all entries at once
+    for(size_t i = 0; i < nArchiveCount; i++)
+        nItemCount += pSegments[i].EKeyEntries.ItemCount();
+    dwErrCode = hs->IndexArray.Create(sizeof(CASC_EKEY_ENTRY), CASCLIB_MAX(nItemCount, 1));
     if(dwErrCode != ERROR_SUCCESS)
         return dwErrCode;
 
-    // Load all the indices
+    // Copy the entries
     for(size_t i = 0; i < nArchiveCount; i++)
     {
-        CASC_PATH<TCHAR> LocalPath;
-        LPBYTE pbIndexHash = hs->ArchivesKey.pbData + (i * MD5_HASH_SIZE);
+        CASC_ARCINDEX_SEGMENT & Segment = pSegments[i];
 
-        // Inform the user about what we are doing
-        if(InvokeProgressCallback(hs, CascProgressDownloadingArchiveIndexes, NULL, (DWORD)(i), (DWORD)(nArchiveCount)))
+        if(Segment.EKeyLength != 0)
         {
-            dwErrCode = ERROR_CANCELLED;
-            break;
+            SaveFileOffsetBitsAndEKeyLength(hs->LoadedIndexes, Segment.FileOffsetBits, Segment.EKeyLength);
+            hs->IndexArray.Insert(Segment.EKeyEntries.ItemAt(0), Segment.EKeyEntries.ItemCount(), false);
         }
+        Segment.EKeyEntries.Free();
+    }
 
-        // Fetch and parse the archive index
-        dwErrCode = FetchCascFile(hs, PathTypeData, pbIndexHash, _T(".index"), LocalPath);
-        if(dwErrCode == ERROR_SUCCESS)
+    return ERROR_SUCCESS;
+}
+
+// Archive-group index. This is one index merged from the indexes of all archives.
+// The entries are sorted by EKey and the offset field contains 2-byte archive index
+// followed by 4-byte offset in the archive. The CDN often does not have the file,
+// so if it is not there, we build it from the archive indexes and cache it locally.
+// Storages without "archive-group" get the same index, cached under the CDN config key.
+// The locally built index has its own file name, so it's never mistaken for the CDN file.
+// Layout: pages, table of contents (last EKey of each page), page hashes, footer
+
+#define ARCHIVE_GROUP_PAGE_LENGTH   0x1000          // Length of one page of the group index
+#define ARCHIVE_GROUP_OFFSET_BYTES  6               // 2 bytes of archive index + 4 bytes of archive offset
+#define ARCHIVE_GROUP_SIZE_BYTES    4               // Length of the encoded size
+#define ARCHIVE_GROUP_HASH_BYTES    8               // Length of the page hashes and of the footer hash
+#define ARCHIVE_GROUP_ITEM_LENGTH   (MD5_HASH_SIZE + ARCHIVE_GROUP_SIZE_BYTES + ARCHIVE_GROUP_OFFSET_BYTES)
+#define ARCHIVE_GROUP_FOOTER_LENGTH (sizeof(FILE_INDEX_FOOTER<0x08>) - MD5_HASH_SIZE + ARCHIVE_GROUP_HASH_BYTES)
+#define ARCHIVE_GROUP_LOCAL_EXT     _T(".local.index")  // Extension of the locally built group index
+
+static DWORD CaptureArchiveGroupIndex(CASC_ARCHIVE_GROUP & Group, LPBYTE pbIndexFile, size_t cbIndexFile)
+{
+    CASC_ARCINDEX_FOOTER & InFooter = Group.Footer;
+    size_t cbPageAndToc;
+    size_t nPageCount;
+
+    // Validate and capture the footer
+    if(cbIndexFile < sizeof(FILE_INDEX_FOOTER<0x08>))
+        return ERROR_BAD_FORMAT;
+    if(CaptureArchiveIndexFooter(InFooter, pbIndexFile, cbIndexFile) != ERROR_SUCCESS)
+        return ERROR_BAD_FORMAT;
+
+    // We only support the usual group index layout
+    if(InFooter.OffsetBytes != ARCHIVE_GROUP_OFFSET_BYTES || InFooter.SizeBytes != ARCHIVE_GROUP_SIZE_BYTES || InFooter.EKeyLength != MD5_HASH_SIZE)
+        return ERROR_BAD_FORMAT;
+    if(InFooter.PageLength < InFooter.ItemLength)
+        return ERROR_BAD_FORMAT;
+
+    // The size of the file must exactly match the number of pages
+    cbPageAndToc = InFooter.PageLength + InFooter.EKeyLength + InFooter.FooterHashBytes;
+    nPageCount = (cbIndexFile - ARCHIVE_GROUP_FOOTER_LENGTH) / cbPageAndToc;
+    if((nPageCount * cbPageAndToc + ARCHIVE_GROUP_FOOTER_LENGTH) != cbIndexFile)
+        return ERROR_BAD_FORMAT;
+
+    // Remember the pages and the table of contents
+    Group.pbPages = pbIndexFile;
+    Group.pbToc = pbIndexFile + (nPageCount * InFooter.PageLength);
+    Group.nPageCount = nPageCount;
+    return ERROR_SUCCESS;
+}
+
+// Returns the key of the archive-group index, or NULL if there is none
+static LPBYTE GetArchiveGroupKey(TCascStorage * hs)
+{
+    if(hs->ArchiveGroup.cbData == MD5_HASH_SIZE)
+        return hs->ArchiveGroup.pbData;
+    if(hs->CdnConfigKey.cbData == MD5_HASH_SIZE)
+        return hs->CdnConfigKey.pbData;
+    return NULL;
+}
+
+// Verifies the hash of one page of the group index. Called for each page, possibly on a worker thread
+static DWORD VerifyArchiveGroupPage(void * pvParam, size_t nPage)
+{
+    CASC_ARCHIVE_GROUP & Group = *(PCASC_ARCHIVE_GROUP)pvParam;
+    CASC_ARCINDEX_FOOTER & InFooter = Group.Footer;
+    LPBYTE pbPageHash = Group.pbToc + (Group.nPageCount * InFooter.EKeyLength) + (nPage * InFooter.FooterHashBytes);
+    BYTE md5_hash[MD5_HASH_SIZE];
+
+    CascHash_MD5(Group.pbPages + (nPage * InFooter.PageLength), InFooter.PageLength, md5_hash);
+    return memcmp(md5_hash, pbPageHash, InFooter.FooterHashBytes) ? ERROR_FILE_CORRUPT : ERROR_SUCCESS;
+}
+
+// Verifies the hash of the table of contents and the hashes of all pages.
+// The footer hash has already been checked by CaptureArchiveIndexFooter
+static DWORD VerifyArchiveGroupIndex(TCascStorage * hs, CASC_ARCHIVE_GROUP & Group, LPBYTE pbIndexFile, size_t cbIndexFile)
+{
+    CASC_ARCINDEX_FOOTER & InFooter = Group.Footer;
+    LPBYTE pbTocHash = pbIndexFile + cbIndexFile - ARCHIVE_GROUP_FOOTER_LENGTH;
+    BYTE md5_hash[MD5_HASH_SIZE];
+
+    // The table of contents contains the last EKeys and the page hashes
+    CascHash_MD5(Group.pbToc, Group.nPageCount * (InFooter.EKeyLength + InFooter.FooterHashBytes), md5_hash);
+    if(memcmp(md5_hash, pbTocHash, InFooter.FooterHashBytes))
+        return ERROR_FILE_CORRUPT;
+
+    // Verify the hashes of all pages
+    return hs->WorkerPool.ParallelFor(Group.nPageCount, VerifyArchiveGroupPage, &Group);
+}
+
+static DWORD LoadArchiveGroupFile(TCascStorage * hs, LPCTSTR szFileName)
+{
+    CASC_ARCHIVE_GROUP & Group = hs->LoadedIndexes.GroupIndex;
+    LPBYTE pbIndexFile = NULL;
+    size_t cbIndexFile = 0;
+    DWORD dwErrCode;
+
+    // Map the group index to memory. Only the pages that we search are kept in memory
+    Group.pStream = FileStream_OpenFile(szFileName, BASE_PROVIDER_MAP | STREAM_PROVIDER_FLAT | STREAM_FLAG_READ_ONLY);
+    if(Group.pStream != NULL)
+    {
+        if((pbIndexFile = FileStream_GetMappedData(Group.pStream, &cbIndexFile)) == NULL)
         {
-            // Load the index file to memory
-            if((dwErrCode = LoadFileToMemory(LocalPath, FileData)) == ERROR_SUCCESS)
-            {
-                dwErrCode = LoadArchiveIndexFile(hs, FileData.pbData, FileData.cbData, i);
-            }
+            FileStream_Close(Group.pStream);
+            Group.pStream = NULL;
         }
+    }
 
-        // Break if an error
-        if(dwErrCode != ERROR_SUCCESS)
-            break;
+    // If the mapping failed, load the file to memory
+    if(pbIndexFile == NULL)
+    {
+        if((dwErrCode = LoadFileToMemory(szFileName, Group.FileData)) != ERROR_SUCCESS)
+            return dwErrCode;
+        pbIndexFile = Group.FileData.pbData;
+        cbIndexFile = Group.FileData.cbData;
+    }
+
+    // Verify the group index. A truncated or damaged file is deleted, so it's fetched or built again
+    if((dwErrCode = CaptureArchiveGroupIndex(Group, pbIndexFile, cbIndexFile)) == ERROR_SUCCESS)
+        dwErrCode = VerifyArchiveGroupIndex(hs, Group, pbIndexFile, cbIndexFile);
+    if(dwErrCode != ERROR_SUCCESS)
+    {
+        FreeArchiveGroupIndex(Group);
+        _tremove(szFileName);
+    }
+    return dwErrCode;
+}
+
+static DWORD LoadArchiveGroupIndex(TCascStorage * hs, LPBYTE pbGroupKey)
+{
+    CASC_PATH<TCHAR> LocalPath;
+
+    // Look for the group index on the CDN (or in its local copy).
+    // The index keyed by the CDN config is never on the CDN
+    if(pbGroupKey == hs->ArchiveGroup.pbData)
+    {
+        if(FetchCascFile(hs, PathTypeData, pbGroupKey, _T(".index"), LocalPath) == ERROR_SUCCESS)
+        {
+            if(LoadArchiveGroupFile(hs, LocalPath) == ERROR_SUCCESS)
+                return ERROR_SUCCESS;
+        }
+    }
+
+    // Look for the group index that we have built before
+    if(FindCachedCascFile(hs, PathTypeData, pbGroupKey, ARCHIVE_GROUP_LOCAL_EXT, LocalPath) != ERROR_SUCCESS)
+        return ERROR_FILE_NOT_FOUND;
+    return LoadArchiveGroupFile(hs, LocalPath);
+}
+
+static int CompareEKeyEntries(const void * pvEntry1, const void * pvEntry2)
+{
+    PCASC_EKEY_ENTRY pEKeyEntry1 = *(PCASC_EKEY_ENTRY *)pvEntry1;
+    PCASC_EKEY_ENTRY pEKeyEntry2 = *(PCASC_EKEY_ENTRY *)pvEntry2;
+    int nResult;
+
+    // Sort by EKey. Equal EKeys stay in the order of the archives
+    if((nResult = memcmp(pEKeyEntry1->EKey, pEKeyEntry2->EKey, MD5_HASH_SIZE)) == 0)
+        nResult = (pEKeyEntry1 < pEKeyEntry2) ? -1 : (pEKeyEntry1 > pEKeyEntry2) ? 1 : 0;
+    return nResult;
+}
+
+static void WriteArchiveGroupFooter(LPBYTE pbFooter, LPBYTE pbToc, size_t cbToc, size_t nItemCount)
+{
+    BYTE checksum_data[sizeof(FILE_INDEX_FOOTER<0x08>) - MD5_HASH_SIZE] = { 0 };
+    BYTE md5_hash[MD5_HASH_SIZE];
+    LPBYTE pbFooterData = pbFooter + ARCHIVE_GROUP_HASH_BYTES;
+
+    // Hash of the table of contents
+    CascHash_MD5(pbToc, cbToc, md5_hash);
+    memcpy(pbFooter, md5_hash, ARCHIVE_GROUP_HASH_BYTES);
+
+    // The footer values. Same layout as FILE_INDEX_FOOTER
+    pbFooterData[0] = 1;                            // Version
+    pbFooterData[1] = 0;                            // Reserved
+    pbFooterData[2] = 0;
+    pbFooterData[3] = (BYTE)(ARCHIVE_GROUP_PAGE_LENGTH >> 10);
+    pbFooterData[4] = ARCHIVE_GROUP_OFFSET_BYTES;
+    pbFooterData[5] = ARCHIVE_GROUP_SIZE_BYTES;
+    pbFooterData[6] = MD5_HASH_SIZE;
+    pbFooterData[7] = ARCHIVE_GROUP_HASH_BYTES;
+    ConvertIntegerToBytes_4_LE((DWORD)nItemCount, pbFooterData + 8);
+
+    // Footer hash, calculated with the hash field cleared
+    memcpy(checksum_data, pbFooterData, 12);
+    CascHash_MD5(checksum_data, sizeof(checksum_data), md5_hash);
+    memcpy(pbFooterData + 12, md5_hash, ARCHIVE_GROUP_HASH_BYTES);
+}
+
+// Builds the archive-group index from the loaded archive indexes
+static DWORD BuildArchiveGroupIndex(TCascStorage * hs, CASC_BLOB & FileData)
+{
+    PCASC_EKEY_ENTRY * SortedEntries;
+    PCASC_EKEY_ENTRY pEKeyEntry;
+    DWORD FileOffsetBits = hs->LoadedIndexes.FileOffsetBits;
+    ULONGLONG OffsetMask = ((ULONGLONG)1 << FileOffsetBits) - 1;
+    LPBYTE pbPage;
+    LPBYTE pbToc;
+    LPBYTE pbPageHash;
+    size_t nItemsPerPage = ARCHIVE_GROUP_PAGE_LENGTH / ARCHIVE_GROUP_ITEM_LENGTH;
+    size_t nItemCount = hs->IndexArray.ItemCount();
+    size_t nUniqueCount = 0;
+    size_t nPageCount;
+    BYTE md5_hash[MD5_HASH_SIZE];
+
+    // The archive index must fit into 2 bytes, the archive offset into 4 bytes
+    if(nItemCount == 0 || FileOffsetBits != 32 || (hs->ArchivesKey.cbData / MD5_HASH_SIZE) > 0x10000)
+        return ERROR_NOT_SUPPORTED;
+
+    // Sort the entries by EKey
+    if((SortedEntries = CASC_ALLOC<PCASC_EKEY_ENTRY>(nItemCount)) == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    for(size_t i = 0; i < nItemCount; i++)
+        SortedEntries[i] = (PCASC_EKEY_ENTRY)hs->IndexArray.ItemAt(i);
+    qsort(SortedEntries, nItemCount, sizeof(PCASC_EKEY_ENTRY), CompareEKeyEntries);
+
+    // Remove duplicates. Just like the map, we keep the entry from the first archive
+    for(size_t i = 0; i < nItemCount; i++)
+    {
+        if(nUniqueCount == 0 || memcmp(SortedEntries[nUniqueCount - 1]->EKey, SortedEntries[i]->EKey, MD5_HASH_SIZE))
+        {
+            SortedEntries[nUniqueCount++] = SortedEntries[i];
+        }
+    }
+
+    // Allocate the group index
+    nPageCount = (nUniqueCount + nItemsPerPage - 1) / nItemsPerPage;
+    if(FileData.SetSize(nPageCount * (ARCHIVE_GROUP_PAGE_LENGTH + MD5_HASH_SIZE + ARCHIVE_GROUP_HASH_BYTES) + ARCHIVE_GROUP_FOOTER_LENGTH) != ERROR_SUCCESS)
+    {
+        CASC_FREE(SortedEntries);
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+    memset(FileData.pbData, 0, FileData.cbData);
+    pbToc = FileData.pbData + (nPageCount * ARCHIVE_GROUP_PAGE_LENGTH);
+    pbPageHash = pbToc + (nPageCount * MD5_HASH_SIZE);
+
+    // Write all pages. The rest of each page stays zeroed
+    for(size_t nPage = 0; nPage < nPageCount; nPage++)
+    {
+        size_t nFirstItem = nPage * nItemsPerPage;
+        size_t nLastItem = CASCLIB_MIN(nFirstItem + nItemsPerPage, nUniqueCount);
+
+        pbPage = FileData.pbData + (nPage * ARCHIVE_GROUP_PAGE_LENGTH);
+        for(size_t i = nFirstItem; i < nLastItem; i++)
+        {
+            LPBYTE pbItem = pbPage + (i - nFirstItem) * ARCHIVE_GROUP_ITEM_LENGTH;
+
+            pEKeyEntry = SortedEntries[i];
+            memcpy(pbItem, pEKeyEntry->EKey, MD5_HASH_SIZE);
+            ConvertIntegerToBytes_4(pEKeyEntry->EncodedSize, pbItem + MD5_HASH_SIZE);
+            ConvertIntegerToBytes_2((USHORT)(pEKeyEntry->StorageOffset >> FileOffsetBits), pbItem + MD5_HASH_SIZE + 4);
+            ConvertIntegerToBytes_4((DWORD)(pEKeyEntry->StorageOffset & OffsetMask), pbItem + MD5_HASH_SIZE + 6);
+        }
+
+        // The table of contents contains the last EKey of each page
+        memcpy(pbToc + (nPage * MD5_HASH_SIZE), SortedEntries[nLastItem - 1]->EKey, MD5_HASH_SIZE);
+
+        // Hash of the page
+        CascHash_MD5(pbPage, ARCHIVE_GROUP_PAGE_LENGTH, md5_hash);
+        memcpy(pbPageHash + (nPage * ARCHIVE_GROUP_HASH_BYTES), md5_hash, ARCHIVE_GROUP_HASH_BYTES);
+    }
+
+    // Write the footer
+    WriteArchiveGroupFooter(pbPageHash + (nPageCount * ARCHIVE_GROUP_HASH_BYTES), pbToc, nPageCount * (MD5_HASH_SIZE + ARCHIVE_GROUP_HASH_BYTES), nUniqueCount);
+    CASC_FREE(SortedEntries);
+    return ERROR_SUCCESS;
+}
+
+// Builds the group index, caches it and replaces the index array with it
+static DWORD CreateArchiveGroupIndex(TCascStorage * hs, LPBYTE pbGroupKey)
+{
+    CASC_ARCHIVE_GROUP & Group = hs->LoadedIndexes.GroupIndex;
+    DWORD dwErrCode;
+
+    // Build the group index in memory
+    if((dwErrCode = BuildArchiveGroupIndex(hs, Group.FileData)) != ERROR_SUCCESS)
+        return dwErrCode;
+
+    // Save the group index to the cache. The next open will load it from there
+    SaveCascFile(hs, PathTypeData, pbGroupKey, ARCHIVE_GROUP_LOCAL_EXT, Group.FileData.pbData, Group.FileData.cbData);
+
+    // Use the group index instead of the index array
+    if((dwErrCode = CaptureArchiveGroupIndex(Group, Group.FileData.pbData, Group.FileData.cbData)) != ERROR_SUCCESS)
+    {
+        FreeArchiveGroupIndex(Group);
+        return dwErrCode;
+    }
+    hs->IndexArray.Free();
+    return ERROR_SUCCESS;
+}
+
+// Returns the number of items in the page. The rest of the page is zeroed
+static size_t GetArchiveGroupPageItems(CASC_ARCINDEX_FOOTER & InFooter, LPBYTE pbPage)
+{
+    size_t nLow = 0;
+    size_t nHigh = InFooter.PageLength / InFooter.ItemLength;
+
+    // Find the first zeroed item
+    while(nLow < nHigh)
+    {
+        size_t nMid = nLow + (nHigh - nLow) / 2;
+
+        if(CascIsValidMD5(pbPage + (nMid * InFooter.ItemLength)))
+            nLow = nMid + 1;
+        else
+            nHigh = nMid;
+    }
+    return nLow;
+}
+
+static bool FindArchiveGroupEntry(CASC_ARCHIVE_GROUP & Group, LPBYTE pbEKey, CASC_EKEY_ENTRY & EKeyEntry)
+{
+    CASC_ARCINDEX_FOOTER & InFooter = Group.Footer;
+    LPBYTE pbPage;
+    LPBYTE pbItem;
+    size_t nPage;
+
+    // Find the first page whose last EKey is greater or equal to the EKey.
+    // Not found if the EKey is greater than all EKeys in the group
+    nPage = CascLowerBoundKey(Group.pbToc, Group.nPageCount, InFooter.EKeyLength, pbEKey, InFooter.EKeyLength);
+    if(nPage >= Group.nPageCount)
+        return false;
+
+    // Search the page
+    pbPage = Group.pbPages + (nPage * InFooter.PageLength);
+    pbItem = CascSearchSortedKeys(pbPage, GetArchiveGroupPageItems(InFooter, pbPage), InFooter.ItemLength, pbEKey, InFooter.EKeyLength);
+    if(pbItem != NULL)
+    {
+        ULONGLONG ArchiveIndex = ConvertBytesToInteger_2(pbItem + MD5_HASH_SIZE + InFooter.SizeBytes);
+        ULONGLONG ArchiveOffset = ConvertBytesToInteger_4(pbItem + MD5_HASH_SIZE + InFooter.SizeBytes + 2);
+
+        // Compose the entry the same way as CaptureIndexEntry does
+        memcpy(EKeyEntry.EKey, pbItem, MD5_HASH_SIZE);
+        EKeyEntry.StorageOffset = (ArchiveIndex << 32) | ArchiveOffset;
+        EKeyEntry.EncodedSize = ConvertBytesToInteger_4(pbItem + MD5_HASH_SIZE);
+        EKeyEntry.Alignment = 0;
+        return true;
+    }
+
+    return false;
+}
+
+static DWORD LoadArchiveIndexFiles(TCascStorage * hs)
+{
+    CASC_ARCINDEX_SEGMENT * pSegments;
+    LPBYTE pbGroupKey = GetArchiveGroupKey(hs);
+    size_t nArchiveCount = (hs->ArchivesKey.cbData / MD5_HASH_SIZE);
+    DWORD dwErrCode = ERROR_SUCCESS;
+
+    // If there is the archive-group index, we don't need the indexes of the archives
+    if(pbGroupKey != NULL)
+    {
+        if(LoadArchiveGroupIndex(hs, pbGroupKey) == ERROR_SUCCESS)
+        {
+            SaveFileOffsetBitsAndEKeyLength(hs->LoadedIndexes, 32, MD5_HASH_SIZE);
+            return ERROR_SUCCESS;
+        }
     }
 
-    // Build map of EKey -> CASC_EKEY_ENTRY
+    // Allocate one segment for each archive
+    if((pSegments = new CASC_ARCINDEX_SEGMENT[CASCLIB_MAX(nArchiveCount, 1)]) == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    // Fetch and parse the archive indexes. The number of parallel downloads
+    // is limited by the number of the worker threads
+    {
+        CASC_ARCINDEX_LOAD Load(hs, pSegments, nArchiveCount);
+
+        dwErrCode = hs->WorkerPool.ParallelFor(nArchiveCount, LoadArchiveIndexWorker, &Load);
+        dwErrCode = (Load.dwErrCode != ERROR_SUCCESS) ? Load.dwErrCode : dwErrCode;
+    }
+
+    // Merge the loaded entries to the index array
     if(dwErrCode == ERROR_SUCCESS)
-        dwErrCode = BuildMapOfArchiveIndices(hs);
+    {
+        dwErrCode = MergeArchiveIndexSegments(hs, pSegments, nArchiveCount);
+    }
+    delete [] pSegments;
+
+    // Build the archive-group index for the next time. If that fails, we use the map
+    if(dwErrCode == ERROR_SUCCESS && pbGroupKey != NULL)
+    {
+        CreateArchiveGroupIndex(hs, pbGroupKey);
+    }
     return dwErrCode;
 }
 
 //-----------------------------------------------------------------------------
 // Public functions
 
+bool FindEKeyEntryLocation(TCascStorage * hs, LPBYTE pbEKey, ULONGLONG & StorageOffset, DWORD & EncodedSize)
+{
+    LPBYTE pbEKeyEntry;
+
+    // Without the map, the index files are searched directly
+    if(hs->IndexEKeyMap.IsInitialized())
+        pbEKeyEntry = (LPBYTE)hs->IndexEKeyMap.FindObject(pbEKey);
+    else
+        pbEKeyEntry = FindSortedEKeyEntry(hs, pbEKey);
+    if(pbEKeyEntry == NULL)
+        return false;
+
+    StorageOffset = ConvertBytesToInteger_5(pbEKeyEntry + hs->EKeyLength);
+    EncodedSize = ConvertBytesToInteger_4_LE(pbEKeyEntry + hs->EKeyLength + 5);
+    return true;
+}
+
 bool CopyEKeyEntry(TCascStorage * hs, PCASC_CKEY_ENTRY pCKeyEntry)
 {
     // Don't do this on online storages
     if(!(hs->dwFeatures & CASC_FEATURE_ONLINE))
     {
-        LPBYTE pbEKeyEntry;
-
         // If the file was found, then copy the content to the CKey entry
-        pbEKeyEntry = (LPBYTE)hs->IndexEKeyMap.FindObject(pCKeyEntry->EKey);
-        if(pbEKeyEntry == NULL)
+        if(!FindEKeyEntryLocation(hs, pCKeyEntry->EKey, pCKeyEntry->StorageOffset, pCKeyEntry->EncodedSize))
             return false;
-
-        pCKeyEntry->StorageOffset = ConvertBytesToInteger_5(pbEKeyEntry + hs->EKeyLength);
-        pCKeyEntry->EncodedSize = ConvertBytesToInteger_4_LE(pbEKeyEntry + hs->EKeyLength + 5);
         pCKeyEntry->Flags |= CASC_CE_FILE_IS_LOCAL;
     }
 
     return true;
 }
 
+bool FindArchiveIndexEntry(TCascStorage * hs, LPBYTE pbEKey, CASC_EKEY_ENTRY & EKeyEntry)
+{
+    PCASC_EKEY_ENTRY pEKeyEntry;
+
+    // Search the archive-group index, if loaded
+    if(hs->ArchiveGroupIndex.nPageCount != 0)
+    {
+        if(!FindArchiveGroupEntry(hs->ArchiveGroupIndex, pbEKey, EKeyEntry))
+            return false;
+
+        // The archive index must be within the archives of the storage
+        return ((EKeyEntry.StorageOffset >> hs->FileOffsetBits) < (hs->ArchivesKey.cbData / MD5_HASH_SIZE));
+    }
+
+    // Search the map of archive indexes
+    if((pEKeyEntry = (PCASC_EKEY_ENTRY)hs->IndexMap.FindObject(pbEKey)) != NULL)
+    {
+        EKeyEntry = pEKeyEntry[0];
+        return true;
+    }
+
+    return false;
+}
+
 DWORD LoadIndexFiles(TCascStorage * hs)
 {
     switch(hs->BuildFileType)
@@ -817,6 +1513,42 @@ DWORD LoadIndexFiles(TCascStorage * hs)
     }
 }
 
+// Makes the archive indexes of online storages available for lookups. This is separate
+// from LoadIndexFiles, because the index files may be loaded on a worker thread while
+// the main thread downloads the ENCODING manifest. Until the main thread waits for
+// the worker, the storage must not see anything that the worker has loaded.
+DWORD LinkIndexFiles(TCascStorage * hs)
+{
+    CASC_ARCHIVE_INDEXES & Indexes = hs->LoadedIndexes;
+    CASC_ARCHIVE_GROUP & Group = hs->ArchiveGroupIndex;
+
+    if(hs->BuildFileType == CascVersions)
+    {
+        // Take the values from the index footers
+        if(Indexes.FileOffsetBits != 0)
+            SaveFileOffsetBitsAndEKeyLength(hs, Indexes.FileOffsetBits, Indexes.EKeyLength);
+
+        // Use the archive-group index, if loaded
+        if(Indexes.GroupIndex.nPageCount != 0)
+        {
+            Group.FileData.MoveFrom(Indexes.GroupIndex.FileData);
+            Group.pStream = Indexes.GroupIndex.pStream;
+            Group.pbPages = Indexes.GroupIndex.pbPages;
+            Group.pbToc = Indexes.GroupIndex.pbToc;
+            Group.nPageCount = Indexes.GroupIndex.nPageCount;
+            Group.Footer = Indexes.GroupIndex.Footer;
+
+            Indexes.GroupIndex.pStream = NULL;
+            FreeArchiveGroupIndex(Indexes.GroupIndex);
+            return ERROR_SUCCESS;
+        }
+
+        // Otherwise, build the map of EKey -> CASC_EKEY_ENTRY
+        return BuildMapOfArchiveIndices(hs);
+    }
+    return ERROR_SUCCESS;
+}
+
 void FreeIndexFiles(TCascStorage * hs)
 {
     // Free the map of EKey -> Index Ekey item
@@ -827,10 +1559,29 @@ void FreeIndexFiles(TCascStorage * hs)
     {
         CASC_INDEX & IndexFile = hs->IndexFiles[i];
 
-        // Free the file data
+        // Unmap or free the file data
+        FileStream_Close(IndexFile.pStream);
         IndexFile.FileData.Free();
+        IndexFile.pStream = NULL;
+        IndexFile.pbFileData = NULL;
+        IndexFile.cbFileData = 0;
+
+        // Reset the runs of sorted EKey entries
+        memset(IndexFile.pbSortedEntries, 0, sizeof(IndexFile.pbSortedEntries));
+        memset(IndexFile.nSortedEntries, 0, sizeof(IndexFile.nSortedEntries));
+        IndexFile.bSortedEKeys = false;
 
         // Free the file name
         CASC_FREE(IndexFile.szFileName);
     }
 }
+
+void FreeArchiveGroupIndex(CASC_ARCHIVE_GROUP & Group)
+{
+    // Unmap or free the group index
+    FileStream_Close(Group.pStream);
+    Group.FileData.Free();
+    Group.pStream = NULL;
+    Group.pbPages = Group.pbToc = NULL;
+    Group.nPageCount = 0;
+}
@@ -96,6 +96,10 @@ extern "C" {
 #define CASC_OVERCOME_ENCRYPTED     0x00000020  // When CascReadFile encounters a block encrypted with a key that is missing, the block is filled with zeros and returned as success
 #define CASC_OPEN_CKEY_ONCE         0x00000040  // Only opens a file with given CKey once, regardless on how many file names does it have. Used by CascLib test program
                                                 // If the file was already open before, CascOpenFile returns false and ERROR_FILE_ALREADY_OPENED
+#define CASC_CACHE_MULTI_FRAME      0x00000080  // Keep multiple decoded frames in the file cache, dropping the least recently used ones. See CascSetFileCacheSize
+#define CASC_PARALLEL_DECODE        0x00000100  // Reading a large file at once decodes its frames on the storage worker threads (see dwThreadCount in CASC_OPEN_STORAGE_ARGS)
+
+#define CASC_FILE_CACHE_SIZE_DEFAULT 0x00400000 // Default byte budget of the multi-frame file cache (4 MB)
 
 #define CASC_LOCALE_ALL             0xFFFFFFFF
 #define CASC_LOCALE_ALL_WOW         0x0001F3F6  // All except enCN and enTW
@@ -167,6 +171,13 @@ extern "C" {
 #define CASC_FEATURE_ONLINE         0x00000400  // Load the missing files from online CDNs
 #define CASC_FEATURE_FORCE_DOWNLOAD 0x00001000  // (Online) always download "versions" and "cdns" even if it exists locally
 #define CASC_FEATURE_ALLOW_DOWNLOAD 0x00002000  // Allow downloading internal files, if they are not present locally
+#define CASC_FEATURE_SNAPSHOT       0x00004000  // Load/save the key tables from/to a snapshot file ("casc-<build-key>.snapshot"), see CASC_OPEN_STORAGE_ARGS::szSnapshotPath
+#define CASC_FEATURE_VERIFY_ENCODING 0x00008000 // Verify MD5 hashes of all pages of the ENCODING manifest when loading it
+#define CASC_FEATURE_LAZY_ENCODING  0x00010000  // Keep ENCODING in memory and only create CKey entries for looked-up CKeys. DOWNLOAD (tags) is not loaded.
+                                                // Use with CASC_FEATURE_KEYS_ONLY. ROOT parsing looks up nearly every CKey (TVFS even by EKey), so with ROOT loaded it is slower than the normal load
+#define CASC_FEATURE_SHARED_STORAGE 0x00020000  // Share the loaded storage with other opens of the same build that also set this flag. Encryption keys are per handle
+#define CASC_FEATURE_KEYS_ONLY     0x00040000  // Do not load ROOT and INSTALL. Files can only be open by CKey or EKey, and the storage has no file names
+#define CASC_FEATURE_FROZEN_MAPS   0x00080000  // Convert the key and file name maps to minimal perfect hash tables at the end of open. Saves memory and lookup time
 
 // Macro to convert FileDataId to the argument of CascOpenFile
 #define CASC_FILE_DATA_ID(FileDataId) ((LPCSTR)(size_t)FileDataId)
@@ -200,6 +211,7 @@ typedef enum _CASC_STORAGE_INFO_CLASS
     CascStorageProduct,                         // Gives CASC_STORAGE_PRODUCT
     CascStorageTags,                            // Gives CASC_STORAGE_TAGS structure
     CascStoragePathProduct,                     // Gives Path:Product into a LPTSTR buffer
+    CascStorageFrameCacheInfo,                  // Gives CASC_FRAME_CACHE_INFO structure
     CascStorageInfoClassMax
 
 } CASC_STORAGE_INFO_CLASS, *PCASC_STORAGE_INFO_CLASS;
@@ -210,6 +222,7 @@ typedef enum _CASC_FILE_INFO_CLASS
     CascFileEncodedKey,
     CascFileFullInfo,                           // Gives CASC_FILE_FULL_INFO structure
     CascFileSpanInfo,                           // Gives CASC_FILE_SPAN_INFO structure for each file span
+    CascFileCacheInfo,                          // Gives CASC_FILE_CACHE_INFO structure
     CascFileInfoClassMax
 } CASC_FILE_INFO_CLASS, *PCASC_FILE_INFO_CLASS;
 
@@ -322,6 +335,29 @@ typedef struct _CASC_FILE_SPAN_INFO
 
 } CASC_FILE_SPAN_INFO, *PCASC_FILE_SPAN_INFO;
 
+typedef struct _CASC_FILE_CACHE_INFO
+{
+    ULONGLONG CacheHits;                        // Number of reads (or their parts) handled from the file cache
+    ULONGLONG CacheMisses;                      // Number of frames that had to be loaded and decoded
+    size_t CacheSize;                           // Size of the decoded data currently in the file cache
+    size_t CacheSizeMax;                        // Byte budget of the multi-frame file cache
+    DWORD FrameCount;                           // Number of frames currently in the file cache
+    DWORD bMultiFrame;                          // Nonzero if the file uses the multi-frame cache (CASC_CACHE_MULTI_FRAME)
+
+} CASC_FILE_CACHE_INFO, *PCASC_FILE_CACHE_INFO;
+
+typedef struct _CASC_FRAME_CACHE_INFO
+{
+    ULONGLONG Hits;                             // Number of frames found in the storage frame cache
+    ULONGLONG Misses;                           // Number of frames that were not in the storage frame cache
+    ULONGLONG Evictions;                        // Number of frames dropped from the storage frame cache
+    ULONGLONG CacheSize;                        // Total size of the cached frames
+    ULONGLONG CacheSizeMax;                     // Byte budget of the cache. Zero if the cache is disabled
+    ULONGLONG HotSize;                          // Size of the frames that were accessed repeatedly
+    ULONGLONG FrameCount;                       // Number of cached frames
+
+} CASC_FRAME_CACHE_INFO, *PCASC_FRAME_CACHE_INFO;
+
 //-----------------------------------------------------------------------------
 // Extended version of CascOpenStorage
 
@@ -386,6 +422,15 @@ typedef struct _CASC_OPEN_STORAGE_ARGS
     LPCTSTR szCdnHostUrl;                       // If non-null, specifies the custom CDN URL. Must contain protocol, can contain port number
                                                 // Example: http://eu.custom-wow-cdn.com:8000
 
+    DWORD dwThreadCount;                        // Number of worker threads used for loading the storage. 0 or 1 = load on the calling thread
+
+    ULONGLONG FrameCacheSize;                   // Byte budget of the decoded frame cache shared by all file handles. 0 = no shared cache
+                                                // The cache is split to up to 16 stripes of at least 4 MB each (or FrameCacheSize, if smaller).
+                                                // Frames larger than one stripe are not cached
+
+    LPCTSTR szSnapshotPath;                     // Directory for the snapshot files (CASC_FEATURE_SNAPSHOT). If NULL, a per-user cache directory is used:
+                                                // Windows: "%LOCALAPPDATA%\CascLib", others: "$XDG_CACHE_HOME/casclib" or "$HOME/.cache/casclib"
+
 } CASC_OPEN_STORAGE_ARGS, *PCASC_OPEN_STORAGE_ARGS;
 
 //-----------------------------------------------------------------------------
@@ -396,11 +441,13 @@ bool   WINAPI CascOpenStorage(LPCTSTR szParams, DWORD dwLocaleMask, HANDLE * phS
 bool   WINAPI CascOpenOnlineStorage(LPCTSTR szParams, DWORD dwLocaleMask, HANDLE * phStorage);
 bool   WINAPI CascGetStorageInfo(HANDLE hStorage, CASC_STORAGE_INFO_CLASS InfoClass, void * pvStorageInfo, size_t cbStorageInfo, size_t * pcbLengthNeeded);
 bool   WINAPI CascCloseStorage(HANDLE hStorage);
+bool   WINAPI CascRefreshStorageIndexes(HANDLE hStorage);
 
 bool   WINAPI CascOpenFile(HANDLE hStorage, const void * pvFileName, DWORD dwLocaleFlags, DWORD dwOpenFlags, HANDLE * PtrFileHandle);
 bool   WINAPI CascOpenLocalFile(LPCTSTR szFileName, DWORD dwOpenFlags, HANDLE * PtrFileHandle);
 bool   WINAPI CascGetFileInfo(HANDLE hFile, CASC_FILE_INFO_CLASS InfoClass, void * pvFileInfo, size_t cbFileInfo, size_t * pcbLengthNeeded);
 bool   WINAPI CascSetFileFlags(HANDLE hFile, DWORD dwOpenFlags);
+bool   WINAPI CascSetFileCacheSize(HANDLE hFile, size_t cbCacheSize);
 bool   WINAPI CascGetFileSize64(HANDLE hFile, PULONGLONG PtrFileSize);
 bool   WINAPI CascSetFilePointer64(HANDLE hFile, LONGLONG DistanceToMove, PULONGLONG PtrNewPos, DWORD dwMoveMethod);
 bool   WINAPI CascReadFile(HANDLE hFile, void * lpBuffer, DWORD dwToRead, PDWORD pdwRead);
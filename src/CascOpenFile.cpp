@@ -21,14 +21,23 @@ TCascFile::TCascFile(TCascStorage * ahs, PCASC_CKEY_ENTRY apCKeyEntry)
     if((hs = ahs) != NULL)
         hs->AddRef();
     ClassName = CASC_MAGIC_FILE;
+    hsh = NULL;
 
     FilePointer = 0;
     pCKeyEntry = apCKeyEntry;
     SpanCount = (pCKeyEntry->SpanCount != 0) ? pCKeyEntry->SpanCount : 1;
     bAllowDownloading = false;
     bVerifyIntegrity = false;
+    bOvercomeEncrypted = false;
     bCloseFileStream = false;
     bFreeCKeyEntries = false;
+    bParallelDecode = false;
+
+    // No frames are decoded in advance yet
+    for(size_t i = 0; i < CASC_READAHEAD_FRAMES; i++)
+        Readahead[i].pFileFrame = NULL;
+    ReadaheadOffset = SequentialOffset = 0;
+    dwSequentialReads = 0;
 
     // Allocate the array of file spans
     if((pFileSpan = CASC_ALLOC_ZERO<CASC_FILE_SPAN>(SpanCount)) != NULL)
@@ -40,6 +49,9 @@ TCascFile::TCascFile(TCascStorage * ahs, PCASC_CKEY_ENTRY apCKeyEntry)
 
 TCascFile::~TCascFile()
 {
+    // Wait for the frames being decoded in advance. They use the file spans
+    FreeReadahead();
+
     // Free all stuff related to file spans
     if(pFileSpan != NULL)
     {
@@ -65,14 +77,34 @@ TCascFile::~TCascFile()
     pCKeyEntry = NULL;
 
     // Free the file cache
-    CASC_FREE(pbFileCache);
+    FreeFileCache();
 
     // Close (dereference) the archive handle
+    if(hsh != NULL)
+        hsh = hsh->Release();
     if(hs != NULL)
         hs = hs->Release();
     ClassName = 0;
 }
 
+// Files open by the caller use the encryption keys of the storage handle
+LPBYTE TCascFile::FindEncryptionKey(ULONGLONG KeyName)
+{
+    LPBYTE pbKey = NULL;
+
+    if(hsh != NULL)
+    {
+        if((pbKey = hsh->KeyMap.FindKey(KeyName)) == NULL)
+            hsh->LastFailKeyName = KeyName;
+    }
+    else if(hs != NULL)
+    {
+        if((pbKey = hs->KeyMap.FindKey(KeyName)) == NULL)
+            hs->LastFailKeyName = KeyName;
+    }
+    return pbKey;
+}
+
 DWORD TCascFile::OpenFileSpans(LPCTSTR szSpanList)
 {
     TFileStream * pStream;
@@ -132,9 +164,11 @@ void TCascFile::InitFileSpans(PCASC_FILE_SPAN pSpans, DWORD dwSpanCount)
     // Add all span sizes
     for(DWORD i = 0; i < dwSpanCount; i++, pSpans++)
     {
-        // Put the archive index and archive offset
-        pSpans->ArchiveIndex = (DWORD)(pCKeyEntry[i].StorageOffset >> FileOffsetBits);
-        pSpans->ArchiveOffs = (DWORD)(pCKeyEntry[i].StorageOffset & FileOffsetMask);
+        // Put the archive index and archive offset. CascRefreshStorageIndexes may change the offset at any time
+        ULONGLONG StorageOffset = CascReadAcquire(&pCKeyEntry[i].StorageOffset);
+
+        pSpans->ArchiveIndex = (DWORD)(StorageOffset >> FileOffsetBits);
+        pSpans->ArchiveOffs = (DWORD)(StorageOffset & FileOffsetMask);
 
         // Add to the total encoded size
         if(ContentSize != CASC_INVALID_SIZE64)
@@ -151,6 +185,52 @@ void TCascFile::InitCacheStrategy()
     CacheStrategy = CascCacheLastFrame;
     FileCacheStart = FileCacheEnd = 0;
     pbFileCache = NULL;
+
+    pFirstCachedFrame = pLastCachedFrame = NULL;
+    cbFrameCache = 0;
+    cbFrameCacheMax = CASC_FILE_CACHE_SIZE_DEFAULT;
+    dwCachedFrames = 0;
+    CacheHits = CacheMisses = 0;
+}
+
+void TCascFile::FreeFileCache()
+{
+    PCASC_CACHED_FRAME pCachedFrame;
+
+    // Free the last frame cache
+    CASC_FREE(pbFileCache);
+    FileCacheStart = FileCacheEnd = 0;
+
+    // Free the multi-frame cache
+    while((pCachedFrame = pFirstCachedFrame) != NULL)
+    {
+        pFirstCachedFrame = pCachedFrame->pNext;
+        CASC_FREE(pCachedFrame);
+    }
+    pLastCachedFrame = NULL;
+    cbFrameCache = 0;
+    dwCachedFrames = 0;
+
+    // Free the frames decoded in advance
+    FreeReadahead();
+}
+
+void TCascFile::FreeReadaheadFrame(PCASC_READAHEAD_FRAME pReadahead)
+{
+    if(pReadahead->pFileFrame != NULL)
+    {
+        // The frame may still be decoded by a worker thread
+        hs->WorkerPool.WaitGroupOnly(pReadahead->Group);
+        CASC_FREE(pReadahead->pbData);
+        pReadahead->pFileFrame = NULL;
+    }
+}
+
+void TCascFile::FreeReadahead()
+{
+    for(size_t i = 0; i < CASC_READAHEAD_FRAMES; i++)
+        FreeReadaheadFrame(&Readahead[i]);
+    ReadaheadOffset = 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -178,14 +258,95 @@ static size_t GetSpanFileCount(LPTSTR szSpanList)
     return nSpanCount;
 }
 
+// Returns index of the entry in the CKey array. Entries that are not in the array
+// (e.g. TCascStorage::EncodingCKey or file spans) return CASC_INVALID_SIZE_T
+size_t GetCKeyEntryIndex(TCascStorage * hs, PCASC_CKEY_ENTRY pCKeyEntry)
+{
+    PCASC_CKEY_ENTRY pFirstEntry = (PCASC_CKEY_ENTRY)hs->CKeyArray.ItemArray();
+
+    if(pFirstEntry <= pCKeyEntry && pCKeyEntry < pFirstEntry + hs->CKeyArray.ItemCount())
+        return (size_t)(pCKeyEntry - pFirstEntry);
+    return CASC_INVALID_SIZE_T;
+}
+
+ULONGLONG GetTagBitMask(TCascStorage * hs, PCASC_CKEY_ENTRY pCKeyEntry)
+{
+    ULONGLONG TagBitMask = 0;
+    LPBYTE pbTagBitmap;
+    size_t nEntryIndex = GetCKeyEntryIndex(hs, pCKeyEntry);
+    size_t nTagCount = CASCLIB_MIN(hs->TagBitmaps.ItemCount(), 64);
+
+    // The tag bitmaps are only present if the storage supports tags
+    if(nEntryIndex < hs->TagBitmaps.ItemSize() * 8)
+    {
+        for(size_t i = 0; i < nTagCount; i++)
+        {
+            pbTagBitmap = (LPBYTE)hs->TagBitmaps.ItemAt(i);
+            if(pbTagBitmap[nEntryIndex / 8] & (1 << (nEntryIndex % 8)))
+                TagBitMask |= (ULONGLONG)1 << i;
+        }
+    }
+    return TagBitMask;
+}
+
 PCASC_CKEY_ENTRY FindCKeyEntry_CKey(TCascStorage * hs, LPBYTE pbCKey, PDWORD PtrIndex)
 {
-    return (PCASC_CKEY_ENTRY)hs->CKeyMap.FindObject(pbCKey, PtrIndex);
+    PCASC_CKEY_ENTRY pCKeyEntry;
+
+    // The maps can be searched without lock, even if another thread inserts to them
+    if((pCKeyEntry = (PCASC_CKEY_ENTRY)hs->CKeyMap.FindObject(pbCKey, PtrIndex)) != NULL)
+        return pCKeyEntry;
+
+    // Lazy ENCODING: The entry is created on the first lookup.
+    // Inserting to the maps must be serialized. Also check whether another thread
+    // has not loaded the entry while we were waiting for the lock
+    if(CascReadAcquire(&hs->dwLazyEncoding))
+    {
+        CascLock(hs->StorageLock);
+        if((pCKeyEntry = (PCASC_CKEY_ENTRY)hs->CKeyMap.FindObject(pbCKey, PtrIndex)) == NULL)
+            pCKeyEntry = LoadEncodingEntry(hs, pbCKey);
+        CascUnlock(hs->StorageLock);
+    }
+
+    return pCKeyEntry;
 }
 
 PCASC_CKEY_ENTRY FindCKeyEntry_EKey(TCascStorage * hs, LPBYTE pbEKey, PDWORD PtrIndex)
 {
-    return (PCASC_CKEY_ENTRY)hs->EKeyMap.FindObject(pbEKey, PtrIndex);
+    PCASC_CKEY_ENTRY pCKeyEntry;
+
+    // The maps can be searched without lock, even if another thread inserts to them
+    if((pCKeyEntry = (PCASC_CKEY_ENTRY)hs->EKeyMap.FindObject(pbEKey, PtrIndex)) != NULL)
+        return pCKeyEntry;
+
+    // Lazy ENCODING: The CKey pages are sorted by CKey, so an EKey can't be looked up.
+    // If the EKey is not known yet, we need to load all remaining ENCODING entries
+    if(CascReadAcquire(&hs->dwLazyEncoding))
+    {
+        CascLock(hs->StorageLock);
+        if((pCKeyEntry = (PCASC_CKEY_ENTRY)hs->EKeyMap.FindObject(pbEKey, PtrIndex)) == NULL)
+        {
+            LoadEncodingEntries(hs);
+            pCKeyEntry = (PCASC_CKEY_ENTRY)hs->EKeyMap.FindObject(pbEKey, PtrIndex);
+        }
+        CascUnlock(hs->StorageLock);
+    }
+
+    return pCKeyEntry;
+}
+
+// Converts both key maps to minimal perfect hash tables. All CKey entries are in CKeyArray,
+// which never moves. Must not run while other threads search the maps
+DWORD FreezeKeyMaps(TCascStorage * hs)
+{
+    LPBYTE pbItemArray = (LPBYTE)hs->CKeyArray.ItemArray();
+    size_t nItemCount = hs->CKeyArray.ItemCount();
+    DWORD dwErrCode;
+
+    dwErrCode = hs->CKeyMap.Freeze(pbItemArray, nItemCount, sizeof(CASC_CKEY_ENTRY));
+    if(dwErrCode == ERROR_SUCCESS)
+        dwErrCode = hs->EKeyMap.Freeze(pbItemArray, nItemCount, sizeof(CASC_CKEY_ENTRY));
+    return dwErrCode;
 }
 
 bool OpenFileByCKeyEntry(TCascStorage * hs, PCASC_CKEY_ENTRY pCKeyEntry, DWORD dwOpenFlags, HANDLE * PtrFileHandle)
@@ -202,6 +363,8 @@ bool OpenFileByCKeyEntry(TCascStorage * hs, PCASC_CKEY_ENTRY pCKeyEntry, DWORD d
             hf->bVerifyIntegrity   = (dwOpenFlags & CASC_STRICT_DATA_CHECK)  ? true : false;
             hf->bAllowDownloading  = (hs->dwFeatures & CASC_FEATURE_ONLINE)  ? true : false;
             hf->bOvercomeEncrypted = (dwOpenFlags & CASC_OVERCOME_ENCRYPTED) ? true : false;
+            hf->bParallelDecode    = (dwOpenFlags & CASC_PARALLEL_DECODE)    ? true : false;
+            hf->CacheStrategy      = (dwOpenFlags & CASC_CACHE_MULTI_FRAME)  ? CascCacheMultiFrame : CascCacheLastFrame;
             dwErrCode = ERROR_SUCCESS;
         }
         else
@@ -250,6 +413,7 @@ bool OpenLocalFile(LPCTSTR szFileName, DWORD dwOpenFlags, HANDLE * PtrFileHandle
                     // Prepare the structure
                     hf->bVerifyIntegrity   = (dwOpenFlags & CASC_STRICT_DATA_CHECK)  ? true : false;
                     hf->bOvercomeEncrypted = (dwOpenFlags & CASC_OVERCOME_ENCRYPTED) ? true : false;
+                    hf->CacheStrategy      = (dwOpenFlags & CASC_CACHE_MULTI_FRAME)  ? CascCacheMultiFrame : CascCacheLastFrame;
                     hf->bCloseFileStream = true;
 
                     // Open all local file spans
@@ -305,7 +469,9 @@ bool SetCacheStrategy(HANDLE hFile, CSTRTG CacheStrategy)
 bool WINAPI CascOpenFile(HANDLE hStorage, const void * pvFileName, DWORD dwLocaleFlags, DWORD dwOpenFlags, HANDLE * PtrFileHandle)
 {
     PCASC_CKEY_ENTRY pCKeyEntry = NULL;
+    TCascStorageHandle * hsh;
     TCascStorage * hs;
+    TCascFile * hf;
     const char * szFileName;
     DWORD FileDataId = CASC_INVALID_ID;
     BYTE CKeyEKeyBuffer[MD5_HASH_SIZE];
@@ -315,12 +481,13 @@ bool WINAPI CascOpenFile(HANDLE hStorage, const void * pvFileName, DWORD dwLocal
     CASCLIB_UNUSED(dwLocaleFlags);
 
     // Validate the storage handle
-    hs = TCascStorage::IsValid(hStorage);
-    if(hs == NULL)
+    hsh = TCascStorageHandle::IsValid(hStorage);
+    if(hsh == NULL)
     {
         SetCascError(ERROR_INVALID_HANDLE);
         return false;
     }
+    hs = hsh->hs;
 
     // Validate the other parameters
     if(PtrFileHandle == NULL)
@@ -425,7 +592,13 @@ bool WINAPI CascOpenFile(HANDLE hStorage, const void * pvFileName, DWORD dwLocal
     }
 
     // Perform the open operation
-    return OpenFileByCKeyEntry(hs, pCKeyEntry, dwOpenFlags, PtrFileHandle);
+    if(!OpenFileByCKeyEntry(hs, pCKeyEntry, dwOpenFlags, PtrFileHandle))
+        return false;
+
+    // The file uses the encryption keys of the storage handle
+    if((hf = TCascFile::IsValid(PtrFileHandle[0])) != NULL)
+        hf->hsh = hsh->AddRef();
+    return true;
 }
 
 bool WINAPI CascOpenLocalFile(LPCTSTR szFileName, DWORD dwOpenFlags, HANDLE * PtrFileHandle)
@@ -24,6 +24,40 @@
 // Limit for "additional" items in CKey table
 #define CASC_MAX_EXTRA_ITEMS 0x40
 
+// Manifest file loaded in advance by a worker thread
+struct CASC_PRELOAD
+{
+    CASC_PRELOAD()
+    {
+        hs = NULL;
+        pCKeyEntry = NULL;
+    }
+
+    TCascStorage * hs;
+    PCASC_CKEY_ENTRY pCKeyEntry;                    // The CKey entry of the file. NULL = nothing to preload
+    CASC_BLOB FileData;                             // Content of the file. Empty if the preload failed
+};
+
+// Registry of the storages opened with CASC_FEATURE_SHARED_STORAGE
+struct CASC_STORAGE_REGISTRY
+{
+    CASC_STORAGE_REGISTRY()
+    {
+        CascInitLock(Lock);
+        pFirstStorage = NULL;
+    }
+
+    ~CASC_STORAGE_REGISTRY()
+    {
+        CascFreeLock(Lock);
+    }
+
+    CASC_LOCK Lock;                                 // Lock for the list and for releasing the shared storages
+    TCascStorage * pFirstStorage;                   // The first shared storage
+};
+
+static CASC_STORAGE_REGISTRY StorageRegistry;
+
 //-----------------------------------------------------------------------------
 // DEBUG functions
 
@@ -59,9 +93,10 @@ TCascStorage::TCascStorage()
     // Prepare the base storage parameters
     ClassName = CASC_MAGIC_STORAGE;
     pRootHandler = NULL;
+    pNextShared = NULL;
     dwRefCount = 1;
 
-    szRootPath = szDataPath = szIndexPath = szFilesPath = szConfigPath = szMainFile = NULL;
+    szRootPath = szDataPath = szIndexPath = szFilesPath = szConfigPath = szMainFile = szSnapshotPath = NULL;
     szCdnHostUrl = szCdnServers = szCdnPath = szCodeName = NULL;
     szIndexFormat = NULL;
     szRegion = NULL;
@@ -69,10 +104,22 @@ TCascStorage::TCascStorage()
 
     memset(DataFiles, 0, sizeof(DataFiles));
     memset(IndexFiles, 0, sizeof(IndexFiles));
+    memset(&ArchiveGroupIndex.Footer, 0, sizeof(CASC_ARCINDEX_FOOTER));
+    ArchiveGroupIndex.pStream = NULL;
+    ArchiveGroupIndex.pbPages = ArchiveGroupIndex.pbToc = NULL;
+    ArchiveGroupIndex.nPageCount = 0;
+    memset(&LoadedIndexes.GroupIndex.Footer, 0, sizeof(CASC_ARCINDEX_FOOTER));
+    LoadedIndexes.GroupIndex.pStream = NULL;
+    LoadedIndexes.GroupIndex.pbPages = LoadedIndexes.GroupIndex.pbToc = NULL;
+    LoadedIndexes.GroupIndex.nPageCount = 0;
+    LoadedIndexes.FileOffsetBits = LoadedIndexes.EKeyLength = 0;
     CascInitLock(StorageLock);
     dwDefaultLocale = 0;
     dwBuildNumber = 0;
     dwFeatures = 0;
+    dwLazyEncoding = 0;
+    dwOpenFlags = 0;
+    dwLocaleMask = 0;
     BuildFileType = CascBuildNone;
 
     LastFailKeyName = 0;
@@ -82,6 +129,9 @@ TCascStorage::TCascStorage()
 
 TCascStorage::~TCascStorage()
 {
+    // Stop the worker threads before anything they could use is freed
+    WorkerPool.Free();
+
     // Free the root handler
     if(pRootHandler != NULL)
         delete pRootHandler;
@@ -96,6 +146,8 @@ TCascStorage::~TCascStorage()
 
     // Cleanup space occupied by index files
     FreeIndexFiles(this);
+    FreeArchiveGroupIndex(LoadedIndexes.GroupIndex);
+    FreeArchiveGroupIndex(ArchiveGroupIndex);
 
     // Cleanup the lock
     CascFreeLock(StorageLock);
@@ -107,6 +159,7 @@ TCascStorage::~TCascStorage()
     CASC_FREE(szFilesPath);
     CASC_FREE(szConfigPath);
     CASC_FREE(szMainFile);
+    CASC_FREE(szSnapshotPath);
     CASC_FREE(szCdnHostUrl);
     CASC_FREE(szCdnServers);
     CASC_FREE(szCdnPath);
@@ -135,9 +188,34 @@ TCascStorage * TCascStorage::AddRef()
 
 TCascStorage * TCascStorage::Release()
 {
+    DWORD dwNewRefCount;
+
+    // Shared storages must be unlinked from the registry together with releasing
+    // the last reference, so that no other open can find a storage being deleted
+    if(dwFeatures & CASC_FEATURE_SHARED_STORAGE)
+    {
+        CascLock(StorageRegistry.Lock);
+        if((dwNewRefCount = CascInterlockedDecrement(&dwRefCount)) == 0)
+        {
+            for(TCascStorage ** PtrStorage = &StorageRegistry.pFirstStorage; PtrStorage[0] != NULL; PtrStorage = &PtrStorage[0]->pNextShared)
+            {
+                if(PtrStorage[0] == this)
+                {
+                    PtrStorage[0] = pNextShared;
+                    break;
+                }
+            }
+        }
+        CascUnlock(StorageRegistry.Lock);
+    }
+    else
+    {
+        dwNewRefCount = CascInterlockedDecrement(&dwRefCount);
+    }
+
     // If the reference count reached zero, we close the archive
     // Need this to be atomic to make multi-threaded file opens work
-    if(CascInterlockedDecrement(&dwRefCount) == 0)
+    if(dwNewRefCount == 0)
     {
         // Release all references in the socket cache
         if(dwFeatures & CASC_FEATURE_ONLINE)
@@ -150,6 +228,40 @@ TCascStorage * TCascStorage::Release()
     return this;
 }
 
+//-----------------------------------------------------------------------------
+// TCascStorageHandle class functions
+
+TCascStorageHandle::TCascStorageHandle(TCascStorage * ahs)
+{
+    ClassName = CASC_MAGIC_HANDLE;
+    hs = ahs->AddRef();
+    LastFailKeyName = 0;
+    dwRefCount = 1;
+}
+
+TCascStorageHandle::~TCascStorageHandle()
+{
+    hs = hs->Release();
+    ClassName = 0;
+}
+
+TCascStorageHandle * TCascStorageHandle::AddRef()
+{
+    CascInterlockedIncrement(&dwRefCount);
+    return this;
+}
+
+TCascStorageHandle * TCascStorageHandle::Release()
+{
+    // The handle is deleted when the caller closed it and all files open through it are closed
+    if(CascInterlockedDecrement(&dwRefCount) == 0)
+    {
+        delete this;
+        return NULL;
+    }
+    return this;
+}
+
 //-----------------------------------------------------------------------------
 // Local functions
 
@@ -168,6 +280,36 @@ void * ProbeOutputBuffer(void * pvBuffer, size_t cbLength, size_t cbMinLength, s
     return pvBuffer;
 }
 
+// Work item for loading a manifest file on a worker thread. Only tries the local
+// storage; downloading it (if needed) is done later on the main thread
+static DWORD PreloadManifestFile(void * pvParam)
+{
+    CASC_PRELOAD * pPreload = (CASC_PRELOAD *)pvParam;
+
+    if(pPreload->pCKeyEntry != NULL)
+    {
+        if(LoadInternalFileToMemory(pPreload->hs, pPreload->pCKeyEntry, pPreload->FileData) != ERROR_SUCCESS)
+            pPreload->FileData.Free();
+    }
+    return ERROR_SUCCESS;
+}
+
+// Gives the preloaded content of a manifest file or loads the file now
+static DWORD LoadManifestFile(TCascStorage * hs, PCASC_CKEY_ENTRY pCKeyEntry, CASC_PRELOAD & Preload, CASC_BLOB & FileData)
+{
+    if(pCKeyEntry != NULL && pCKeyEntry == Preload.pCKeyEntry && Preload.FileData.cbData != 0)
+    {
+        FileData.MoveFrom(Preload.FileData);
+        return ERROR_SUCCESS;
+    }
+    return LoadInternalFileToMemory(hs, pCKeyEntry, FileData);
+}
+
+static DWORD LoadIndexFilesWorker(void * pvParam)
+{
+    return LoadIndexFiles((TCascStorage *)pvParam);
+}
+
 static void SetFeatureBit(TCascStorage * hs, DWORD dwBitMask, DWORD dwBit)
 {
     // If the feature bit was present before, set it to 1
@@ -224,30 +366,39 @@ static PCASC_CKEY_ENTRY InsertCKeyEntry(TCascStorage * hs, CASC_CKEY_ENTRY & CKe
 }
 
 // Inserts an entry from ENCODING
-static PCASC_CKEY_ENTRY InsertCKeyEntry(TCascStorage * hs, PFILE_CKEY_ENTRY pFileEntry)
+// Initializes a CKey entry from an ENCODING entry. Safe to call from multiple threads,
+// as long as each thread initializes different entries
+static void InitCKeyEntry(TCascStorage * hs, PCASC_CKEY_ENTRY pCKeyEntry, PFILE_CKEY_ENTRY pFileEntry)
 {
-    PCASC_CKEY_ENTRY pCKeyEntry;
-
     // Stop on file-of-interest
     BREAK_ON_WATCHED(pFileEntry->EKey);
 
+    // Initialize the entry
+    CopyMemory16(pCKeyEntry->CKey, pFileEntry->CKey);
+    CopyMemory16(pCKeyEntry->EKey, pFileEntry->EKey);
+    pCKeyEntry->StorageOffset = CASC_INVALID_OFFS64;
+    pCKeyEntry->ContentSize = ConvertBytesToInteger_4(pFileEntry->ContentSize);
+    pCKeyEntry->EncodedSize = CASC_INVALID_SIZE;
+    pCKeyEntry->Flags = CASC_CE_HAS_CKEY | CASC_CE_HAS_EKEY | CASC_CE_IN_ENCODING;
+    pCKeyEntry->RefCount = 0;
+    pCKeyEntry->SpanCount = 1;
+    pCKeyEntry->Alignment = 0;
+
+    // Copy the information from index files to the CKey entry
+    CopyEKeyEntry(hs, pCKeyEntry);
+}
+
+// Inserts an entry from ENCODING
+static PCASC_CKEY_ENTRY InsertCKeyEntry(TCascStorage * hs, PFILE_CKEY_ENTRY pFileEntry)
+{
+    PCASC_CKEY_ENTRY pCKeyEntry;
+
     // Insert a new entry to the array. DO NOT ALLOW enlarge array here
     pCKeyEntry = (PCASC_CKEY_ENTRY)hs->CKeyArray.Insert(1, false);
     if(pCKeyEntry != NULL)
     {
         // Initialize the entry
-        CopyMemory16(pCKeyEntry->CKey, pFileEntry->CKey);
-        CopyMemory16(pCKeyEntry->EKey, pFileEntry->EKey);
-        pCKeyEntry->StorageOffset = CASC_INVALID_OFFS64;
-        pCKeyEntry->TagBitMask = 0;
-        pCKeyEntry->ContentSize = ConvertBytesToInteger_4(pFileEntry->ContentSize);
-        pCKeyEntry->EncodedSize = CASC_INVALID_SIZE;
-        pCKeyEntry->Flags = CASC_CE_HAS_CKEY | CASC_CE_HAS_EKEY | CASC_CE_IN_ENCODING;
-        pCKeyEntry->RefCount = 0;
-        pCKeyEntry->SpanCount = 1;
-
-        // Copy the information from index files to the CKey entry
-        CopyEKeyEntry(hs, pCKeyEntry);
+        InitCKeyEntry(hs, pCKeyEntry, pFileEntry);
 
         // Insert the item into both maps
         hs->CKeyMap.InsertObject(pCKeyEntry, pCKeyEntry->CKey);
@@ -284,12 +435,12 @@ static PCASC_CKEY_ENTRY InsertCKeyEntry(TCascStorage * hs, CASC_DOWNLOAD_ENTRY &
         ZeroMemory16(pCKeyEntry->CKey);
         CopyMemory16(pCKeyEntry->EKey, DlEntry.EKey);
         pCKeyEntry->StorageOffset = CASC_INVALID_OFFS64;
-        pCKeyEntry->TagBitMask = 0;
         pCKeyEntry->ContentSize = CASC_INVALID_SIZE;
         pCKeyEntry->EncodedSize = (DWORD)DlEntry.EncodedSize;
         pCKeyEntry->Flags = CASC_CE_HAS_EKEY | CASC_CE_IN_DOWNLOAD;
         pCKeyEntry->RefCount = 0;
         pCKeyEntry->SpanCount = 1;
+        pCKeyEntry->Alignment = 0;
 
         // Copy the information from index files to the CKey entry
         CopyEKeyEntry(hs, pCKeyEntry);
@@ -309,8 +460,6 @@ static PCASC_CKEY_ENTRY InsertCKeyEntry(TCascStorage * hs, CASC_DOWNLOAD_ENTRY &
         pCKeyEntry->Flags = (pCKeyEntry->Flags & ~CASC_CE_HAS_EKEY_PARTIAL) | CASC_CE_IN_DOWNLOAD;
     }
 
-    // Save the rest and return the entry
-    pCKeyEntry->Priority = DlEntry.Priority;
     return pCKeyEntry;
 }
 
@@ -368,7 +517,6 @@ static size_t GetEstimatedNumberOfFiles(TCascStorage * hs)
 static DWORD InitCKeyArray(TCascStorage * hs)
 {
     size_t nNumberOfFiles = GetEstimatedNumberOfFiles(hs);
-    size_t EKeyLength = (hs->BuildFileType == CascBuildConfig) ? MD5_HASH_SIZE : CASC_EKEY_SIZE;
     DWORD dwErrCode;
 
     //
@@ -381,13 +529,13 @@ static DWORD InitCKeyArray(TCascStorage * hs)
         return dwErrCode;
 
     // Create the map CKey -> CASC_CKEY_ENTRY
-    dwErrCode = hs->CKeyMap.Create(nNumberOfFiles, MD5_HASH_SIZE, FIELD_OFFSET(CASC_CKEY_ENTRY, CKey));
+    dwErrCode = hs->CKeyMap.Create(nNumberOfFiles, FIELD_OFFSET(CASC_CKEY_ENTRY, CKey));
     if(dwErrCode != ERROR_SUCCESS)
         return dwErrCode;
 
     // Create the map EKey -> CASC_CKEY_ENTRY. Note that most TVFS roots reference files
-    // using 9-byte EKey, while static storages use the full 16-byte EKey
-    dwErrCode = hs->EKeyMap.Create(nNumberOfFiles, EKeyLength, FIELD_OFFSET(CASC_CKEY_ENTRY, EKey));
+    // using 9-byte EKey, so only the first 9 bytes of the EKey are compared
+    dwErrCode = hs->EKeyMap.Create(nNumberOfFiles, FIELD_OFFSET(CASC_CKEY_ENTRY, EKey));
     if(dwErrCode != ERROR_SUCCESS)
         return dwErrCode;
 
@@ -449,6 +597,225 @@ static DWORD LoadEncodingCKeyPage(TCascStorage * hs, CASC_ENCODING_HEADER & EnHe
     return ERROR_SUCCESS;
 }
 
+//
+// Multi-threaded loading of the CKey pages. The pages are independent, so they are processed
+// in three steps: 1) Count the entries in each page (parallel), 2) Initialize the CKey entries
+// in preallocated slots of the CKey array (parallel), 3) Insert the entries to CKeyMap and EKeyMap.
+// The maps are not thread-safe; each of them is filled by one thread, in the order of the CKey array.
+// That keeps the result identical to the single-threaded loading, including duplicate keys.
+//
+
+struct CASC_ENCODING_PAGES
+{
+    TCascStorage * hs;
+    CASC_ENCODING_HEADER * pEnHeader;
+    LPBYTE pbFirstPage;                             // Pointer to the first CKey page
+    size_t * PageEntries;                           // Step 1: Number of entries in each page. Step 2: Index of the first entry of the page
+    PCASC_CKEY_ENTRY pFirstEntry;                   // The first preallocated entry in the CKey array
+    size_t nEntryCount;                             // Total number of entries
+};
+
+static DWORD CountEncodingCKeyPage(void * pvParam, size_t nPageIndex)
+{
+    CASC_ENCODING_PAGES * pPages = (CASC_ENCODING_PAGES *)pvParam;
+    CASC_ENCODING_HEADER & EnHeader = pPages->pEnHeader[0];
+    PFILE_CKEY_ENTRY pFileEntry;
+    LPBYTE pbFileEntry = pPages->pbFirstPage + (nPageIndex * EnHeader.CKeyPageSize);
+    LPBYTE pbEndOfPage = pbFileEntry + EnHeader.CKeyPageSize;
+    size_t nEntryCount = 0;
+
+    while(pbFileEntry < pbEndOfPage)
+    {
+        pFileEntry = (PFILE_CKEY_ENTRY)pbFileEntry;
+        if(pFileEntry->EKeyCount == 0)
+            break;
+
+        pbFileEntry = pbFileEntry + 2 + 4 + EnHeader.CKeyLength + (pFileEntry->EKeyCount * EnHeader.EKeyLength);
+        nEntryCount++;
+    }
+
+    pPages->PageEntries[nPageIndex] = nEntryCount;
+    return ERROR_SUCCESS;
+}
+
+static DWORD FillEncodingCKeyPage(void * pvParam, size_t nPageIndex)
+{
+    CASC_ENCODING_PAGES * pPages = (CASC_ENCODING_PAGES *)pvParam;
+    CASC_ENCODING_HEADER & EnHeader = pPages->pEnHeader[0];
+    PCASC_CKEY_ENTRY pCKeyEntry = pPages->pFirstEntry + pPages->PageEntries[nPageIndex];
+    PFILE_CKEY_ENTRY pFileEntry;
+    LPBYTE pbFileEntry = pPages->pbFirstPage + (nPageIndex * EnHeader.CKeyPageSize);
+    LPBYTE pbEndOfPage = pbFileEntry + EnHeader.CKeyPageSize;
+
+    while(pbFileEntry < pbEndOfPage)
+    {
+        pFileEntry = (PFILE_CKEY_ENTRY)pbFileEntry;
+        if(pFileEntry->EKeyCount == 0)
+            break;
+
+        InitCKeyEntry(pPages->hs, pCKeyEntry++, pFileEntry);
+        pbFileEntry = pbFileEntry + 2 + 4 + EnHeader.CKeyLength + (pFileEntry->EKeyCount * EnHeader.EKeyLength);
+    }
+    return ERROR_SUCCESS;
+}
+
+static DWORD InsertEncodingEntriesToCKeyMap(void * pvParam)
+{
+    CASC_ENCODING_PAGES * pPages = (CASC_ENCODING_PAGES *)pvParam;
+    PCASC_CKEY_ENTRY pCKeyEntry = pPages->pFirstEntry;
+
+    for(size_t i = 0; i < pPages->nEntryCount; i++, pCKeyEntry++)
+        pPages->hs->CKeyMap.InsertObject(pCKeyEntry, pCKeyEntry->CKey);
+    return ERROR_SUCCESS;
+}
+
+static DWORD InsertEncodingEntriesToEKeyMap(void * pvParam)
+{
+    CASC_ENCODING_PAGES * pPages = (CASC_ENCODING_PAGES *)pvParam;
+    PCASC_CKEY_ENTRY pCKeyEntry = pPages->pFirstEntry;
+
+    for(size_t i = 0; i < pPages->nEntryCount; i++, pCKeyEntry++)
+        pPages->hs->EKeyMap.InsertObject(pCKeyEntry, pCKeyEntry->EKey);
+    return ERROR_SUCCESS;
+}
+
+static DWORD LoadEncodingCKeyPages(TCascStorage * hs, CASC_ENCODING_HEADER & EnHeader, LPBYTE pbFirstPage)
+{
+    CASC_ENCODING_PAGES Pages;
+    CASC_WORK_GROUP MapGroup;
+    size_t nPageCount = EnHeader.CKeyPageCount;
+    size_t nEntryIndex = 0;
+    size_t nEntryCount;
+    DWORD dwErrCode;
+
+    // Allocate the array for per-page counts
+    if((Pages.PageEntries = CASC_ALLOC<size_t>(nPageCount + 1)) == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    Pages.hs = hs;
+    Pages.pEnHeader = &EnHeader;
+    Pages.pbFirstPage = pbFirstPage;
+    Pages.pFirstEntry = NULL;
+    Pages.nEntryCount = 0;
+
+    // Step 1: Count the entries in all pages
+    dwErrCode = hs->WorkerPool.ParallelFor(nPageCount, CountEncodingCKeyPage, &Pages);
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        // Convert the counts to indexes of the first entry in each page
+        for(size_t i = 0; i < nPageCount; i++)
+        {
+            nEntryCount = Pages.PageEntries[i];
+            Pages.PageEntries[i] = nEntryIndex;
+            nEntryIndex += nEntryCount;
+        }
+
+        // Preallocate all entries. DO NOT ALLOW enlarge array here. If the estimated
+        // number of files was too small, load the pages one-by-one, like before
+        Pages.pFirstEntry = (PCASC_CKEY_ENTRY)hs->CKeyArray.Insert(nEntryIndex, false);
+        Pages.nEntryCount = nEntryIndex;
+        if(Pages.pFirstEntry == NULL)
+        {
+            for(size_t i = 0; i < nPageCount; i++)
+            {
+                LPBYTE pbCKeyPage = pbFirstPage + (i * EnHeader.CKeyPageSize);
+                LoadEncodingCKeyPage(hs, EnHeader, pbCKeyPage, pbCKeyPage + EnHeader.CKeyPageSize);
+            }
+
+            CASC_FREE(Pages.PageEntries);
+            return ERROR_SUCCESS;
+        }
+    }
+
+    // Step 2: Initialize the CKey entries
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        dwErrCode = hs->WorkerPool.ParallelFor(nPageCount, FillEncodingCKeyPage, &Pages);
+    }
+
+    // Step 3: Fill both maps at once
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        // If the item can't be queued, we fill the EKey map on this thread
+        if(hs->WorkerPool.Submit(MapGroup, InsertEncodingEntriesToEKeyMap, &Pages) != ERROR_SUCCESS)
+            InsertEncodingEntriesToEKeyMap(&Pages);
+        InsertEncodingEntriesToCKeyMap(&Pages);
+        dwErrCode = hs->WorkerPool.Wait(MapGroup);
+    }
+
+    CASC_FREE(Pages.PageEntries);
+    return dwErrCode;
+}
+
+//
+// Verification of the ENCODING pages. Each CKey page and each EKey page has its MD5 in the page table.
+// Verifying takes considerable time of the storage loading, so it's only done on request,
+// and the pages are hashed on the worker threads
+//
+
+struct CASC_ENCODING_VERIFY
+{
+    CASC_ENCODING_HEADER * pEnHeader;
+    PFILE_CKEY_PAGE pCKeyPageHeader;                // Page table of the CKey pages
+    PFILE_CKEY_PAGE pEKeyPageHeader;                // Page table of the EKey pages
+    LPBYTE pbCKeyPages;                             // The first CKey page
+    LPBYTE pbEKeyPages;                             // The first EKey page
+};
+
+static DWORD VerifyEncodingPage(void * pvParam, size_t nPageIndex)
+{
+    CASC_ENCODING_VERIFY * pVerify = (CASC_ENCODING_VERIFY *)pvParam;
+    CASC_ENCODING_HEADER & EnHeader = pVerify->pEnHeader[0];
+    PFILE_CKEY_PAGE pPageHeader;
+    LPBYTE pbPage;
+    size_t cbPage;
+
+    // CKey pages go first, then EKey pages
+    if(nPageIndex < EnHeader.CKeyPageCount)
+    {
+        pPageHeader = pVerify->pCKeyPageHeader + nPageIndex;
+        pbPage = pVerify->pbCKeyPages + (nPageIndex * EnHeader.CKeyPageSize);
+        cbPage = EnHeader.CKeyPageSize;
+    }
+    else
+    {
+        nPageIndex -= EnHeader.CKeyPageCount;
+        pPageHeader = pVerify->pEKeyPageHeader + nPageIndex;
+        pbPage = pVerify->pbEKeyPages + (nPageIndex * EnHeader.EKeyPageSize);
+        cbPage = EnHeader.EKeyPageSize;
+    }
+
+    // Check the hash of the entire page
+    if(!CascVerifyDataBlockHash(pbPage, cbPage, pPageHeader->SegmentHash))
+        return ERROR_FILE_CORRUPT;
+    return ERROR_SUCCESS;
+}
+
+static DWORD VerifyEncodingPages(TCascStorage * hs, CASC_ENCODING_HEADER & EnHeader, LPBYTE pbFileData, size_t cbFileData)
+{
+    CASC_ENCODING_VERIFY Verify;
+    LPBYTE pbFilePtr = pbFileData + sizeof(FILE_ENCODING_HEADER) + EnHeader.ESpecBlockSize;
+    ULONGLONG CKeyPagesSize = (ULONGLONG)EnHeader.CKeyPageCount * EnHeader.CKeyPageSize;
+    ULONGLONG EKeyPagesSize = (ULONGLONG)EnHeader.EKeyPageCount * EnHeader.EKeyPageSize;
+    ULONGLONG cbNeeded;
+
+    // Make sure that all page tables and all pages are within the file
+    cbNeeded = sizeof(FILE_ENCODING_HEADER) + EnHeader.ESpecBlockSize;
+    cbNeeded += (ULONGLONG)EnHeader.CKeyPageCount * sizeof(FILE_CKEY_PAGE) + CKeyPagesSize;
+    cbNeeded += (ULONGLONG)EnHeader.EKeyPageCount * sizeof(FILE_CKEY_PAGE) + EKeyPagesSize;
+    if(cbNeeded > cbFileData)
+        return ERROR_FILE_CORRUPT;
+
+    // Locate the page tables and the pages
+    Verify.pEnHeader = &EnHeader;
+    Verify.pCKeyPageHeader = (PFILE_CKEY_PAGE)pbFilePtr;
+    Verify.pbCKeyPages = (LPBYTE)(Verify.pCKeyPageHeader + EnHeader.CKeyPageCount);
+    Verify.pEKeyPageHeader = (PFILE_CKEY_PAGE)(Verify.pbCKeyPages + CKeyPagesSize);
+    Verify.pbEKeyPages = (LPBYTE)(Verify.pEKeyPageHeader + EnHeader.EKeyPageCount);
+
+    // Verify all pages
+    return hs->WorkerPool.ParallelFor(EnHeader.CKeyPageCount + EnHeader.EKeyPageCount, VerifyEncodingPage, &Verify);
+}
+
 static DWORD LoadEncodingManifest(TCascStorage * hs)
 {
     CASC_CKEY_ENTRY & CKeyEntry = hs->EncodingCKey;
@@ -492,6 +859,15 @@ static DWORD LoadEncodingManifest(TCascStorage * hs)
 
         // Capture the header of the ENCODING file
         dwErrCode = CaptureEncodingHeader(EnHeader, FileData.pbData, FileData.cbData);
+
+        // Verify the hashes of all pages, if requested
+        if(dwErrCode == ERROR_SUCCESS && (hs->dwFeatures & CASC_FEATURE_VERIFY_ENCODING))
+        {
+            if(InvokeProgressCallback(hs, CascProgressLoadingManifest, "ENCODING (verifying)", 0, 0))
+                return ERROR_CANCELLED;
+            dwErrCode = VerifyEncodingPages(hs, EnHeader, FileData.pbData, FileData.cbData);
+        }
+
         if(dwErrCode == ERROR_SUCCESS)
         {
             // Get the CKey page header and the first page
@@ -509,13 +885,7 @@ static DWORD LoadEncodingManifest(TCascStorage * hs)
                     break;
                 }
 
-                // Check the hash of the entire segment
-                // Note that verifying takes considerable time of the storage loading
-//              if(!VerifyDataBlockHash(pbCKeyPage, EnHeader.CKeyPageSize, pEncodingSegment->SegmentHash))
-//              {
-//                  dwErrCode = ERROR_FILE_CORRUPT;
-//                  break;
-//              }
+                // The hash of the entire segment is checked by VerifyEncodingPages (CASC_FEATURE_VERIFY_ENCODING)
 
                 // Check if the CKey matches with the expected first value
                 if(memcmp(((PFILE_CKEY_ENTRY)pbCKeyPage)->CKey, pPageHeader[i].FirstKey, MD5_HASH_SIZE))
@@ -524,15 +894,41 @@ static DWORD LoadEncodingManifest(TCascStorage * hs)
                     break;
                 }
 
-                // Load the entire page of CKey entries.
+                // Load the entire page of CKey entries. With worker threads, all pages are loaded later at once.
+                // With lazy ENCODING, the entries are loaded on demand.
                 // This operation will never fail, because all memory is already pre-allocated
-                dwErrCode = LoadEncodingCKeyPage(hs, EnHeader, pbCKeyPage, pbCKeyPage + EnHeader.CKeyPageSize);
-                if(dwErrCode != ERROR_SUCCESS)
-                    break;
+                if(hs->WorkerPool.IsParallel() == false && (hs->dwFeatures & CASC_FEATURE_LAZY_ENCODING) == 0)
+                {
+                    dwErrCode = LoadEncodingCKeyPage(hs, EnHeader, pbCKeyPage, pbCKeyPage + EnHeader.CKeyPageSize);
+                    if(dwErrCode != ERROR_SUCCESS)
+                        break;
+                }
 
                 // Move to the next CKey page
                 pbCKeyPage += EnHeader.CKeyPageSize;
             }
+
+            // Lazy ENCODING: Keep the manifest in memory for on-demand lookups
+            if(dwErrCode == ERROR_SUCCESS && (hs->dwFeatures & CASC_FEATURE_LAZY_ENCODING))
+            {
+                hs->EncodingHeader = EnHeader;
+                hs->EncodingData.MoveFrom(FileData);
+                hs->dwLazyEncoding = 1;
+            }
+
+            // Load all CKey pages using the worker threads
+            else if(dwErrCode == ERROR_SUCCESS && hs->WorkerPool.IsParallel())
+            {
+                dwErrCode = LoadEncodingCKeyPages(hs, EnHeader, (LPBYTE)(pPageHeader + EnHeader.CKeyPageCount));
+            }
+
+            // Load the ESpec strings and assign them to the loaded entries. They are optional;
+            // if they can't be loaded, the BLTE headers are read without knowing the file layout
+            if(dwErrCode == ERROR_SUCCESS)
+            {
+                CASC_BLOB & EncodingData = (hs->EncodingData.pbData != NULL) ? hs->EncodingData : FileData;
+                LoadEncodingESpecs(hs, EnHeader, EncodingData.pbData, EncodingData.cbData);
+            }
         }
 
         // All CKey->EKey entries from the text build files need to be copied to the CKey array
@@ -544,6 +940,101 @@ static DWORD LoadEncodingManifest(TCascStorage * hs)
     return dwErrCode;
 }
 
+// Lazy ENCODING: Finds the CKey in the ENCODING manifest and creates its CKey entry.
+// The caller must hold the storage lock
+PCASC_CKEY_ENTRY LoadEncodingEntry(TCascStorage * hs, LPBYTE pbCKey)
+{
+    CASC_ENCODING_HEADER & EnHeader = hs->EncodingHeader;
+    PFILE_CKEY_ENTRY pFileEntry;
+    PFILE_CKEY_PAGE pPageHeader;
+    LPBYTE pbFileEntry;
+    LPBYTE pbEndOfPage;
+    DWORD dwPageIndex = 0;
+    DWORD dwPageCount = EnHeader.CKeyPageCount;
+    DWORD dwMiddle;
+    int nResult;
+
+    // Only if the ENCODING manifest is loaded
+    if(hs->EncodingData.pbData == NULL || dwPageCount == 0)
+        return NULL;
+    pPageHeader = (PFILE_CKEY_PAGE)(hs->EncodingData.pbData + sizeof(FILE_ENCODING_HEADER) + EnHeader.ESpecBlockSize);
+
+    // Binary search for the first page whose first key is greater than the CKey.
+    // The CKey, if present, is in the page before it
+    while(dwPageIndex < dwPageCount)
+    {
+        dwMiddle = dwPageIndex + (dwPageCount - dwPageIndex) / 2;
+        if(memcmp(pPageHeader[dwMiddle].FirstKey, pbCKey, MD5_HASH_SIZE) <= 0)
+            dwPageIndex = dwMiddle + 1;
+        else
+            dwPageCount = dwMiddle;
+    }
+
+    // CKey is lower than the first key of the first page
+    if(dwPageIndex == 0)
+        return NULL;
+
+    // Search the page. The entries are sorted by CKey
+    pbFileEntry = (LPBYTE)(pPageHeader + EnHeader.CKeyPageCount) + ((dwPageIndex - 1) * EnHeader.CKeyPageSize);
+    pbEndOfPage = pbFileEntry + EnHeader.CKeyPageSize;
+    while(pbFileEntry < pbEndOfPage)
+    {
+        pFileEntry = (PFILE_CKEY_ENTRY)pbFileEntry;
+        if(pFileEntry->EKeyCount == 0)
+            break;
+
+        // Did we find it?
+        if((nResult = memcmp(pFileEntry->CKey, pbCKey, MD5_HASH_SIZE)) >= 0)
+            return (nResult == 0) ? InsertCKeyEntry(hs, pFileEntry) : NULL;
+
+        // Move to the next encoding entry
+        pbFileEntry = pbFileEntry + 2 + 4 + EnHeader.CKeyLength + (pFileEntry->EKeyCount * EnHeader.EKeyLength);
+    }
+    return NULL;
+}
+
+// Lazy ENCODING: Creates CKey entries for all remaining entries of the ENCODING manifest
+// and switches the storage to the normal mode. The caller must hold the storage lock
+void LoadEncodingEntries(TCascStorage * hs)
+{
+    CASC_ENCODING_HEADER & EnHeader = hs->EncodingHeader;
+    PFILE_CKEY_ENTRY pFileEntry;
+    PFILE_CKEY_PAGE pPageHeader;
+    LPBYTE pbCKeyPage;
+    LPBYTE pbFileEntry;
+
+    // Only if the ENCODING manifest is loaded
+    if(hs->EncodingData.pbData != NULL)
+    {
+        pPageHeader = (PFILE_CKEY_PAGE)(hs->EncodingData.pbData + sizeof(FILE_ENCODING_HEADER) + EnHeader.ESpecBlockSize);
+        pbCKeyPage = (LPBYTE)(pPageHeader + EnHeader.CKeyPageCount);
+
+        for(DWORD i = 0; i < EnHeader.CKeyPageCount; i++, pbCKeyPage += EnHeader.CKeyPageSize)
+        {
+            for(pbFileEntry = pbCKeyPage; pbFileEntry < pbCKeyPage + EnHeader.CKeyPageSize; )
+            {
+                pFileEntry = (PFILE_CKEY_ENTRY)pbFileEntry;
+                if(pFileEntry->EKeyCount == 0)
+                    break;
+
+                // Skip entries that have already been looked up
+                if(hs->CKeyMap.FindObject(pFileEntry->CKey) == NULL)
+                    InsertCKeyEntry(hs, pFileEntry);
+
+                pbFileEntry = pbFileEntry + 2 + 4 + EnHeader.CKeyLength + (pFileEntry->EKeyCount * EnHeader.EKeyLength);
+            }
+        }
+
+        // Keep the ESpecs of the entries. The EKey pages are going to be freed
+        LoadEncodingESpecIndexes(hs);
+
+        // All entries are loaded now. Threads that see the state cleared without the lock
+        // must also see all inserted entries and ESpec indexes
+        CascWriteRelease(&hs->dwLazyEncoding, 0);
+        hs->EncodingData.Free();
+    }
+}
+
 size_t GetTagBitmapLength(LPBYTE pbFilePtr, LPBYTE pbFileEnd, DWORD EntryCount)
 {
     size_t nBitmapLength;
@@ -663,6 +1154,23 @@ int CaptureDownloadTag(CASC_DOWNLOAD_HEADER & DlHeader, CASC_TAG_ENTRY1 & DlTag,
     return ERROR_SUCCESS;
 }
 
+// The tags are stored as one bitmap per tag, with one bit for each item in the CKey array.
+// Most storages don't have tags, so we don't want to have them in every CASC_CKEY_ENTRY
+DWORD CreateTagBitmaps(TCascStorage * hs, size_t nTagCount, size_t nEntryCount)
+{
+    size_t cbBitmap = (nEntryCount + 7) / 8;
+    LPBYTE pbBitmaps;
+    DWORD dwErrCode;
+
+    if((dwErrCode = hs->TagBitmaps.Create(cbBitmap, nTagCount)) == ERROR_SUCCESS)
+    {
+        if((pbBitmaps = (LPBYTE)hs->TagBitmaps.Insert(nTagCount, false)) == NULL)
+            return ERROR_NOT_ENOUGH_MEMORY;
+        memset(pbBitmaps, 0, nTagCount * cbBitmap);
+    }
+    return dwErrCode;
+}
+
 static int LoadDownloadManifest(TCascStorage * hs, CASC_DOWNLOAD_HEADER & DlHeader, LPBYTE pbFileData, LPBYTE pbFileEnd)
 {
     PCASC_TAG_ENTRY1 TagArray = NULL;
@@ -721,6 +1229,12 @@ static int LoadDownloadManifest(TCascStorage * hs, CASC_DOWNLOAD_HEADER & DlHead
                     pTargetTag->TagValue = pSourceTag->TagValue;
                 }
             }
+
+            // Allocate the tag bitmaps. Each DOWNLOAD entry adds at most one item to the CKey array
+            if(dwErrCode == ERROR_SUCCESS)
+            {
+                dwErrCode = CreateTagBitmaps(hs, DlHeader.TagCount, hs->CKeyArray.ItemCount() + DlHeader.EntryCount);
+            }
         }
         else
         {
@@ -733,9 +1247,10 @@ static int LoadDownloadManifest(TCascStorage * hs, CASC_DOWNLOAD_HEADER & DlHead
     {
         CASC_DOWNLOAD_ENTRY DlEntry;
         PCASC_CKEY_ENTRY pCKeyEntry;
-        ULONGLONG TagBit = 1;
+        LPBYTE pbTagBitmap;
         size_t BitMaskOffset = (i / 8);
-        size_t TagItemCount = hs->TagsArray.ItemCount();
+        size_t TagItemCount = hs->TagBitmaps.ItemCount();
+        size_t nEntryIndex;
         BYTE BitMaskBit = 0x80 >> (i % 8);
 
         // Capture the download entry
@@ -748,17 +1263,18 @@ static int LoadDownloadManifest(TCascStorage * hs, CASC_DOWNLOAD_HEADER & DlHead
         // Insert the entry to the central CKey table
         if((pCKeyEntry = InsertCKeyEntry(hs, DlEntry)) != NULL)
         {
-            if(TagArray != NULL)
+            nEntryIndex = GetCKeyEntryIndex(hs, pCKeyEntry);
+            if(TagArray != NULL && nEntryIndex < hs->TagBitmaps.ItemSize() * 8)
             {
                 // Supply the tag bits
                 for(size_t j = 0; j < TagItemCount; j++)
                 {
-                    // Set the bit in the entry, if the tag for it is present
+                    // Set the bit of the entry in the tag bitmap, if the tag for it is present
                     if((BitMaskOffset < TagArray[j].BitmapLength) && (TagArray[j].Bitmap[BitMaskOffset] & BitMaskBit))
-                        pCKeyEntry->TagBitMask |= TagBit;
-
-                    // Move to the next bit
-                    TagBit <<= 1;
+                    {
+                        pbTagBitmap = (LPBYTE)hs->TagBitmaps.ItemAt(j);
+                        pbTagBitmap[nEntryIndex / 8] |= (BYTE)(1 << (nEntryIndex % 8));
+                    }
                 }
             }
         }
@@ -775,7 +1291,7 @@ static int LoadDownloadManifest(TCascStorage * hs, CASC_DOWNLOAD_HEADER & DlHead
     return dwErrCode;
 }
 
-static int LoadDownloadManifest(TCascStorage * hs)
+static int LoadDownloadManifest(TCascStorage * hs, CASC_PRELOAD & Preload)
 {
     PCASC_CKEY_ENTRY pCKeyEntry = FindCKeyEntry_CKey(hs, hs->DownloadCKey.CKey);
     CASC_BLOB FileData;
@@ -787,7 +1303,7 @@ static int LoadDownloadManifest(TCascStorage * hs)
         return ERROR_CANCELLED;
 
     // Attempt to load the DOWNLOAD manifest from the local storage
-    dwErrCode = LoadInternalFileToMemory(hs, pCKeyEntry, FileData);
+    dwErrCode = LoadManifestFile(hs, pCKeyEntry, Preload, FileData);
 
     // If not available, try to download it
     if((dwErrCode != ERROR_SUCCESS) && (hs->dwFeatures & CASC_FEATURE_ALLOW_DOWNLOAD))
@@ -885,7 +1401,7 @@ static bool InsertWellKnownFile(TCascStorage * hs, const char * szFileName, CASC
     return false;
 }
 
-static DWORD LoadBuildManifest(TCascStorage * hs, DWORD dwLocaleMask)
+static DWORD LoadBuildManifest(TCascStorage * hs, DWORD dwLocaleMask, CASC_PRELOAD & Preload)
 {
     PCASC_CKEY_ENTRY pCKeyEntry = &hs->RootFile;
     TRootHandler * pOldRootHandler = NULL;
@@ -913,7 +1429,7 @@ __LoadRootFile:
 
     // Download the local copy of the ROOT file
     pCKeyEntry = FindCKeyEntry_CKey(hs, pCKeyEntry->CKey);
-    dwErrCode = LoadInternalFileToMemory(hs, pCKeyEntry, FileData);
+    dwErrCode = LoadManifestFile(hs, pCKeyEntry, Preload, FileData);
 
     // If not available, try to download it
     if((dwErrCode != ERROR_SUCCESS) && (hs->dwFeatures & CASC_FEATURE_ALLOW_DOWNLOAD))
@@ -1150,20 +1666,210 @@ static bool GetStoragePathProduct(TCascStorage * hs, void * pvStorageInfo, size_
     return (szBuffer != NULL);
 }
 
-static DWORD LoadCascStorage(TCascStorage * hs, PCASC_OPEN_STORAGE_ARGS pArgs, LPCTSTR szMainFile, CBLD_TYPE BuildFileType, DWORD dwFeatures)
+static bool GetStorageFrameCacheInfo(TCascStorage * hs, void * pvStorageInfo, size_t cbStorageInfo, size_t * pcbLengthNeeded)
+{
+    PCASC_FRAME_CACHE_INFO pCacheInfo;
+
+    // Verify whether we have enough space in the buffer
+    pCacheInfo = (PCASC_FRAME_CACHE_INFO)ProbeOutputBuffer(pvStorageInfo, cbStorageInfo, sizeof(CASC_FRAME_CACHE_INFO), pcbLengthNeeded);
+    if(pCacheInfo != NULL)
+        hs->FrameCache.GetStats(pCacheInfo);
+    return (pCacheInfo != NULL);
+}
+
+template <typename xchar>
+static bool IsSameString(const xchar * szString1, const xchar * szString2)
+{
+    if(szString1 == NULL || szString2 == NULL)
+        return (szString1 == szString2);
+
+    while(szString1[0] != 0 && szString1[0] == szString2[0])
+    {
+        szString1++;
+        szString2++;
+    }
+    return (szString1[0] == szString2[0]);
+}
+
+static bool IsSameBlob(CASC_BLOB & Blob1, CASC_BLOB & Blob2)
+{
+    if(Blob1.cbData != Blob2.cbData)
+        return false;
+    return (Blob1.cbData == 0 || memcmp(Blob1.pbData, Blob2.pbData, Blob1.cbData) == 0);
+}
+
+// Checks whether a shared storage has been opened the same way as a storage being opened.
+// The storage being opened has only the main file loaded at this point
+static bool IsSameSharedStorage(TCascStorage * hs, TCascStorage * hsShared)
+{
+    return (hs->BuildFileType == hsShared->BuildFileType &&
+            hs->dwOpenFlags == hsShared->dwOpenFlags &&
+            hs->dwLocaleMask == hsShared->dwLocaleMask &&
+            IsSameString(hs->szMainFile, hsShared->szMainFile) &&
+            IsSameString(hs->szCodeName, hsShared->szCodeName) &&
+            IsSameString(hs->szRegion, hsShared->szRegion) &&
+            IsSameString(hs->szCdnHostUrl, hsShared->szCdnHostUrl) &&
+            IsSameBlob(hs->CdnBuildKey, hsShared->CdnBuildKey));
+}
+
+// Finds a loaded storage of the same build. Returns it with an added reference
+static TCascStorage * FindSharedStorage(TCascStorage * hs)
+{
+    TCascStorage * hsShared;
+
+    CascLock(StorageRegistry.Lock);
+    for(hsShared = StorageRegistry.pFirstStorage; hsShared != NULL; hsShared = hsShared->pNextShared)
+    {
+        if(IsSameSharedStorage(hs, hsShared))
+        {
+            hsShared->AddRef();
+            break;
+        }
+    }
+    CascUnlock(StorageRegistry.Lock);
+    return hsShared;
+}
+
+// Makes a loaded storage available to other opens. If a storage of the same build
+// has been loaded by another thread in the meantime, the new one stays private
+static void RegisterSharedStorage(TCascStorage * hs)
+{
+    TCascStorage * hsShared;
+
+    CascLock(StorageRegistry.Lock);
+    for(hsShared = StorageRegistry.pFirstStorage; hsShared != NULL; hsShared = hsShared->pNextShared)
+    {
+        if(IsSameSharedStorage(hs, hsShared))
+            break;
+    }
+
+    if(hsShared == NULL)
+    {
+        hs->pNextShared = StorageRegistry.pFirstStorage;
+        StorageRegistry.pFirstStorage = hs;
+    }
+    CascUnlock(StorageRegistry.Lock);
+}
+
+// Loads the main file of the storage again and checks whether the installed build is still the same
+static DWORD CheckInstalledBuild(TCascStorage * hs)
+{
+    CASC_OPEN_STORAGE_ARGS OpenArgs;
+    TCascStorage * hsNew;
+    DWORD dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+
+    memset(&OpenArgs, 0, sizeof(CASC_OPEN_STORAGE_ARGS));
+    OpenArgs.Size = sizeof(CASC_OPEN_STORAGE_ARGS);
+
+    // Only the main file is loaded into the temporary storage
+    if((hsNew = new TCascStorage()) != NULL)
+    {
+        hsNew->pArgs = &OpenArgs;
+        hsNew->BuildFileType = hs->BuildFileType;
+        hsNew->szMainFile = CascNewStr(hs->szMainFile);
+        hsNew->szCodeName = CascNewStr(hs->szCodeName);
+        hsNew->szRegion = CascNewStr(hs->szRegion);
+
+        // Load the main file. If the build key differs, the ROOT, ENCODING
+        // and all other manifests belong to a different build
+        if(hsNew->szMainFile != NULL && (dwErrCode = LoadMainFile(hsNew)) == ERROR_SUCCESS)
+        {
+            if(!IsSameBlob(hs->CdnBuildKey, hsNew->CdnBuildKey))
+            {
+                dwErrCode = ERROR_CAN_NOT_COMPLETE;
+            }
+        }
+
+        hsNew->pArgs = NULL;
+        hsNew->Release();
+    }
+
+    return dwErrCode;
+}
+
+// Updates the location of a file while other threads may be opening it. Each field
+// changes with one store, and a file that stays local is never seen as missing
+static void UpdateFileLocation(PCASC_CKEY_ENTRY pCKeyEntry, ULONGLONG StorageOffset, DWORD EncodedSize)
+{
+    if(StorageOffset != CASC_INVALID_OFFS64)
+    {
+        pCKeyEntry->EncodedSize = EncodedSize;
+        CascWriteRelease(&pCKeyEntry->StorageOffset, StorageOffset);
+        pCKeyEntry->Flags |= CASC_CE_FILE_IS_LOCAL;
+    }
+    else
+    {
+        pCKeyEntry->Flags &= ~CASC_CE_FILE_IS_LOCAL;
+        CascWriteRelease(&pCKeyEntry->StorageOffset, CASC_INVALID_OFFS64);
+    }
+}
+
+// Reloads the index files and updates the location of all CKey entries
+static DWORD RefreshLocalIndexes(TCascStorage * hs)
+{
+    PCASC_CKEY_ENTRY pCKeyEntry;
+    ULONGLONG StorageOffset;
+    size_t nItemCount = hs->CKeyArray.ItemCount();
+    size_t nLocalFiles = 0;
+    DWORD EncodedSize = 0;
+    DWORD dwErrCode;
+
+    // Free the index files of the previous load. With lazy ENCODING, they are still in memory.
+    // The index files might have been replaced by newer versions in the meantime
+    FreeIndexFiles(hs);
+    for(size_t i = 0; i < CASC_INDEX_COUNT; i++)
+        hs->IndexFiles[i].NewSubIndex = hs->IndexFiles[i].OldSubIndex = 0;
+
+    // Load the current index files
+    if((dwErrCode = LoadIndexFiles(hs)) == ERROR_SUCCESS)
+    {
+        // Files may have been downloaded, moved to another data file or removed.
+        // Only entries with an EKey can be found in the index files
+        for(size_t i = 0; i < nItemCount; i++)
+        {
+            pCKeyEntry = (PCASC_CKEY_ENTRY)hs->CKeyArray.ItemAt(i);
+            StorageOffset = CASC_INVALID_OFFS64;
+            if(pCKeyEntry->Flags & CASC_CE_HAS_EKEY)
+                FindEKeyEntryLocation(hs, pCKeyEntry->EKey, StorageOffset, EncodedSize);
+            UpdateFileLocation(pCKeyEntry, StorageOffset, EncodedSize);
+            nLocalFiles += (StorageOffset != CASC_INVALID_OFFS64) ? 1 : 0;
+        }
+
+        // The ENCODING entry is stored separately
+        StorageOffset = CASC_INVALID_OFFS64;
+        FindEKeyEntryLocation(hs, hs->EncodingCKey.EKey, StorageOffset, EncodedSize);
+        UpdateFileLocation(&hs->EncodingCKey, StorageOffset, EncodedSize);
+        hs->LocalFiles = nLocalFiles;
+    }
+
+    // With lazy ENCODING, the index files are needed for the CKey entries created later
+    if((hs->dwFeatures & CASC_FEATURE_LAZY_ENCODING) == 0)
+        FreeIndexFiles(hs);
+    return dwErrCode;
+}
+
+static DWORD LoadCascStorage(TCascStorage *& hs, PCASC_OPEN_STORAGE_ARGS pArgs, LPCTSTR szMainFile, CBLD_TYPE BuildFileType, DWORD dwFeatures)
 {
     LPCTSTR szCdnHostUrl = NULL;
     LPCTSTR szCodeName = NULL;
     LPCTSTR szRegion = NULL;
     LPCTSTR szBuildKey = NULL;
+    LPCTSTR szSnapshotPath = NULL;
+    CASC_PRELOAD DownloadPreload;
+    CASC_PRELOAD RootPreload;
+    ULONGLONG FrameCacheSize = 0;
+    DWORD dwThreadCount = 0;
     DWORD dwLocaleMask = 0;
     DWORD dwErrCode = ERROR_SUCCESS;
+    bool bSnapshotLoaded = false;
 
     // Pass the argument array to the storage
     hs->pArgs = pArgs;
 
     // Extract optional arguments
     ExtractVersionedArgument(pArgs, FIELD_OFFSET(CASC_OPEN_STORAGE_ARGS, dwLocaleMask), &dwLocaleMask);
+    ExtractVersionedArgument(pArgs, FIELD_OFFSET(CASC_OPEN_STORAGE_ARGS, dwThreadCount), &dwThreadCount);
+    ExtractVersionedArgument(pArgs, FIELD_OFFSET(CASC_OPEN_STORAGE_ARGS, FrameCacheSize), &FrameCacheSize);
 
     // Extract the CDN host URL
     if(ExtractVersionedArgument(pArgs, FIELD_OFFSET(CASC_OPEN_STORAGE_ARGS, szCdnHostUrl), &szCdnHostUrl) && szCdnHostUrl != NULL)
@@ -1181,11 +1887,18 @@ static DWORD LoadCascStorage(TCascStorage * hs, PCASC_OPEN_STORAGE_ARGS pArgs, L
     if(ExtractVersionedArgument(pArgs, FIELD_OFFSET(CASC_OPEN_STORAGE_ARGS, szBuildKey), &szBuildKey) && szBuildKey != NULL)
         hs->szBuildKey = CascNewStrT2A(szBuildKey);
 
+    // Extract the snapshot directory (optional)
+    if(ExtractVersionedArgument(pArgs, FIELD_OFFSET(CASC_OPEN_STORAGE_ARGS, szSnapshotPath), &szSnapshotPath) && szSnapshotPath != NULL)
+        hs->szSnapshotPath = CascNewStr(szSnapshotPath);
+
     // Merge features
     hs->dwFeatures |= (dwFeatures & (CASC_FEATURE_DATA_ARCHIVES | CASC_FEATURE_DATA_FILES | CASC_FEATURE_ONLINE | CASC_FEATURE_ALLOW_DOWNLOAD));
-    hs->dwFeatures |= (pArgs->dwFlags & CASC_FEATURE_FORCE_DOWNLOAD);
+    hs->dwFeatures |= (pArgs->dwFlags & (CASC_FEATURE_FORCE_DOWNLOAD | CASC_FEATURE_SNAPSHOT | CASC_FEATURE_VERIFY_ENCODING | CASC_FEATURE_LAZY_ENCODING | CASC_FEATURE_SHARED_STORAGE | CASC_FEATURE_KEYS_ONLY | CASC_FEATURE_FROZEN_MAPS));
     hs->dwFeatures |= (BuildFileType == CascVersions) ? CASC_FEATURE_ONLINE : 0;
+    hs->dwFeatures &= (BuildFileType == CascBuildConfig) ? ~CASC_FEATURE_LAZY_ENCODING : 0xFFFFFFFF;
     hs->BuildFileType = BuildFileType;
+    hs->dwOpenFlags = pArgs->dwFlags;
+    hs->dwLocaleMask = dwLocaleMask;
 
     // Copy the name of the build file
     hs->szMainFile = CascNewStr(szMainFile);
@@ -1211,6 +1924,20 @@ static DWORD LoadCascStorage(TCascStorage * hs, PCASC_OPEN_STORAGE_ARGS pArgs, L
         dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
     }
 
+    // Start the worker threads, if the caller wants them
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        dwErrCode = hs->WorkerPool.Create(dwThreadCount);
+    }
+
+    // Create the decoded frame cache, if the caller wants it
+    if(dwErrCode == ERROR_SUCCESS && FrameCacheSize != 0)
+    {
+        if(FrameCacheSize > (size_t)(-1))
+            FrameCacheSize = (size_t)(-1);
+        dwErrCode = hs->FrameCache.Create((size_t)FrameCacheSize);
+    }
+
     // Initialize variables for local CASC storages
     if(dwErrCode == ERROR_SUCCESS)
     {
@@ -1240,6 +1967,19 @@ static DWORD LoadCascStorage(TCascStorage * hs, PCASC_OPEN_STORAGE_ARGS pArgs, L
         dwErrCode = LoadMainFile(hs);
     }
 
+    // If the same build is already loaded and shared, we use it instead of loading it again
+    if(dwErrCode == ERROR_SUCCESS && (hs->dwFeatures & CASC_FEATURE_SHARED_STORAGE))
+    {
+        TCascStorage * hsShared;
+
+        if((hsShared = FindSharedStorage(hs)) != NULL)
+        {
+            hs->Release();
+            hs = hsShared;
+            return ERROR_SUCCESS;
+        }
+    }
+
     // Proceed with loading the CDN config file
     if(dwErrCode == ERROR_SUCCESS && hs->CdnConfigKey.Valid())
     {
@@ -1276,23 +2016,74 @@ static DWORD LoadCascStorage(TCascStorage * hs, PCASC_OPEN_STORAGE_ARGS pArgs, L
     // Static storages have no ENCODING manifest, so insert BUILD entries directly
     if(BuildFileType != CascBuildConfig)
     {
-        // Pre-load the local index files
+        CASC_WORK_GROUP IndexGroup;
+        CASC_WORK_GROUP PreloadGroup;
+        DWORD dwIndexErrCode;
+
+        // Pre-load the index files. The local index files are needed for ENCODING,
+        // but the archive indexes of online storages are not (the ENCODING manifest
+        // is never stored in an archive), so we let a worker thread download them
         if(dwErrCode == ERROR_SUCCESS)
         {
-            dwErrCode = LoadIndexFiles(hs);
+            if(BuildFileType != CascVersions || hs->WorkerPool.Submit(IndexGroup, LoadIndexFilesWorker, hs) != ERROR_SUCCESS)
+                dwErrCode = LoadIndexFiles(hs);
+        }
+
+        // If there is a snapshot of this build, it replaces both ENCODING and DOWNLOAD
+        if(dwErrCode == ERROR_SUCCESS && LoadStorageSnapshot(hs) == ERROR_SUCCESS)
+        {
+            bSnapshotLoaded = true;
         }
 
         // Load the ENCODING manifest
-        if(dwErrCode == ERROR_SUCCESS)
+        if(dwErrCode == ERROR_SUCCESS && bSnapshotLoaded == false)
         {
             dwErrCode = LoadEncodingManifest(hs);
         }
 
-        // Load the DOWNLOAD manifest. We're tolerant if the manifest is not present in the storage
+        // Join the index loading and link the archive indexes. We must always wait
+        // for the worker, even if something has failed, because it uses the storage
+        dwIndexErrCode = hs->WorkerPool.Wait(IndexGroup);
+        dwErrCode = (dwErrCode == ERROR_SUCCESS) ? dwIndexErrCode : dwErrCode;
         if(dwErrCode == ERROR_SUCCESS)
         {
-            dwErrCode = LoadDownloadManifest(hs);
+            dwErrCode = LinkIndexFiles(hs);
+        }
+
+        // The DOWNLOAD and ROOT manifests only need the CKey table, so they can be read in parallel.
+        // Parsing them stays on this thread, as both insert into the CKey table
+        if(dwErrCode == ERROR_SUCCESS && hs->WorkerPool.IsParallel())
+        {
+            PCASC_CKEY_ENTRY pRootEntry = (hs->VfsRoot.ContentSize != CASC_INVALID_SIZE) ? &hs->VfsRoot : &hs->RootFile;
+
+            if(bSnapshotLoaded == false && (hs->dwFeatures & CASC_FEATURE_LAZY_ENCODING) == 0)
+            {
+                DownloadPreload.hs = hs;
+                DownloadPreload.pCKeyEntry = FindCKeyEntry_CKey(hs, hs->DownloadCKey.CKey);
+                if(hs->WorkerPool.Submit(PreloadGroup, PreloadManifestFile, &DownloadPreload) != ERROR_SUCCESS)
+                    PreloadManifestFile(&DownloadPreload);
+            }
+
+            if((hs->dwFeatures & CASC_FEATURE_KEYS_ONLY) == 0)
+            {
+                RootPreload.hs = hs;
+                RootPreload.pCKeyEntry = FindCKeyEntry_CKey(hs, pRootEntry->CKey);
+                if(hs->WorkerPool.Submit(PreloadGroup, PreloadManifestFile, &RootPreload) != ERROR_SUCCESS)
+                    PreloadManifestFile(&RootPreload);
+            }
+            hs->WorkerPool.Wait(PreloadGroup);
+        }
+
+        // Load the DOWNLOAD manifest. We're tolerant if the manifest is not present in the storage.
+        // With lazy ENCODING, we skip it, because it would create CKey entries for all files
+        if(dwErrCode == ERROR_SUCCESS && bSnapshotLoaded == false && (hs->dwFeatures & CASC_FEATURE_LAZY_ENCODING) == 0)
+        {
+            dwErrCode = LoadDownloadManifest(hs, DownloadPreload);
             dwErrCode = (dwErrCode == ERROR_FILE_NOT_FOUND) ? ERROR_SUCCESS : dwErrCode;
+
+            // Save the snapshot for the next open. Failure to save it is not an error.
+            if(dwErrCode == ERROR_SUCCESS)
+                SaveStorageSnapshot(hs);
         }
     }
     else
@@ -1303,8 +2094,18 @@ static DWORD LoadCascStorage(TCascStorage * hs, PCASC_OPEN_STORAGE_ARGS pArgs, L
         }
     }
 
+    // Keys-only mode: The files are only open by CKey or EKey, so we need
+    // neither ROOT nor INSTALL. The generic root handler has no file names
+    if(dwErrCode == ERROR_SUCCESS && (hs->dwFeatures & CASC_FEATURE_KEYS_ONLY))
+    {
+        if((hs->pRootHandler = new TRootHandler()) == NULL)
+        {
+            dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+        }
+    }
+
     // Load the build manifest ("ROOT" file)
-    if(dwErrCode == ERROR_SUCCESS)
+    if(dwErrCode == ERROR_SUCCESS && hs->pRootHandler == NULL)
     {
         // For WoW storages, multiple files are present in the storage (same name, same file data ID, different locale).
         // Failing to select storage on them will lead to the first-in-order file in the list being loaded.
@@ -1313,7 +2114,7 @@ static DWORD LoadCascStorage(TCascStorage * hs, PCASC_OPEN_STORAGE_ARGS pArgs, L
         dwLocaleMask = (dwLocaleMask != 0) ? dwLocaleMask : hs->dwDefaultLocale;
 
         // Continue loading the manifest
-        dwErrCode = LoadBuildManifest(hs, dwLocaleMask);
+        dwErrCode = LoadBuildManifest(hs, dwLocaleMask, RootPreload);
 
         // If we fail to load the ROOT file, we take the file names from the INSTALL manifest
         // Beware on low memory condition - in that case, we cannot guarantee a consistent state of the root file
@@ -1321,12 +2122,12 @@ static DWORD LoadCascStorage(TCascStorage * hs, PCASC_OPEN_STORAGE_ARGS pArgs, L
         {
             dwErrCode = LoadInstallManifest(hs);
         }
-
-        // All entries in a static storage describe local data files
-        if(dwErrCode == ERROR_SUCCESS && BuildFileType == CascBuildConfig)
-            hs->LocalFiles = hs->CKeyArray.ItemCount();
     }
 
+    // All entries in a static storage describe local data files
+    if(dwErrCode == ERROR_SUCCESS && BuildFileType == CascBuildConfig)
+        hs->LocalFiles = hs->CKeyArray.ItemCount();
+
     // Insert entries for files with well-known names. Their CKeys are in the BUILD file
     // See https://wowdev.wiki/TACT#Encoding_table for their list
     if(dwErrCode == ERROR_SUCCESS)
@@ -1345,12 +2146,33 @@ static DWORD LoadCascStorage(TCascStorage * hs, PCASC_OPEN_STORAGE_ARGS pArgs, L
     // Load the encryption keys
     if(dwErrCode == ERROR_SUCCESS)
     {
-        dwErrCode = CascLoadEncryptionKeys(hs);
+        dwErrCode = CascLoadEncryptionKeys(hs->KeyMap);
     }
 
-    // Cleanup and exit
-    FreeIndexFiles(hs);
+    // Convert the lookup maps to their read-only form. Failure to do so is not an error
+    if(dwErrCode == ERROR_SUCCESS && (hs->dwFeatures & CASC_FEATURE_FROZEN_MAPS))
+    {
+        FreezeKeyMaps(hs);
+        hs->pRootHandler->FreezeMaps();
+    }
+
+    // The maps and arrays keep their replaced buffers for the threads that search them.
+    // Nobody else can use the storage yet, so we can free them here
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        hs->CKeyMap.FreeOldTables();
+        hs->EKeyMap.FreeOldTables();
+        hs->pRootHandler->FreeOldBuffers();
+    }
+
+    // Cleanup and exit. With lazy ENCODING, the index files are needed for the CKey entries created later
+    if((hs->dwFeatures & CASC_FEATURE_LAZY_ENCODING) == 0)
+        FreeIndexFiles(hs);
     hs->pArgs = NULL;
+
+    // Make the storage available to other opens of the same build
+    if(dwErrCode == ERROR_SUCCESS && (hs->dwFeatures & CASC_FEATURE_SHARED_STORAGE))
+        RegisterSharedStorage(hs);
     return dwErrCode;
 }
 
@@ -1453,11 +2275,15 @@ static DWORD ParseOpenParams(LPTSTR szParams, PCASC_OPEN_STORAGE_ARGS pArgs)
 
 bool WINAPI CascOpenStorageEx(LPCTSTR szParams, PCASC_OPEN_STORAGE_ARGS pArgs, bool bOnlineStorage, HANDLE * phStorage)
 {
-    CASC_OPEN_STORAGE_ARGS LocalArgs = {sizeof(CASC_OPEN_STORAGE_ARGS)};
+    CASC_OPEN_STORAGE_ARGS LocalArgs;
+    TCascStorageHandle * hsh = NULL;
     TCascStorage * hs = NULL;
     LPTSTR szParamsCopy = NULL;
     DWORD dwErrCode = ERROR_SUCCESS;
 
+    memset(&LocalArgs, 0, sizeof(CASC_OPEN_STORAGE_ARGS));
+    LocalArgs.Size = sizeof(CASC_OPEN_STORAGE_ARGS);
+
     // Supply the local args if not given by the caller
     pArgs = (pArgs != NULL) ? pArgs : &LocalArgs;
 
@@ -1524,14 +2350,28 @@ bool WINAPI CascOpenStorageEx(LPCTSTR szParams, PCASC_OPEN_STORAGE_ARGS pArgs, b
         }
     }
 
-    // Delete the storage on error
-    if(dwErrCode != ERROR_SUCCESS)
+    // Create the handle for the caller. Each handle has its own encryption keys
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        if((hsh = new TCascStorageHandle(hs)) != NULL)
+        {
+            if((dwErrCode = CascLoadEncryptionKeys(hsh->KeyMap)) != ERROR_SUCCESS)
+                hsh = hsh->Release();
+        }
+        else
+        {
+            dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+        }
+    }
+
+    // Release our reference to the storage. On success, the handle holds its own one
+    if(hs != NULL)
         hs = hs->Release();
     CASC_FREE(szParamsCopy);
 
     // Give the output parameter to the caller
     if(phStorage != NULL)
-        phStorage[0] = (HANDLE)hs;
+        phStorage[0] = (HANDLE)hsh;
     if(dwErrCode != ERROR_SUCCESS)
         SetCascError(dwErrCode);
     return (dwErrCode == ERROR_SUCCESS);
@@ -1549,7 +2389,10 @@ bool WINAPI CascOpenStorageEx(LPCTSTR szParams, PCASC_OPEN_STORAGE_ARGS pArgs, b
 //
 bool WINAPI CascOpenStorage(LPCTSTR szParams, DWORD dwLocaleMask, HANDLE * phStorage)
 {
-    CASC_OPEN_STORAGE_ARGS OpenArgs = {sizeof(CASC_OPEN_STORAGE_ARGS)};
+    CASC_OPEN_STORAGE_ARGS OpenArgs;
+
+    memset(&OpenArgs, 0, sizeof(CASC_OPEN_STORAGE_ARGS));
+    OpenArgs.Size = sizeof(CASC_OPEN_STORAGE_ARGS);
 
     OpenArgs.dwLocaleMask = dwLocaleMask;
     return CascOpenStorageEx(szParams, &OpenArgs, false, phStorage);
@@ -1570,7 +2413,10 @@ bool WINAPI CascOpenStorage(LPCTSTR szParams, DWORD dwLocaleMask, HANDLE * phSto
 //
 bool WINAPI CascOpenOnlineStorage(LPCTSTR szParams, DWORD dwLocaleMask, HANDLE * phStorage)
 {
-    CASC_OPEN_STORAGE_ARGS OpenArgs = {sizeof(CASC_OPEN_STORAGE_ARGS)};
+    CASC_OPEN_STORAGE_ARGS OpenArgs;
+
+    memset(&OpenArgs, 0, sizeof(CASC_OPEN_STORAGE_ARGS));
+    OpenArgs.Size = sizeof(CASC_OPEN_STORAGE_ARGS);
 
     OpenArgs.dwLocaleMask = dwLocaleMask;
     return CascOpenStorageEx(szParams, &OpenArgs, true, phStorage);
@@ -1625,6 +2471,9 @@ bool WINAPI CascGetStorageInfo(
         case CascStoragePathProduct:
             return GetStoragePathProduct(hs, pvStorageInfo, cbStorageInfo, pcbLengthNeeded);
 
+        case CascStorageFrameCacheInfo:
+            return GetStorageFrameCacheInfo(hs, pvStorageInfo, cbStorageInfo, pcbLengthNeeded);
+
         default:
             SetCascError(ERROR_INVALID_PARAMETER);
             return false;
@@ -1640,19 +2489,61 @@ bool WINAPI CascGetStorageInfo(
     return (PtrOutputValue != NULL);
 }
 
-bool WINAPI CascCloseStorage(HANDLE hStorage)
+//
+// Updates an open local storage after the game launcher has downloaded or repaired files
+// of the same build. Only the index files are loaded again, and the location of each file
+// is updated. ENCODING, ROOT and the other manifests are not loaded again, so if a different
+// build has been installed since the storage was open, the function fails with
+// ERROR_CAN_NOT_COMPLETE and the storage must be closed and open again.
+// File handles that are open during the refresh keep reading from the old locations.
+//
+bool WINAPI CascRefreshStorageIndexes(HANDLE hStorage)
 {
     TCascStorage * hs;
+    DWORD dwErrCode;
 
     // Verify the storage handle
     hs = TCascStorage::IsValid(hStorage);
     if(hs == NULL)
+    {
+        SetCascError(ERROR_INVALID_HANDLE);
+        return false;
+    }
+
+    // Only local storages have index files that can change
+    if(hs->BuildFileType != CascBuildInfo && hs->BuildFileType != CascBuildDb)
+    {
+        SetCascError(ERROR_NOT_SUPPORTED);
+        return false;
+    }
+
+    // Check whether the build is still the same
+    if((dwErrCode = CheckInstalledBuild(hs)) == ERROR_SUCCESS)
+    {
+        CascLock(hs->StorageLock);
+        dwErrCode = RefreshLocalIndexes(hs);
+        CascUnlock(hs->StorageLock);
+    }
+
+    if(dwErrCode != ERROR_SUCCESS)
+        SetCascError(dwErrCode);
+    return (dwErrCode == ERROR_SUCCESS);
+}
+
+bool WINAPI CascCloseStorage(HANDLE hStorage)
+{
+    TCascStorageHandle * hsh;
+
+    // Verify the storage handle
+    hsh = TCascStorageHandle::IsValid(hStorage);
+    if(hsh == NULL)
     {
         SetCascError(ERROR_INVALID_PARAMETER);
         return false;
     }
 
-    // Only free the storage if the reference count reaches 0
-    hs->Release();
+    // Files open through the handle keep it alive. The storage itself
+    // is only freed when its reference count reaches 0
+    hsh->Release();
     return true;
 }
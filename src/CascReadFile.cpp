@@ -12,6 +12,23 @@
 #include "CascLib.h"
 #include "CascCommon.h"
 
+//-----------------------------------------------------------------------------
+// Local defines
+
+#define PARALLEL_DECODE_MIN_SIZE    0x00400000      // Minimal content size of a file span for decoding its frames in parallel
+#define PARALLEL_DECODE_MIN_FRAMES  8               // Minimal number of frames in a file span for decoding its frames in parallel
+
+// Parameter for decoding frames of one file span in parallel
+typedef struct _CASC_DECODE_FRAMES
+{
+    TCascFile * hf;
+    PCASC_CKEY_ENTRY pCKeyEntry;
+    PCASC_FILE_SPAN pFileSpan;
+    LPBYTE pbEncoded;                               // The encoded file span
+    LPBYTE pbDecoded;                               // The output buffer for the entire file
+    PDWORD EncodedOffsets;                          // Offsets of the frames in the encoded file span
+} CASC_DECODE_FRAMES, *PCASC_DECODE_FRAMES;
+
 //-----------------------------------------------------------------------------
 // Local functions
 
@@ -434,10 +451,9 @@ static DWORD LoadSpanFramesForZlibFile(PCASC_FILE_SPAN pFileSpan, PCASC_CKEY_ENT
     return ERROR_NOT_ENOUGH_MEMORY;
 }
 
-static DWORD LoadEncodedHeaderAndSpanFrames(PCASC_FILE_SPAN pFileSpan, PCASC_CKEY_ENTRY pCKeyEntry)
+static DWORD LoadEncodedHeaderAndSpanFrames(PCASC_FILE_SPAN pFileSpan, PCASC_CKEY_ENTRY pCKeyEntry, size_t cbEncodedBuffer)
 {
     LPBYTE pbEncodedBuffer;
-    size_t cbEncodedBuffer = MAX_ENCODED_HEADER;
     DWORD dwErrCode = ERROR_SUCCESS;
 
     // Should only be called when the file frames are NOT loaded
@@ -448,20 +464,20 @@ static DWORD LoadEncodedHeaderAndSpanFrames(PCASC_FILE_SPAN pFileSpan, PCASC_CKE
     if(pCKeyEntry->Flags & CASC_CE_ZLIB_DATA)
         return LoadSpanFramesForZlibFile(pFileSpan, pCKeyEntry);
 
+    // At this point, we expect encoded size to be known
+    assert(pCKeyEntry->EncodedSize != CASC_INVALID_SIZE);
+
+    // Do not read more than encoded size
+    cbEncodedBuffer = CASCLIB_MIN(cbEncodedBuffer, pCKeyEntry->EncodedSize);
+
     // Allocate the initial buffer for the encoded headers
-    pbEncodedBuffer = CASC_ALLOC<BYTE>(MAX_ENCODED_HEADER);
+    pbEncodedBuffer = CASC_ALLOC<BYTE>(cbEncodedBuffer);
     if(pbEncodedBuffer != NULL)
     {
         ULONGLONG ReadOffset = pFileSpan->ArchiveOffs;
         size_t cbTotalHeaderSize;
         size_t cbHeaderSize = 0;
 
-        // At this point, we expect encoded size to be known
-        assert(pCKeyEntry->EncodedSize != CASC_INVALID_SIZE);
-
-        // Do not read more than encoded size
-        cbEncodedBuffer = CASCLIB_MIN(cbEncodedBuffer, pCKeyEntry->EncodedSize);
-
         // Load the entire (eventual) header area. This is faster than doing
         // two read operations in a row. Read as much as possible. If the file is cut,
         // the FileStream will pad it with zeros
@@ -516,6 +532,8 @@ static DWORD LoadEncodedHeaderAndSpanFrames(PCASC_FILE_SPAN pFileSpan, PCASC_CKE
 
 static DWORD LoadSpanFrames(TCascFile * hf, PCASC_FILE_SPAN pFileSpan, PCASC_CKEY_ENTRY pCKeyEntry)
 {
+    CASC_ESPEC_INFO ESpecInfo;
+    size_t cbEncodedBuffer = MAX_ENCODED_HEADER;
     DWORD dwErrCode = ERROR_SUCCESS;
 
     // Sanity check
@@ -529,8 +547,15 @@ static DWORD LoadSpanFrames(TCascFile * hf, PCASC_FILE_SPAN pFileSpan, PCASC_CKE
             return dwErrCode;
     }
 
+    // If the ESpec tells the number of frames, we read the entire header area at once
+    if(GetESpecInfo(hf->hs, pCKeyEntry, ESpecInfo) && ESpecInfo.FrameCount != 0)
+    {
+        size_t cbTotalHeaderSize = sizeof(BLTE_ENCODED_HEADER) + ((size_t)ESpecInfo.FrameCount * sizeof(BLTE_FRAME));
+        cbEncodedBuffer = CASCLIB_MAX(cbEncodedBuffer, cbTotalHeaderSize);
+    }
+
     // Make sure we have header area loaded
-    return LoadEncodedHeaderAndSpanFrames(pFileSpan, pCKeyEntry);
+    return LoadEncodedHeaderAndSpanFrames(pFileSpan, pCKeyEntry, cbEncodedBuffer);
 }
 
 // Loads all file spans to memory
@@ -579,6 +604,22 @@ static DWORD LoadFileSpanFrames(TCascFile * hf)
     return dwErrCode;
 }
 
+// Checks the ESpec of all file spans. If the entire file is encrypted by a key
+// that we don't know, there is no point in reading anything
+static DWORD CheckFileEncryptionKeys(TCascFile * hf)
+{
+    PCASC_CKEY_ENTRY pCKeyEntry = hf->pCKeyEntry;
+    CASC_ESPEC_INFO ESpecInfo;
+
+    for(DWORD i = 0; i < hf->SpanCount; i++, pCKeyEntry++)
+    {
+        // Not known, not encrypted or we have the key. A missing key is reported like in CascDecrypt
+        if(!GetESpecInfo(hf->hs, pCKeyEntry, ESpecInfo) || ESpecInfo.KeyName == 0 || hf->FindEncryptionKey(ESpecInfo.KeyName))
+            return ERROR_SUCCESS;
+    }
+    return ERROR_FILE_ENCRYPTED;
+}
+
 static DWORD EnsureFileSpanFramesLoaded(TCascFile * hf)
 {
     DWORD dwErrCode;
@@ -606,7 +647,6 @@ static DWORD DecodeFileFrame(
     LPBYTE pbDecoded,
     DWORD FrameIndex)
 {
-    TCascStorage * hs = hf->hs;
     LPBYTE pbWorkBuffer = NULL;
     DWORD cbDecodedExpected = 0;
     DWORD cbWorkBuffer = 0;
@@ -672,7 +712,7 @@ static DWORD DecodeFileFrame(
                     return ERROR_NOT_ENOUGH_MEMORY;
 
                 // Decrypt the stream to the work buffer
-                dwErrCode = CascDecrypt(hs, pbWorkBuffer, &cbWorkBuffer, pbEncoded + 1, cbEncoded - 1, FrameIndex);
+                dwErrCode = CascDecrypt(hf, pbWorkBuffer, &cbWorkBuffer, pbEncoded + 1, cbEncoded - 1, FrameIndex);
                 if(dwErrCode != ERROR_SUCCESS)
                 {
                     bWorkComplete = true;
@@ -761,7 +801,7 @@ static bool GetFileFullInfo(TCascFile * hf, void * pvFileInfo, size_t cbFileInfo
         pFileInfo->StorageOffset = pCKeyEntry->StorageOffset;
         pFileInfo->SegmentOffset = hf->pFileSpan->ArchiveOffs;
         pFileInfo->FileNameHash = 0;
-        pFileInfo->TagBitMask = pCKeyEntry->TagBitMask;
+        pFileInfo->TagBitMask = GetTagBitMask(hf->hs, pCKeyEntry);
         pFileInfo->ContentSize = hf->ContentSize;
         pFileInfo->EncodedSize = hf->EncodedSize;
         pFileInfo->SegmentIndex = hf->pFileSpan->ArchiveIndex;
@@ -819,6 +859,9 @@ static DWORD ReadFile_Cache(TCascFile * hf, LPBYTE pbBuffer, ULONGLONG StartOffs
     {
         LPBYTE pbStartBlock = hf->pbFileCache + (size_t)(StartOffset - hf->FileCacheStart);
 
+        // Count the cache hit
+        hf->CacheHits++;
+
         // Can we handle the entire request from the cache?
         if(EndOffset <= hf->FileCacheEnd)
         {
@@ -842,6 +885,58 @@ static DWORD ReadFile_Cache(TCascFile * hf, LPBYTE pbBuffer, ULONGLONG StartOffs
     return 0;
 }
 
+static DWORD DecodeFileFrameWorker(void * pvParam, size_t nIndex)
+{
+    PCASC_DECODE_FRAMES pDecode = (PCASC_DECODE_FRAMES)pvParam;
+    PCASC_FILE_FRAME pFileFrame = pDecode->pFileSpan->pFrames + nIndex;
+
+    return DecodeFileFrame(pDecode->hf,
+                           pDecode->pCKeyEntry,
+                           pFileFrame,
+                           pDecode->pbEncoded + pDecode->EncodedOffsets[nIndex],
+                           pDecode->pbDecoded + pFileFrame->StartOffset,
+                           (DWORD)nIndex);
+}
+
+// Only large spans are worth distributing to the worker threads
+static bool IsParallelDecodeWorthy(TCascFile * hf, PCASC_FILE_SPAN pFileSpan)
+{
+    return (hf->bParallelDecode &&
+            hf->hs != NULL &&
+            hf->hs->WorkerPool.IsParallel() &&
+            pFileSpan->FrameCount >= PARALLEL_DECODE_MIN_FRAMES &&
+            (pFileSpan->EndOffset - pFileSpan->StartOffset) >= PARALLEL_DECODE_MIN_SIZE);
+}
+
+// Decodes all frames of the file span on the worker threads. The frames
+// are independent and their position in the output buffer is known
+static DWORD DecodeFileFramesParallel(TCascFile * hf, PCASC_CKEY_ENTRY pCKeyEntry, PCASC_FILE_SPAN pFileSpan, LPBYTE pbEncoded, LPBYTE pbDecoded)
+{
+    CASC_DECODE_FRAMES Decode;
+    DWORD EncodedOffset = 0;
+    DWORD dwErrCode;
+
+    // Calculate the offsets of the frames in the encoded span
+    if((Decode.EncodedOffsets = CASC_ALLOC<DWORD>(pFileSpan->FrameCount)) == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    for(DWORD FrameIndex = 0; FrameIndex < pFileSpan->FrameCount; FrameIndex++)
+    {
+        Decode.EncodedOffsets[FrameIndex] = EncodedOffset;
+        EncodedOffset += pFileSpan->pFrames[FrameIndex].EncodedSize;
+    }
+
+    // Decode the frames
+    Decode.hf = hf;
+    Decode.pCKeyEntry = pCKeyEntry;
+    Decode.pFileSpan = pFileSpan;
+    Decode.pbEncoded = pbEncoded;
+    Decode.pbDecoded = pbDecoded;
+    dwErrCode = hf->hs->WorkerPool.ParallelFor(pFileSpan->FrameCount, DecodeFileFrameWorker, &Decode);
+
+    CASC_FREE(Decode.EncodedOffsets);
+    return dwErrCode;
+}
+
 // No cache at all. The entire file will be read directly to the user buffer
 static DWORD ReadFile_WholeFile(TCascFile * hf, LPBYTE pbBuffer)
 {
@@ -870,16 +965,31 @@ static DWORD ReadFile_WholeFile(TCascFile * hf, LPBYTE pbBuffer)
         {
             PCASC_FILE_FRAME pFileFrame = pFileSpan->pFrames;
 
-            for(DWORD FrameIndex = 0; FrameIndex < pFileSpan->FrameCount; FrameIndex++, pFileFrame++)
+            // Large spans are decoded on the worker threads. On error, we stop at the beginning of the span
+            if(IsParallelDecodeWorthy(hf, pFileSpan))
             {
-                // Decode the file frame
-                dwErrCode = DecodeFileFrame(hf, pCKeyEntry, pFileFrame, pbEncodedPtr, pbBuffer, FrameIndex);
-                if(dwErrCode != ERROR_SUCCESS)
+                if((dwErrCode = DecodeFileFramesParallel(hf, pCKeyEntry, pFileSpan, pbEncoded, pbSaveBuffer)) != ERROR_SUCCESS)
+                {
+                    CASC_FREE(pbEncoded);
+                    SetCascError(dwErrCode);
                     break;
+                }
 
-                // Move pointers
-                pbEncodedPtr += pFileFrame->EncodedSize;
-                pbBuffer += pFileFrame->ContentSize;
+                pbBuffer += (size_t)(pFileSpan->EndOffset - pFileSpan->StartOffset);
+            }
+            else
+            {
+                for(DWORD FrameIndex = 0; FrameIndex < pFileSpan->FrameCount; FrameIndex++, pFileFrame++)
+                {
+                    // Decode the file frame
+                    dwErrCode = DecodeFileFrame(hf, pCKeyEntry, pFileFrame, pbEncodedPtr, pbBuffer, FrameIndex);
+                    if(dwErrCode != ERROR_SUCCESS)
+                        break;
+
+                    // Move pointers
+                    pbEncodedPtr += pFileFrame->EncodedSize;
+                    pbBuffer += pFileFrame->ContentSize;
+                }
             }
         }
 
@@ -890,13 +1000,99 @@ static DWORD ReadFile_WholeFile(TCascFile * hf, LPBYTE pbBuffer)
     return (DWORD)(pbBuffer - pbSaveBuffer);
 }
 
+// Loads and decodes one frame. If the storage has the shared frame cache, the frame
+// is taken from there, and newly decoded frames are inserted there
+static DWORD LoadFileFrameData(TCascFile * hf, PCASC_CKEY_ENTRY pCKeyEntry, PCASC_FILE_SPAN pFileSpan, PCASC_FILE_FRAME pFileFrame, LPBYTE pbDecoded)
+{
+    TCascStorage * hs = hf->hs;
+    LPBYTE pbEncoded;
+    DWORD FrameIndex = (DWORD)(pFileFrame - pFileSpan->pFrames);
+    DWORD dwErrCode;
+    bool bSharedCache;
+
+    // Frames zeroed due to a missing key must never get to the shared cache.
+    // Files with integrity check don't take the frames that were not checked
+    bSharedCache = (hs != NULL && hs->FrameCache.IsEnabled() && hf->bOvercomeEncrypted == false);
+    if(bSharedCache && hf->bVerifyIntegrity == false)
+    {
+        if(hs->FrameCache.ReadFrame(pCKeyEntry->EKey, FrameIndex, pbDecoded, pFileFrame->ContentSize))
+            return ERROR_SUCCESS;
+    }
+
+    // Allocate the encoded frame
+    if((pbEncoded = CASC_ALLOC<BYTE>(pFileFrame->EncodedSize)) == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    // Load and decode the frame
+    if(FileStream_Read(pFileSpan->pStream, &pFileFrame->DataFileOffset, pbEncoded, pFileFrame->EncodedSize))
+        dwErrCode = DecodeFileFrame(hf, pCKeyEntry, pFileFrame, pbEncoded, pbDecoded, FrameIndex);
+    else
+        dwErrCode = GetCascError();
+
+    // Share the decoded frame with the other file handles. A shared storage has
+    // the encryption keys per storage handle, so decrypted frames are not shared there
+    if(dwErrCode == ERROR_SUCCESS && bSharedCache)
+    {
+        if(pbEncoded[0] != 'E' || (hs->dwFeatures & CASC_FEATURE_SHARED_STORAGE) == 0)
+            hs->FrameCache.InsertFrame(pCKeyEntry->EKey, FrameIndex, pbDecoded, pFileFrame->ContentSize);
+    }
+
+    CASC_FREE(pbEncoded);
+    return dwErrCode;
+}
+
+// Decodes one frame in advance. Runs on a worker thread
+static DWORD ReadaheadWorker(void * pvParam)
+{
+    PCASC_READAHEAD_FRAME pReadahead = (PCASC_READAHEAD_FRAME)pvParam;
+    PCASC_FILE_FRAME pFileFrame = pReadahead->pFileFrame;
+
+    if((pReadahead->pbData = CASC_ALLOC<BYTE>(pFileFrame->ContentSize)) != NULL)
+        pReadahead->dwErrCode = LoadFileFrameData(pReadahead->hf, pReadahead->pCKeyEntry, pReadahead->pFileSpan, pFileFrame, pReadahead->pbData);
+    else
+        pReadahead->dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+    return pReadahead->dwErrCode;
+}
+
+// If the frame has been decoded in advance, copies it to the buffer. On a decoding error,
+// the frame is loaded again by the caller, so the caller gets the proper error code
+static bool ReadaheadTakeFrame(TCascFile * hf, PCASC_FILE_FRAME pFileFrame, LPBYTE pbDecoded)
+{
+    for(size_t i = 0; i < CASC_READAHEAD_FRAMES; i++)
+    {
+        PCASC_READAHEAD_FRAME pReadahead = &hf->Readahead[i];
+
+        if(pReadahead->pFileFrame == pFileFrame)
+        {
+            bool bResult;
+
+            // Wait until the worker thread decodes the frame. Don't run other work items meanwhile
+            hf->hs->WorkerPool.WaitGroupOnly(pReadahead->Group);
+            if((bResult = (pReadahead->dwErrCode == ERROR_SUCCESS)) == true)
+                memcpy(pbDecoded, pReadahead->pbData, pFileFrame->ContentSize);
+
+            hf->FreeReadaheadFrame(pReadahead);
+            return bResult;
+        }
+    }
+    return false;
+}
+
+static DWORD LoadFileFrame(TCascFile * hf, PCASC_CKEY_ENTRY pCKeyEntry, PCASC_FILE_SPAN pFileSpan, PCASC_FILE_FRAME pFileFrame, LPBYTE pbDecoded)
+{
+    // The frame may have been decoded in advance
+    if(ReadaheadTakeFrame(hf, pFileFrame, pbDecoded))
+        return ERROR_SUCCESS;
+
+    return LoadFileFrameData(hf, pCKeyEntry, pFileSpan, pFileFrame, pbDecoded);
+}
+
 static DWORD ReadFile_FrameCached(TCascFile * hf, LPBYTE pbBuffer, ULONGLONG StartOffset, ULONGLONG EndOffset)
 {
     PCASC_CKEY_ENTRY pCKeyEntry = hf->pCKeyEntry;
     PCASC_FILE_SPAN pFileSpan = hf->pFileSpan;
     PCASC_FILE_FRAME pFileFrame = NULL;
     LPBYTE pbSaveBuffer = pbBuffer;
-    LPBYTE pbEncoded = NULL;
     LPBYTE pbDecoded = NULL;
     DWORD dwBytesRead = 0;
     DWORD dwErrCode = ERROR_SUCCESS;
@@ -940,35 +1136,21 @@ static DWORD ReadFile_FrameCached(TCascFile * hf, LPBYTE pbBuffer, ULONGLONG Sta
                         pbDecoded = pbBuffer;
                     }
 
-                    // Allocate the encoded frame
-                    if((pbEncoded = CASC_ALLOC<BYTE>(pFileFrame->EncodedSize)) == NULL)
-                    {
-                        CASC_FREE(pbDecoded);
-                        SetCascError(ERROR_NOT_ENOUGH_MEMORY);
-                        return 0;
-                    }
-
-                    // Load the frame to the encoded buffer
-                    if(FileStream_Read(pFileSpan->pStream, &pFileFrame->DataFileOffset, pbEncoded, pFileFrame->EncodedSize))
+                    // Load and decode the frame
+                    hf->CacheMisses++;
+                    dwErrCode = LoadFileFrame(hf, pCKeyEntry, pFileSpan, pFileFrame, pbDecoded);
+                    if(dwErrCode == ERROR_SUCCESS)
                     {
                         ULONGLONG EndOfCopy = CASCLIB_MIN(pFileFrame->EndOffset, EndOffset);
                         DWORD dwBytesToCopy = (DWORD)(EndOfCopy - StartOffset);
 
-                        // Decode the frame
-                        dwErrCode = DecodeFileFrame(hf, pCKeyEntry, pFileFrame, pbEncoded, pbDecoded, FrameIndex);
-                        if(dwErrCode == ERROR_SUCCESS)
-                        {
-                            // Copy the data
-                            if(pbDecoded != pbBuffer)
-                                memcpy(pbBuffer, pbDecoded + (DWORD)(StartOffset - pFileFrame->StartOffset), dwBytesToCopy);
-                            StartOffset += dwBytesToCopy;
-                            pbBuffer += dwBytesToCopy;
-                        }
+                        // Copy the data
+                        if(pbDecoded != pbBuffer)
+                            memcpy(pbBuffer, pbDecoded + (DWORD)(StartOffset - pFileFrame->StartOffset), dwBytesToCopy);
+                        StartOffset += dwBytesToCopy;
+                        pbBuffer += dwBytesToCopy;
                     }
 
-                    // Free the encoded buffer
-                    CASC_FREE(pbEncoded);
-
                     // If we are at the end of the read area, break all loops
                     if(dwErrCode != ERROR_SUCCESS || StartOffset >= EndOffset)
                         goto __WorkComplete;
@@ -1005,7 +1187,134 @@ static DWORD ReadFile_FrameCached(TCascFile * hf, LPBYTE pbBuffer, ULONGLONG Sta
     return (DWORD)(pbBuffer - pbSaveBuffer);
 }
 
-// No cache at all. The entire file will be read directly to the user buffer
+// Returns the frame that contains the given byte offset. The frames are sorted by offset
+static PCASC_FILE_FRAME FindFileFrame(PCASC_FILE_SPAN pFileSpan, ULONGLONG ByteOffset)
+{
+    PCASC_FILE_FRAME pFrames = pFileSpan->pFrames;
+    DWORD dwLeft = 0;
+    DWORD dwRight = pFileSpan->FrameCount;
+
+    while(dwLeft < dwRight)
+    {
+        DWORD dwMiddle = dwLeft + (dwRight - dwLeft) / 2;
+
+        if(ByteOffset < pFrames[dwMiddle].StartOffset)
+            dwRight = dwMiddle;
+        else if(ByteOffset >= pFrames[dwMiddle].EndOffset)
+            dwLeft = dwMiddle + 1;
+        else
+            return pFrames + dwMiddle;
+    }
+    return NULL;
+}
+
+// No cache at all. Only the frames that overlap the read range are loaded. All of them
+// are read with one read operation per span, and the frames that are entirely in the range
+// are decoded directly to the user buffer. Nothing stays in the file cache
+static DWORD ReadFile_Partial(TCascFile * hf, LPBYTE pbBuffer, ULONGLONG StartOffset, ULONGLONG EndOffset)
+{
+    PCASC_CKEY_ENTRY pCKeyEntry = hf->pCKeyEntry;
+    PCASC_FILE_SPAN pFileSpan = hf->pFileSpan;
+    LPBYTE pbSaveBuffer = pbBuffer;
+    LPBYTE pbDecoded = NULL;
+    DWORD cbDecoded = 0;
+    DWORD dwErrCode = ERROR_SUCCESS;
+
+    for(DWORD SpanIndex = 0; SpanIndex < hf->SpanCount && StartOffset < EndOffset; SpanIndex++, pCKeyEntry++, pFileSpan++)
+    {
+        PCASC_FILE_FRAME pFirstFrame;
+        PCASC_FILE_FRAME pLastFrame;
+        ULONGLONG ByteOffset;
+        LPBYTE pbEncoded;
+        LPBYTE pbEncodedPtr;
+        DWORD cbEncoded;
+
+        // Skip the spans that are before the read range
+        if(StartOffset >= pFileSpan->EndOffset)
+            continue;
+
+        // Find the first and the last frame that overlap the read range
+        pFirstFrame = FindFileFrame(pFileSpan, StartOffset);
+        pLastFrame = FindFileFrame(pFileSpan, CASCLIB_MIN(EndOffset, pFileSpan->EndOffset) - 1);
+        if(pFirstFrame == NULL || pLastFrame == NULL)
+        {
+            dwErrCode = ERROR_FILE_CORRUPT;
+            break;
+        }
+
+        // Load the encoded data of all frames at once. The frames follow each other in the data file
+        ByteOffset = pFirstFrame->DataFileOffset;
+        cbEncoded = (DWORD)(pLastFrame->DataFileOffset + pLastFrame->EncodedSize - ByteOffset);
+        if((pbEncodedPtr = pbEncoded = CASC_ALLOC<BYTE>(cbEncoded)) == NULL)
+        {
+            dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+            break;
+        }
+
+        if(FileStream_Read(pFileSpan->pStream, &ByteOffset, pbEncoded, cbEncoded))
+        {
+            for(PCASC_FILE_FRAME pFileFrame = pFirstFrame; pFileFrame <= pLastFrame; pFileFrame++)
+            {
+                ULONGLONG EndOfCopy = CASCLIB_MIN(pFileFrame->EndOffset, EndOffset);
+                DWORD dwBytesToCopy = (DWORD)(EndOfCopy - StartOffset);
+                DWORD FrameIndex = (DWORD)(pFileFrame - pFileSpan->pFrames);
+
+                // Frames that are entirely in the read range are decoded directly to the user buffer
+                if(pFileFrame->StartOffset == StartOffset && pFileFrame->EndOffset <= EndOffset)
+                {
+                    dwErrCode = DecodeFileFrame(hf, pCKeyEntry, pFileFrame, pbEncodedPtr, pbBuffer, FrameIndex);
+                }
+
+                // Frames partially in the range need a buffer for the decoded data
+                else
+                {
+                    if(pFileFrame->ContentSize > cbDecoded)
+                    {
+                        CASC_FREE(pbDecoded);
+                        if((pbDecoded = CASC_ALLOC<BYTE>(pFileFrame->ContentSize)) == NULL)
+                        {
+                            dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+                            cbDecoded = 0;
+                            break;
+                        }
+                        cbDecoded = pFileFrame->ContentSize;
+                    }
+
+                    dwErrCode = DecodeFileFrame(hf, pCKeyEntry, pFileFrame, pbEncodedPtr, pbDecoded, FrameIndex);
+                    if(dwErrCode == ERROR_SUCCESS)
+                        memcpy(pbBuffer, pbDecoded + (DWORD)(StartOffset - pFileFrame->StartOffset), dwBytesToCopy);
+                }
+
+                // Stop on any error
+                if(dwErrCode != ERROR_SUCCESS)
+                    break;
+
+                // Move pointers
+                pbEncodedPtr += pFileFrame->EncodedSize;
+                StartOffset += dwBytesToCopy;
+                pbBuffer += dwBytesToCopy;
+            }
+        }
+        else
+        {
+            dwErrCode = GetCascError();
+        }
+
+        CASC_FREE(pbEncoded);
+
+        // Stop on any error
+        if(dwErrCode != ERROR_SUCCESS)
+            break;
+    }
+
+    CASC_FREE(pbDecoded);
+
+    // Return the number of bytes read. Always set LastError.
+    SetCascError(dwErrCode);
+    return (dwErrCode == ERROR_SUCCESS) ? (DWORD)(pbBuffer - pbSaveBuffer) : 0;
+}
+
+// No cache at all. The data will be read directly to the user buffer
 static DWORD ReadFile_NonCached(TCascFile * hf, LPBYTE pbBuffer, ULONGLONG StartOffset, ULONGLONG EndOffset)
 {
     // Reading the whole file?
@@ -1014,13 +1323,291 @@ static DWORD ReadFile_NonCached(TCascFile * hf, LPBYTE pbBuffer, ULONGLONG Start
         return ReadFile_WholeFile(hf, pbBuffer);
     }
 
-    // Reading just a part of the file?
+    // Reading just a part of the file
+    return ReadFile_Partial(hf, pbBuffer, StartOffset, EndOffset);
+}
+
+// Moves the cached frame to the front of the LRU list
+static void LinkCachedFrame(TCascFile * hf, PCASC_CACHED_FRAME pCachedFrame)
+{
+    pCachedFrame->pPrev = NULL;
+    pCachedFrame->pNext = hf->pFirstCachedFrame;
+    if(hf->pFirstCachedFrame != NULL)
+        hf->pFirstCachedFrame->pPrev = pCachedFrame;
+    hf->pFirstCachedFrame = pCachedFrame;
+    if(hf->pLastCachedFrame == NULL)
+        hf->pLastCachedFrame = pCachedFrame;
+}
+
+static void UnlinkCachedFrame(TCascFile * hf, PCASC_CACHED_FRAME pCachedFrame)
+{
+    if(pCachedFrame->pPrev != NULL)
+        pCachedFrame->pPrev->pNext = pCachedFrame->pNext;
     else
+        hf->pFirstCachedFrame = pCachedFrame->pNext;
+
+    if(pCachedFrame->pNext != NULL)
+        pCachedFrame->pNext->pPrev = pCachedFrame->pPrev;
+    else
+        hf->pLastCachedFrame = pCachedFrame->pPrev;
+}
+
+// Drops the least recently used frames until the cache fits into the byte budget.
+// The most recently used frame always stays, even if it's larger than the budget
+static void TrimFrameCache(TCascFile * hf, size_t cbFrameCacheMax)
+{
+    PCASC_CACHED_FRAME pCachedFrame;
+
+    while(hf->cbFrameCache > cbFrameCacheMax && (pCachedFrame = hf->pLastCachedFrame) != hf->pFirstCachedFrame)
     {
-        assert(false);
+        UnlinkCachedFrame(hf, pCachedFrame);
+        hf->cbFrameCache -= (size_t)(pCachedFrame->EndOffset - pCachedFrame->StartOffset);
+        hf->dwCachedFrames--;
+        CASC_FREE(pCachedFrame);
     }
+}
 
-    return 0;
+// Finds the frame that contains the given byte offset and makes it the most recently used one
+static PCASC_CACHED_FRAME FindCachedFrame(TCascFile * hf, ULONGLONG ByteOffset)
+{
+    PCASC_CACHED_FRAME pCachedFrame;
+
+    for(pCachedFrame = hf->pFirstCachedFrame; pCachedFrame != NULL; pCachedFrame = pCachedFrame->pNext)
+    {
+        if(pCachedFrame->StartOffset <= ByteOffset && ByteOffset < pCachedFrame->EndOffset)
+        {
+            if(pCachedFrame != hf->pFirstCachedFrame)
+            {
+                UnlinkCachedFrame(hf, pCachedFrame);
+                LinkCachedFrame(hf, pCachedFrame);
+            }
+            return pCachedFrame;
+        }
+    }
+    return NULL;
+}
+
+// Loads and decodes the frame that contains the given byte offset and inserts it to the cache
+static DWORD LoadCachedFrame(TCascFile * hf, ULONGLONG ByteOffset, PCASC_CACHED_FRAME * PtrCachedFrame)
+{
+    PCASC_CACHED_FRAME pCachedFrame;
+    PCASC_CKEY_ENTRY pCKeyEntry = hf->pCKeyEntry;
+    PCASC_FILE_SPAN pFileSpan = hf->pFileSpan;
+    PCASC_FILE_FRAME pFileFrame = NULL;
+    DWORD dwErrCode = ERROR_SUCCESS;
+
+    // Find the file span and the frame
+    for(DWORD SpanIndex = 0; SpanIndex < hf->SpanCount; SpanIndex++, pCKeyEntry++, pFileSpan++)
+    {
+        if(pFileSpan->StartOffset <= ByteOffset && ByteOffset < pFileSpan->EndOffset)
+        {
+            pFileFrame = FindFileFrame(pFileSpan, ByteOffset);
+            break;
+        }
+    }
+    if(pFileFrame == NULL)
+        return ERROR_FILE_CORRUPT;
+
+    // Allocate the cached frame
+    pCachedFrame = (PCASC_CACHED_FRAME)CASC_ALLOC<BYTE>(sizeof(CASC_CACHED_FRAME) + pFileFrame->ContentSize);
+    if(pCachedFrame != NULL)
+    {
+        pCachedFrame->StartOffset = pFileFrame->StartOffset;
+        pCachedFrame->EndOffset = pFileFrame->EndOffset;
+        pCachedFrame->pbData = (LPBYTE)(pCachedFrame + 1);
+
+        // Load and decode the frame
+        dwErrCode = LoadFileFrame(hf, pCKeyEntry, pFileSpan, pFileFrame, pCachedFrame->pbData);
+    }
+    else
+    {
+        dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    // Insert the frame to the cache and drop the old ones
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        LinkCachedFrame(hf, pCachedFrame);
+        hf->cbFrameCache += pFileFrame->ContentSize;
+        hf->dwCachedFrames++;
+        TrimFrameCache(hf, hf->cbFrameCacheMax);
+        PtrCachedFrame[0] = pCachedFrame;
+        pCachedFrame = NULL;
+    }
+
+    CASC_FREE(pCachedFrame);
+    return dwErrCode;
+}
+
+// Multiple decoded frames stay in the cache, so seeking back and forth
+// between a few places of the file does not decode the same frames again
+static DWORD ReadFile_MultiFrameCached(TCascFile * hf, LPBYTE pbBuffer, ULONGLONG StartOffset, ULONGLONG EndOffset)
+{
+    PCASC_CACHED_FRAME pCachedFrame;
+    LPBYTE pbSaveBuffer = pbBuffer;
+    DWORD dwErrCode = ERROR_SUCCESS;
+
+    while(StartOffset < EndOffset)
+    {
+        // Is the frame in the cache?
+        if((pCachedFrame = FindCachedFrame(hf, StartOffset)) != NULL)
+        {
+            hf->CacheHits++;
+        }
+        else
+        {
+            hf->CacheMisses++;
+            if((dwErrCode = LoadCachedFrame(hf, StartOffset, &pCachedFrame)) != ERROR_SUCCESS)
+                break;
+        }
+
+        // Copy the data
+        ULONGLONG EndOfCopy = CASCLIB_MIN(pCachedFrame->EndOffset, EndOffset);
+        DWORD dwBytesToCopy = (DWORD)(EndOfCopy - StartOffset);
+
+        memcpy(pbBuffer, pCachedFrame->pbData + (size_t)(StartOffset - pCachedFrame->StartOffset), dwBytesToCopy);
+        StartOffset += dwBytesToCopy;
+        pbBuffer += dwBytesToCopy;
+    }
+
+    // Return the number of bytes read. Always set LastError.
+    SetCascError(dwErrCode);
+    return (dwErrCode == ERROR_SUCCESS) ? (DWORD)(pbBuffer - pbSaveBuffer) : 0;
+}
+
+// Checks whether the frame is in the file cache. Does not change the order of the cached frames
+static bool IsFrameCached(TCascFile * hf, PCASC_FILE_FRAME pFileFrame)
+{
+    PCASC_CACHED_FRAME pCachedFrame;
+
+    if(hf->pbFileCache != NULL && hf->FileCacheStart <= pFileFrame->StartOffset && pFileFrame->EndOffset <= hf->FileCacheEnd)
+        return true;
+
+    for(pCachedFrame = hf->pFirstCachedFrame; pCachedFrame != NULL; pCachedFrame = pCachedFrame->pNext)
+    {
+        if(pCachedFrame->StartOffset == pFileFrame->StartOffset)
+            return true;
+    }
+    return false;
+}
+
+// Finds the next frame to be decoded in advance. Frames that are in the file cache are skipped
+static PCASC_FILE_FRAME GetNextReadaheadFrame(TCascFile * hf, PCASC_CKEY_ENTRY * PtrCKeyEntry, PCASC_FILE_SPAN * PtrFileSpan)
+{
+    PCASC_CKEY_ENTRY pCKeyEntry;
+    PCASC_FILE_SPAN pFileSpan;
+    PCASC_FILE_FRAME pFileFrame;
+
+    while(hf->ReadaheadOffset < hf->ContentSize)
+    {
+        // Find the span and the frame
+        pCKeyEntry = hf->pCKeyEntry;
+        pFileSpan = hf->pFileSpan;
+        pFileFrame = NULL;
+        for(DWORD SpanIndex = 0; SpanIndex < hf->SpanCount; SpanIndex++, pCKeyEntry++, pFileSpan++)
+        {
+            if(pFileSpan->StartOffset <= hf->ReadaheadOffset && hf->ReadaheadOffset < pFileSpan->EndOffset)
+            {
+                pFileFrame = FindFileFrame(pFileSpan, hf->ReadaheadOffset);
+                break;
+            }
+        }
+        if(pFileFrame == NULL)
+            break;
+        hf->ReadaheadOffset = pFileFrame->EndOffset;
+
+        // The frame that is being read is usually in the file cache already
+        if(IsFrameCached(hf, pFileFrame) == false)
+        {
+            PtrCKeyEntry[0] = pCKeyEntry;
+            PtrFileSpan[0] = pFileSpan;
+            return pFileFrame;
+        }
+    }
+    return NULL;
+}
+
+// Detects sequential reads. When the file is read sequentially, the frames that follow
+// the read position are decoded in advance on the worker threads of the storage
+static void ReadaheadAfterRead(TCascFile * hf, ULONGLONG StartOffset, ULONGLONG EndOffset)
+{
+    PCASC_READAHEAD_FRAME pReadahead;
+
+    // Only files with a file cache, and only if the storage has worker threads
+    if(hf->CacheStrategy == CascCacheNothing || hf->hs == NULL || hf->hs->WorkerPool.IsParallel() == false)
+        return;
+
+    // A read elsewhere drops the frames that were decoded in advance
+    if(StartOffset != hf->SequentialOffset)
+    {
+        if(hf->dwSequentialReads >= CASC_READAHEAD_MIN_READS)
+            hf->FreeReadahead();
+        hf->dwSequentialReads = 0;
+    }
+    hf->SequentialOffset = EndOffset;
+
+    // Only start after a few sequential reads
+    if(++hf->dwSequentialReads < CASC_READAHEAD_MIN_READS)
+        return;
+
+    // Free the frames that have been passed by the reader without being used
+    for(size_t i = 0; i < CASC_READAHEAD_FRAMES; i++)
+    {
+        pReadahead = &hf->Readahead[i];
+        if(pReadahead->pFileFrame != NULL && pReadahead->pFileFrame->EndOffset <= EndOffset)
+            hf->FreeReadaheadFrame(pReadahead);
+    }
+
+    // Fill the free slots with the frames that follow
+    hf->ReadaheadOffset = CASCLIB_MAX(hf->ReadaheadOffset, EndOffset);
+    for(size_t i = 0; i < CASC_READAHEAD_FRAMES; i++)
+    {
+        pReadahead = &hf->Readahead[i];
+        if(pReadahead->pFileFrame == NULL)
+        {
+            if((pReadahead->pFileFrame = GetNextReadaheadFrame(hf, &pReadahead->pCKeyEntry, &pReadahead->pFileSpan)) == NULL)
+                break;
+
+            // Start decoding the frame
+            pReadahead->hf = hf;
+            pReadahead->pbData = NULL;
+            pReadahead->dwErrCode = ERROR_SUCCESS;
+            if(hf->hs->WorkerPool.Submit(pReadahead->Group, ReadaheadWorker, pReadahead) != ERROR_SUCCESS)
+            {
+                pReadahead->pFileFrame = NULL;
+                break;
+            }
+        }
+    }
+}
+
+static bool GetFileCacheInfo(TCascFile * hf, void * pvFileInfo, size_t cbFileInfo, size_t * pcbLengthNeeded)
+{
+    PCASC_FILE_CACHE_INFO pFileInfo;
+
+    // Verify whether we have enough space in the buffer
+    pFileInfo = (PCASC_FILE_CACHE_INFO)ProbeOutputBuffer(pvFileInfo, cbFileInfo, sizeof(CASC_FILE_CACHE_INFO), pcbLengthNeeded);
+    if(pFileInfo != NULL)
+    {
+        pFileInfo->CacheHits = hf->CacheHits;
+        pFileInfo->CacheMisses = hf->CacheMisses;
+        pFileInfo->CacheSizeMax = hf->cbFrameCacheMax;
+        pFileInfo->bMultiFrame = (hf->CacheStrategy == CascCacheMultiFrame);
+
+        // The last frame cache has at most one frame
+        if(hf->CacheStrategy == CascCacheMultiFrame)
+        {
+            pFileInfo->CacheSize = hf->cbFrameCache;
+            pFileInfo->FrameCount = hf->dwCachedFrames;
+        }
+        else
+        {
+            pFileInfo->CacheSize = (hf->pbFileCache != NULL) ? (size_t)(hf->FileCacheEnd - hf->FileCacheStart) : 0;
+            pFileInfo->FrameCount = (hf->pbFileCache != NULL) ? 1 : 0;
+        }
+    }
+
+    return (pFileInfo != NULL);
 }
 
 //-----------------------------------------------------------------------------
@@ -1077,6 +1664,9 @@ bool WINAPI CascGetFileInfo(HANDLE hFile, CASC_FILE_INFO_CLASS InfoClass, void *
         case CascFileSpanInfo:
             return GetFileSpanInfo(hf, pvFileInfo, cbFileInfo, pcbLengthNeeded);
 
+        case CascFileCacheInfo:
+            return GetFileCacheInfo(hf, pvFileInfo, cbFileInfo, pcbLengthNeeded);
+
         default:
             SetCascError(ERROR_INVALID_PARAMETER);
             return false;
@@ -1104,15 +1694,50 @@ bool WINAPI CascSetFileFlags(HANDLE hFile, DWORD dwOpenFlags)
         return false;
     }
 
-    // Currently, only CASC_OVERCOME_ENCRYPTED can be changed
-    if(dwOpenFlags & ~CASC_OVERCOME_ENCRYPTED)
+    // Currently, only CASC_OVERCOME_ENCRYPTED, CASC_CACHE_MULTI_FRAME and CASC_PARALLEL_DECODE can be changed
+    if(dwOpenFlags & ~(CASC_OVERCOME_ENCRYPTED | CASC_CACHE_MULTI_FRAME | CASC_PARALLEL_DECODE))
     {
         SetCascError(ERROR_INVALID_PARAMETER);
         return false;
     }
 
-    // Set "overcome encrypted" flag. Will apply on next CascReadFile
+    // The readahead frames are decoded with the current flags by the worker threads.
+    // Wait for them and drop them before changing anything
+    hf->FreeReadahead();
+
+    // Set "overcome encrypted" and "parallel decode" flags. Will apply on next CascReadFile
     hf->bOvercomeEncrypted = (dwOpenFlags & CASC_OVERCOME_ENCRYPTED) ? true : false;
+    hf->bParallelDecode = (dwOpenFlags & CASC_PARALLEL_DECODE) ? true : false;
+
+    // Switch between the last frame cache and the multi-frame cache. The cached data are dropped.
+    // Files that don't use a cache at all (internal files) are not affected
+    if(hf->CacheStrategy == CascCacheLastFrame || hf->CacheStrategy == CascCacheMultiFrame)
+    {
+        CSTRTG CacheStrategy = (dwOpenFlags & CASC_CACHE_MULTI_FRAME) ? CascCacheMultiFrame : CascCacheLastFrame;
+
+        if(CacheStrategy != hf->CacheStrategy)
+        {
+            hf->FreeFileCache();
+            hf->CacheStrategy = CacheStrategy;
+        }
+    }
+    return true;
+}
+
+bool WINAPI CascSetFileCacheSize(HANDLE hFile, size_t cbCacheSize)
+{
+    TCascFile * hf;
+
+    // Validate the file handle
+    if((hf = TCascFile::IsValid(hFile)) == NULL)
+    {
+        SetCascError(ERROR_INVALID_HANDLE);
+        return false;
+    }
+
+    // Set the byte budget of the multi-frame cache and drop the frames that don't fit
+    hf->cbFrameCacheMax = cbCacheSize;
+    TrimFrameCache(hf, cbCacheSize);
     return true;
 }
 
@@ -1280,6 +1905,7 @@ bool WINAPI CascReadFile(HANDLE hFile, void * pvBuffer, DWORD dwBytesToRead, PDW
     ULONGLONG StartOffset;
     ULONGLONG EndOffset;
     TCascFile * hf;
+    CSTRTG CacheStrategy;
     LPBYTE pbBuffer = (LPBYTE)pvBuffer;
     DWORD dwBytesRead1 = 0;     // From cache
     DWORD dwBytesRead2 = 0;     // From file
@@ -1306,6 +1932,16 @@ bool WINAPI CascReadFile(HANDLE hFile, void * pvBuffer, DWORD dwBytesToRead, PDW
         return true;
     }
 
+    // If the file is encrypted by an unknown key, fail before reading the headers
+    if(hf->pFileSpan->pFrames == NULL && hf->bOvercomeEncrypted == false)
+    {
+        if((dwErrCode = CheckFileEncryptionKeys(hf)) != ERROR_SUCCESS)
+        {
+            SetCascError(dwErrCode);
+            return false;
+        }
+    }
+
     // If we don't have file frames loaded, we need to do it now.
     // Need to do it before file range check, as the file size may be unknown at this point
     dwErrCode = EnsureFileSpanFramesLoaded(hf);
@@ -1343,15 +1979,22 @@ bool WINAPI CascReadFile(HANDLE hFile, void * pvBuffer, DWORD dwBytesToRead, PDW
             if(PtrBytesRead != NULL)
                 PtrBytesRead[0] = dwBytesRead1;
             hf->FilePointer = EndOffset;
+            ReadaheadAfterRead(hf, SaveFilePointer, EndOffset);
             return true;
         }
     }
 
+    // Reading the whole file of a handle with CASC_PARALLEL_DECODE
+    // goes directly to the user buffer, whatever the cache strategy is
+    CacheStrategy = hf->CacheStrategy;
+    if(hf->bParallelDecode && StartOffset == 0 && EndOffset == hf->ContentSize)
+        CacheStrategy = CascCacheNothing;
+
     // Perform the cache-strategy-specific read
-    switch(hf->CacheStrategy)
+    switch(CacheStrategy)
     {
-        // No caching at all. The entire file will be read directly to the user buffer
-        // Used for loading internal files, where we need to read the whole file
+        // No caching at all. The data will be read directly to the user buffer.
+        // Partial reads only load the frames that overlap the read range
         case CascCacheNothing:
             dwBytesRead2 = ReadFile_NonCached(hf, pbBuffer, StartOffset, EndOffset);
             break;
@@ -1362,6 +2005,12 @@ bool WINAPI CascReadFile(HANDLE hFile, void * pvBuffer, DWORD dwBytesToRead, PDW
             dwBytesRead2 = ReadFile_FrameCached(hf, pbBuffer, StartOffset, EndOffset);
             break;
 
+        // Keep as many decoded frames as the byte budget allows. Frames that were
+        // not used for the longest time are dropped first
+        case CascCacheMultiFrame:
+            dwBytesRead2 = ReadFile_MultiFrameCached(hf, pbBuffer, StartOffset, EndOffset);
+            break;
+
         default:
             break;
     }
@@ -1373,6 +2022,7 @@ bool WINAPI CascReadFile(HANDLE hFile, void * pvBuffer, DWORD dwBytesToRead, PDW
         if(PtrBytesRead != NULL)
             PtrBytesRead[0] = (dwBytesRead1 + dwBytesRead2);
         hf->FilePointer = StartOffset + dwBytesRead2;
+        ReadaheadAfterRead(hf, SaveFilePointer, hf->FilePointer);
         return true;
     }
     else
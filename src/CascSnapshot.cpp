@@ -0,0 +1,435 @@
+/*****************************************************************************/
+/* CascSnapshot.cpp                       Copyright (c) Ladislav Zezula 2026 */
+/*---------------------------------------------------------------------------*/
+/* Persistent snapshot of the storage key tables                             */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 17.10.26  1.00  Lad  Created                                              */
+/*****************************************************************************/
+
+#define __CASCLIB_SELF__
+#include "CascLib.h"
+#include "CascCommon.h"
+
+//-----------------------------------------------------------------------------
+// Local defines
+//
+// The snapshot file contains the array of CASC_CKEY_ENTRY, the array
+// of CASC_TAG_ENTRY2 and the tag bitmaps, exactly as they are after ENCODING
+// and DOWNLOAD manifests have been loaded. Neither of them contains pointers,
+// so each table is loaded back with a single read, without any parsing.
+// The file is read to memory rather than mapped, because the storage offsets
+// are refreshed from the local index files after loading. ROOT and the file
+// tree are not in the snapshot; they are still parsed on every open.
+//
+// File layout:
+//
+//  CASC_SNAPSHOT_HEADER
+//  CASC_CKEY_ENTRY[CKeyEntryCount]
+//  (CASC_TAG_ENTRY2 of TagEntrySize bytes)[TagEntryCount]
+//  (BYTE[(CKeyEntryCount + 7) / 8])[TagEntryCount]  // Tag bitmaps, one bit for each CKey entry
+//  BYTE[CKeyMapSize]                               // Frozen CKey map, only with CASC_FEATURE_FROZEN_MAPS
+//  BYTE[EKeyMapSize]                               // Frozen EKey map, only with CASC_FEATURE_FROZEN_MAPS
+//
+// The frozen maps only contain indexes to the CKey array, so they are
+// position-independent too.
+//
+
+#define CASC_SNAPSHOT_SIGNATURE     0x504E5343      // 'CSNP'
+#define CASC_SNAPSHOT_VERSION       0x00000004      // Increment on any change of CASC_CKEY_ENTRY
+
+typedef struct _CASC_SNAPSHOT_HEADER
+{
+    DWORD Signature;                                // CASC_SNAPSHOT_SIGNATURE
+    DWORD Version;                                  // CASC_SNAPSHOT_VERSION
+    BYTE  CdnBuildKey[MD5_HASH_SIZE];               // The build key the snapshot was created from
+    BYTE  CdnConfigKey[MD5_HASH_SIZE];              // The CDN config key the snapshot was created from
+    DWORD CKeyEntrySize;                            // sizeof(CASC_CKEY_ENTRY)
+    DWORD TagEntrySize;                             // Size of one entry in TCascStorage::TagsArray
+    DWORD CKeyEntryCount;                           // Number of items in TCascStorage::CKeyArray
+    DWORD TagEntryCount;                            // Number of items in TCascStorage::TagsArray
+    DWORD EKeyLength;                               // Key length of TCascStorage::EKeyMap
+    DWORD Features;                                 // Storage features set by loading ENCODING and DOWNLOAD
+    DWORD CKeyMapSize;                              // Size of the frozen CKey map, in bytes. Zero if not present
+    DWORD EKeyMapSize;                              // Size of the frozen EKey map, in bytes. Zero if not present
+
+} CASC_SNAPSHOT_HEADER, *PCASC_SNAPSHOT_HEADER;
+
+//-----------------------------------------------------------------------------
+// Local functions
+
+static bool IsSnapshotSupported(TCascStorage * hs)
+{
+    // Only if requested by the caller
+    if((hs->dwFeatures & CASC_FEATURE_SNAPSHOT) == 0)
+        return false;
+
+    // Static storages don't have ENCODING nor DOWNLOAD
+    if(hs->BuildFileType == CascBuildConfig)
+        return false;
+
+    // With lazy ENCODING, there is no complete CKey table to be saved or loaded
+    if(hs->dwFeatures & CASC_FEATURE_LAZY_ENCODING)
+        return false;
+
+    // We need both build key and the CDN config key to identify the build
+    if(hs->CdnBuildKey.cbData != MD5_HASH_SIZE || hs->CdnConfigKey.cbData != MD5_HASH_SIZE)
+        return false;
+    return true;
+}
+
+// The snapshots go to the directory given by the caller. If there is none, we use
+// a per-user cache directory, so that the game directory doesn't need to be writable
+static LPTSTR CreateSnapshotFileName(TCascStorage * hs)
+{
+    CASC_PATH<TCHAR> SnapshotPath;
+    TCHAR szPlainName[0x40];
+    TCHAR szBuildKey[MD5_STRING_SIZE + 1];
+
+    if(hs->szSnapshotPath != NULL && hs->szSnapshotPath[0] != 0)
+    {
+        SnapshotPath.SetPathRoot(hs->szSnapshotPath);
+    }
+    else
+    {
+#ifdef CASCLIB_PLATFORM_WINDOWS
+        LPCTSTR szLocalAppData = _tgetenv(_T("LOCALAPPDATA"));
+
+        if(szLocalAppData == NULL || szLocalAppData[0] == 0)
+            return NULL;
+        SnapshotPath.SetPathRoot(szLocalAppData);
+        SnapshotPath.AppendString(_T("CascLib"), true);
+#else
+        const char * szCacheHome = getenv("XDG_CACHE_HOME");
+        const char * szHome = getenv("HOME");
+
+        // XDG_CACHE_HOME is only valid if it's an absolute path
+        if(szCacheHome != NULL && szCacheHome[0] == '/')
+        {
+            SnapshotPath.SetPathRoot(szCacheHome);
+        }
+        else if(szHome != NULL && szHome[0] != 0)
+        {
+            SnapshotPath.SetPathRoot(szHome);
+            SnapshotPath.AppendString(".cache", true);
+        }
+        else
+        {
+            return NULL;
+        }
+        SnapshotPath.AppendString("casclib", true);
+#endif
+    }
+
+    // The file name is "casc-<build-key>.snapshot"
+    StringFromBinary(hs->CdnBuildKey.pbData, MD5_HASH_SIZE, szBuildKey);
+    CascStrPrintf(szPlainName, _countof(szPlainName), _T("casc-%s.snapshot"), szBuildKey);
+    SnapshotPath.AppendString(szPlainName, true);
+    return SnapshotPath.New();
+}
+
+static DWORD VerifySnapshotHeader(TCascStorage * hs, CASC_SNAPSHOT_HEADER & Header, ULONGLONG FileSize)
+{
+    ULONGLONG ExpectedSize;
+
+    // Verify signature and version
+    if(Header.Signature != CASC_SNAPSHOT_SIGNATURE || Header.Version != CASC_SNAPSHOT_VERSION)
+        return ERROR_BAD_FORMAT;
+
+    // The snapshot must have been created from the same build
+    if(memcmp(Header.CdnBuildKey, hs->CdnBuildKey.pbData, MD5_HASH_SIZE) || memcmp(Header.CdnConfigKey, hs->CdnConfigKey.pbData, MD5_HASH_SIZE))
+        return ERROR_BAD_FORMAT;
+
+    // The in-memory structures must match the ones in the file
+    if(Header.CKeyEntrySize != sizeof(CASC_CKEY_ENTRY) || Header.EKeyLength != hs->EKeyMap.KeyLength())
+        return ERROR_BAD_FORMAT;
+    if(Header.TagEntryCount != 0 && Header.TagEntrySize < sizeof(CASC_TAG_ENTRY2))
+        return ERROR_BAD_FORMAT;
+
+    // The snapshot must fit into the preallocated CKey array
+    if(Header.CKeyEntryCount == 0 || Header.CKeyEntryCount > hs->CKeyArray.ItemCountMax())
+        return ERROR_BAD_FORMAT;
+
+    // Check the file size. This catches incomplete snapshots
+    ExpectedSize = sizeof(CASC_SNAPSHOT_HEADER) +
+                   (ULONGLONG)Header.CKeyEntryCount * Header.CKeyEntrySize +
+                   (ULONGLONG)Header.TagEntryCount * Header.TagEntrySize +
+                   (ULONGLONG)Header.TagEntryCount * ((Header.CKeyEntryCount + 7) / 8);
+    ExpectedSize += (ULONGLONG)Header.CKeyMapSize + Header.EKeyMapSize;
+    return (FileSize == ExpectedSize) ? ERROR_SUCCESS : ERROR_FILE_CORRUPT;
+}
+
+static DWORD ReadFrozenKeyMap(TFileStream * pStream, CASC_BLOB & MapImage, DWORD cbMapImage, bool bUseImage)
+{
+    // Skip the image if not needed
+    if(cbMapImage == 0 || bUseImage == false)
+        return ERROR_SUCCESS;
+
+    if(MapImage.SetSize(cbMapImage) != ERROR_SUCCESS)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    if(!FileStream_Read(pStream, NULL, MapImage.pbData, cbMapImage))
+        return ERROR_FILE_CORRUPT;
+    return ERROR_SUCCESS;
+}
+
+template <size_t KEY_LENGTH>
+static bool LoadFrozenKeyMap(TCascStorage * hs, CASC_CONCURRENT_MAP<KEY_LENGTH> & KeyMap, CASC_BLOB & MapImage, size_t nKeyCount)
+{
+    PCASC_FROZEN_HEADER pHeader = (PCASC_FROZEN_HEADER)MapImage.pbData;
+
+    // The frozen map must contain exactly the keys of the CKey array
+    if(MapImage.cbData < sizeof(CASC_FROZEN_HEADER) || pHeader->ItemCount != nKeyCount)
+        return false;
+    return (KeyMap.LoadFrozen(MapImage.pbData, MapImage.cbData, hs->CKeyArray.ItemArray(), hs->CKeyArray.ItemCount(), sizeof(CASC_CKEY_ENTRY)) == ERROR_SUCCESS);
+}
+
+static DWORD LinkSnapshotEntries(TCascStorage * hs, CASC_BLOB & CKeyMapImage, CASC_BLOB & EKeyMapImage)
+{
+    PCASC_CKEY_ENTRY pCKeyEntry;
+    size_t nItemCount = hs->CKeyArray.ItemCount();
+    size_t nCKeyCount = 0;
+    size_t nEKeyCount = 0;
+    bool bCKeyMapLoaded;
+    bool bEKeyMapLoaded;
+
+    for(size_t i = 0; i < nItemCount; i++)
+    {
+        pCKeyEntry = (PCASC_CKEY_ENTRY)hs->CKeyArray.ItemAt(i);
+
+        // The local index files may have changed since the snapshot was created
+        // (e.g. files downloaded by the Battle.net agent). Refresh the storage offsets.
+        if(!(hs->dwFeatures & CASC_FEATURE_ONLINE))
+        {
+            pCKeyEntry->Flags &= ~CASC_CE_FILE_IS_LOCAL;
+            pCKeyEntry->StorageOffset = CASC_INVALID_OFFS64;
+            CopyEKeyEntry(hs, pCKeyEntry);
+        }
+
+        // Count the keys for the frozen maps
+        nCKeyCount += (pCKeyEntry->Flags & CASC_CE_HAS_CKEY) ? 1 : 0;
+        nEKeyCount += (pCKeyEntry->Flags & CASC_CE_HAS_EKEY) ? 1 : 0;
+    }
+
+    // Use the frozen maps, if the snapshot has them
+    bCKeyMapLoaded = LoadFrozenKeyMap(hs, hs->CKeyMap, CKeyMapImage, nCKeyCount);
+    bEKeyMapLoaded = LoadFrozenKeyMap(hs, hs->EKeyMap, EKeyMapImage, nEKeyCount);
+
+    // Insert the entries to the maps that were not loaded
+    if(bCKeyMapLoaded == false || bEKeyMapLoaded == false)
+    {
+        for(size_t i = 0; i < nItemCount; i++)
+        {
+            pCKeyEntry = (PCASC_CKEY_ENTRY)hs->CKeyArray.ItemAt(i);
+
+            if(bCKeyMapLoaded == false && (pCKeyEntry->Flags & CASC_CE_HAS_CKEY))
+                hs->CKeyMap.InsertObject(pCKeyEntry, pCKeyEntry->CKey);
+            if(bEKeyMapLoaded == false && (pCKeyEntry->Flags & CASC_CE_HAS_EKEY))
+                hs->EKeyMap.InsertObject(pCKeyEntry, pCKeyEntry->EKey);
+        }
+    }
+
+    // Also refresh the information about the ENCODING file itself
+    CopyEKeyEntry(hs, &hs->EncodingCKey);
+    hs->TotalFiles = nItemCount;
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+// Public functions
+
+DWORD LoadStorageSnapshot(TCascStorage * hs)
+{
+    CASC_SNAPSHOT_HEADER Header;
+    TFileStream * pStream;
+    CASC_BLOB CKeyMapImage;
+    CASC_BLOB EKeyMapImage;
+    ULONGLONG FileSize = 0;
+    LPTSTR szFileName;
+    LPBYTE pbItems;
+    DWORD dwErrCode = ERROR_FILE_NOT_FOUND;
+    bool bFrozenMaps = (hs->dwFeatures & CASC_FEATURE_FROZEN_MAPS) ? true : false;
+
+    // Sanity checks
+    assert(hs->CKeyArray.ItemCount() == 0);
+    assert(hs->TagsArray.IsInitialized() == false);
+
+    // Check whether we shall use the snapshot. If the caller wants the ENCODING manifest
+    // to be verified, we need to load it (the snapshot will be refreshed from it)
+    if(!IsSnapshotSupported(hs) || (hs->dwFeatures & CASC_FEATURE_VERIFY_ENCODING))
+        return ERROR_NOT_SUPPORTED;
+    if((szFileName = CreateSnapshotFileName(hs)) == NULL)
+        return ERROR_PATH_NOT_FOUND;
+
+    // Open the snapshot. The CKey entries are refreshed after loading, so the file is read to memory
+    pStream = FileStream_OpenFile(szFileName, BASE_PROVIDER_FILE | STREAM_PROVIDER_FLAT | STREAM_FLAG_READ_ONLY);
+    if(pStream != NULL)
+    {
+        // Load and verify the header
+        FileStream_GetSize(pStream, &FileSize);
+        dwErrCode = ERROR_BAD_FORMAT;
+        if(FileStream_Read(pStream, NULL, &Header, sizeof(CASC_SNAPSHOT_HEADER)))
+            dwErrCode = VerifySnapshotHeader(hs, Header, FileSize);
+
+        // Load the array of CKey entries
+        if(dwErrCode == ERROR_SUCCESS)
+        {
+            dwErrCode = ERROR_FILE_CORRUPT;
+            if((pbItems = (LPBYTE)hs->CKeyArray.Insert(Header.CKeyEntryCount, false)) != NULL)
+            {
+                if(FileStream_Read(pStream, NULL, pbItems, Header.CKeyEntryCount * Header.CKeyEntrySize))
+                {
+                    dwErrCode = ERROR_SUCCESS;
+                }
+            }
+        }
+
+        // Load the array of tags
+        if(dwErrCode == ERROR_SUCCESS && Header.TagEntryCount != 0)
+        {
+            dwErrCode = hs->TagsArray.Create(Header.TagEntrySize, Header.TagEntryCount);
+            if(dwErrCode == ERROR_SUCCESS)
+            {
+                pbItems = (LPBYTE)hs->TagsArray.Insert(Header.TagEntryCount);
+                if(!FileStream_Read(pStream, NULL, pbItems, Header.TagEntryCount * Header.TagEntrySize))
+                {
+                    dwErrCode = ERROR_FILE_CORRUPT;
+                }
+            }
+
+            // Load the tag bitmaps
+            if(dwErrCode == ERROR_SUCCESS)
+                dwErrCode = CreateTagBitmaps(hs, Header.TagEntryCount, Header.CKeyEntryCount);
+            if(dwErrCode == ERROR_SUCCESS)
+            {
+                if(!FileStream_Read(pStream, NULL, hs->TagBitmaps.ItemArray(), Header.TagEntryCount * hs->TagBitmaps.ItemSize()))
+                {
+                    dwErrCode = ERROR_FILE_CORRUPT;
+                }
+            }
+        }
+
+        // Load the frozen key maps. They are only used if the caller wants frozen maps
+        if(dwErrCode == ERROR_SUCCESS)
+            dwErrCode = ReadFrozenKeyMap(pStream, CKeyMapImage, Header.CKeyMapSize, bFrozenMaps);
+        if(dwErrCode == ERROR_SUCCESS)
+            dwErrCode = ReadFrozenKeyMap(pStream, EKeyMapImage, Header.EKeyMapSize, bFrozenMaps);
+
+        // Insert all CKey entries into the maps
+        if(dwErrCode == ERROR_SUCCESS)
+        {
+            hs->dwFeatures |= (Header.Features & CASC_FEATURE_TAGS);
+            dwErrCode = LinkSnapshotEntries(hs, CKeyMapImage, EKeyMapImage);
+        }
+
+        // On error, revert the arrays so the caller can load the manifests normally
+        if(dwErrCode != ERROR_SUCCESS)
+        {
+            hs->CKeyArray.Reset();
+            hs->TagsArray.Free();
+            hs->TagBitmaps.Free();
+        }
+
+        FileStream_Close(pStream);
+    }
+
+    CASC_FREE(szFileName);
+    return dwErrCode;
+}
+
+DWORD SaveStorageSnapshot(TCascStorage * hs)
+{
+    CASC_SNAPSHOT_HEADER Header;
+    TFileStream * pStream;
+    LPTSTR szFileName;
+    LPTSTR szTempName;
+    LPBYTE pbCKeyMapImage = NULL;
+    LPBYTE pbEKeyMapImage = NULL;
+    size_t cbCKeyMapImage = 0;
+    size_t cbEKeyMapImage = 0;
+    DWORD dwErrCode = ERROR_CAN_NOT_COMPLETE;
+
+    // Check whether we shall use the snapshot
+    if(!IsSnapshotSupported(hs) || hs->CKeyArray.ItemCount() == 0)
+        return ERROR_NOT_SUPPORTED;
+    if((szFileName = CreateSnapshotFileName(hs)) == NULL)
+        return ERROR_PATH_NOT_FOUND;
+    if((szTempName = CreateTempFileName(szFileName)) == NULL)
+    {
+        CASC_FREE(szFileName);
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    // Prepare the header
+    memset(&Header, 0, sizeof(CASC_SNAPSHOT_HEADER));
+    Header.Signature = CASC_SNAPSHOT_SIGNATURE;
+    Header.Version = CASC_SNAPSHOT_VERSION;
+    memcpy(Header.CdnBuildKey, hs->CdnBuildKey.pbData, MD5_HASH_SIZE);
+    memcpy(Header.CdnConfigKey, hs->CdnConfigKey.pbData, MD5_HASH_SIZE);
+    Header.CKeyEntrySize = sizeof(CASC_CKEY_ENTRY);
+    Header.CKeyEntryCount = (DWORD)hs->CKeyArray.ItemCount();
+    Header.TagEntrySize = (DWORD)hs->TagsArray.ItemSize();
+    Header.TagEntryCount = (hs->TagBitmaps.ItemSize() * 8 >= Header.CKeyEntryCount) ? (DWORD)hs->TagBitmaps.ItemCount() : 0;
+    Header.EKeyLength = (DWORD)hs->EKeyMap.KeyLength();
+    Header.Features = (hs->dwFeatures & CASC_FEATURE_TAGS);
+
+    // If the caller wants frozen maps, we freeze them now and save them too.
+    // The next open of the same build will not need to build them again
+    if((hs->dwFeatures & CASC_FEATURE_FROZEN_MAPS) && FreezeKeyMaps(hs) == ERROR_SUCCESS)
+    {
+        // Only save the maps that contain all keys
+        if(hs->CKeyMap.FrozenCount() == hs->CKeyMap.ItemCount() && hs->EKeyMap.FrozenCount() == hs->EKeyMap.ItemCount())
+        {
+            pbCKeyMapImage = hs->CKeyMap.FrozenImage(cbCKeyMapImage);
+            pbEKeyMapImage = hs->EKeyMap.FrozenImage(cbEKeyMapImage);
+            Header.CKeyMapSize = (DWORD)cbCKeyMapImage;
+            Header.EKeyMapSize = (DWORD)cbEKeyMapImage;
+        }
+    }
+
+    // Write the snapshot under a temporary name. Other opens of the same build
+    // only see the snapshot after it has been completely written
+    if(ForcePathExist(szTempName, true) == ERROR_SUCCESS && (pStream = FileStream_CreateFile(szTempName, BASE_PROVIDER_FILE | STREAM_PROVIDER_FLAT)) != NULL)
+    {
+        if(FileStream_Write(pStream, NULL, &Header, sizeof(CASC_SNAPSHOT_HEADER)) &&
+           FileStream_Write(pStream, NULL, hs->CKeyArray.ItemArray(), Header.CKeyEntryCount * Header.CKeyEntrySize))
+        {
+            dwErrCode = ERROR_SUCCESS;
+        }
+
+        // Write the tags, if any
+        if(dwErrCode == ERROR_SUCCESS && Header.TagEntryCount != 0)
+        {
+            if(!FileStream_Write(pStream, NULL, hs->TagsArray.ItemArray(), Header.TagEntryCount * Header.TagEntrySize))
+                dwErrCode = ERROR_DISK_FULL;
+
+            // The bitmaps may be longer than needed. Only save the bits of existing entries
+            for(DWORD i = 0; dwErrCode == ERROR_SUCCESS && i < Header.TagEntryCount; i++)
+            {
+                if(!FileStream_Write(pStream, NULL, hs->TagBitmaps.ItemAt(i), (Header.CKeyEntryCount + 7) / 8))
+                    dwErrCode = ERROR_DISK_FULL;
+            }
+        }
+
+        // Write the frozen maps, if any
+        if(dwErrCode == ERROR_SUCCESS && Header.CKeyMapSize != 0)
+        {
+            if(!FileStream_Write(pStream, NULL, pbCKeyMapImage, Header.CKeyMapSize))
+                dwErrCode = ERROR_DISK_FULL;
+            if(dwErrCode == ERROR_SUCCESS && !FileStream_Write(pStream, NULL, pbEKeyMapImage, Header.EKeyMapSize))
+                dwErrCode = ERROR_DISK_FULL;
+        }
+
+        FileStream_Close(pStream);
+
+        // Move the complete snapshot in place. If anything failed, delete the incomplete file
+        if(dwErrCode == ERROR_SUCCESS && !RenameFile(szTempName, szFileName))
+            dwErrCode = ERROR_CAN_NOT_COMPLETE;
+        if(dwErrCode != ERROR_SUCCESS)
+            _tremove(szTempName);
+    }
+
+    CASC_FREE(szTempName);
+    CASC_FREE(szFileName);
+    return dwErrCode;
+}
@@ -15,6 +15,14 @@
 //-----------------------------------------------------------------------------
 // Structures
 
+// Array buffer that was replaced by a larger one, but may still be accessed by other threads
+typedef struct _CASC_RETIRED_ARRAY
+{
+    struct _CASC_RETIRED_ARRAY * pNext;         // The next retired buffer
+    LPBYTE pbArray;                             // The retired buffer
+    size_t cbArray;                             // Size of the retired buffer, in bytes
+} CASC_RETIRED_ARRAY, *PCASC_RETIRED_ARRAY;
+
 class CASC_ARRAY
 {
     public:
@@ -25,6 +33,8 @@ class CASC_ARRAY
         m_ItemCountMax = 0;
         m_ItemCount = 0;
         m_ItemSize = 0;
+        m_pRetired = NULL;
+        m_bRetainOldArrays = false;
     }
 
     ~CASC_ARRAY()
@@ -125,6 +135,16 @@ class CASC_ARRAY
     {
         LPBYTE pbItem = (LPBYTE)pItem;
 
+        // Another thread may have obtained the item before the array was moved
+        if(m_pRetired != NULL && !((m_pItemArray <= pbItem) && (pbItem < m_pItemArray + (m_ItemCountMax * m_ItemSize))))
+        {
+            for(PCASC_RETIRED_ARRAY pRetired = m_pRetired; pRetired != NULL; pRetired = pRetired->pNext)
+            {
+                if((pRetired->pbArray <= pbItem) && (pbItem < pRetired->pbArray + pRetired->cbArray))
+                    return ((pbItem - pRetired->pbArray) / m_ItemSize);
+            }
+        }
+
         assert((m_pItemArray <= pbItem) && (pbItem <= m_pItemArray + (m_ItemCount * m_ItemSize)));
         assert(((pbItem - m_pItemArray) % m_ItemSize) == 0);
 
@@ -163,9 +183,30 @@ class CASC_ARRAY
         m_ItemCount = 0;
     }
 
+    // From now on, the array keeps the old buffers when it grows. They are freed by FreeOldArrays()
+    // or with the array. Use this if other threads may hold pointers to items while the array grows
+    void RetainOldArrays()
+    {
+        m_bRetainOldArrays = true;
+    }
+
+    // Frees the buffers kept by RetainOldArrays(). No other thread may hold pointers to their items
+    void FreeOldArrays()
+    {
+        PCASC_RETIRED_ARRAY pRetired;
+
+        while((pRetired = m_pRetired) != NULL)
+        {
+            m_pRetired = pRetired->pNext;
+            CASC_FREE(pRetired->pbArray);
+            CASC_FREE(pRetired);
+        }
+    }
+
     // Frees the array
     void Free()
     {
+        FreeOldArrays();
         CASC_FREE(m_pItemArray);
         m_ItemCountMax = m_ItemCount = m_ItemSize = 0;
     }
@@ -212,22 +253,55 @@ class CASC_ARRAY
                 ItemCountMax = ItemCountMax << 1;
 
             // Allocate new table. If this fails, the 'm_pItemArray' remains valid
-            NewItemArray = CASC_REALLOC(m_pItemArray, (ItemCountMax * m_ItemSize));
-            if(NewItemArray == NULL)
-                return false;
+            if(m_bRetainOldArrays)
+            {
+                if((NewItemArray = RetainAndCopyArray(ItemCountMax)) == NULL)
+                    return false;
+            }
+            else
+            {
+                NewItemArray = CASC_REALLOC(m_pItemArray, (ItemCountMax * m_ItemSize));
+                if(NewItemArray == NULL)
+                    return false;
+            }
 
             // Set the new table size
             m_ItemCountMax = ItemCountMax;
-            m_pItemArray = NewItemArray;
+            CascWriteRelease(&m_pItemArray, NewItemArray);
         }
 
         return true;
     }
 
+    LPBYTE RetainAndCopyArray(size_t ItemCountMax)
+    {
+        PCASC_RETIRED_ARRAY pRetired;
+        LPBYTE NewItemArray;
+
+        // Allocate the new buffer and the entry for the old one
+        if((pRetired = CASC_ALLOC<CASC_RETIRED_ARRAY>(1)) == NULL)
+            return NULL;
+        if((NewItemArray = CASC_ALLOC<BYTE>(ItemCountMax * m_ItemSize)) == NULL)
+        {
+            CASC_FREE(pRetired);
+            return NULL;
+        }
+
+        // Copy the items and keep the old buffer
+        memcpy(NewItemArray, m_pItemArray, (m_ItemCountMax * m_ItemSize));
+        pRetired->pNext = m_pRetired;
+        pRetired->pbArray = m_pItemArray;
+        pRetired->cbArray = m_ItemCountMax * m_ItemSize;
+        m_pRetired = pRetired;
+        return NewItemArray;
+    }
+
     LPBYTE m_pItemArray;                        // Pointer to item array
     size_t m_ItemCountMax;                      // Maximum item count
     size_t m_ItemCount;                         // Current item count
     size_t m_ItemSize;                          // Size of an item
+    PCASC_RETIRED_ARRAY m_pRetired;             // List of old buffers, if RetainOldArrays() was called
+    bool m_bRetainOldArrays;                    // If true, the old buffers are kept when the array grows
 };
 
 #endif // __CASC_ARRAY__
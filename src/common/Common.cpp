@@ -12,6 +12,23 @@
 #include "../CascLib.h"
 #include "../CascCommon.h"
 
+// Vector instructions for the key search. SSE2 is always there on x64.
+// AVX2 is compiled in, but only used if the CPU supports it
+#if defined(__x86_64__) || defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define CASC_SEARCH_SSE2
+#if defined(_MSC_VER) && (_MSC_VER >= 1700)
+#include <immintrin.h>
+#include <intrin.h>
+#define CASC_SEARCH_AVX2
+#define CASC_TARGET_AVX2
+#elif (defined(__GNUC__) && (__GNUC__ >= 5)) || defined(__clang__)
+#include <immintrin.h>
+#define CASC_SEARCH_AVX2
+#define CASC_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
 //-----------------------------------------------------------------------------
 // Conversion to uppercase/lowercase
 
@@ -621,3 +638,248 @@ void CascHash_SHA1(const void * pvDataBlock, size_t cbDataBlock, LPBYTE sha1_has
     SHA1_Update(&sha1_ctx, pvDataBlock, (u32)(cbDataBlock));
     SHA1_Final(&sha1_ctx, sha1_hash);
 }
+
+//-----------------------------------------------------------------------------
+// Searching sorted keys
+
+// Number of items where the binary search stops and the items are compared one by one
+#define CASC_SEARCH_SCAN_ITEMS  0x10
+
+typedef LPBYTE (*PFNSCANKEYS)(LPBYTE pbItems, size_t nItemCount, size_t ItemLength, LPBYTE pbKey, size_t KeyLength);
+
+// Loads the first 8 bytes of the key as big-endian integer, so they compare like memcmp
+static inline ULONGLONG LoadKeyPrefix(LPBYTE pbKey)
+{
+#if defined(CASCLIB_PLATFORM_LITTLE_ENDIAN) && defined(_MSC_VER)
+    ULONGLONG KeyPrefix;
+
+    memcpy(&KeyPrefix, pbKey, sizeof(ULONGLONG));
+    return _byteswap_uint64(KeyPrefix);
+#elif defined(CASCLIB_PLATFORM_LITTLE_ENDIAN) && defined(__GNUC__)
+    ULONGLONG KeyPrefix;
+
+    memcpy(&KeyPrefix, pbKey, sizeof(ULONGLONG));
+    return __builtin_bswap64(KeyPrefix);
+#else
+    return ConvertBytesToInteger_8(pbKey);
+#endif
+}
+
+static inline bool IsKeyLess(LPBYTE pbItemKey, LPBYTE pbKey, ULONGLONG KeyPrefix, size_t KeyLength)
+{
+    ULONGLONG ItemPrefix = LoadKeyPrefix(pbItemKey);
+
+    // The prefixes are almost always different
+    if(ItemPrefix != KeyPrefix)
+        return (ItemPrefix < KeyPrefix);
+    return (memcmp(pbItemKey + sizeof(ULONGLONG), pbKey + sizeof(ULONGLONG), KeyLength - sizeof(ULONGLONG)) < 0);
+}
+
+// Branchless lower bound. The range is halved regardless of the comparison,
+// so the compiler can use conditional moves instead of unpredictable branches
+static void LowerBoundRange(LPBYTE pbItems, size_t & nFirst, size_t & nCount, size_t nStopCount, size_t ItemLength, LPBYTE pbKey, size_t KeyLength)
+{
+    ULONGLONG KeyPrefix = LoadKeyPrefix(pbKey);
+
+    while(nCount > nStopCount)
+    {
+        size_t nHalf = nCount / 2;
+        bool bLess = IsKeyLess(pbItems + (nFirst + nHalf) * ItemLength, pbKey, KeyPrefix, KeyLength);
+
+        nFirst = bLess ? (nFirst + nHalf + 1) : nFirst;
+        nCount = bLess ? (nCount - nHalf - 1) : nHalf;
+    }
+}
+
+static LPBYTE ScanKeys_Scalar(LPBYTE pbItems, size_t nItemCount, size_t ItemLength, LPBYTE pbKey, size_t KeyLength)
+{
+    for(size_t i = 0; i < nItemCount; i++, pbItems += ItemLength)
+    {
+        if(!memcmp(pbItems, pbKey, KeyLength))
+            return pbItems;
+    }
+    return NULL;
+}
+
+#ifdef CASC_SEARCH_SSE2
+static LPBYTE ScanKeys_SSE2(LPBYTE pbItems, size_t nItemCount, size_t ItemLength, LPBYTE pbKey, size_t KeyLength)
+{
+    BYTE KeyBuffer[CASC_SEARCH_MAX_KEY_LENGTH] = {0};
+    __m128i Key;
+    int KeyMask = (int)((1 << KeyLength) - 1);
+
+    // The probe must not read beyond the key
+    memcpy(KeyBuffer, pbKey, KeyLength);
+    Key = _mm_loadu_si128((const __m128i *)KeyBuffer);
+
+    // Compare 16 bytes of each item at once. Only the key bytes count
+    for(size_t i = 0; i < nItemCount; i++, pbItems += ItemLength)
+    {
+        __m128i Item = _mm_loadu_si128((const __m128i *)pbItems);
+
+        if((_mm_movemask_epi8(_mm_cmpeq_epi8(Item, Key)) & KeyMask) == KeyMask)
+            return pbItems;
+    }
+    return NULL;
+}
+#endif
+
+#ifdef CASC_SEARCH_AVX2
+CASC_TARGET_AVX2
+static LPBYTE ScanKeys_AVX2(LPBYTE pbItems, size_t nItemCount, size_t ItemLength, LPBYTE pbKey, size_t KeyLength)
+{
+    BYTE KeyBuffer[CASC_SEARCH_MAX_KEY_LENGTH] = {0};
+    __m256i Key;
+    DWORD KeyMask = (DWORD)((1 << KeyLength) - 1);
+    size_t i;
+
+    // The key is in both halves of the register
+    memcpy(KeyBuffer, pbKey, KeyLength);
+    Key = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)KeyBuffer));
+
+    // Compare two items at once
+    for(i = 0; (i + 2) <= nItemCount; i += 2, pbItems += ItemLength * 2)
+    {
+        __m128i Item0 = _mm_loadu_si128((const __m128i *)(pbItems));
+        __m128i Item1 = _mm_loadu_si128((const __m128i *)(pbItems + ItemLength));
+        __m256i Items = _mm256_inserti128_si256(_mm256_castsi128_si256(Item0), Item1, 1);
+        DWORD EqualMask = (DWORD)_mm256_movemask_epi8(_mm256_cmpeq_epi8(Items, Key));
+
+        if((EqualMask & KeyMask) == KeyMask)
+            return pbItems;
+        if(((EqualMask >> 16) & KeyMask) == KeyMask)
+            return pbItems + ItemLength;
+    }
+
+    // The last odd item
+    if(i < nItemCount)
+    {
+        __m128i Item = _mm_loadu_si128((const __m128i *)pbItems);
+
+        if(((DWORD)_mm_movemask_epi8(_mm_cmpeq_epi8(Item, _mm256_castsi256_si128(Key))) & KeyMask) == KeyMask)
+            return pbItems;
+    }
+    return NULL;
+}
+
+static bool IsAVX2Supported()
+{
+#ifdef _MSC_VER
+    int CpuInfo[4];
+
+    // The CPU must support AVX and the OS must save the YMM registers
+    __cpuid(CpuInfo, 0);
+    if(CpuInfo[0] < 7)
+        return false;
+    __cpuid(CpuInfo, 1);
+    if((CpuInfo[2] & 0x18000000) != 0x18000000 || (_xgetbv(0) & 0x06) != 0x06)
+        return false;
+    __cpuidex(CpuInfo, 7, 0);
+    return (CpuInfo[1] & 0x20) ? true : false;
+#else
+    // Static initializers may run before the CPU model data of libgcc is set up
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? true : false;
+#endif
+}
+#endif
+
+// Returns NULL if the kernel is not compiled in or the CPU doesn't support it
+static PFNSCANKEYS SelectScanKeys(KEY_SEARCH KeySearch)
+{
+    switch(KeySearch)
+    {
+        case KeySearchBest:
+#ifdef CASC_SEARCH_AVX2
+            if(IsAVX2Supported())
+                return ScanKeys_AVX2;
+#endif
+#ifdef CASC_SEARCH_SSE2
+            return ScanKeys_SSE2;
+#else
+            return ScanKeys_Scalar;
+#endif
+
+        case KeySearchScalar:
+            return ScanKeys_Scalar;
+
+#ifdef CASC_SEARCH_SSE2
+        case KeySearchSSE2:
+            return ScanKeys_SSE2;
+#endif
+
+#ifdef CASC_SEARCH_AVX2
+        case KeySearchAVX2:
+            return IsAVX2Supported() ? ScanKeys_AVX2 : NULL;
+#endif
+
+        default:
+            return NULL;
+    }
+}
+
+// Selected once, when the library is loaded
+static PFNSCANKEYS PfnScanKeys = SelectScanKeys(KeySearchBest);
+
+// Changes the kernel for all searches. Only meant for comparing the kernels;
+// it must not be called while another thread is searching
+bool CascSetKeySearch(KEY_SEARCH KeySearch)
+{
+    PFNSCANKEYS PfnNewScanKeys = SelectScanKeys(KeySearch);
+
+    if(PfnNewScanKeys == NULL)
+        return false;
+    PfnScanKeys = PfnNewScanKeys;
+    return true;
+}
+
+// Returns the index of the first item whose key is not less than the given key
+size_t CascLowerBoundKey(LPBYTE pbItems, size_t nItemCount, size_t ItemLength, LPBYTE pbKey, size_t KeyLength)
+{
+    size_t nFirst = 0;
+
+    // Short keys are not worth the integer compares
+    if(KeyLength < sizeof(ULONGLONG))
+    {
+        while(nItemCount > 0)
+        {
+            size_t nHalf = nItemCount / 2;
+            bool bLess = (memcmp(pbItems + (nFirst + nHalf) * ItemLength, pbKey, KeyLength) < 0);
+
+            nFirst = bLess ? (nFirst + nHalf + 1) : nFirst;
+            nItemCount = bLess ? (nItemCount - nHalf - 1) : nHalf;
+        }
+        return nFirst;
+    }
+
+    LowerBoundRange(pbItems, nFirst, nItemCount, 0, ItemLength, pbKey, KeyLength);
+    return nFirst;
+}
+
+// Returns the first item with the given key, or NULL if there is none. The binary search
+// only narrows the range to a few items, which are then compared with vector instructions
+LPBYTE CascSearchSortedKeys(LPBYTE pbItems, size_t nItemCount, size_t ItemLength, LPBYTE pbKey, size_t KeyLength)
+{
+    size_t nTotalCount = nItemCount;
+    size_t nFirst = 0;
+
+    // Short keys are searched by the plain binary search
+    if(KeyLength < sizeof(ULONGLONG))
+    {
+        nFirst = CascLowerBoundKey(pbItems, nItemCount, ItemLength, pbKey, KeyLength);
+        if(nFirst < nItemCount && !memcmp(pbItems + nFirst * ItemLength, pbKey, KeyLength))
+            return pbItems + nFirst * ItemLength;
+        return NULL;
+    }
+
+    // The lower bound is at most one item after the remaining range. If the key
+    // is there, the first item with that key is the first one that matches
+    LowerBoundRange(pbItems, nFirst, nItemCount, CASC_SEARCH_SCAN_ITEMS, ItemLength, pbKey, KeyLength);
+    nItemCount = CASCLIB_MIN(nItemCount + 1, nTotalCount - nFirst);
+    pbItems = pbItems + nFirst * ItemLength;
+
+    // The vector compares read 16 bytes of each item
+    if(KeyLength <= CASC_SEARCH_MAX_KEY_LENGTH && ItemLength >= CASC_SEARCH_MAX_KEY_LENGTH)
+        return PfnScanKeys(pbItems, nItemCount, ItemLength, pbKey, KeyLength);
+    return ScanKeys_Scalar(pbItems, nItemCount, ItemLength, pbKey, KeyLength);
+}
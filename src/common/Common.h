@@ -74,7 +74,10 @@ typedef struct _CASC_EKEY_ENTRY
 #define CASC_CE_OPEN_CKEY_ONCE     0x1000           // Used by CascLib test program - only opens a file with given CKey once, regardless on how many file names does it have
 #define CASC_CE_ZLIB_DATA          0x2000           // The file data is a raw ZLIB stream
 
-// In-memory representation of a single entry.
+// In-memory representation of a single entry. The structure is kept compact,
+// as there are millions of them in large storages. The keys go first,
+// because they are compared during the map lookups. Rarely used information
+// (e.g. tag bit masks) is stored in arrays parallel to TCascStorage::CKeyArray
 struct CASC_CKEY_ENTRY
 {
     CASC_CKEY_ENTRY()
@@ -111,13 +114,12 @@ struct CASC_CKEY_ENTRY
     BYTE CKey[MD5_HASH_SIZE];                       // Content key of the full length
     BYTE EKey[MD5_HASH_SIZE];                       // Encoded key of the full length
     ULONGLONG StorageOffset;                        // Linear offset over the entire storage. 0 if not present
-    ULONGLONG TagBitMask;                           // Bitmap for the tags. 0 ig tags are not supported
     DWORD ContentSize;                              // Content size of the file
     DWORD EncodedSize;                              // Encoded size of the file
     DWORD RefCount;                                 // This is the number of file names referencing this entry
     USHORT Flags;                                   // See CASC_CE_XXX
     BYTE SpanCount;                                 // Number of spans for the file
-    BYTE Priority;                                  // Number of spans for the file
+    BYTE Alignment;                                 // Alignment to 8-byte boundary. Always zero, as the entry is saved in the snapshot
 };
 typedef CASC_CKEY_ENTRY *PCASC_CKEY_ENTRY;
 
@@ -174,6 +176,101 @@ void CASC_FREE(T *& ptr)
     ptr = NULL;
 }
 
+//-----------------------------------------------------------------------------
+// Publishing pointers to other threads. The writer fully initializes the object,
+// then stores its pointer with CascWriteRelease. A reader that obtained the pointer
+// with CascReadAcquire is guaranteed to see the initialized object.
+
+template <typename T>
+T * CascReadAcquire(T * volatile * PtrValue)
+{
+#if defined(CASCLIB_PLATFORM_WINDOWS) && (defined(_M_IX86) || defined(_M_X64))
+    T * pValue = *PtrValue;                     // Loads are not reordered with other loads on x86/x64
+    _ReadWriteBarrier();
+    return pValue;
+#elif defined(CASCLIB_PLATFORM_WINDOWS)
+    T * pValue = *PtrValue;
+    MemoryBarrier();
+    return pValue;
+#elif defined(__GNUC__)
+    return __atomic_load_n(PtrValue, __ATOMIC_ACQUIRE);
+#else
+    return *PtrValue;
+#endif
+}
+
+template <typename T>
+void CascWriteRelease(T * volatile * PtrValue, T * pValue)
+{
+#if defined(CASCLIB_PLATFORM_WINDOWS) && (defined(_M_IX86) || defined(_M_X64))
+    _ReadWriteBarrier();                        // Stores are not reordered with other stores on x86/x64
+    *PtrValue = pValue;
+#elif defined(CASCLIB_PLATFORM_WINDOWS)
+    MemoryBarrier();
+    *PtrValue = pValue;
+#elif defined(__GNUC__)
+    __atomic_store_n(PtrValue, pValue, __ATOMIC_RELEASE);
+#else
+    *PtrValue = pValue;
+#endif
+}
+
+// The same for 32-bit state values that are read without a lock
+inline DWORD CascReadAcquire(DWORD volatile * PtrValue)
+{
+#if defined(CASCLIB_PLATFORM_WINDOWS) && (defined(_M_IX86) || defined(_M_X64))
+    DWORD dwValue = *PtrValue;
+    _ReadWriteBarrier();
+    return dwValue;
+#elif defined(CASCLIB_PLATFORM_WINDOWS)
+    DWORD dwValue = *PtrValue;
+    MemoryBarrier();
+    return dwValue;
+#elif defined(__GNUC__)
+    return __atomic_load_n(PtrValue, __ATOMIC_ACQUIRE);
+#else
+    return *PtrValue;
+#endif
+}
+
+inline void CascWriteRelease(DWORD volatile * PtrValue, DWORD dwValue)
+{
+#if defined(CASCLIB_PLATFORM_WINDOWS) && (defined(_M_IX86) || defined(_M_X64))
+    _ReadWriteBarrier();
+    *PtrValue = dwValue;
+#elif defined(CASCLIB_PLATFORM_WINDOWS)
+    MemoryBarrier();
+    *PtrValue = dwValue;
+#elif defined(__GNUC__)
+    __atomic_store_n(PtrValue, dwValue, __ATOMIC_RELEASE);
+#else
+    *PtrValue = dwValue;
+#endif
+}
+
+// 64-bit values, like storage offsets. A plain 64-bit load or store is not atomic on 32-bit platforms
+inline ULONGLONG CascReadAcquire(ULONGLONG volatile * PtrValue)
+{
+#if defined(CASCLIB_PLATFORM_WINDOWS)
+    return (ULONGLONG)InterlockedCompareExchange64((LONGLONG volatile *)PtrValue, 0, 0);
+#elif defined(__GNUC__)
+    return __atomic_load_n(PtrValue, __ATOMIC_ACQUIRE);
+#else
+    return *PtrValue;
+#endif
+}
+
+inline void CascWriteRelease(ULONGLONG volatile * PtrValue, ULONGLONG Value)
+{
+#if defined(CASCLIB_PLATFORM_WINDOWS)
+    InterlockedExchange64((LONGLONG volatile *)PtrValue, (LONGLONG)Value);
+#elif defined(__GNUC__)
+    __atomic_store_n(PtrValue, Value, __ATOMIC_RELEASE);
+#else
+    *PtrValue = Value;
+#endif
+}
+
 //-----------------------------------------------------------------------------
 // 32-bit ROL
 
@@ -277,6 +374,29 @@ inline ULONGLONG ConvertBytesToInteger_7(LPBYTE ValueAsBytes)
     return Value;
 }
 
+// Read the 64-bit big-endian value into ULONGLONG
+inline ULONGLONG ConvertBytesToInteger_8(LPBYTE ValueAsBytes)
+{
+    ULONGLONG Value = 0;
+
+    Value = (Value << 0x08) | ValueAsBytes[0];
+    Value = (Value << 0x08) | ValueAsBytes[1];
+    Value = (Value << 0x08) | ValueAsBytes[2];
+    Value = (Value << 0x08) | ValueAsBytes[3];
+    Value = (Value << 0x08) | ValueAsBytes[4];
+    Value = (Value << 0x08) | ValueAsBytes[5];
+    Value = (Value << 0x08) | ValueAsBytes[6];
+    Value = (Value << 0x08) | ValueAsBytes[7];
+
+    return Value;
+}
+
+inline void ConvertIntegerToBytes_2(USHORT Value, LPBYTE ValueAsBytes)
+{
+    ValueAsBytes[0] = (BYTE)((Value >> 0x08) & 0xFF);
+    ValueAsBytes[1] = (BYTE)((Value >> 0x00) & 0xFF);
+}
+
 inline void ConvertIntegerToBytes_4(DWORD Value, LPBYTE ValueAsBytes)
 {
     ValueAsBytes[0] = (BYTE)((Value >> 0x18) & 0xFF);
@@ -629,6 +749,25 @@ void CascHash_MD5(const void * pvDataBlock, size_t cbDataBlock, LPBYTE md5_hash)
 void CascHash_SHA1(const void * pvDataBlock, size_t cbDataBlock, LPBYTE sha1_hash);
 bool CascVerifyDataBlockHash(void * pvDataBlock, size_t cbDataBlock, LPBYTE expected_md5);
 
+//-----------------------------------------------------------------------------
+// Searching in arrays of sorted keys, like pages of the index files.
+// Items are ItemLength bytes long and each begins with a big-endian key of KeyLength bytes
+
+#define CASC_SEARCH_MAX_KEY_LENGTH  0x10            // Keys up to this length can be searched by the vector compares
+
+// Kernels that compare the remaining items after the binary search
+typedef enum _KEY_SEARCH
+{
+    KeySearchBest,                                  // The fastest kernel supported by the CPU. Selected at load time
+    KeySearchScalar,                                // One memcmp per item
+    KeySearchSSE2,                                  // One item per 16-byte compare
+    KeySearchAVX2                                   // Two items per 32-byte compare
+} KEY_SEARCH, *PKEY_SEARCH;
+
+bool   CascSetKeySearch(KEY_SEARCH KeySearch);
+size_t CascLowerBoundKey(LPBYTE pbItems, size_t nItemCount, size_t ItemLength, LPBYTE pbKey, size_t KeyLength);
+LPBYTE CascSearchSortedKeys(LPBYTE pbItems, size_t nItemCount, size_t ItemLength, LPBYTE pbKey, size_t KeyLength);
+
 //-----------------------------------------------------------------------------
 // Argument structure versioning
 // Safely retrieves field value from a structure
@@ -12,6 +12,11 @@
 #include "../CascLib.h"
 #include "../CascCommon.h"
 
+//-----------------------------------------------------------------------------
+// Local variables
+
+static DWORD dwTempFileCounter = 0;
+
 //-----------------------------------------------------------------------------
 // Public functions
 
@@ -136,3 +141,38 @@ DWORD ScanDirectory(
 
     return ERROR_PATH_NOT_FOUND;
 }
+
+LPTSTR CreateTempFileName(LPCTSTR szFileName)
+{
+    LPTSTR szTempName;
+    size_t nLength = _tcslen(szFileName) + 0x20;
+    DWORD dwProcessId;
+
+#ifdef CASCLIB_PLATFORM_WINDOWS
+    dwProcessId = GetCurrentProcessId();
+#else
+    dwProcessId = (DWORD)getpid();
+#endif
+
+    // The name is "<file name>.<process id>.<counter>.tmp"
+    if((szTempName = CASC_ALLOC<TCHAR>(nLength)) != NULL)
+    {
+        CascStrPrintf(szTempName, nLength, _T("%s.%x.%x.tmp"), szFileName, dwProcessId, CascInterlockedIncrement(&dwTempFileCounter));
+    }
+    return szTempName;
+}
+
+bool RenameFile(LPCTSTR szOldName, LPCTSTR szNewName)
+{
+#ifdef CASCLIB_PLATFORM_WINDOWS
+
+    BOOL bResult = MoveFileEx(szOldName, szNewName, MOVEFILE_REPLACE_EXISTING);
+    return (bResult) ? true : false;
+
+#else
+
+    // "rename" replaces the target file atomically
+    return (rename(szOldName, szNewName) == 0);
+
+#endif
+}
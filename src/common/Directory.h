@@ -32,4 +32,19 @@ DWORD ScanDirectory(
     void * pvContext
     );
 
+//-----------------------------------------------------------------------------
+// Replacing files. The file is written under a temporary name, then renamed,
+// so that other processes never see an incomplete file
+
+// Returns a unique name of a temporary file in the same directory. Free with CASC_FREE
+LPTSTR CreateTempFileName(
+    LPCTSTR szFileName
+    );
+
+// If the target file exists, it is replaced
+bool RenameFile(
+    LPCTSTR szOldName,
+    LPCTSTR szNewName
+    );
+
 #endif // __DIRECTORY_H__
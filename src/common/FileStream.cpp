@@ -530,6 +530,8 @@ static bool BaseMap_Open(TFileStream * pStream, LPCTSTR szFileName, DWORD dwStre
         if(fstat64(handle, &fileinfo) != -1)
         {
             pStream->Base.Map.pbFile = (LPBYTE)mmap(NULL, (size_t)fileinfo.st_size, PROT_READ, MAP_PRIVATE, handle, 0);
+            if(pStream->Base.Map.pbFile == (LPBYTE)MAP_FAILED)
+                pStream->Base.Map.pbFile = NULL;
             if(pStream->Base.Map.pbFile != NULL)
             {
                 // time_t is number of seconds since 1.1.1970, UTC.
@@ -2711,6 +2713,23 @@ bool FileStream_GetFlags(TFileStream * pStream, PDWORD pdwStreamFlags)
     return true;
 }
 
+/**
+ * Returns pointer to the data of a flat memory-mapped stream.
+ * For all other streams, the function returns NULL
+ *
+ * \a pStream Pointer to an open stream
+ * \a pcbFileData Pointer to variable that receives the size of the mapped data
+ */
+LPBYTE FileStream_GetMappedData(TFileStream * pStream, size_t * pcbFileData)
+{
+    if((pStream->dwFlags & STREAM_PROVIDERS_MASK) == (STREAM_PROVIDER_FLAT | BASE_PROVIDER_MAP))
+    {
+        pcbFileData[0] = (size_t)pStream->Base.Map.FileSize;
+        return pStream->Base.Map.pbFile;
+    }
+    return NULL;
+}
+
 /**
  * Switches a stream with another. Used for final phase of archive compacting.
  * Performs these steps:
@@ -111,11 +111,11 @@ PCASC_FILE_NODE CASC_FILE_TREE::InsertNew()
         // will use the uninitialized one
         SetExtras(pFileNode, CASC_INVALID_ID, CASC_INVALID_ID, CASC_INVALID_ID);
 
-        // If the array pointer changed or we are close to the size of the array, we need to rebuild the maps
-        if(NodeTable.ItemArray() != SaveItemArray || (NodeTable.ItemCount() * 3 / 2) > NameMap.HashTableSize())
+        // If the array pointer changed, we need to rebuild the maps. The name map grows by itself
+        if(NodeTable.ItemArray() != SaveItemArray)
         {
-            // Rebuild both maps. Note that rebuilding also inserts all items to the maps, so no need to insert them here
-            if(!RebuildNameMaps())
+            // Move the node pointers in both maps to the new array. The new node is not in the maps yet
+            if(!RebuildNameMaps((LPBYTE)SaveItemArray))
             {
                 pFileNode = NULL;
                 assert(false);
@@ -198,34 +198,23 @@ DWORD CASC_FILE_TREE::GetNextFileDataId()
     return CASC_INVALID_ID;
 }
 
-bool CASC_FILE_TREE::RebuildNameMaps()
+bool CASC_FILE_TREE::RebuildNameMaps(LPBYTE pbOldArray)
 {
     PCASC_FILE_NODE pFileNode;
-    size_t nMaxItems = NodeTable.ItemCountMax();
+    size_t cbOldArray = NodeTable.ItemCount() * NodeTable.ItemSize();
 
-    // Free the map of "FullName -> CASC_FILE_NODE"
-    NameMap.Free();
-
-    // Create new map map "FullName -> CASC_FILE_NODE"
-    if(NameMap.Create(nMaxItems, sizeof(ULONGLONG), FIELD_OFFSET(CASC_FILE_NODE, FileNameHash)) != ERROR_SUCCESS)
+    // The nodes keep their indexes, so the map of "FullName -> CASC_FILE_NODE" only needs
+    // to move its pointers. Other threads can keep searching the map in the meantime
+    if(!NameMap.Relocate(pbOldArray, cbOldArray, NodeTable.ItemArray()))
         return false;
 
-    // Reset the entire array, but buffers allocated
-    FileDataIds.Reset();
-
-    // Parse all items and insert them to the map
-    for(size_t i = 0; i < NodeTable.ItemCount(); i++)
+    // Update the array "FileDataId -> CASC_FILE_NODE". The items are overwritten in place,
+    // so a search by file data id never sees an empty item
+    if(FileDataIds.IsInitialized())
     {
-        // Retrieve the n-th object
-        pFileNode = (PCASC_FILE_NODE)NodeTable.ItemAt(i);
-        if(pFileNode != NULL)
+        for(size_t i = 0; i < NodeTable.ItemCount(); i++)
         {
-            // Insert it to the map "FileNameHash -> CASC_FILE_NODE"
-            if(pFileNode->FileNameHash != 0)
-                InsertToNameMap(pFileNode);
-
-            // Insert it to the array "FileDataId -> CASC_FILE_NODE"
-            if(FileDataIds.IsInitialized())
+            if((pFileNode = (PCASC_FILE_NODE)NodeTable.ItemAt(i)) != NULL)
                 InsertToIdTable(pFileNode);
         }
     }
@@ -243,6 +232,7 @@ DWORD CASC_FILE_TREE::Create(DWORD Flags)
 
     // Initialize the file tree
     memset(this, 0, sizeof(CASC_FILE_TREE));
+    CascInitLock(Lock);
     KeyLength = MD5_HASH_SIZE;
 
     // Shall we use the data ID in the tree node?
@@ -296,9 +286,9 @@ DWORD CASC_FILE_TREE::Create(DWORD Flags)
         }
     }
 
-    // Create both maps
-    if(!RebuildNameMaps())
-        dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+    // Create the map of "FullName -> CASC_FILE_NODE"
+    if(dwErrCode == ERROR_SUCCESS)
+        dwErrCode = NameMap.Create(NodeTable.ItemCountMax(), FIELD_OFFSET(CASC_FILE_NODE, FileNameHash));
     return dwErrCode;
 }
 
@@ -311,6 +301,7 @@ void CASC_FILE_TREE::Free()
 
     // Free the name map
     NameMap.Free();
+    CascFreeLock(Lock);
 
     // Zero the object
     memset(this, 0, sizeof(CASC_FILE_TREE));
@@ -351,7 +342,7 @@ PCASC_FILE_NODE CASC_FILE_TREE::InsertByName(PCASC_CKEY_ENTRY pCKeyEntry, const
             InsertToIdTable(pFileNode);
 
             // Set the file name of the new file node
-            SetNodeFileName(pFileNode, szFileName);
+            SetNodePathName(pFileNode, szFileName);
 
             // If we created a new node, we need to increment the reference count
             assert(pCKeyEntry->RefCount < 0xFFFFFFFF);
@@ -556,6 +547,26 @@ PCASC_FILE_NODE CASC_FILE_TREE::FindById(DWORD FileDataId)
 }
 
 bool CASC_FILE_TREE::SetNodeFileName(PCASC_FILE_NODE pFileNode, const char * szFileName)
+{
+    size_t nFileNode;
+    bool bResult = true;
+
+    // This is called during search, possibly by multiple threads, while other threads
+    // search the tree. From now on, the arrays keep their old buffers when they grow
+    CascLock(Lock);
+    NodeTable.RetainOldArrays();
+    NameTable.RetainOldArrays();
+
+    // The node may come from before the node array moved. It may also have been named by another thread
+    nFileNode = NodeTable.IndexOf(pFileNode);
+    pFileNode = (PCASC_FILE_NODE)NodeTable.ItemAt(nFileNode);
+    if(pFileNode != NULL && pFileNode->NameLength == 0)
+        bResult = SetNodePathName(pFileNode, szFileName);
+    CascUnlock(Lock);
+    return bResult;
+}
+
+bool CASC_FILE_TREE::SetNodePathName(PCASC_FILE_NODE pFileNode, const char * szFileName)
 {
     ULONGLONG FileNameHash = 0;
     PCASC_FILE_NODE pFolderNode = NULL;
@@ -666,6 +677,18 @@ bool CASC_FILE_TREE::SetNodeFileName(PCASC_FILE_NODE pFileNode, const char * szF
     return true;
 }
 
+DWORD CASC_FILE_TREE::Freeze()
+{
+    return NameMap.Freeze(NodeTable.ItemArray(), NodeTable.ItemCount(), NodeTable.ItemSize());
+}
+
+void CASC_FILE_TREE::FreeOldBuffers()
+{
+    NameMap.FreeOldTables();
+    NodeTable.FreeOldArrays();
+    NameTable.FreeOldArrays();
+}
+
 size_t CASC_FILE_TREE::GetMaxFileIndex()
 {
     if(FileDataIds.IsInitialized())
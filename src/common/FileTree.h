@@ -62,9 +62,15 @@ class CASC_FILE_TREE
     PCASC_FILE_NODE Find(ULONGLONG FileNameHash);
     PCASC_FILE_NODE FindById(DWORD FileDataId);
 
-    // Assigns a file name to the node
+    // Assigns a file name to a nameless node. Can be called while other threads search the tree
     bool SetNodeFileName(PCASC_FILE_NODE pFileNode, const char * szFileName);
 
+    // Converts the name map to a minimal perfect hash table. Nodes inserted later go to a small hash table
+    DWORD Freeze();
+
+    // Frees the map tables and arrays that were replaced as the tree grew. Must not run while other threads search the tree
+    void FreeOldBuffers();
+
     // Returns the number of items in the tree
     size_t GetMaxFileIndex();
     size_t GetCount();
@@ -97,14 +103,16 @@ class CASC_FILE_TREE
     bool InsertToIdTable(PCASC_FILE_NODE pFileNode);
 
     bool SetNodePlainName(PCASC_FILE_NODE pFileNode, const char * szPlainName, const char * szPlainNameEnd);
-    bool RebuildNameMaps();
+    bool SetNodePathName(PCASC_FILE_NODE pFileNode, const char * szFileName);
+    bool RebuildNameMaps(LPBYTE pbOldArray);
 
     CASC_ARRAY NodeTable;                           // Dynamic array that holds all CASC_FILE_NODEs
     CASC_ARRAY NameTable;                           // Dynamic array that holds all node names
 
     CASC_SPARSE_ARRAY FileDataIds;                  // Dynamic array that maps FileDataId -> CASC_FILE_NODE
     //CASC_ARRAY FileDataIds;                         // Dynamic array that maps FileDataId -> CASC_FILE_NODE
-    CASC_MAP NameMap;                               // Map of FileNameHash -> CASC_FILE_NODE
+    CASC_CONCURRENT_MAP<sizeof(ULONGLONG)> NameMap; // Map of FileNameHash -> CASC_FILE_NODE
+    CASC_LOCK Lock;                                 // Serializes naming of the nodes after the tree is loaded
 
     size_t FileDataIdOffset;                        // If nonzero, this is the offset of the "FileDataId" field in the CASC_FILE_NODE
     size_t LocaleFlagsOffset;                       // If nonzero, this is the offset of the "LocaleFlags" field in the CASC_FILE_NODE
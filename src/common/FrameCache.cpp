@@ -0,0 +1,371 @@
+/*****************************************************************************/
+/* FrameCache.cpp                         Copyright (c) Ladislav Zezula 2026 */
+/*---------------------------------------------------------------------------*/
+/* Storage-wide cache of decoded file frames                                 */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 17.10.26  1.00  Lad  Created                                              */
+/*****************************************************************************/
+
+#define __CASCLIB_SELF__
+#include "../CascLib.h"
+#include "../CascCommon.h"
+
+//-----------------------------------------------------------------------------
+// Local defines
+
+#define INITIAL_HASH_TABLE_SIZE     0x40            // Initial number of hash buckets in each stripe
+
+//-----------------------------------------------------------------------------
+// Local functions
+
+static void LinkEntry(CASC_FRAME_CACHE_LIST & List, PCASC_FRAME_CACHE_ENTRY pEntry)
+{
+    pEntry->pPrev = List.pLast;
+    pEntry->pNext = NULL;
+    if(List.pLast != NULL)
+        List.pLast->pNext = pEntry;
+    List.pLast = pEntry;
+    if(List.pFirst == NULL)
+        List.pFirst = pEntry;
+}
+
+static void UnlinkEntry(CASC_FRAME_CACHE_LIST & List, PCASC_FRAME_CACHE_ENTRY pEntry)
+{
+    if(pEntry->pPrev != NULL)
+        pEntry->pPrev->pNext = pEntry->pNext;
+    else
+        List.pFirst = pEntry->pNext;
+
+    if(pEntry->pNext != NULL)
+        pEntry->pNext->pPrev = pEntry->pPrev;
+    else
+        List.pLast = pEntry->pPrev;
+}
+
+static size_t GetGhostIndex(ULONGLONG KeyHash)
+{
+    return (size_t)(KeyHash >> 32) & (CASC_FRAME_CACHE_GHOSTS - 1);
+}
+
+//-----------------------------------------------------------------------------
+// CASC_FRAME_CACHE class
+
+CASC_FRAME_CACHE::CASC_FRAME_CACHE()
+{
+    m_pStripes = NULL;
+    m_nStripes = 0;
+    m_cbStripeSizeMax = 0;
+    m_cbHotSizeMax = 0;
+}
+
+CASC_FRAME_CACHE::~CASC_FRAME_CACHE()
+{
+    Free();
+}
+
+DWORD CASC_FRAME_CACHE::Create(size_t cbCacheSizeMax)
+{
+    // Don't create the cache twice
+    if(m_pStripes != NULL)
+        return ERROR_SUCCESS;
+
+    // Use fewer stripes if the stripe budget would be too small for the frames
+    m_nStripes = CASC_FRAME_CACHE_STRIPES;
+    while(m_nStripes > 1 && (cbCacheSizeMax / m_nStripes) < CASC_FRAME_CACHE_STRIPE_MIN)
+        m_nStripes /= 2;
+
+    // Allocate the stripes
+    if((m_pStripes = CASC_ALLOC_ZERO<CASC_FRAME_CACHE_STRIPE>(m_nStripes)) == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    // Initialize the stripes
+    for(size_t i = 0; i < m_nStripes; i++)
+    {
+        PCASC_FRAME_CACHE_STRIPE pStripe = m_pStripes + i;
+
+        if((pStripe->HashTable = CASC_ALLOC_ZERO<PCASC_FRAME_CACHE_ENTRY>(INITIAL_HASH_TABLE_SIZE)) == NULL)
+        {
+            Free();
+            return ERROR_NOT_ENOUGH_MEMORY;
+        }
+
+        pStripe->HashTableSize = INITIAL_HASH_TABLE_SIZE;
+        CascInitLock(pStripe->Lock);
+    }
+
+    // Split the budget
+    m_cbStripeSizeMax = cbCacheSizeMax / m_nStripes;
+    m_cbHotSizeMax = m_cbStripeSizeMax - (m_cbStripeSizeMax / 4);
+    return ERROR_SUCCESS;
+}
+
+void CASC_FRAME_CACHE::Free()
+{
+    PCASC_FRAME_CACHE_ENTRY pEntry;
+    PCASC_FRAME_CACHE_ENTRY pNext;
+
+    if(m_pStripes != NULL)
+    {
+        for(size_t i = 0; i < m_nStripes; i++)
+        {
+            PCASC_FRAME_CACHE_STRIPE pStripe = m_pStripes + i;
+
+            // The stripe may not be initialized if Create() failed
+            if(pStripe->HashTable != NULL)
+            {
+                for(pEntry = pStripe->ColdList.pFirst; pEntry != NULL; pEntry = pNext)
+                {
+                    pNext = pEntry->pNext;
+                    CASC_FREE(pEntry);
+                }
+
+                for(pEntry = pStripe->HotList.pFirst; pEntry != NULL; pEntry = pNext)
+                {
+                    pNext = pEntry->pNext;
+                    CASC_FREE(pEntry);
+                }
+
+                CASC_FREE(pStripe->HashTable);
+                CascFreeLock(pStripe->Lock);
+            }
+        }
+        CASC_FREE(m_pStripes);
+        m_nStripes = 0;
+    }
+}
+
+bool CASC_FRAME_CACHE::ReadFrame(LPBYTE EKey, DWORD FrameIndex, LPBYTE pbBuffer, DWORD cbBuffer)
+{
+    PCASC_FRAME_CACHE_STRIPE pStripe;
+    PCASC_FRAME_CACHE_ENTRY pEntry;
+    ULONGLONG KeyHash = GetKeyHash(EKey, FrameIndex);
+
+    // Find the frame. The data are copied while holding the lock,
+    // because the frame can be evicted by another thread anytime
+    pStripe = GetStripe(KeyHash);
+    CascLock(pStripe->Lock);
+    if((pEntry = FindEntry(pStripe, KeyHash, EKey, FrameIndex)) != NULL && pEntry->cbData == cbBuffer)
+    {
+        memcpy(pbBuffer, pEntry + 1, cbBuffer);
+        pEntry->bReferenced = true;
+        pStripe->Hits++;
+    }
+    else
+    {
+        pStripe->Misses++;
+        pEntry = NULL;
+    }
+    CascUnlock(pStripe->Lock);
+
+    return (pEntry != NULL);
+}
+
+void CASC_FRAME_CACHE::InsertFrame(LPBYTE EKey, DWORD FrameIndex, LPBYTE pbData, DWORD cbData)
+{
+    PCASC_FRAME_CACHE_STRIPE pStripe;
+    PCASC_FRAME_CACHE_ENTRY pEntry;
+    ULONGLONG KeyHash = GetKeyHash(EKey, FrameIndex);
+    size_t nGhostIndex = GetGhostIndex(KeyHash);
+
+    // Large frames would flush the whole stripe
+    if(cbData == 0 || cbData > m_cbStripeSizeMax)
+        return;
+
+    // Prepare the new entry before we lock the stripe
+    if((pEntry = (PCASC_FRAME_CACHE_ENTRY)CASC_ALLOC<BYTE>(sizeof(CASC_FRAME_CACHE_ENTRY) + cbData)) == NULL)
+        return;
+    memcpy(pEntry->EKey, EKey, MD5_HASH_SIZE);
+    memcpy(pEntry + 1, pbData, cbData);
+    pEntry->KeyHash = KeyHash;
+    pEntry->FrameIndex = FrameIndex;
+    pEntry->cbData = cbData;
+    pEntry->bReferenced = false;
+
+    pStripe = GetStripe(KeyHash);
+    CascLock(pStripe->Lock);
+
+    // Another thread may have loaded the same frame in the meantime
+    if(FindEntry(pStripe, KeyHash, EKey, FrameIndex) == NULL)
+    {
+        PCASC_FRAME_CACHE_GHOST pGhost = pStripe->Ghosts + nGhostIndex;
+
+        // Frames that were dropped from the cold list recently go directly to the hot list
+        if(pGhost->KeyHash == KeyHash && (pStripe->Evictions - pGhost->EvictionTime) <= pStripe->nFrameCount)
+        {
+            pGhost->KeyHash = 0;
+            pStripe->cbHotSize += cbData;
+            pEntry->bHot = true;
+            LinkEntry(pStripe->HotList, pEntry);
+        }
+        else
+        {
+            pEntry->bHot = false;
+            LinkEntry(pStripe->ColdList, pEntry);
+        }
+
+        // Insert the entry to the hash table
+        InsertToHashTable(pStripe, pEntry);
+        pStripe->cbCacheSize += cbData;
+        pEntry = NULL;
+
+        // Make space for the new entry
+        EvictFrames(pStripe);
+    }
+
+    CascUnlock(pStripe->Lock);
+    CASC_FREE(pEntry);
+}
+
+void CASC_FRAME_CACHE::GetStats(PCASC_FRAME_CACHE_INFO pCacheInfo)
+{
+    memset(pCacheInfo, 0, sizeof(CASC_FRAME_CACHE_INFO));
+
+    if(m_pStripes != NULL)
+    {
+        for(size_t i = 0; i < m_nStripes; i++)
+        {
+            PCASC_FRAME_CACHE_STRIPE pStripe = m_pStripes + i;
+
+            CascLock(pStripe->Lock);
+            pCacheInfo->Hits += pStripe->Hits;
+            pCacheInfo->Misses += pStripe->Misses;
+            pCacheInfo->Evictions += pStripe->Evictions;
+            pCacheInfo->CacheSize += pStripe->cbCacheSize;
+            pCacheInfo->HotSize += pStripe->cbHotSize;
+            pCacheInfo->FrameCount += pStripe->nFrameCount;
+            CascUnlock(pStripe->Lock);
+        }
+
+        pCacheInfo->CacheSizeMax = (ULONGLONG)m_cbStripeSizeMax * m_nStripes;
+    }
+}
+
+ULONGLONG CASC_FRAME_CACHE::GetKeyHash(LPBYTE EKey, DWORD FrameIndex)
+{
+    ULONGLONG KeyHash;
+
+    // The EKey is already a MD5 hash, so its first 8 bytes are random enough
+    memcpy(&KeyHash, EKey, sizeof(ULONGLONG));
+    return MixHash64(KeyHash + FrameIndex);
+}
+
+PCASC_FRAME_CACHE_ENTRY CASC_FRAME_CACHE::FindEntry(PCASC_FRAME_CACHE_STRIPE pStripe, ULONGLONG KeyHash, LPBYTE EKey, DWORD FrameIndex)
+{
+    PCASC_FRAME_CACHE_ENTRY pEntry;
+
+    for(pEntry = pStripe->HashTable[KeyHash & (pStripe->HashTableSize - 1)]; pEntry != NULL; pEntry = pEntry->pHashNext)
+    {
+        if(pEntry->KeyHash == KeyHash && pEntry->FrameIndex == FrameIndex && !memcmp(pEntry->EKey, EKey, MD5_HASH_SIZE))
+            return pEntry;
+    }
+    return NULL;
+}
+
+void CASC_FRAME_CACHE::InsertToHashTable(PCASC_FRAME_CACHE_STRIPE pStripe, PCASC_FRAME_CACHE_ENTRY pEntry)
+{
+    PCASC_FRAME_CACHE_ENTRY * PtrBucket;
+
+    // Keep the chains short. If the table cannot grow, we just use the old one
+    if(pStripe->nFrameCount >= pStripe->HashTableSize)
+        GrowHashTable(pStripe);
+
+    PtrBucket = pStripe->HashTable + (pEntry->KeyHash & (pStripe->HashTableSize - 1));
+    pEntry->pHashNext = PtrBucket[0];
+    PtrBucket[0] = pEntry;
+    pStripe->nFrameCount++;
+}
+
+void CASC_FRAME_CACHE::RemoveFromHashTable(PCASC_FRAME_CACHE_STRIPE pStripe, PCASC_FRAME_CACHE_ENTRY pEntry)
+{
+    PCASC_FRAME_CACHE_ENTRY * PtrEntry;
+
+    for(PtrEntry = pStripe->HashTable + (pEntry->KeyHash & (pStripe->HashTableSize - 1)); PtrEntry[0] != NULL; PtrEntry = &PtrEntry[0]->pHashNext)
+    {
+        if(PtrEntry[0] == pEntry)
+        {
+            PtrEntry[0] = pEntry->pHashNext;
+            pStripe->nFrameCount--;
+            break;
+        }
+    }
+}
+
+void CASC_FRAME_CACHE::GrowHashTable(PCASC_FRAME_CACHE_STRIPE pStripe)
+{
+    PCASC_FRAME_CACHE_ENTRY * NewHashTable;
+    PCASC_FRAME_CACHE_ENTRY pEntry;
+    PCASC_FRAME_CACHE_ENTRY pNext;
+    size_t NewHashTableSize = pStripe->HashTableSize * 2;
+
+    if((NewHashTable = CASC_ALLOC_ZERO<PCASC_FRAME_CACHE_ENTRY>(NewHashTableSize)) != NULL)
+    {
+        for(size_t i = 0; i < pStripe->HashTableSize; i++)
+        {
+            for(pEntry = pStripe->HashTable[i]; pEntry != NULL; pEntry = pNext)
+            {
+                size_t nIndex = (size_t)(pEntry->KeyHash & (NewHashTableSize - 1));
+
+                pNext = pEntry->pHashNext;
+                pEntry->pHashNext = NewHashTable[nIndex];
+                NewHashTable[nIndex] = pEntry;
+            }
+        }
+
+        CASC_FREE(pStripe->HashTable);
+        pStripe->HashTable = NewHashTable;
+        pStripe->HashTableSize = NewHashTableSize;
+    }
+}
+
+void CASC_FRAME_CACHE::EvictFrames(PCASC_FRAME_CACHE_STRIPE pStripe)
+{
+    PCASC_FRAME_CACHE_ENTRY pEntry;
+
+    while(pStripe->cbCacheSize > m_cbStripeSizeMax)
+    {
+        // Move the clock hand of the hot list if the hot list is too large
+        // or if there is nothing else to evict. Hot frames that were not used
+        // since the last pass are demoted to the cold list
+        if(pStripe->HotList.pFirst != NULL && (pStripe->cbHotSize > m_cbHotSizeMax || pStripe->ColdList.pFirst == NULL))
+        {
+            pEntry = pStripe->HotList.pFirst;
+            UnlinkEntry(pStripe->HotList, pEntry);
+
+            if(pEntry->bReferenced)
+            {
+                pEntry->bReferenced = false;
+                LinkEntry(pStripe->HotList, pEntry);
+            }
+            else
+            {
+                pStripe->cbHotSize -= pEntry->cbData;
+                pEntry->bHot = false;
+                LinkEntry(pStripe->ColdList, pEntry);
+            }
+            continue;
+        }
+
+        // Take the oldest frame from the cold list. If it was accessed again, promote it to the hot list
+        pEntry = pStripe->ColdList.pFirst;
+        UnlinkEntry(pStripe->ColdList, pEntry);
+
+        if(pEntry->bReferenced)
+        {
+            pStripe->cbHotSize += pEntry->cbData;
+            pEntry->bReferenced = false;
+            pEntry->bHot = true;
+            LinkEntry(pStripe->HotList, pEntry);
+            continue;
+        }
+
+        // Drop the frame and remember its key in the ghost table
+        pStripe->Ghosts[GetGhostIndex(pEntry->KeyHash)].KeyHash = pEntry->KeyHash;
+        pStripe->Ghosts[GetGhostIndex(pEntry->KeyHash)].EvictionTime = pStripe->Evictions;
+        pStripe->cbCacheSize -= pEntry->cbData;
+        pStripe->Evictions++;
+        RemoveFromHashTable(pStripe, pEntry);
+        CASC_FREE(pEntry);
+    }
+}
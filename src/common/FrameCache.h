@@ -0,0 +1,130 @@
+/*****************************************************************************/
+/* FrameCache.h                           Copyright (c) Ladislav Zezula 2026 */
+/*---------------------------------------------------------------------------*/
+/* Storage-wide cache of decoded file frames                                 */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 17.10.26  1.00  Lad  Created                                              */
+/*****************************************************************************/
+
+#ifndef __CASC_FRAME_CACHE_H__
+#define __CASC_FRAME_CACHE_H__
+
+//-----------------------------------------------------------------------------
+// Defines
+//
+// The cache is split to stripes by the hash of (EKey, frame index). Each stripe
+// has its own lock, its own part of the byte budget and its own replacement lists.
+// Frames larger than the budget of one stripe are not cached, so small caches
+// have fewer stripes. A stripe has at least CASC_FRAME_CACHE_STRIPE_MIN bytes,
+// unless the whole cache is smaller than that.
+//
+// The replacement policy is similar to CLOCK-Pro:
+//
+//  - New frames go to the cold list. A frame that is accessed again while
+//    in the cold list is promoted to the hot list when it reaches the list head.
+//    Frames that were only accessed once (like when somebody reads all files
+//    of the storage) are dropped from the cold list and never disturb the hot frames.
+//  - The hot list holds up to 3/4 of the budget and it's scanned by a clock hand.
+//    Hot frames that were not accessed since the last pass go back to the cold list.
+//  - Keys of frames dropped from the cold list are remembered in a small ghost
+//    table. If such a frame is loaded again before the cache drops as many frames
+//    as it currently holds, it goes directly to the hot list. Frames of a scan
+//    larger than the cache come back too late and stay cold.
+//
+
+#define CASC_FRAME_CACHE_STRIPES    0x10            // Maximum number of stripes. Must be a power of two
+#define CASC_FRAME_CACHE_STRIPE_MIN 0x400000        // Minimum budget of one stripe. Covers the frames of the common files
+#define CASC_FRAME_CACHE_GHOSTS     0x400           // Number of ghost entries per stripe. Must be a power of two
+
+typedef struct _CASC_FRAME_CACHE_ENTRY
+{
+    struct _CASC_FRAME_CACHE_ENTRY * pHashNext;     // Next entry in the same hash bucket
+    struct _CASC_FRAME_CACHE_ENTRY * pPrev;         // Previous entry in the hot/cold list
+    struct _CASC_FRAME_CACHE_ENTRY * pNext;         // Next entry in the hot/cold list
+    ULONGLONG KeyHash;                              // Hash of (EKey, frame index)
+    BYTE EKey[MD5_HASH_SIZE];                       // Encoded key of the file span
+    DWORD FrameIndex;                               // Index of the frame within the file span
+    DWORD cbData;                                   // Length of the decoded frame. The data follow the structure
+    bool bHot;                                      // If true, the entry is in the hot list
+    bool bReferenced;                               // Set on every access, cleared by the replacement policy
+} CASC_FRAME_CACHE_ENTRY, *PCASC_FRAME_CACHE_ENTRY;
+
+typedef struct _CASC_FRAME_CACHE_LIST
+{
+    PCASC_FRAME_CACHE_ENTRY pFirst;                 // The oldest entry. The clock hand / FIFO head
+    PCASC_FRAME_CACHE_ENTRY pLast;                  // The newest entry
+} CASC_FRAME_CACHE_LIST, *PCASC_FRAME_CACHE_LIST;
+
+typedef struct _CASC_FRAME_CACHE_GHOST
+{
+    ULONGLONG KeyHash;                              // Hash of the frame dropped from the cold list
+    ULONGLONG EvictionTime;                         // Value of the stripe eviction counter when the frame was dropped
+} CASC_FRAME_CACHE_GHOST, *PCASC_FRAME_CACHE_GHOST;
+
+typedef struct _CASC_FRAME_CACHE_STRIPE
+{
+    CASC_LOCK Lock;                                 // Lock for everything in the stripe
+    PCASC_FRAME_CACHE_ENTRY * HashTable;            // Hash buckets
+    size_t HashTableSize;                           // Number of hash buckets. Always a power of two
+    CASC_FRAME_CACHE_LIST ColdList;                 // Frames accessed once (FIFO)
+    CASC_FRAME_CACHE_LIST HotList;                  // Frames accessed repeatedly (CLOCK)
+    CASC_FRAME_CACHE_GHOST Ghosts[CASC_FRAME_CACHE_GHOSTS]; // Frames recently dropped from the cold list
+    size_t cbCacheSize;                             // Total length of the cached frames
+    size_t cbHotSize;                               // Length of the frames in the hot list
+    size_t nFrameCount;                             // Number of cached frames
+    ULONGLONG Hits;                                 // Number of lookups that found the frame
+    ULONGLONG Misses;                               // Number of lookups that did not find the frame
+    ULONGLONG Evictions;                            // Number of frames dropped from the cache
+} CASC_FRAME_CACHE_STRIPE, *PCASC_FRAME_CACHE_STRIPE;
+
+//-----------------------------------------------------------------------------
+// The frame cache class. Can be used from any number of threads
+
+class CASC_FRAME_CACHE
+{
+    public:
+
+    CASC_FRAME_CACHE();
+    ~CASC_FRAME_CACHE();
+
+    DWORD Create(size_t cbCacheSizeMax);
+    void Free();
+
+    // Copies the decoded frame to the buffer. Returns false if the frame is not in the cache
+    bool ReadFrame(LPBYTE EKey, DWORD FrameIndex, LPBYTE pbBuffer, DWORD cbBuffer);
+
+    // Inserts a copy of the decoded frame to the cache. Frames larger than the stripe budget are ignored
+    void InsertFrame(LPBYTE EKey, DWORD FrameIndex, LPBYTE pbData, DWORD cbData);
+
+    // Sums the statistics of all stripes
+    void GetStats(PCASC_FRAME_CACHE_INFO pCacheInfo);
+
+    bool IsEnabled()
+    {
+        return (m_pStripes != NULL);
+    }
+
+    protected:
+
+    static ULONGLONG GetKeyHash(LPBYTE EKey, DWORD FrameIndex);
+
+    PCASC_FRAME_CACHE_ENTRY FindEntry(PCASC_FRAME_CACHE_STRIPE pStripe, ULONGLONG KeyHash, LPBYTE EKey, DWORD FrameIndex);
+    void InsertToHashTable(PCASC_FRAME_CACHE_STRIPE pStripe, PCASC_FRAME_CACHE_ENTRY pEntry);
+    void RemoveFromHashTable(PCASC_FRAME_CACHE_STRIPE pStripe, PCASC_FRAME_CACHE_ENTRY pEntry);
+    void GrowHashTable(PCASC_FRAME_CACHE_STRIPE pStripe);
+    void EvictFrames(PCASC_FRAME_CACHE_STRIPE pStripe);
+
+    PCASC_FRAME_CACHE_STRIPE GetStripe(ULONGLONG KeyHash)
+    {
+        return m_pStripes + ((size_t)(KeyHash >> 60) & (m_nStripes - 1));
+    }
+
+    PCASC_FRAME_CACHE_STRIPE m_pStripes;            // Array of m_nStripes stripes
+    size_t m_nStripes;                              // Number of stripes. Always a power of two
+    size_t m_cbStripeSizeMax;                       // Byte budget of one stripe
+    size_t m_cbHotSizeMax;                          // Byte budget of the hot list in one stripe
+};
+
+#endif // __CASC_FRAME_CACHE_H__
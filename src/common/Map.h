@@ -28,6 +28,20 @@ typedef enum _KEY_TYPE
 
 #define KEY_LENGTH_STRING 0xFFFFFFFF
 
+#define CASC_MAP_MIGRATE_SLOTS  0x08            // Number of slots moved to the new table on each insert while a map is growing
+
+// Statistics of a map, for diagnostics
+typedef struct _CASC_MAP_STATS
+{
+    size_t ItemCount;                           // Number of objects in the map
+    size_t HashTableSize;                       // Size of the hash table, in entries
+    size_t LoadFactor;                          // Percentage of the used entries
+    size_t TotalProbeLength;                    // Sum of the probe lengths of all objects inserted to the current table
+    size_t MaxProbeLength;                      // The longest probe length
+    bool bGrowing;                              // If true, the map is moving objects to a new table
+    bool bFrozen;                               // If true, most of the objects are in a minimal perfect hash table
+} CASC_MAP_STATS, *PCASC_MAP_STATS;
+
 //-----------------------------------------------------------------------------
 // Hashing functions
 
@@ -82,10 +96,16 @@ class CASC_MAP
         PfnCalcHashValue = NULL;
         m_HashTable = NULL;
         m_HashTableSize = 0;
+        m_OldHashTable = NULL;
+        m_OldHashTableSize = 0;
+        m_MigratedSlots = 0;
         m_ItemCount = 0;
         m_KeyOffset = 0;
         m_KeyLength = 0;
+        m_TotalProbeLength = 0;
+        m_MaxProbeLength = 0;
         m_bKeyIsHash = false;
+        m_bGrowable = false;
     }
 
     ~CASC_MAP()
@@ -93,12 +113,19 @@ class CASC_MAP
         Free();
     }
 
-    DWORD Create(size_t MaxItems, size_t KeyLength, size_t KeyOffset, KEY_TYPE KeyType = KeyIsHash)
+    // If bGrowable is true, the map doubles its size when it gets 75% full instead of refusing
+    // new objects. The objects are moved to the new table a few at a time on each insert,
+    // so there is no long pause. Growable maps can't contain strings.
+    DWORD Create(size_t MaxItems, size_t KeyLength, size_t KeyOffset, KEY_TYPE KeyType = KeyIsHash, bool bGrowable = false)
     {
         // Set the class variables
         m_KeyLength = CASCLIB_MAX(KeyLength, 8);
         m_KeyOffset = KeyOffset;
         m_ItemCount = 0;
+        m_TotalProbeLength = 0;
+        m_MaxProbeLength = 0;
+        m_bGrowable = bGrowable;
+        assert(bGrowable == false || KeyType != KeyIsString);
 
         // Setup the hashing function
         switch(KeyType)
@@ -135,13 +162,15 @@ class CASC_MAP
     void * FindObject(void * pvKey, PDWORD PtrIndex = NULL)
     {
         void * pvObject;
+        DWORD dwHashValue;
         DWORD dwHashIndex;
 
         // Verify pointer to the map
         if(m_HashTable != NULL)
         {
             // Construct the hash index
-            dwHashIndex = HashToIndex(PfnCalcHashValue(pvKey, m_KeyLength));
+            dwHashValue = PfnCalcHashValue(pvKey, m_KeyLength);
+            dwHashIndex = HashToIndex(dwHashValue);
 
             // Search the hash table
             while((pvObject = m_HashTable[dwHashIndex]) != NULL)
@@ -157,6 +186,14 @@ class CASC_MAP
                 // Move to the next entry
                 dwHashIndex = HashToIndex(dwHashIndex + 1);
             }
+
+            // If the map is growing, the object may still be in the old table
+            if(m_OldHashTable != NULL)
+            {
+                if(PtrIndex != NULL)
+                    PtrIndex[0] = CASC_INVALID_INDEX;
+                return FindInOldTable(dwHashValue, pvKey);
+            }
         }
 
         // Not found, sorry
@@ -165,34 +202,33 @@ class CASC_MAP
 
     bool InsertObject(void * pvNewObject, void * pvKey)
     {
-        void * pvExistingObject;
-        DWORD dwHashIndex;
+        DWORD dwHashValue;
 
         // Verify pointer to the map
         if(m_HashTable != NULL)
         {
+            // Growable maps make room for the new object
+            if(m_bGrowable)
+            {
+                if(!GrowHashTable())
+                    return false;
+            }
+
             // Limit check
             if((m_ItemCount + 1) >= m_HashTableSize)
                 return false;
 
-            // Construct the hash index
-            dwHashIndex = HashToIndex(PfnCalcHashValue(pvKey, m_KeyLength));
+            // Check if hash being inserted conflicts with an existing hash
+            dwHashValue = PfnCalcHashValue(pvKey, m_KeyLength);
+            if(m_OldHashTable != NULL && FindInOldTable(dwHashValue, pvKey) != NULL)
+                return false;
 
-            // Search the hash table
-            while((pvExistingObject = m_HashTable[dwHashIndex]) != NULL)
+            // Insert to the current table
+            if(InsertToTable(pvNewObject, pvKey, dwHashValue))
             {
-                // Check if hash being inserted conflicts with an existing hash
-                if(CompareObject_Key(pvExistingObject, pvKey))
-                    return false;
-
-                // Move to the next entry
-                dwHashIndex = HashToIndex(dwHashIndex + 1);
+                m_ItemCount++;
+                return true;
             }
-
-            // Insert at that position
-            m_HashTable[dwHashIndex] = pvNewObject;
-            m_ItemCount++;
-            return true;
         }
 
         // Failed
@@ -285,15 +321,33 @@ class CASC_MAP
         return m_ItemCount;
     }
 
+    size_t KeyLength()
+    {
+        return m_KeyLength;
+    }
+
     bool IsInitialized()
     {
         return (m_HashTable && m_HashTableSize);
     }
 
+    void GetStats(CASC_MAP_STATS & Stats)
+    {
+        Stats.ItemCount = m_ItemCount;
+        Stats.HashTableSize = m_HashTableSize;
+        Stats.LoadFactor = (m_HashTableSize != 0) ? (m_ItemCount * 100 / m_HashTableSize) : 0;
+        Stats.TotalProbeLength = m_TotalProbeLength;
+        Stats.MaxProbeLength = m_MaxProbeLength;
+        Stats.bGrowing = (m_OldHashTable != NULL);
+        Stats.bFrozen = false;
+    }
+
     void Free()
     {
         PfnCalcHashValue = NULL;
+        CASC_FREE(m_OldHashTable);
         CASC_FREE(m_HashTable);
+        m_OldHashTableSize = 0;
         m_HashTableSize = 0;
     }
 
@@ -304,6 +358,109 @@ class CASC_MAP
         return HashValue & (m_HashTableSize - 1);
     }
 
+    // Inserts the object to the current table. Also used for moving the objects from the old table
+    bool InsertToTable(void * pvNewObject, void * pvKey, DWORD dwHashValue)
+    {
+        void * pvExistingObject;
+        DWORD dwHashIndex = HashToIndex(dwHashValue);
+        size_t nProbeLength = 1;
+
+        // Search the hash table
+        while((pvExistingObject = m_HashTable[dwHashIndex]) != NULL)
+        {
+            // Check if hash being inserted conflicts with an existing hash
+            if(CompareObject_Key(pvExistingObject, pvKey))
+                return false;
+
+            // Move to the next entry
+            dwHashIndex = HashToIndex(dwHashIndex + 1);
+            nProbeLength++;
+        }
+
+        // Insert at that position
+        m_HashTable[dwHashIndex] = pvNewObject;
+        m_TotalProbeLength += nProbeLength;
+        m_MaxProbeLength = CASCLIB_MAX(m_MaxProbeLength, nProbeLength);
+        return true;
+    }
+
+    // The objects that were already moved stay in the old table, so the probe sequences
+    // of the other objects are not broken. They are skipped, as they are in the new table
+    void * FindInOldTable(DWORD dwHashValue, void * pvKey)
+    {
+        void * pvObject;
+        DWORD dwHashIndex = dwHashValue & (DWORD)(m_OldHashTableSize - 1);
+
+        while((pvObject = m_OldHashTable[dwHashIndex]) != NULL)
+        {
+            if(dwHashIndex >= m_MigratedSlots && CompareObject_Key(pvObject, pvKey))
+                return pvObject;
+            dwHashIndex = (dwHashIndex + 1) & (DWORD)(m_OldHashTableSize - 1);
+        }
+        return NULL;
+    }
+
+    // Moves a few objects from the old table. Frees the old table when all are moved
+    void MigrateSlots(size_t nSlotCount)
+    {
+        void * pvObject;
+
+        while(nSlotCount > 0 && m_MigratedSlots < m_OldHashTableSize)
+        {
+            if((pvObject = m_OldHashTable[m_MigratedSlots]) != NULL)
+            {
+                LPBYTE pbKey = (LPBYTE)pvObject + m_KeyOffset;
+                InsertToTable(pvObject, pbKey, PfnCalcHashValue(pbKey, m_KeyLength));
+            }
+
+            m_MigratedSlots++;
+            nSlotCount--;
+        }
+
+        // All moved?
+        if(m_MigratedSlots >= m_OldHashTableSize)
+        {
+            CASC_FREE(m_OldHashTable);
+            m_OldHashTableSize = 0;
+            m_MigratedSlots = 0;
+        }
+    }
+
+    bool GrowHashTable()
+    {
+        void ** NewHashTable;
+
+        // Continue moving the objects from the old table
+        if(m_OldHashTable != NULL)
+            MigrateSlots(CASC_MAP_MIGRATE_SLOTS);
+
+        // Is the table 75% full?
+        if(((m_ItemCount + 1) * 4) >= (m_HashTableSize * 3))
+        {
+            // The previous growing must be complete
+            if(m_OldHashTable != NULL)
+                MigrateSlots(m_OldHashTableSize);
+
+            // Overflow check
+            if((m_HashTableSize << 1) < m_HashTableSize)
+                return false;
+
+            // Allocate the table with twice the size
+            if((NewHashTable = CASC_ALLOC_ZERO<void *>(m_HashTableSize << 1)) == NULL)
+                return false;
+
+            // The current table becomes the old table
+            m_OldHashTable = m_HashTable;
+            m_OldHashTableSize = m_HashTableSize;
+            m_MigratedSlots = 0;
+            m_HashTable = NewHashTable;
+            m_HashTableSize = m_HashTableSize << 1;
+            m_TotalProbeLength = 0;
+            m_MaxProbeLength = 0;
+        }
+        return true;
+    }
+
     bool CompareObject_Key(void * pvObject, void * pvKey)
     {
         LPBYTE pbObjectKey = (LPBYTE)pvObject + m_KeyOffset;
@@ -348,11 +505,824 @@ class CASC_MAP
     PFNHASHFUNC PfnCalcHashValue;
     void ** m_HashTable;                        // Hash table
     size_t m_HashTableSize;                     // Size of the hash table, in entries. Always a power of two.
+    void ** m_OldHashTable;                     // The previous hash table, while a growable map is growing
+    size_t m_OldHashTableSize;                  // Size of the previous hash table, in entries
+    size_t m_MigratedSlots;                     // Number of slots of the previous hash table that were moved to the current table
     size_t m_ItemCount;                         // Number of objects in the map
     size_t m_KeyOffset;                         // How far is the hash from the begin of the objects (in bytes)
     size_t m_KeyLength;                         // Length of the hash key, in bytes
+    size_t m_TotalProbeLength;                  // Sum of probe lengths of the objects in the current table
+    size_t m_MaxProbeLength;                    // The longest probe length in the current table
     bool m_bKeyIsHash;                          // If set, then it means that the key is a hash of some sort.
                                                 // Will improve performance, as we will not hash a hash :-)
+    bool m_bGrowable;                           // If set, the map grows instead of refusing new objects
+};
+
+//-----------------------------------------------------------------------------
+// Map with compile-time key length, used for the maps of CKeys and EKeys.
+// The keys are hashes, so their first 8 bytes are used both as the hash value
+// and as a fingerprint stored in the hash table next to the object pointer.
+// Most lookups are resolved without touching the object itself.
+
+template <size_t KEY_LENGTH>
+class CASC_FIXED_MAP
+{
+    public:
+
+    CASC_FIXED_MAP()
+    {
+        m_HashTable = NULL;
+        m_HashTableSize = 0;
+        m_ItemCount = 0;
+        m_KeyOffset = 0;
+        m_TotalProbeLength = 0;
+        m_MaxProbeLength = 0;
+    }
+
+    ~CASC_FIXED_MAP()
+    {
+        Free();
+    }
+
+    DWORD Create(size_t MaxItems, size_t KeyOffset)
+    {
+        // The fingerprint is the first 8 bytes of the key
+        assert(KEY_LENGTH >= sizeof(ULONGLONG));
+
+        // Set the class variables
+        m_KeyOffset = KeyOffset;
+        m_ItemCount = 0;
+        m_TotalProbeLength = 0;
+        m_MaxProbeLength = 0;
+
+        // Same size as CASC_MAP: 133% of the item count, rounded up to the next power of two
+        m_HashTableSize = MIN_HASH_TABLE_SIZE;
+        while(m_HashTableSize < (MaxItems * 4 / 3))
+        {
+            if((m_HashTableSize << 1) < m_HashTableSize)
+                return ERROR_NOT_ENOUGH_MEMORY;
+            m_HashTableSize <<= 1;
+        }
+
+        // Allocate the slots
+        m_HashTable = CASC_ALLOC_ZERO<CASC_MAP_SLOT>(m_HashTableSize);
+        return (m_HashTable != NULL) ? ERROR_SUCCESS : ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    void * FindObject(void * pvKey, PDWORD PtrIndex = NULL)
+    {
+        CASC_MAP_SLOT * pSlot;
+        ULONGLONG Fingerprint;
+        DWORD dwHashIndex;
+
+        // Verify pointer to the map
+        if(m_HashTable != NULL)
+        {
+            // Construct the fingerprint and the hash index
+            Fingerprint = GetFingerprint(pvKey);
+            dwHashIndex = HashToIndex(Fingerprint);
+
+            // Search the hash table. Only compare the rest of the key if the fingerprint matches
+            while((pSlot = &m_HashTable[dwHashIndex])->pvObject != NULL)
+            {
+                if(pSlot->Fingerprint == Fingerprint && CompareObject_Key(pSlot->pvObject, pvKey))
+                {
+                    if(PtrIndex != NULL)
+                        PtrIndex[0] = dwHashIndex;
+                    return pSlot->pvObject;
+                }
+
+                // Move to the next entry
+                dwHashIndex = HashToIndex(dwHashIndex + 1);
+            }
+        }
+
+        // Not found, sorry
+        return NULL;
+    }
+
+    bool InsertObject(void * pvNewObject, void * pvKey)
+    {
+        CASC_MAP_SLOT * pSlot;
+        ULONGLONG Fingerprint;
+        DWORD dwHashIndex;
+        size_t nProbeLength = 1;
+
+        // Verify pointer to the map
+        if(m_HashTable != NULL)
+        {
+            // Limit check
+            if((m_ItemCount + 1) >= m_HashTableSize)
+                return false;
+
+            // Construct the fingerprint and the hash index
+            Fingerprint = GetFingerprint(pvKey);
+            dwHashIndex = HashToIndex(Fingerprint);
+
+            // Search the hash table
+            while((pSlot = &m_HashTable[dwHashIndex])->pvObject != NULL)
+            {
+                // Check if hash being inserted conflicts with an existing hash
+                if(pSlot->Fingerprint == Fingerprint && CompareObject_Key(pSlot->pvObject, pvKey))
+                    return false;
+
+                // Move to the next entry
+                dwHashIndex = HashToIndex(dwHashIndex + 1);
+                nProbeLength++;
+            }
+
+            // Insert at that position
+            pSlot->Fingerprint = Fingerprint;
+            pSlot->pvObject = pvNewObject;
+            m_TotalProbeLength += nProbeLength;
+            m_MaxProbeLength = CASCLIB_MAX(m_MaxProbeLength, nProbeLength);
+            m_ItemCount++;
+            return true;
+        }
+
+        // Failed
+        return false;
+    }
+
+    void * ItemAt(size_t nIndex)
+    {
+        assert(nIndex < m_HashTableSize);
+        return m_HashTable[nIndex].pvObject;
+    }
+
+    size_t HashTableSize()
+    {
+        return m_HashTableSize;
+    }
+
+    size_t ItemCount()
+    {
+        return m_ItemCount;
+    }
+
+    size_t KeyLength()
+    {
+        return KEY_LENGTH;
+    }
+
+    bool IsInitialized()
+    {
+        return (m_HashTable && m_HashTableSize);
+    }
+
+    void GetStats(CASC_MAP_STATS & Stats)
+    {
+        Stats.ItemCount = m_ItemCount;
+        Stats.HashTableSize = m_HashTableSize;
+        Stats.LoadFactor = (m_HashTableSize != 0) ? (m_ItemCount * 100 / m_HashTableSize) : 0;
+        Stats.TotalProbeLength = m_TotalProbeLength;
+        Stats.MaxProbeLength = m_MaxProbeLength;
+        Stats.bGrowing = false;
+        Stats.bFrozen = false;
+    }
+
+    void Free()
+    {
+        CASC_FREE(m_HashTable);
+        m_HashTableSize = 0;
+        m_ItemCount = 0;
+    }
+
+    protected:
+
+    struct CASC_MAP_SLOT
+    {
+        ULONGLONG Fingerprint;                  // The first 8 bytes of the key
+        void * pvObject;                        // The object. NULL if the slot is free
+    };
+
+    static ULONGLONG GetFingerprint(const void * pvKey)
+    {
+        ULONGLONG Fingerprint;
+
+        memcpy(&Fingerprint, pvKey, sizeof(ULONGLONG));
+        return Fingerprint;
+    }
+
+    DWORD HashToIndex(ULONGLONG HashValue)
+    {
+        return (DWORD)(HashValue & (m_HashTableSize - 1));
+    }
+
+    bool CompareObject_Key(void * pvObject, void * pvKey)
+    {
+        LPBYTE pbObjectKey = (LPBYTE)pvObject + m_KeyOffset + sizeof(ULONGLONG);
+        return (memcmp(pbObjectKey, (LPBYTE)pvKey + sizeof(ULONGLONG), KEY_LENGTH - sizeof(ULONGLONG)) == 0);
+    }
+
+    CASC_MAP_SLOT * m_HashTable;                // Hash table
+    size_t m_HashTableSize;                     // Size of the hash table, in entries. Always a power of two.
+    size_t m_ItemCount;                         // Number of objects in the map
+    size_t m_KeyOffset;                         // How far is the key from the begin of the objects (in bytes)
+    size_t m_TotalProbeLength;                  // Sum of probe lengths of all objects
+    size_t m_MaxProbeLength;                    // The longest probe length
+};
+
+//-----------------------------------------------------------------------------
+// Map for lookups that run in parallel with inserts, like the lazily loaded ENCODING
+// entries or file names assigned during search. The slots are the same as in CASC_FIXED_MAP.
+//
+//  - Readers never lock. A slot is published by writing the fingerprint first
+//    and then storing the object pointer with release semantics.
+//  - Writers must be serialized by the caller, e.g. by TCascStorage::StorageLock.
+//  - The map grows by publishing an empty table with double size. The objects are moved
+//    to it a few at a time on each insert, so there is no long pause. Until all are moved,
+//    readers also search the previous table. Relocating the objects builds a new table
+//    that is published as a whole. The previous tables are only freed when the map is freed,
+//    so a reader that still walks a previous table never touches freed memory.
+
+template <size_t KEY_LENGTH>
+class CASC_CONCURRENT_MAP
+{
+    public:
+
+    CASC_CONCURRENT_MAP()
+    {
+        m_pTable = NULL;
+        m_pFrozen = NULL;
+        m_pbFrozenItems = NULL;
+        m_cbFrozenItem = 0;
+        m_MigratedSlots = 0;
+        m_ItemCount = 0;
+        m_KeyOffset = 0;
+        m_TotalProbeLength = 0;
+        m_MaxProbeLength = 0;
+    }
+
+    ~CASC_CONCURRENT_MAP()
+    {
+        Free();
+    }
+
+    DWORD Create(size_t MaxItems, size_t KeyOffset)
+    {
+        CASC_MAP_TABLE * pTable;
+        size_t nTableSize = MIN_HASH_TABLE_SIZE;
+
+        // The fingerprint is the first 8 bytes of the key
+        assert(KEY_LENGTH >= sizeof(ULONGLONG) && KEY_LENGTH <= 2 * sizeof(ULONGLONG));
+        assert(m_pTable == NULL);
+
+        // Set the class variables
+        m_KeyOffset = KeyOffset;
+        m_ItemCount = 0;
+        m_TotalProbeLength = 0;
+        m_MaxProbeLength = 0;
+
+        // Same size as CASC_MAP: 133% of the item count, rounded up to the next power of two
+        while(nTableSize < (MaxItems * 4 / 3))
+        {
+            if((nTableSize << 1) < nTableSize)
+                return ERROR_NOT_ENOUGH_MEMORY;
+            nTableSize <<= 1;
+        }
+
+        // Allocate and publish the table
+        if((pTable = AllocateTable(nTableSize, NULL)) == NULL)
+            return ERROR_NOT_ENOUGH_MEMORY;
+        CascWriteRelease(&m_pTable, pTable);
+        return ERROR_SUCCESS;
+    }
+
+    void * FindObject(void * pvKey, PDWORD PtrIndex = NULL)
+    {
+        CASC_FROZEN_MAP * pFrozen;
+        CASC_MAP_TABLE * pOldTable;
+        CASC_MAP_TABLE * pTable;
+        void * pvObject;
+
+        // If the map is frozen, most of the objects are in the frozen table
+        if((pFrozen = CascReadAcquire(&m_pFrozen)) != NULL)
+        {
+            if((pvObject = FindFrozenObject(pFrozen, pvKey, PtrIndex)) != NULL)
+                return pvObject;
+        }
+
+        // Verify pointer to the map
+        if((pTable = CascReadAcquire(&m_pTable)) != NULL)
+        {
+            // Must be read before searching the table. If it's NULL, all objects are in the table
+            pOldTable = CascReadAcquire(&pTable->pMigrateFrom);
+
+            // Search the current table
+            if((pvObject = FindInTable(pTable, pvKey, PtrIndex)) != NULL)
+                return pvObject;
+
+            // If the map is growing, the object may not be moved yet
+            if(pOldTable != NULL && (pvObject = FindInTable(pOldTable, pvKey, NULL)) != NULL)
+            {
+                if(PtrIndex != NULL)
+                    PtrIndex[0] = CASC_INVALID_INDEX;
+                return pvObject;
+            }
+        }
+
+        // Not found, sorry
+        return NULL;
+    }
+
+    // Note: The caller must serialize inserts
+    bool InsertObject(void * pvNewObject, void * pvKey)
+    {
+        CASC_MAP_TABLE * pTable;
+
+        // Verify pointer to the map
+        if((pTable = m_pTable) != NULL)
+        {
+            // The key must not be in the frozen table either
+            if(m_pFrozen != NULL && FindFrozenObject(m_pFrozen, pvKey, NULL) != NULL)
+                return false;
+
+            // Continue moving the objects from the previous table
+            if(pTable->pMigrateFrom != NULL)
+                MigrateSlots(pTable, CASC_MAP_MIGRATE_SLOTS);
+
+            // Keep the load factor under 75 %. If the map is full, start growing to a larger table
+            if((m_ItemCount - FrozenCount() + 1) * 4 > pTable->nTableSize * 3)
+            {
+                if((pTable = GrowTable(pTable)) == NULL)
+                    return false;
+            }
+
+            // The key must not be among the objects that were not moved yet
+            if(pTable->pMigrateFrom != NULL && FindInTable(pTable->pMigrateFrom, pvKey, NULL) != NULL)
+                return false;
+
+            // Insert the object to the current table
+            if(InsertToTable(pTable, pvNewObject, pvKey))
+            {
+                m_ItemCount++;
+                return true;
+            }
+        }
+
+        // Failed
+        return false;
+    }
+
+    // Moves all objects that are in the range of [pvOldBase, pvOldBase + cbOldSize) to pvNewBase.
+    // Used after the array holding the objects was reallocated. The caller must serialize it with inserts
+    bool Relocate(const void * pvOldBase, size_t cbOldSize, const void * pvNewBase)
+    {
+        CASC_MAP_TABLE * pOldTable = m_pTable;
+        CASC_MAP_TABLE * pNewTable;
+        LPBYTE pbOldBase = (LPBYTE)pvOldBase;
+        LPBYTE pbObject;
+
+        // Verify pointer to the map
+        if(pOldTable == NULL)
+            return false;
+        FinishGrowing(pOldTable);
+
+        // The objects keep their positions, so we only need to copy the slots and fix the pointers
+        if((pNewTable = AllocateTable(pOldTable->nTableSize, pOldTable)) == NULL)
+            return false;
+
+        for(size_t i = 0; i < pOldTable->nTableSize; i++)
+        {
+            pbObject = (LPBYTE)pOldTable->Slots[i].pvObject;
+            if(pbOldBase <= pbObject && pbObject < pbOldBase + cbOldSize)
+                pbObject = (LPBYTE)pvNewBase + (pbObject - pbOldBase);
+
+            pNewTable->Slots[i].Fingerprint = pOldTable->Slots[i].Fingerprint;
+            pNewTable->Slots[i].pvObject = pbObject;
+        }
+
+        // Publish the new table
+        CascWriteRelease(&m_pTable, pNewTable);
+
+        // The frozen table only contains indexes. Move its base if it's the same array
+        if(m_pbFrozenItems == pvOldBase)
+            CascWriteRelease(&m_pbFrozenItems, (LPBYTE)pvNewBase);
+        return true;
+    }
+
+    // Frees the tables that were replaced by growing or relocating the map.
+    // Note: Must not run in parallel with any other operation on the map
+    void FreeOldTables()
+    {
+        CASC_MAP_TABLE * pTable = m_pTable;
+        CASC_MAP_TABLE * pPrevTable;
+
+        if(pTable != NULL)
+        {
+            FinishGrowing(pTable);
+            while((pPrevTable = pTable->pPrevTable) != NULL)
+            {
+                pTable->pPrevTable = pPrevTable->pPrevTable;
+                CASC_FREE(pPrevTable);
+            }
+        }
+    }
+
+    // Moves all objects into a minimal perfect hash table. The objects must be items
+    // of the given array. Objects inserted after that go to a small hash table.
+    // Note: Must not run in parallel with any other operation on the map
+    DWORD Freeze(void * pvItemArray, size_t nItemCount, size_t cbItemSize)
+    {
+        CASC_FROZEN_MAP * pFrozen;
+        CASC_MAP_TABLE * pTable;
+        PULONGLONG KeyHashes;
+        LPBYTE pbItemArray = (LPBYTE)pvItemArray;
+        LPBYTE pbObject;
+        PDWORD ItemIndexes;
+        size_t nFrozenCount = FrozenCount();
+        size_t nObjects = 0;
+        DWORD dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+
+        // Check whether there is something to do
+        if(m_pTable == NULL || pbItemArray == NULL || cbItemSize == 0)
+            return ERROR_NOT_SUPPORTED;
+        if(m_ItemCount == 0)
+            return ERROR_NOT_SUPPORTED;
+
+        // A few objects in the hash table are not worth rebuilding the frozen table
+        if((m_ItemCount - nFrozenCount) * 16 < nFrozenCount)
+            return ERROR_SUCCESS;
+        if(m_pFrozen != NULL && (m_pbFrozenItems != pbItemArray || m_cbFrozenItem != cbItemSize))
+            return ERROR_NOT_SUPPORTED;
+        FinishGrowing(m_pTable);
+
+        // Allocate the arrays of key hashes and item indexes
+        KeyHashes = CASC_ALLOC<ULONGLONG>(m_ItemCount);
+        ItemIndexes = CASC_ALLOC<DWORD>(m_ItemCount);
+        if(KeyHashes != NULL && ItemIndexes != NULL)
+        {
+            // The objects that are already frozen
+            for(size_t i = 0; i < nFrozenCount; i++)
+            {
+                ItemIndexes[nObjects] = m_pFrozen->ItemAt(i);
+                KeyHashes[nObjects++] = GetKeyHash(pbItemArray + ItemIndexes[i] * cbItemSize + m_KeyOffset);
+            }
+
+            // The objects in the hash table. All of them must be items of the array
+            for(size_t i = 0; i < m_pTable->nTableSize; i++)
+            {
+                if((pbObject = (LPBYTE)m_pTable->Slots[i].pvObject) != NULL)
+                {
+                    if(pbObject < pbItemArray || pbObject >= pbItemArray + (nItemCount * cbItemSize) || ((pbObject - pbItemArray) % cbItemSize) != 0)
+                        break;
+                    ItemIndexes[nObjects] = (DWORD)((pbObject - pbItemArray) / cbItemSize);
+                    KeyHashes[nObjects++] = GetKeyHash(pbObject + m_KeyOffset);
+                }
+            }
+
+            // Build the perfect hash table
+            dwErrCode = ERROR_NOT_SUPPORTED;
+            if(nObjects == m_ItemCount && (pFrozen = new CASC_FROZEN_MAP()) != NULL)
+            {
+                if((dwErrCode = pFrozen->Create(KeyHashes, ItemIndexes, nObjects)) == ERROR_SUCCESS)
+                {
+                    // Replace the hash table by an empty one
+                    if((pTable = AllocateTable(MIN_HASH_TABLE_SIZE, NULL)) != NULL)
+                    {
+                        FreeTables();
+                        delete m_pFrozen;
+                        m_pTable = pTable;
+                        m_pbFrozenItems = pbItemArray;
+                        m_cbFrozenItem = cbItemSize;
+                        m_pFrozen = pFrozen;
+                        m_TotalProbeLength = m_MaxProbeLength = 0;
+                        pFrozen = NULL;
+                    }
+                    else
+                    {
+                        dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+                    }
+                }
+                delete pFrozen;
+            }
+        }
+
+        CASC_FREE(ItemIndexes);
+        CASC_FREE(KeyHashes);
+        return dwErrCode;
+    }
+
+    // Loads the frozen table that was saved from FrozenImage(). The map must be empty.
+    // Note: Must not run in parallel with any other operation on the map
+    DWORD LoadFrozen(LPBYTE pbImage, size_t cbImage, void * pvItemArray, size_t nItemCount, size_t cbItemSize)
+    {
+        CASC_FROZEN_MAP * pFrozen;
+        CASC_MAP_TABLE * pTable;
+        DWORD dwErrCode;
+
+        // Sanity check
+        if(m_pTable == NULL || m_ItemCount != 0 || pvItemArray == NULL || cbItemSize == 0)
+            return ERROR_NOT_SUPPORTED;
+
+        // Load and verify the frozen table
+        if((pFrozen = new CASC_FROZEN_MAP()) == NULL)
+            return ERROR_NOT_ENOUGH_MEMORY;
+        if((dwErrCode = pFrozen->Load(pbImage, cbImage)) == ERROR_SUCCESS)
+        {
+            for(size_t i = 0; i < pFrozen->ItemCount(); i++)
+            {
+                if(pFrozen->ItemAt(i) >= nItemCount)
+                {
+                    dwErrCode = ERROR_BAD_FORMAT;
+                    break;
+                }
+            }
+        }
+
+        // Replace the hash table by an empty one
+        if(dwErrCode == ERROR_SUCCESS)
+        {
+            if((pTable = AllocateTable(MIN_HASH_TABLE_SIZE, NULL)) != NULL)
+            {
+                FreeTables();
+                m_pTable = pTable;
+                m_pbFrozenItems = (LPBYTE)pvItemArray;
+                m_cbFrozenItem = cbItemSize;
+                m_pFrozen = pFrozen;
+                m_ItemCount = pFrozen->ItemCount();
+                return ERROR_SUCCESS;
+            }
+            dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+        }
+
+        delete pFrozen;
+        return dwErrCode;
+    }
+
+    // Returns the frozen table as a position-independent buffer, or NULL if the map is not frozen
+    LPBYTE FrozenImage(size_t & cbImage)
+    {
+        cbImage = (m_pFrozen != NULL) ? m_pFrozen->ImageSize() : 0;
+        return (m_pFrozen != NULL) ? m_pFrozen->ImageData() : NULL;
+    }
+
+    size_t FrozenCount()
+    {
+        return (m_pFrozen != NULL) ? m_pFrozen->ItemCount() : 0;
+    }
+
+    void * ItemAt(size_t nIndex)
+    {
+        assert(nIndex < HashTableSize());
+        return m_pTable->Slots[nIndex].pvObject;
+    }
+
+    size_t HashTableSize()
+    {
+        return (m_pTable != NULL) ? m_pTable->nTableSize : 0;
+    }
+
+    size_t ItemCount()
+    {
+        return m_ItemCount;
+    }
+
+    size_t KeyLength()
+    {
+        return KEY_LENGTH;
+    }
+
+    bool IsInitialized()
+    {
+        return (m_pTable != NULL);
+    }
+
+    // The frozen objects count as one probe each
+    void GetStats(CASC_MAP_STATS & Stats)
+    {
+        Stats.ItemCount = m_ItemCount;
+        Stats.HashTableSize = HashTableSize() + FrozenCount();
+        Stats.LoadFactor = (Stats.HashTableSize != 0) ? (m_ItemCount * 100 / Stats.HashTableSize) : 0;
+        Stats.TotalProbeLength = m_TotalProbeLength + FrozenCount();
+        Stats.MaxProbeLength = CASCLIB_MAX(m_MaxProbeLength, (size_t)((m_pFrozen != NULL) ? 1 : 0));
+        Stats.bGrowing = (m_pTable != NULL && m_pTable->pMigrateFrom != NULL);
+        Stats.bFrozen = (m_pFrozen != NULL);
+    }
+
+    void Free()
+    {
+        FreeTables();
+        delete m_pFrozen;
+        m_pFrozen = NULL;
+        m_pbFrozenItems = NULL;
+        m_ItemCount = 0;
+    }
+
+    protected:
+
+    struct CASC_MAP_SLOT
+    {
+        ULONGLONG Fingerprint;                  // The first 8 bytes of the key
+        void * volatile pvObject;               // The object. NULL if the slot is free
+    };
+
+    struct CASC_MAP_TABLE
+    {
+        CASC_MAP_TABLE * pPrevTable;            // The table that was replaced by this one. Freed by FreeOldTables() or with the map
+        CASC_MAP_TABLE * volatile pMigrateFrom; // The table whose objects are being moved to this one. NULL if all are moved
+        size_t nTableSize;                      // Size of the table, in entries. Always a power of two.
+        CASC_MAP_SLOT Slots[1];                 // Array of slots
+    };
+
+    void FreeTables()
+    {
+        CASC_MAP_TABLE * pTable = m_pTable;
+        CASC_MAP_TABLE * pPrevTable;
+
+        // Free the current table and all previous ones
+        while(pTable != NULL)
+        {
+            pPrevTable = pTable->pPrevTable;
+            CASC_FREE(pTable);
+            pTable = pPrevTable;
+        }
+        m_pTable = NULL;
+        m_MigratedSlots = 0;
+    }
+
+    void * FindInTable(CASC_MAP_TABLE * pTable, void * pvKey, PDWORD PtrIndex)
+    {
+        CASC_MAP_SLOT * pSlot;
+        ULONGLONG Fingerprint;
+        void * pvObject;
+        DWORD dwHashIndex;
+
+        // Construct the fingerprint and the hash index
+        Fingerprint = GetFingerprint(pvKey);
+        dwHashIndex = HashToIndex(pTable, Fingerprint);
+
+        // Search the hash table. Only compare the rest of the key if the fingerprint matches
+        while((pvObject = CascReadAcquire(&(pSlot = &pTable->Slots[dwHashIndex])->pvObject)) != NULL)
+        {
+            if(pSlot->Fingerprint == Fingerprint && CompareObject_Key(pvObject, pvKey))
+            {
+                if(PtrIndex != NULL)
+                    PtrIndex[0] = dwHashIndex;
+                return pvObject;
+            }
+
+            // Move to the next entry
+            dwHashIndex = HashToIndex(pTable, dwHashIndex + 1);
+        }
+        return NULL;
+    }
+
+    void * FindFrozenObject(CASC_FROZEN_MAP * pFrozen, void * pvKey, PDWORD PtrIndex)
+    {
+        LPBYTE pbObject;
+        DWORD dwItemIndex;
+
+        // Only compare the key if the fingerprint matches
+        if((dwItemIndex = pFrozen->FindItem(GetKeyHash(pvKey))) != CASC_INVALID_INDEX)
+        {
+            pbObject = CascReadAcquire(&m_pbFrozenItems) + (dwItemIndex * m_cbFrozenItem);
+            if(!memcmp(pbObject + m_KeyOffset, pvKey, KEY_LENGTH))
+            {
+                if(PtrIndex != NULL)
+                    PtrIndex[0] = dwItemIndex;
+                return pbObject;
+            }
+        }
+        return NULL;
+    }
+
+    static CASC_MAP_TABLE * AllocateTable(size_t nTableSize, CASC_MAP_TABLE * pPrevTable)
+    {
+        CASC_MAP_TABLE * pTable;
+        size_t cbTable = sizeof(CASC_MAP_TABLE) + (nTableSize - 1) * sizeof(CASC_MAP_SLOT);
+
+        if((pTable = (CASC_MAP_TABLE *)CASC_ALLOC_ZERO<BYTE>(cbTable)) != NULL)
+        {
+            pTable->pPrevTable = pPrevTable;
+            pTable->nTableSize = nTableSize;
+        }
+        return pTable;
+    }
+
+    // Moves a few objects from the previous table. The moved objects stay in the previous
+    // table too, so the readers that walk it still find them
+    void MigrateSlots(CASC_MAP_TABLE * pTable, size_t nSlotCount)
+    {
+        CASC_MAP_TABLE * pOldTable = pTable->pMigrateFrom;
+        CASC_MAP_SLOT * pSlot;
+
+        while(nSlotCount > 0 && m_MigratedSlots < pOldTable->nTableSize)
+        {
+            pSlot = &pOldTable->Slots[m_MigratedSlots];
+            if(pSlot->pvObject != NULL)
+                InsertToTable(pTable, pSlot->pvObject, (LPBYTE)pSlot->pvObject + m_KeyOffset);
+
+            m_MigratedSlots++;
+            nSlotCount--;
+        }
+
+        // All moved? The readers that see NULL find all objects in the current table
+        if(m_MigratedSlots >= pOldTable->nTableSize)
+        {
+            CascWriteRelease(&pTable->pMigrateFrom, (CASC_MAP_TABLE *)NULL);
+            m_MigratedSlots = 0;
+        }
+    }
+
+    void FinishGrowing(CASC_MAP_TABLE * pTable)
+    {
+        if(pTable != NULL && pTable->pMigrateFrom != NULL)
+            MigrateSlots(pTable, pTable->pMigrateFrom->nTableSize);
+    }
+
+    CASC_MAP_TABLE * GrowTable(CASC_MAP_TABLE * pOldTable)
+    {
+        CASC_MAP_TABLE * pNewTable;
+
+        // The previous growing must be complete
+        FinishGrowing(pOldTable);
+
+        // Check for overflow of the table size
+        if((pOldTable->nTableSize << 1) < pOldTable->nTableSize)
+            return NULL;
+
+        // Allocate new table with double size. The objects are moved to it by the next inserts
+        if((pNewTable = AllocateTable(pOldTable->nTableSize << 1, pOldTable)) == NULL)
+            return NULL;
+        pNewTable->pMigrateFrom = pOldTable;
+        m_MigratedSlots = 0;
+        m_TotalProbeLength = m_MaxProbeLength = 0;
+
+        // Publish the new table
+        CascWriteRelease(&m_pTable, pNewTable);
+        return pNewTable;
+    }
+
+    bool InsertToTable(CASC_MAP_TABLE * pTable, void * pvNewObject, void * pvKey)
+    {
+        CASC_MAP_SLOT * pSlot;
+        ULONGLONG Fingerprint;
+        DWORD dwHashIndex;
+        size_t nProbeLength = 1;
+
+        // Construct the fingerprint and the hash index
+        Fingerprint = GetFingerprint(pvKey);
+        dwHashIndex = HashToIndex(pTable, Fingerprint);
+
+        // Search the hash table
+        while((pSlot = &pTable->Slots[dwHashIndex])->pvObject != NULL)
+        {
+            // Check if hash being inserted conflicts with an existing hash
+            if(pSlot->Fingerprint == Fingerprint && CompareObject_Key(pSlot->pvObject, pvKey))
+                return false;
+
+            // Move to the next entry
+            dwHashIndex = HashToIndex(pTable, dwHashIndex + 1);
+            nProbeLength++;
+        }
+
+        // Write the fingerprint first, then publish the object
+        pSlot->Fingerprint = Fingerprint;
+        CascWriteRelease(&pSlot->pvObject, pvNewObject);
+        m_TotalProbeLength += nProbeLength;
+        m_MaxProbeLength = CASCLIB_MAX(m_MaxProbeLength, nProbeLength);
+        return true;
+    }
+
+    static ULONGLONG GetFingerprint(const void * pvKey)
+    {
+        ULONGLONG Fingerprint;
+
+        memcpy(&Fingerprint, pvKey, sizeof(ULONGLONG));
+        return Fingerprint;
+    }
+
+    // 64-bit hash of the entire key, for the frozen table
+    static ULONGLONG GetKeyHash(const void * pvKey)
+    {
+        ULONGLONG KeyRest = 0;
+
+        memcpy(&KeyRest, (LPBYTE)pvKey + sizeof(ULONGLONG), KEY_LENGTH - sizeof(ULONGLONG));
+        return GetFingerprint(pvKey) ^ (KeyRest * 0x9E3779B97F4A7C15ULL);
+    }
+
+    static DWORD HashToIndex(CASC_MAP_TABLE * pTable, ULONGLONG HashValue)
+    {
+        return (DWORD)(HashValue & (pTable->nTableSize - 1));
+    }
+
+    bool CompareObject_Key(void * pvObject, void * pvKey)
+    {
+        LPBYTE pbObjectKey = (LPBYTE)pvObject + m_KeyOffset + sizeof(ULONGLONG);
+        return (memcmp(pbObjectKey, (LPBYTE)pvKey + sizeof(ULONGLONG), KEY_LENGTH - sizeof(ULONGLONG)) == 0);
+    }
+
+    CASC_MAP_TABLE * volatile m_pTable;         // The current hash table
+    CASC_FROZEN_MAP * volatile m_pFrozen;       // The frozen table, if the map was frozen
+    LPBYTE volatile m_pbFrozenItems;            // The array of items the frozen table refers to
+    size_t m_cbFrozenItem;                      // Size of one item in the array
+    size_t m_MigratedSlots;                     // Number of slots of the previous table that were moved to the current table
+    size_t m_ItemCount;                         // Number of objects in the map, including the frozen ones
+    size_t m_KeyOffset;                         // How far is the key from the begin of the objects (in bytes)
+    size_t m_TotalProbeLength;                  // Sum of probe lengths of the objects in the current table
+    size_t m_MaxProbeLength;                    // The longest probe length in the current table
 };
 
 //-----------------------------------------------------------------------------
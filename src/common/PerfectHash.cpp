@@ -0,0 +1,310 @@
+/*****************************************************************************/
+/* PerfectHash.cpp                        Copyright (c) Ladislav Zezula 2026 */
+/*---------------------------------------------------------------------------*/
+/* Minimal perfect hash tables for maps that do not change anymore           */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 17.10.26  1.00  Lad  Created                                              */
+/*****************************************************************************/
+
+#define __CASCLIB_SELF__
+#include "../CascLib.h"
+#include "../CascCommon.h"
+
+//-----------------------------------------------------------------------------
+// Local defines
+
+#define KEYS_PER_BUCKET         4               // Average number of keys per bucket
+#define EXTRA_POSITIONS         10              // The table has one extra position per this number of keys
+#define MAX_BUILD_ATTEMPTS      4               // Number of seeds to try before giving up
+
+#define ALIGN_TO_8(size)        (((size) + 7) & ~(size_t)7)
+
+//-----------------------------------------------------------------------------
+// Local functions
+
+static size_t GetImageSize(size_t nItemCount, size_t nTableSize, size_t nBucketCount)
+{
+    return sizeof(CASC_FROZEN_HEADER) +
+           ALIGN_TO_8(nBucketCount * sizeof(USHORT)) +
+           ALIGN_TO_8((nTableSize - nItemCount) * sizeof(DWORD)) +
+           (nItemCount * sizeof(CASC_FROZEN_SLOT));
+}
+
+static bool IsPositionTaken(LPBYTE TakenBits, DWORD dwPosition)
+{
+    return (TakenBits[dwPosition / 8] & (1 << (dwPosition & 7))) ? true : false;
+}
+
+static void SetPositionTaken(LPBYTE TakenBits, DWORD dwPosition)
+{
+    TakenBits[dwPosition / 8] |= (BYTE)(1 << (dwPosition & 7));
+}
+
+//-----------------------------------------------------------------------------
+// CASC_FROZEN_MAP class
+
+CASC_FROZEN_MAP::CASC_FROZEN_MAP()
+{
+    m_pbImage = NULL;
+    m_cbImage = 0;
+    m_pHeader = NULL;
+    m_Pilots = NULL;
+    m_Remap = NULL;
+    m_Slots = NULL;
+}
+
+CASC_FROZEN_MAP::~CASC_FROZEN_MAP()
+{
+    Free();
+}
+
+DWORD CASC_FROZEN_MAP::Create(const ULONGLONG * KeyHashes, const DWORD * ItemIndexes, size_t nItemCount)
+{
+    DWORD dwErrCode = ERROR_CAN_NOT_COMPLETE;
+
+    // The positions and item indexes are 32-bit
+    if(nItemCount == 0 || nItemCount >= (CASC_INVALID_INDEX - (CASC_INVALID_INDEX / EXTRA_POSITIONS) - 1))
+        return ERROR_INVALID_PARAMETER;
+
+    // Building may fail if some bucket finds no pilot. In that case, we try another seed
+    for(DWORD i = 0; i < MAX_BUILD_ATTEMPTS; i++)
+    {
+        dwErrCode = BuildWithSeed(KeyHashes, ItemIndexes, nItemCount, MixHash64(i + 1));
+        if(dwErrCode != ERROR_CAN_NOT_COMPLETE)
+            break;
+    }
+
+    // Free the partially built table on failure
+    if(dwErrCode != ERROR_SUCCESS)
+        Free();
+    return dwErrCode;
+}
+
+DWORD CASC_FROZEN_MAP::Load(LPBYTE pbImage, size_t cbImage)
+{
+    PCASC_FROZEN_HEADER pHeader = (PCASC_FROZEN_HEADER)pbImage;
+
+    // Verify the header
+    if(cbImage < sizeof(CASC_FROZEN_HEADER) || pHeader->Signature != CASC_FROZEN_SIGNATURE)
+        return ERROR_BAD_FORMAT;
+    if(pHeader->ItemCount == 0 || pHeader->TableSize < pHeader->ItemCount || pHeader->BucketCount < 2)
+        return ERROR_BAD_FORMAT;
+    if(cbImage != GetImageSize(pHeader->ItemCount, pHeader->TableSize, pHeader->BucketCount))
+        return ERROR_BAD_FORMAT;
+
+    // Copy the table
+    if(!AllocateImage(pHeader->ItemCount, pHeader->TableSize, pHeader->BucketCount))
+        return ERROR_NOT_ENOUGH_MEMORY;
+    memcpy(m_pbImage, pbImage, cbImage);
+
+    // The remapped positions must be in the table
+    for(DWORD i = 0; i < (m_pHeader->TableSize - m_pHeader->ItemCount); i++)
+    {
+        if(m_Remap[i] >= m_pHeader->ItemCount)
+        {
+            Free();
+            return ERROR_BAD_FORMAT;
+        }
+    }
+    return ERROR_SUCCESS;
+}
+
+void CASC_FROZEN_MAP::Free()
+{
+    CASC_FREE(m_pbImage);
+    m_cbImage = 0;
+    m_pHeader = NULL;
+    m_Pilots = NULL;
+    m_Remap = NULL;
+    m_Slots = NULL;
+}
+
+DWORD CASC_FROZEN_MAP::BuildWithSeed(const ULONGLONG * KeyHashes, const DWORD * ItemIndexes, size_t nItemCount, ULONGLONG Seed)
+{
+    PDWORD BucketStarts = NULL;                 // Index of the first key of each bucket in KeysByBucket
+    PDWORD KeysByBucket = NULL;                 // Key indexes, sorted by bucket
+    PDWORD BucketOrder = NULL;                  // Buckets, sorted by size (largest first)
+    PDWORD Positions = NULL;                    // Positions of the keys of the current bucket
+    PULONGLONG BucketHashes = NULL;             // Key hashes of the current bucket
+    LPBYTE TakenBits = NULL;                    // Bit array of the taken positions
+    size_t nTableSize = nItemCount + (nItemCount / EXTRA_POSITIONS) + 1;
+    size_t nBucketCount = (nItemCount / KEYS_PER_BUCKET) + 2;
+    size_t nMaxBucketSize = 0;
+    DWORD dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+
+    // Allocate the table and all work buffers
+    if(!AllocateImage(nItemCount, nTableSize, nBucketCount))
+        return ERROR_NOT_ENOUGH_MEMORY;
+    m_pHeader->Seed = Seed;
+
+    BucketStarts = CASC_ALLOC_ZERO<DWORD>(nBucketCount + 1);
+    KeysByBucket = CASC_ALLOC<DWORD>(nItemCount);
+    BucketOrder = CASC_ALLOC<DWORD>(nBucketCount);
+    TakenBits = CASC_ALLOC_ZERO<BYTE>((nTableSize / 8) + 1);
+    if(BucketStarts && KeysByBucket && BucketOrder && TakenBits)
+    {
+        PDWORD SizeStarts;
+        size_t nSizeCount;
+
+        // Sort the keys by bucket (counting sort)
+        for(size_t i = 0; i < nItemCount; i++)
+            BucketStarts[GetBucket(KeyHashes[i]) + 1]++;
+        for(size_t i = 0; i < nBucketCount; i++)
+        {
+            nMaxBucketSize = CASCLIB_MAX(nMaxBucketSize, BucketStarts[i + 1]);
+            BucketStarts[i + 1] += BucketStarts[i];
+        }
+        for(size_t i = 0; i < nItemCount; i++)
+            KeysByBucket[BucketStarts[GetBucket(KeyHashes[i])]++] = (DWORD)i;
+        memmove(BucketStarts + 1, BucketStarts, nBucketCount * sizeof(DWORD));
+        BucketStarts[0] = 0;
+
+        // Sort the buckets by size, largest first (counting sort)
+        nSizeCount = nMaxBucketSize + 1;
+        Positions = CASC_ALLOC<DWORD>(nMaxBucketSize);
+        BucketHashes = CASC_ALLOC<ULONGLONG>(nMaxBucketSize);
+        SizeStarts = CASC_ALLOC_ZERO<DWORD>(nSizeCount + 1);
+        if(Positions != NULL && BucketHashes != NULL && SizeStarts != NULL)
+        {
+            for(size_t i = 0; i < nBucketCount; i++)
+                SizeStarts[nMaxBucketSize - (BucketStarts[i + 1] - BucketStarts[i]) + 1]++;
+            for(size_t i = 0; i < nSizeCount; i++)
+                SizeStarts[i + 1] += SizeStarts[i];
+            for(size_t i = 0; i < nBucketCount; i++)
+                BucketOrder[SizeStarts[nMaxBucketSize - (BucketStarts[i + 1] - BucketStarts[i])]++] = (DWORD)i;
+            dwErrCode = ERROR_SUCCESS;
+        }
+        CASC_FREE(SizeStarts);
+    }
+
+    // Find the pilot of each bucket, largest buckets first
+    for(size_t i = 0; i < nBucketCount && dwErrCode == ERROR_SUCCESS; i++)
+    {
+        DWORD dwBucket = BucketOrder[i];
+        DWORD dwFirstKey = BucketStarts[dwBucket];
+        DWORD dwKeyCount = BucketStarts[dwBucket + 1] - dwFirstKey;
+        DWORD dwPilot;
+
+        // The rest of the buckets is empty
+        if(dwKeyCount == 0)
+            break;
+
+        // Copy the key hashes of the bucket. Two keys with the same hash can never be separated
+        for(DWORD j = 0; j < dwKeyCount; j++)
+        {
+            BucketHashes[j] = GetPositionHash(KeyHashes[KeysByBucket[dwFirstKey + j]]);
+            for(DWORD k = 0; k < j; k++)
+            {
+                if(BucketHashes[j] == BucketHashes[k])
+                    dwErrCode = ERROR_ALREADY_EXISTS;
+            }
+        }
+
+        // Try the pilots until all keys of the bucket land on free positions
+        for(dwPilot = 0; dwPilot <= CASC_FROZEN_MAX_PILOT && dwErrCode == ERROR_SUCCESS; dwPilot++)
+        {
+            DWORD j;
+
+            for(j = 0; j < dwKeyCount; j++)
+            {
+                DWORD k;
+
+                Positions[j] = GetPosition(BucketHashes[j], dwPilot);
+                if(IsPositionTaken(TakenBits, Positions[j]))
+                    break;
+
+                // The position must not collide with other keys in the same bucket
+                for(k = 0; k < j && Positions[k] != Positions[j]; k++);
+                if(k < j)
+                    break;
+            }
+
+            // All keys of the bucket found a free position
+            if(j == dwKeyCount)
+            {
+                for(j = 0; j < dwKeyCount; j++)
+                    SetPositionTaken(TakenBits, Positions[j]);
+                m_Pilots[dwBucket] = (USHORT)dwPilot;
+                break;
+            }
+        }
+
+        // No pilot found. The caller will try another seed
+        if(dwPilot > CASC_FROZEN_MAX_PILOT && dwErrCode == ERROR_SUCCESS)
+            dwErrCode = ERROR_CAN_NOT_COMPLETE;
+    }
+
+    // Remap the keys from the extra positions to the free positions
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        DWORD dwFreePosition = 0;
+
+        for(DWORD dwPosition = (DWORD)nItemCount; dwPosition < nTableSize; dwPosition++)
+        {
+            if(IsPositionTaken(TakenBits, dwPosition))
+            {
+                while(IsPositionTaken(TakenBits, dwFreePosition))
+                    dwFreePosition++;
+                m_Remap[dwPosition - nItemCount] = dwFreePosition++;
+            }
+        }
+
+        // Fill the slots
+        for(size_t i = 0; i < nItemCount; i++)
+        {
+            DWORD dwPosition = GetPosition(KeyHashes[i]);
+
+            if(dwPosition >= nItemCount)
+                dwPosition = m_Remap[dwPosition - nItemCount];
+            m_Slots[dwPosition].Fingerprint = GetFingerprint(KeyHashes[i]);
+            m_Slots[dwPosition].ItemIndex = ItemIndexes[i];
+        }
+    }
+
+    // Free the work buffers
+    CASC_FREE(TakenBits);
+    CASC_FREE(BucketHashes);
+    CASC_FREE(Positions);
+    CASC_FREE(BucketOrder);
+    CASC_FREE(KeysByBucket);
+    CASC_FREE(BucketStarts);
+    return dwErrCode;
+}
+
+bool CASC_FROZEN_MAP::AllocateImage(size_t nItemCount, size_t nTableSize, size_t nBucketCount)
+{
+    // Free the previous table, if any
+    Free();
+
+    // Allocate the buffer for the entire table
+    m_cbImage = GetImageSize(nItemCount, nTableSize, nBucketCount);
+    if((m_pbImage = CASC_ALLOC_ZERO<BYTE>(m_cbImage)) == NULL)
+        return false;
+
+    // Fill the header and set the pointers
+    m_pHeader = (PCASC_FROZEN_HEADER)m_pbImage;
+    m_pHeader->Signature = CASC_FROZEN_SIGNATURE;
+    m_pHeader->ItemCount = (DWORD)nItemCount;
+    m_pHeader->TableSize = (DWORD)nTableSize;
+    m_pHeader->BucketCount = (DWORD)nBucketCount;
+    SetImagePointers();
+    return true;
+}
+
+void CASC_FROZEN_MAP::SetImagePointers()
+{
+    LPBYTE pbImagePtr = m_pbImage + sizeof(CASC_FROZEN_HEADER);
+
+    m_Pilots = (USHORT *)pbImagePtr;
+    pbImagePtr += ALIGN_TO_8(m_pHeader->BucketCount * sizeof(USHORT));
+
+    m_Remap = (PDWORD)pbImagePtr;
+    pbImagePtr += ALIGN_TO_8((m_pHeader->TableSize - m_pHeader->ItemCount) * sizeof(DWORD));
+
+    m_Slots = (PCASC_FROZEN_SLOT)pbImagePtr;
+
+    // The dense buckets are at the beginning
+    m_DenseBuckets = (DWORD)(((ULONGLONG)m_pHeader->BucketCount * 3) / 10) + 1;
+}
@@ -0,0 +1,171 @@
+/*****************************************************************************/
+/* PerfectHash.h                          Copyright (c) Ladislav Zezula 2026 */
+/*---------------------------------------------------------------------------*/
+/* Minimal perfect hash tables for maps that do not change anymore           */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 17.10.26  1.00  Lad  Created                                              */
+/*****************************************************************************/
+
+#ifndef __CASC_PERFECT_HASH_H__
+#define __CASC_PERFECT_HASH_H__
+
+//-----------------------------------------------------------------------------
+// Structures
+//
+// The hash function maps each key to a bucket. 60 % of the keys go to 30 % of the buckets,
+// so the large buckets are placed while the table is still empty. Each bucket
+// has a 16-bit "pilot", chosen at build time so that the keys of the bucket land
+// on positions not used by any other key. The table has 10 % more positions than keys;
+// the keys that land on the extra positions are remapped to the free positions.
+// A lookup is always one pilot read and one slot read.
+//
+// The whole table is a single position-independent buffer, so it can be saved
+// to a file and loaded back:
+//
+//  CASC_FROZEN_HEADER
+//  USHORT Pilots[BucketCount]                      // Aligned to 8 bytes
+//  DWORD  Remap[TableSize - ItemCount]             // Aligned to 8 bytes
+//  CASC_FROZEN_SLOT Slots[ItemCount]
+//
+
+#define CASC_FROZEN_SIGNATURE   0x4E5A5246      // 'FRZN'
+#define CASC_FROZEN_MAX_PILOT   0xFFFF          // The largest pilot value
+#define CASC_FROZEN_DENSE_KEYS  0x9999999A      // 60 % of the 32-bit range: keys that go to the dense buckets
+
+typedef struct _CASC_FROZEN_HEADER
+{
+    DWORD Signature;                            // CASC_FROZEN_SIGNATURE
+    DWORD ItemCount;                            // Number of keys in the table
+    DWORD TableSize;                            // Number of positions of the hash function. Slightly larger than ItemCount
+    DWORD BucketCount;                          // Number of buckets, each of them has one pilot
+    ULONGLONG Seed;                             // Seed of the hash function
+} CASC_FROZEN_HEADER, *PCASC_FROZEN_HEADER;
+
+typedef struct _CASC_FROZEN_SLOT
+{
+    DWORD Fingerprint;                          // Fingerprint of the key. Most of the misses are rejected by it
+    DWORD ItemIndex;                            // Index of the object in the item array of the map
+} CASC_FROZEN_SLOT, *PCASC_FROZEN_SLOT;
+
+//-----------------------------------------------------------------------------
+// Hashing functions
+
+// Finalizer of MurmurHash3
+inline ULONGLONG MixHash64(ULONGLONG Value)
+{
+    Value = (Value ^ (Value >> 33)) * 0xFF51AFD7ED558CCDULL;
+    Value = (Value ^ (Value >> 33)) * 0xC4CEB9FE1A85EC53ULL;
+    return Value ^ (Value >> 33);
+}
+
+// Maps a 32-bit value to the range of [0, nRange) without division
+inline DWORD ReduceHash32(DWORD dwValue, DWORD nRange)
+{
+    return (DWORD)(((ULONGLONG)dwValue * nRange) >> 32);
+}
+
+//-----------------------------------------------------------------------------
+// The frozen map class. It only maps key hashes to item indexes. The caller
+// must compare the key of the item, because keys that are not in the map
+// are also mapped to some item
+
+class CASC_FROZEN_MAP
+{
+    public:
+
+    CASC_FROZEN_MAP();
+    ~CASC_FROZEN_MAP();
+
+    // Builds the table from the hashes of the keys and their item indexes
+    DWORD Create(const ULONGLONG * KeyHashes, const DWORD * ItemIndexes, size_t nItemCount);
+
+    // Loads the table that was previously saved from ImageData()
+    DWORD Load(LPBYTE pbImage, size_t cbImage);
+    void Free();
+
+    // Returns the item index for the key hash, or CASC_INVALID_INDEX if the key is surely not in the map
+    DWORD FindItem(ULONGLONG KeyHash)
+    {
+        PCASC_FROZEN_SLOT pSlot;
+        DWORD dwPosition;
+
+        // Get the position. The extra positions are remapped to the free ones
+        if((dwPosition = GetPosition(KeyHash)) >= m_pHeader->ItemCount)
+            dwPosition = m_Remap[dwPosition - m_pHeader->ItemCount];
+
+        // Check the fingerprint
+        pSlot = m_Slots + dwPosition;
+        return (pSlot->Fingerprint == GetFingerprint(KeyHash)) ? pSlot->ItemIndex : CASC_INVALID_INDEX;
+    }
+
+    // Returns the item index at the given slot
+    DWORD ItemAt(size_t nIndex)
+    {
+        assert(nIndex < ItemCount());
+        return m_Slots[nIndex].ItemIndex;
+    }
+
+    size_t ItemCount()
+    {
+        return (m_pHeader != NULL) ? m_pHeader->ItemCount : 0;
+    }
+
+    LPBYTE ImageData()
+    {
+        return m_pbImage;
+    }
+
+    size_t ImageSize()
+    {
+        return m_cbImage;
+    }
+
+    protected:
+
+    DWORD BuildWithSeed(const ULONGLONG * KeyHashes, const DWORD * ItemIndexes, size_t nItemCount, ULONGLONG Seed);
+    bool AllocateImage(size_t nItemCount, size_t nTableSize, size_t nBucketCount);
+    void SetImagePointers();
+
+    static DWORD GetFingerprint(ULONGLONG KeyHash)
+    {
+        return (DWORD)(KeyHash >> 32) ^ (DWORD)(KeyHash);
+    }
+
+    DWORD GetBucket(ULONGLONG KeyHash)
+    {
+        ULONGLONG BucketHash = KeyHash ^ m_pHeader->Seed;
+
+        if((DWORD)(BucketHash) < CASC_FROZEN_DENSE_KEYS)
+            return ReduceHash32((DWORD)(BucketHash >> 32), m_DenseBuckets);
+        return m_DenseBuckets + ReduceHash32((DWORD)(BucketHash >> 32), m_pHeader->BucketCount - m_DenseBuckets);
+    }
+
+    // The key part of the position. The build computes it only once per key
+    ULONGLONG GetPositionHash(ULONGLONG KeyHash)
+    {
+        return MixHash64(KeyHash ^ m_pHeader->Seed);
+    }
+
+    DWORD GetPosition(ULONGLONG PositionHash, DWORD dwPilot)
+    {
+        ULONGLONG Hash = (PositionHash ^ MixHash64(dwPilot + 1)) * 0x9E3779B97F4A7C15ULL;
+        return ReduceHash32((DWORD)(Hash >> 32), m_pHeader->TableSize);
+    }
+
+    DWORD GetPosition(ULONGLONG KeyHash)
+    {
+        return GetPosition(GetPositionHash(KeyHash), m_Pilots[GetBucket(KeyHash)]);
+    }
+
+    LPBYTE m_pbImage;                           // The table buffer (header, pilots, remap and slots)
+    size_t m_cbImage;                           // Size of the table buffer, in bytes
+    PCASC_FROZEN_HEADER m_pHeader;              // Pointer to the header in the table buffer
+    USHORT * m_Pilots;                          // Pointer to the pilots in the table buffer
+    PDWORD m_Remap;                             // Pointer to the remapped positions in the table buffer
+    PCASC_FROZEN_SLOT m_Slots;                  // Pointer to the slots in the table buffer
+    DWORD m_DenseBuckets;                       // Number of the dense buckets (30 % of all buckets)
+};
+
+#endif // __CASC_PERFECT_HASH_H__
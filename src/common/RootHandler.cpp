@@ -148,3 +148,13 @@ size_t TFileTreeRoot::GetMaxFileIndex()
 {
     return FileTree.GetMaxFileIndex();
 }
+
+DWORD TFileTreeRoot::FreezeMaps()
+{
+    return FileTree.Freeze();
+}
+
+void TFileTreeRoot::FreeOldBuffers()
+{
+    FileTree.FreeOldBuffers();
+}
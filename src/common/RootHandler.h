@@ -98,6 +98,16 @@ struct TRootHandler
         return 0;
     }
 
+    // Converts the lookup maps to their read-only form. Called at the end of storage open
+    virtual DWORD FreezeMaps()
+    {
+        return ERROR_NOT_SUPPORTED;
+    }
+
+    // Frees the memory that was replaced while the root file was loaded. Called at the end of storage open
+    virtual void FreeOldBuffers()
+    {}
+
     // Returns the list of features
     DWORD GetFeatures()
     {
@@ -126,6 +136,8 @@ struct TFileTreeRoot : public TRootHandler
     bool GetInfo(PCASC_CKEY_ENTRY pCKeyEntry, struct _CASC_FILE_FULL_INFO * pFileInfo);
     size_t Copy(TRootHandler * pRoot);
     size_t GetMaxFileIndex();
+    DWORD FreezeMaps();
+    void FreeOldBuffers();
 
     protected:
 
@@ -357,6 +357,7 @@ void CASC_SOCKET::Delete()
 
 CASC_SOCKET_CACHE::CASC_SOCKET_CACHE()
 {
+    CascInitLock(Lock);
     pFirst = pLast = NULL;
     dwRefCount = 0;
 }
@@ -364,17 +365,25 @@ CASC_SOCKET_CACHE::CASC_SOCKET_CACHE()
 CASC_SOCKET_CACHE::~CASC_SOCKET_CACHE()
 {
     PurgeAll();
+    CascFreeLock(Lock);
 }
 
-PCASC_SOCKET CASC_SOCKET_CACHE::Find(const char * hostName, unsigned portNum)
+PCASC_SOCKET CASC_SOCKET_CACHE::FindAndAddRef(const char * hostName, unsigned portNum)
 {
     PCASC_SOCKET pSocket;
 
+    // The reference must be added under the lock,
+    // so the socket can't be unlinked by another thread meanwhile
+    CascLock(Lock);
     for(pSocket = pFirst; pSocket != NULL; pSocket = pSocket->pNext)
     {
         if(!_stricmp(pSocket->hostName, hostName) && (pSocket->portNum == portNum))
+        {
+            pSocket->AddRef();
             break;
+        }
     }
+    CascUnlock(Lock);
 
     return pSocket;
 }
@@ -383,6 +392,8 @@ PCASC_SOCKET CASC_SOCKET_CACHE::InsertSocket(PCASC_SOCKET pSocket)
 {
     if(pSocket != NULL && pSocket->pCache == NULL)
     {
+        CascLock(Lock);
+
         // Do we have caching turned on?
         if(dwRefCount > 0)
         {
@@ -404,6 +415,8 @@ PCASC_SOCKET CASC_SOCKET_CACHE::InsertSocket(PCASC_SOCKET pSocket)
             // Mark the socket as cached
             pSocket->pCache = this;
         }
+
+        CascUnlock(Lock);
     }
 
     return pSocket;
@@ -414,6 +427,8 @@ void CASC_SOCKET_CACHE::UnlinkSocket(PCASC_SOCKET pSocket)
     // Only if it's a valid socket
     if(pSocket != NULL)
     {
+        CascLock(Lock);
+
         // Check the first and the last items
         if(pSocket == pFirst)
             pFirst = pSocket->pNext;
@@ -425,6 +440,8 @@ void CASC_SOCKET_CACHE::UnlinkSocket(PCASC_SOCKET pSocket)
             pSocket->pPrev->pNext = pSocket->pNext;
         if(pSocket->pNext != NULL)
             pSocket->pNext->pPrev = pSocket->pPrev;
+
+        CascUnlock(Lock);
     }
 }
 
@@ -484,11 +501,7 @@ PCASC_SOCKET sockets_connect(const char * hostName, unsigned portNum)
     PCASC_SOCKET pSocket;
 
     // Try to find the item in the cache
-    if((pSocket = SocketCache.Find(hostName, portNum)) != NULL)
-    {
-        pSocket->AddRef();
-    }
-    else
+    if((pSocket = SocketCache.FindAndAddRef(hostName, portNum)) == NULL)
     {
         // Create new socket and connect it to the remote host
         pSocket = CASC_SOCKET::Connect(hostName, portNum);
@@ -88,7 +88,7 @@ class CASC_SOCKET_CACHE
     CASC_SOCKET_CACHE();
     ~CASC_SOCKET_CACHE();
 
-    PCASC_SOCKET Find(const char * hostName, unsigned portNum);
+    PCASC_SOCKET FindAndAddRef(const char * hostName, unsigned portNum);
     PCASC_SOCKET InsertSocket(PCASC_SOCKET pSocket);
     void UnlinkSocket(PCASC_SOCKET pSocket);
 
@@ -99,6 +99,7 @@ class CASC_SOCKET_CACHE
 
     PCASC_SOCKET pFirst;
     PCASC_SOCKET pLast;
+    CASC_LOCK Lock;                     // Lock for the socket chain. Sockets may be connected from multiple threads
     DWORD dwRefCount;
 };
 
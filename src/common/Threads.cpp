@@ -0,0 +1,386 @@
+/*****************************************************************************/
+/* Threads.cpp                            Copyright (c) Ladislav Zezula 2026 */
+/*---------------------------------------------------------------------------*/
+/* Worker thread pool for CascLib                                            */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 17.10.26  1.00  Lad  Created                                              */
+/*****************************************************************************/
+
+#define __CASCLIB_SELF__
+#include "../CascLib.h"
+#include "../CascCommon.h"
+
+//-----------------------------------------------------------------------------
+// Local defines
+
+#define INITIAL_QUEUE_SIZE      0x100           // Initial size of the work item queue
+#define CHUNKS_PER_THREAD       4               // ParallelFor: number of chunks per worker thread
+
+// Parameter for one chunk of ParallelFor
+typedef struct _CASC_PARALLEL_CHUNK
+{
+    PFNPARALLELITEM PfnItem;
+    void * pvParam;
+    size_t nStartIndex;
+    size_t nEndIndex;
+} CASC_PARALLEL_CHUNK, *PCASC_PARALLEL_CHUNK;
+
+//-----------------------------------------------------------------------------
+// Platform-specific functions
+
+#ifdef CASCLIB_PLATFORM_WINDOWS
+
+#define CascInitCondition(Cond)         InitializeConditionVariable(&Cond)
+#define CascFreeCondition(Cond)         /* Nothing */
+#define CascWaitCondition(Cond, Lock)   SleepConditionVariableCS(&Cond, &Lock, INFINITE)
+#define CascBroadcastCondition(Cond)    WakeAllConditionVariable(&Cond)
+
+static bool CascCreateThread(CASC_THREAD & hThread, LPTHREAD_START_ROUTINE PfnThread, void * pvParam)
+{
+    hThread = CreateThread(NULL, 0, PfnThread, pvParam, 0, NULL);
+    return (hThread != NULL);
+}
+
+static void CascJoinThread(CASC_THREAD & hThread)
+{
+    WaitForSingleObject(hThread, INFINITE);
+    CloseHandle(hThread);
+}
+
+#else
+
+#define CascInitCondition(Cond)         pthread_cond_init(&Cond, NULL)
+#define CascFreeCondition(Cond)         pthread_cond_destroy(&Cond)
+#define CascWaitCondition(Cond, Lock)   pthread_cond_wait(&Cond, &Lock)
+#define CascBroadcastCondition(Cond)    pthread_cond_broadcast(&Cond)
+
+static bool CascCreateThread(CASC_THREAD & hThread, void * (*PfnThread)(void *), void * pvParam)
+{
+    return (pthread_create(&hThread, NULL, PfnThread, pvParam) == 0);
+}
+
+static void CascJoinThread(CASC_THREAD & hThread)
+{
+    pthread_join(hThread, NULL);
+}
+
+#endif
+
+//-----------------------------------------------------------------------------
+// CASC_WORKER_POOL class
+
+CASC_WORKER_POOL::CASC_WORKER_POOL()
+{
+    CascInitLock(m_Lock);
+    CascInitCondition(m_WorkAvailable);
+    CascInitCondition(m_WorkCompleted);
+    m_Queue = NULL;
+    m_QueueSize = 0;
+    m_QueueHead = 0;
+    m_QueueCount = 0;
+    m_ThreadCount = 0;
+    m_bShutdown = false;
+}
+
+CASC_WORKER_POOL::~CASC_WORKER_POOL()
+{
+    Free();
+    CascFreeCondition(m_WorkCompleted);
+    CascFreeCondition(m_WorkAvailable);
+    CascFreeLock(m_Lock);
+}
+
+DWORD CASC_WORKER_POOL::Create(size_t nThreadCount)
+{
+    // Sanity checks
+    assert(m_ThreadCount == 0);
+    assert(m_Queue == NULL);
+
+    // One thread means no threads at all - everything runs on the caller's thread
+    nThreadCount = CASCLIB_MIN(nThreadCount, CASC_MAX_WORKER_THREADS);
+    if(nThreadCount <= 1)
+        return ERROR_SUCCESS;
+
+    // Allocate the work item queue
+    if((m_Queue = CASC_ALLOC<CASC_WORK_ITEM>(INITIAL_QUEUE_SIZE)) == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    m_QueueSize = INITIAL_QUEUE_SIZE;
+    m_bShutdown = false;
+
+    // Start the worker threads. If we fail to create some, we continue with the ones we have
+    for(size_t i = 0; i < nThreadCount; i++)
+    {
+        if(!CascCreateThread(m_Threads[i], WorkerThread, this))
+            break;
+        m_ThreadCount++;
+    }
+
+    // If no thread has been created, we're running in single-threaded mode
+    if(m_ThreadCount == 0)
+        CASC_FREE(m_Queue);
+    return ERROR_SUCCESS;
+}
+
+void CASC_WORKER_POOL::Free()
+{
+    // Tell all threads to terminate
+    CascLock(m_Lock);
+    m_bShutdown = true;
+    CascBroadcastCondition(m_WorkAvailable);
+    CascUnlock(m_Lock);
+
+    // Wait until all threads terminate
+    for(size_t i = 0; i < m_ThreadCount; i++)
+        CascJoinThread(m_Threads[i]);
+    m_ThreadCount = 0;
+
+    // Free the queue
+    CASC_FREE(m_Queue);
+    m_QueueSize = m_QueueHead = m_QueueCount = 0;
+}
+
+DWORD CASC_WORKER_POOL::Submit(CASC_WORK_GROUP & Group, PFNWORKITEM PfnWorkItem, void * pvParam)
+{
+    CASC_WORK_ITEM WorkItem = {PfnWorkItem, pvParam, &Group};
+    DWORD dwErrCode = ERROR_SUCCESS;
+
+    // No threads: Execute the item directly
+    if(m_ThreadCount == 0)
+    {
+        Group.PendingItems++;
+        RunWorkItem(WorkItem);
+        return ERROR_SUCCESS;
+    }
+
+    CascLock(m_Lock);
+
+    // Enlarge the ring buffer, if needed
+    if(m_QueueCount >= m_QueueSize)
+    {
+        PCASC_WORK_ITEM NewQueue;
+
+        if((NewQueue = CASC_ALLOC<CASC_WORK_ITEM>(m_QueueSize * 2)) != NULL)
+        {
+            for(size_t i = 0; i < m_QueueCount; i++)
+                NewQueue[i] = m_Queue[(m_QueueHead + i) % m_QueueSize];
+
+            CASC_FREE(m_Queue);
+            m_Queue = NewQueue;
+            m_QueueSize = m_QueueSize * 2;
+            m_QueueHead = 0;
+        }
+        else
+        {
+            dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+        }
+    }
+
+    // Insert the work item to the queue and wake one of the threads
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        m_Queue[(m_QueueHead + m_QueueCount) % m_QueueSize] = WorkItem;
+        m_QueueCount++;
+        Group.PendingItems++;
+        CascBroadcastCondition(m_WorkAvailable);
+    }
+
+    CascUnlock(m_Lock);
+    return dwErrCode;
+}
+
+DWORD CASC_WORKER_POOL::Wait(CASC_WORK_GROUP & Group)
+{
+    CASC_WORK_ITEM WorkItem;
+
+    // Without threads, everything has already been done
+    if(m_ThreadCount != 0)
+    {
+        CascLock(m_Lock);
+        while(Group.PendingItems != 0)
+        {
+            // Help with processing the queue instead of just waiting
+            if(PopWorkItem(WorkItem))
+            {
+                CascUnlock(m_Lock);
+                RunWorkItem(WorkItem);
+                CascLock(m_Lock);
+                continue;
+            }
+
+            // Nothing in the queue: wait until one of the items completes
+            CascWaitCondition(m_WorkCompleted, m_Lock);
+        }
+        CascUnlock(m_Lock);
+    }
+
+    return Group.dwErrCode;
+}
+
+DWORD CASC_WORKER_POOL::WaitGroupOnly(CASC_WORK_GROUP & Group)
+{
+    CASC_WORK_ITEM WorkItem;
+
+    // Without threads, everything has already been done
+    if(m_ThreadCount != 0)
+    {
+        CascLock(m_Lock);
+        while(Group.PendingItems != 0)
+        {
+            // Run the items of our group that no worker thread has taken yet
+            if(PopGroupItem(Group, WorkItem))
+            {
+                CascUnlock(m_Lock);
+                RunWorkItem(WorkItem);
+                CascLock(m_Lock);
+                continue;
+            }
+
+            // The rest is running on the worker threads
+            CascWaitCondition(m_WorkCompleted, m_Lock);
+        }
+        CascUnlock(m_Lock);
+    }
+
+    return Group.dwErrCode;
+}
+
+DWORD CASC_WORKER_POOL::ParallelFor(size_t nItemCount, PFNPARALLELITEM PfnItem, void * pvParam)
+{
+    PCASC_PARALLEL_CHUNK pChunks;
+    CASC_WORK_GROUP Group;
+    size_t nChunkCount;
+    size_t nChunkSize;
+    DWORD dwErrCode;
+
+    // Single-threaded: call the items directly
+    if(m_ThreadCount == 0 || nItemCount < 2)
+    {
+        for(size_t i = 0; i < nItemCount; i++)
+        {
+            if((dwErrCode = PfnItem(pvParam, i)) != ERROR_SUCCESS)
+                return dwErrCode;
+        }
+        return ERROR_SUCCESS;
+    }
+
+    // Split the range into chunks. More chunks than threads evens out uneven items
+    nChunkCount = CASCLIB_MIN(nItemCount, (m_ThreadCount + 1) * CHUNKS_PER_THREAD);
+    nChunkSize = (nItemCount + nChunkCount - 1) / nChunkCount;
+    nChunkCount = (nItemCount + nChunkSize - 1) / nChunkSize;
+    if((pChunks = CASC_ALLOC<CASC_PARALLEL_CHUNK>(nChunkCount)) == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    // Submit all chunks
+    for(size_t i = 0; i < nChunkCount; i++)
+    {
+        pChunks[i].PfnItem = PfnItem;
+        pChunks[i].pvParam = pvParam;
+        pChunks[i].nStartIndex = i * nChunkSize;
+        pChunks[i].nEndIndex = CASCLIB_MIN(pChunks[i].nStartIndex + nChunkSize, nItemCount);
+
+        if((dwErrCode = Submit(Group, ParallelForChunk, &pChunks[i])) != ERROR_SUCCESS)
+        {
+            if(Group.dwErrCode == ERROR_SUCCESS)
+                Group.dwErrCode = dwErrCode;
+            break;
+        }
+    }
+
+    // Wait until all chunks complete
+    dwErrCode = Wait(Group);
+    CASC_FREE(pChunks);
+    return dwErrCode;
+}
+
+#ifdef CASCLIB_PLATFORM_WINDOWS
+DWORD WINAPI CASC_WORKER_POOL::WorkerThread(LPVOID pvParam)
+#else
+void * CASC_WORKER_POOL::WorkerThread(void * pvParam)
+#endif
+{
+    CASC_WORKER_POOL * pPool = (CASC_WORKER_POOL *)pvParam;
+    CASC_WORK_ITEM WorkItem;
+
+    CascLock(pPool->m_Lock);
+    while(pPool->m_bShutdown == false)
+    {
+        // Take the next item from the queue and run it
+        if(pPool->PopWorkItem(WorkItem))
+        {
+            CascUnlock(pPool->m_Lock);
+            pPool->RunWorkItem(WorkItem);
+            CascLock(pPool->m_Lock);
+            continue;
+        }
+
+        // Wait for more work
+        CascWaitCondition(pPool->m_WorkAvailable, pPool->m_Lock);
+    }
+    CascUnlock(pPool->m_Lock);
+    return 0;
+}
+
+DWORD CASC_WORKER_POOL::ParallelForChunk(void * pvParam)
+{
+    PCASC_PARALLEL_CHUNK pChunk = (PCASC_PARALLEL_CHUNK)pvParam;
+    DWORD dwErrCode;
+
+    for(size_t i = pChunk->nStartIndex; i < pChunk->nEndIndex; i++)
+    {
+        if((dwErrCode = pChunk->PfnItem(pChunk->pvParam, i)) != ERROR_SUCCESS)
+            return dwErrCode;
+    }
+    return ERROR_SUCCESS;
+}
+
+// Must be called with m_Lock held
+bool CASC_WORKER_POOL::PopWorkItem(CASC_WORK_ITEM & WorkItem)
+{
+    if(m_QueueCount != 0)
+    {
+        WorkItem = m_Queue[m_QueueHead];
+        m_QueueHead = (m_QueueHead + 1) % m_QueueSize;
+        m_QueueCount--;
+        return true;
+    }
+    return false;
+}
+
+// Removes the first queued item of the given group. Must be called with m_Lock held
+bool CASC_WORKER_POOL::PopGroupItem(CASC_WORK_GROUP & Group, CASC_WORK_ITEM & WorkItem)
+{
+    for(size_t i = 0; i < m_QueueCount; i++)
+    {
+        if(m_Queue[(m_QueueHead + i) % m_QueueSize].pGroup == &Group)
+        {
+            WorkItem = m_Queue[(m_QueueHead + i) % m_QueueSize];
+
+            // Move the items after it to keep the queue order
+            for(size_t j = i + 1; j < m_QueueCount; j++)
+                m_Queue[(m_QueueHead + j - 1) % m_QueueSize] = m_Queue[(m_QueueHead + j) % m_QueueSize];
+            m_QueueCount--;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Must be called without m_Lock held
+void CASC_WORKER_POOL::RunWorkItem(CASC_WORK_ITEM & WorkItem)
+{
+    CASC_WORK_GROUP * pGroup = WorkItem.pGroup;
+    DWORD dwErrCode;
+
+    // Run the item
+    dwErrCode = WorkItem.PfnWorkItem(WorkItem.pvParam);
+
+    // Update the group. Keep the first error code
+    CascLock(m_Lock);
+    if(dwErrCode != ERROR_SUCCESS && pGroup->dwErrCode == ERROR_SUCCESS)
+        pGroup->dwErrCode = dwErrCode;
+    pGroup->PendingItems--;
+    CascBroadcastCondition(m_WorkCompleted);
+    CascUnlock(m_Lock);
+}
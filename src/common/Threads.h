@@ -0,0 +1,122 @@
+/*****************************************************************************/
+/* Threads.h                              Copyright (c) Ladislav Zezula 2026 */
+/*---------------------------------------------------------------------------*/
+/* Worker thread pool for CascLib                                            */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 17.10.26  1.00  Lad  Created                                              */
+/*****************************************************************************/
+
+#ifndef __CASC_THREADS_H__
+#define __CASC_THREADS_H__
+
+//-----------------------------------------------------------------------------
+// Defines
+
+#define CASC_MAX_WORKER_THREADS     0x40            // Upper limit for the number of worker threads
+
+// Work item callback. Returns ERROR_SUCCESS or an error code
+typedef DWORD (*PFNWORKITEM)(void * pvParam);
+
+// Callback for CASC_WORKER_POOL::ParallelFor. Called once for each index in the range
+typedef DWORD (*PFNPARALLELITEM)(void * pvParam, size_t nIndex);
+
+//-----------------------------------------------------------------------------
+// Platform-specific thread primitives
+
+#ifdef CASCLIB_PLATFORM_WINDOWS
+typedef CONDITION_VARIABLE CASC_CONDITION;
+typedef HANDLE CASC_THREAD;
+#else
+typedef pthread_cond_t CASC_CONDITION;
+typedef pthread_t CASC_THREAD;
+#endif
+
+//-----------------------------------------------------------------------------
+// Group of work items. The caller can wait until all items of the group complete.
+// The first error returned by any of the items is stored in the group
+
+struct CASC_WORK_GROUP
+{
+    CASC_WORK_GROUP()
+    {
+        PendingItems = 0;
+        dwErrCode = ERROR_SUCCESS;
+    }
+
+    DWORD PendingItems;                         // Number of items that have not completed yet
+    DWORD dwErrCode;                            // The first error code returned by a work item
+};
+
+typedef struct _CASC_WORK_ITEM
+{
+    PFNWORKITEM PfnWorkItem;                    // The function to call
+    void * pvParam;                             // Parameter for the function
+    CASC_WORK_GROUP * pGroup;                   // The group the item belongs to
+} CASC_WORK_ITEM, *PCASC_WORK_ITEM;
+
+//-----------------------------------------------------------------------------
+// The worker pool class. If not created (or created with one thread),
+// all work items are executed directly on the calling thread
+
+class CASC_WORKER_POOL
+{
+    public:
+
+    CASC_WORKER_POOL();
+    ~CASC_WORKER_POOL();
+
+    DWORD Create(size_t nThreadCount);
+    void Free();
+
+    // Queues a work item. Executes it directly if the pool has no threads
+    DWORD Submit(CASC_WORK_GROUP & Group, PFNWORKITEM PfnWorkItem, void * pvParam);
+
+    // Waits until all work items in the group complete. The waiting thread
+    // helps with processing the queued items, so it is safe to wait on a worker thread
+    DWORD Wait(CASC_WORK_GROUP & Group);
+
+    // Same as Wait, but the waiting thread only runs the queued items of this group.
+    // Use this when the caller must not be delayed by unrelated work
+    DWORD WaitGroupOnly(CASC_WORK_GROUP & Group);
+
+    // Calls PfnItem for each index in [0, nItemCount), distributed over the worker threads
+    DWORD ParallelFor(size_t nItemCount, PFNPARALLELITEM PfnItem, void * pvParam);
+
+    size_t ThreadCount()
+    {
+        return m_ThreadCount;
+    }
+
+    bool IsParallel()
+    {
+        return (m_ThreadCount != 0);
+    }
+
+    protected:
+
+#ifdef CASCLIB_PLATFORM_WINDOWS
+    static DWORD WINAPI WorkerThread(LPVOID pvParam);
+#else
+    static void * WorkerThread(void * pvParam);
+#endif
+    static DWORD ParallelForChunk(void * pvParam);
+
+    bool PopWorkItem(CASC_WORK_ITEM & WorkItem);
+    bool PopGroupItem(CASC_WORK_GROUP & Group, CASC_WORK_ITEM & WorkItem);
+    void RunWorkItem(CASC_WORK_ITEM & WorkItem);
+
+    CASC_THREAD m_Threads[CASC_MAX_WORKER_THREADS]; // Worker threads
+    CASC_LOCK m_Lock;                           // Lock for the queue and the group counters
+    CASC_CONDITION m_WorkAvailable;             // Signalled when a work item was queued or the pool is shutting down
+    CASC_CONDITION m_WorkCompleted;             // Signalled when a work item completed
+    PCASC_WORK_ITEM m_Queue;                    // Ring buffer of queued work items
+    size_t m_QueueSize;                         // Size of the ring buffer, in items
+    size_t m_QueueHead;                         // Index of the first queued item
+    size_t m_QueueCount;                        // Number of queued items
+    size_t m_ThreadCount;                       // Number of running worker threads
+    bool m_bShutdown;                           // If true, the worker threads are terminating
+};
+
+#endif // __CASC_THREADS_H__
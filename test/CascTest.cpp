@@ -60,6 +60,18 @@ static const char szCircleChar[] = "|/-\\";
 
 #define SHORT_NAME_SIZE 59
 
+//#define TEST_KEY_MAP_SPEED                // Compare the lookup speed of CASC_MAP and the fixed-key maps
+//#define TEST_KEY_SEARCH_SPEED             // Compare the scalar, SSE2 and AVX2 kernels of the sorted key search
+//#define TEST_RANGE_READS                  // Compare range reads with whole-file reads for each cache strategy
+
+#ifdef TEST_RANGE_READS
+#define RANGE_READ_COUNT        0x600           // Number of random reads for each cache strategy
+#define RANGE_READ_MAX_LENGTH   0x80000         // The longest random read. Spans multiple frames
+#define RANGE_READ_PAST_END     0x100           // How far can a read of the last frame go past the end of the file
+#define RANGE_READ_CACHE_SIZE   0x20000         // Size of the multi-frame cache, small enough for frames to be dropped
+#define RANGE_READ_CHUNK        0x1235          // Size of the sequential reads
+#endif  // TEST_RANGE_READS
+
 //-----------------------------------------------------------------------------
 // Local structures
 
@@ -738,6 +750,180 @@ static DWORD Storage_SeekFiles(TLogHelper & LogHelper, TEST_PARAMS & Params)
     return dwErrCode;
 }
 
+#ifdef TEST_RANGE_READS
+// RAND_MAX may be as small as 0x7FFF
+static DWORD GetRandomLength(DWORD dwMaxLength)
+{
+    return (((DWORD)rand() << 16) ^ (DWORD)rand()) % dwMaxLength;
+}
+
+// Reads ranges of a file with the given cache strategy and compares them with the whole file
+static DWORD CheckRangeReads(TLogHelper & LogHelper, TEST_PARAMS & Params, LPBYTE pbFileData, ULONGLONG FileSize, CSTRTG CacheStrategy)
+{
+    ULONGLONG ByteOffset;
+    HANDLE hFile = NULL;
+    LPBYTE pbBuffer;
+    DWORD dwBytesToRead;
+    DWORD dwBytesExpected;
+    DWORD dwBytesRead;
+    DWORD dwErrCode = ERROR_SUCCESS;
+
+    // Allocate the buffer for the largest range
+    if((pbBuffer = CASC_ALLOC<BYTE>(RANGE_READ_MAX_LENGTH + RANGE_READ_PAST_END)) == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    // Open the file and set the cache strategy. Each strategy starts with an empty cache
+    if(CascOpenFile(Params.hStorage, Params.szFileName, 0, Params.dwOpenFlags, &hFile))
+    {
+        switch(CacheStrategy)
+        {
+            case CascCacheNothing:
+                SetCacheStrategy(hFile, CascCacheNothing);
+                break;
+
+            case CascCacheMultiFrame:
+                CascSetFileFlags(hFile, CASC_CACHE_MULTI_FRAME);
+                CascSetFileCacheSize(hFile, RANGE_READ_CACHE_SIZE);
+                break;
+
+            default:
+                break;
+        }
+
+        // Always set random number generator to the same value
+        srand(0x12345678);
+
+        // Perform several random reads. They take turns between a partial read of one frame,
+        // a read across multiple frames and a read of the last frame that goes past the end of the file
+        for(DWORD i = 0; i < RANGE_READ_COUNT; i++)
+        {
+            ULONGLONG RandomHi = rand();
+            DWORD RandomLo = rand();
+
+            // Show the progress
+            if(LogHelper.TimeElapsed(1000))
+                LogHelper.PrintProgress("Testing range reads (strategy %u, %u of %u) ...", (DWORD)CacheStrategy, i, RANGE_READ_COUNT);
+
+            // Determine offset and length
+            switch(i % 3)
+            {
+                case 0:     // Partial read
+                    ByteOffset = ((RandomHi << 0x20) | RandomLo) % FileSize;
+                    dwBytesToRead = GetRandomLength(0x1000);
+                    break;
+
+                case 1:     // Multiple frames
+                    ByteOffset = ((RandomHi << 0x20) | RandomLo) % FileSize;
+                    dwBytesToRead = GetRandomLength(RANGE_READ_MAX_LENGTH);
+                    break;
+
+                default:    // Last frame. CASCLIB_MIN evaluates its arguments twice
+                    ByteOffset = GetRandomLength(RANGE_READ_MAX_LENGTH) + 1;
+                    ByteOffset = FileSize - CASCLIB_MIN(FileSize, ByteOffset);
+                    dwBytesToRead = (DWORD)(FileSize - ByteOffset) + GetRandomLength(RANGE_READ_PAST_END);
+                    break;
+            }
+            dwBytesExpected = (DWORD)CASCLIB_MIN((ULONGLONG)dwBytesToRead, FileSize - ByteOffset);
+
+            // Load the data from CASC file
+            CascSetFilePointer64(hFile, ByteOffset, NULL, FILE_BEGIN);
+            if(!CascReadFile(hFile, pbBuffer, dwBytesToRead, &dwBytesRead) || dwBytesRead != dwBytesExpected)
+            {
+                LogHelper.PrintMessage("Error: Failed to read %u bytes from CASC file (offset %llX, strategy %u).", dwBytesToRead, ByteOffset, (DWORD)CacheStrategy);
+                dwErrCode = ERROR_CAN_NOT_COMPLETE;
+                break;
+            }
+
+            // Compare with the whole file
+            if(memcmp(pbBuffer, pbFileData + ByteOffset, dwBytesRead))
+            {
+                LogHelper.PrintMessage("Error: Data mismatch at offset %llX, length %u (strategy %u).", ByteOffset, dwBytesRead, (DWORD)CacheStrategy);
+                dwErrCode = ERROR_CAN_NOT_COMPLETE;
+                break;
+            }
+        }
+
+        // Read the whole file sequentially in odd-sized chunks. This also triggers the readahead
+        if(dwErrCode == ERROR_SUCCESS)
+        {
+            CascSetFilePointer64(hFile, 0, NULL, FILE_BEGIN);
+            for(ByteOffset = 0; ByteOffset < FileSize; ByteOffset += dwBytesRead)
+            {
+                dwBytesToRead = (DWORD)CASCLIB_MIN((ULONGLONG)RANGE_READ_CHUNK, FileSize - ByteOffset);
+                if(!CascReadFile(hFile, pbBuffer, dwBytesToRead, &dwBytesRead) || dwBytesRead != dwBytesToRead)
+                {
+                    LogHelper.PrintMessage("Error: Failed to read %u bytes from CASC file (offset %llX, strategy %u).", dwBytesToRead, ByteOffset, (DWORD)CacheStrategy);
+                    dwErrCode = ERROR_CAN_NOT_COMPLETE;
+                    break;
+                }
+
+                if(memcmp(pbBuffer, pbFileData + ByteOffset, dwBytesRead))
+                {
+                    LogHelper.PrintMessage("Error: Data mismatch at offset %llX, length %u (strategy %u).", ByteOffset, dwBytesRead, (DWORD)CacheStrategy);
+                    dwErrCode = ERROR_CAN_NOT_COMPLETE;
+                    break;
+                }
+            }
+        }
+
+        CascCloseFile(hFile);
+    }
+    else
+    {
+        LogHelper.PrintMessage("Error: Failed to open file %s.", Params.szFileName);
+        dwErrCode = GetCascError();
+    }
+
+    CASC_FREE(pbBuffer);
+    return dwErrCode;
+}
+
+// Compares partial, multi-frame and last-frame reads with the whole-file read, for each cache strategy
+static DWORD Storage_ReadRanges(TLogHelper & LogHelper, TEST_PARAMS & Params)
+{
+    ULONGLONG FileSize = 0;
+    HANDLE hFile;
+    LPBYTE pbFileData = NULL;
+    DWORD dwBytesRead = 0;
+    DWORD dwErrCode = ERROR_SUCCESS;
+
+    // Check whether the file name was given
+    if(Params.szFileName == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    // Load the whole file at once
+    LogHelper.PrintProgress("Loading file ...");
+    if(CascOpenFile(Params.hStorage, Params.szFileName, 0, Params.dwOpenFlags, &hFile))
+    {
+        CascGetFileSize64(hFile, &FileSize);
+        if(FileSize != 0 && FileSize < 0x40000000 && (pbFileData = CASC_ALLOC<BYTE>((size_t)FileSize)) != NULL)
+        {
+            if(!CascReadFile(hFile, pbFileData, (DWORD)FileSize, &dwBytesRead) || dwBytesRead != FileSize)
+            {
+                LogHelper.PrintMessage("Error: Failed to read the whole file %s.", Params.szFileName);
+                dwErrCode = ERROR_CAN_NOT_COMPLETE;
+            }
+        }
+        CascCloseFile(hFile);
+    }
+
+    // Compare the ranges for each strategy
+    if(pbFileData != NULL)
+    {
+        if(dwErrCode == ERROR_SUCCESS)
+            dwErrCode = CheckRangeReads(LogHelper, Params, pbFileData, FileSize, CascCacheNothing);
+        if(dwErrCode == ERROR_SUCCESS)
+            dwErrCode = CheckRangeReads(LogHelper, Params, pbFileData, FileSize, CascCacheLastFrame);
+        if(dwErrCode == ERROR_SUCCESS)
+            dwErrCode = CheckRangeReads(LogHelper, Params, pbFileData, FileSize, CascCacheMultiFrame);
+        CASC_FREE(pbFileData);
+    }
+
+    LogHelper.PrintTotalTime();
+    return dwErrCode;
+}
+#endif  // TEST_RANGE_READS
+
 static DWORD Storage_EnumFiles(TLogHelper & LogHelper, TEST_PARAMS & Params)
 {
     PCASC_FIND_DATA_ARRAY pFiles;
@@ -884,12 +1070,15 @@ static DWORD Storage_ReadFiles(TLogHelper & LogHelper, TEST_PARAMS & Params)
 
 static DWORD LocalStorage_Test(PFN_RUN_TEST PfnRunTest, STORAGE_INFO & StorInfo)
 {
-    CASC_OPEN_STORAGE_ARGS OpenArgs = {sizeof(CASC_OPEN_STORAGE_ARGS)};
+    CASC_OPEN_STORAGE_ARGS OpenArgs;
     TLogHelper LogHelper(StorInfo.szPath);
     HANDLE hStorage;
     TCHAR szFullPath[MAX_PATH];
     DWORD dwErrCode = ERROR_SUCCESS;
 
+    memset(&OpenArgs, 0, sizeof(CASC_OPEN_STORAGE_ARGS));
+    OpenArgs.Size = sizeof(CASC_OPEN_STORAGE_ARGS);
+
     // Prepare the full path of the storage
     MakeFullPath(szFullPath, _countof(szFullPath), StorInfo.szPath);
 
@@ -1042,12 +1231,15 @@ static bool WINAPI OnlineStorage_OpenCB_Simple(
 
 static DWORD OnlineStorage_Test(PFN_RUN_TEST PfnRunTest, STORAGE_INFO & StorInfo)
 {
-    CASC_OPEN_STORAGE_ARGS OpenArgs = {sizeof(CASC_OPEN_STORAGE_ARGS)};
+    CASC_OPEN_STORAGE_ARGS OpenArgs;
     TLogHelper LogHelper(StorInfo.szPath);
     HANDLE hStorage;
     TCHAR szParams[MAX_PATH+0x40];
     DWORD dwErrCode = ERROR_SUCCESS;
 
+    memset(&OpenArgs, 0, sizeof(CASC_OPEN_STORAGE_ARGS));
+    OpenArgs.Size = sizeof(CASC_OPEN_STORAGE_ARGS);
+
     LogHelper.PrintMessage("Root File: %s", StorInfo.szPath);
     LogHelper.PrintProgress("Opening storage ...");
 
@@ -1119,6 +1311,262 @@ static DWORD OnlineStorage_Test(PFN_RUN_TEST PfnRunTest, STORAGE_INFO & StorInfo
     return dwErrCode;
 }
 
+//-----------------------------------------------------------------------------
+// Speed of the key maps
+
+#ifdef TEST_KEY_MAP_SPEED
+
+#define KEY_MAP_ITEM_COUNT  0x200000        // Number of objects inserted to the maps
+#define KEY_MAP_LOOKUPS     0x800000        // Number of lookups. Half of them look for keys that are not there
+
+// Measures the lookup speed of a key map. Returns the number of objects found
+template <typename KEY_MAP_CLASS>
+static size_t SpeedKeyMap_Lookup(KEY_MAP_CLASS & KeyMap, LPBYTE pbKeys, LPCSTR szMapName, LPBYTE * FoundObjects)
+{
+    clock_t StartTime = clock();
+    size_t nFound = 0;
+    double Seconds;
+
+    for(size_t i = 0; i < KEY_MAP_LOOKUPS; i++)
+    {
+        LPBYTE pbKey = pbKeys + ((i * 0x9E3779B1) % (KEY_MAP_ITEM_COUNT * 2)) * MD5_HASH_SIZE;
+
+        FoundObjects[i] = (LPBYTE)KeyMap.FindObject(pbKey);
+        nFound += (FoundObjects[i] != NULL) ? 1 : 0;
+    }
+
+    Seconds = (double)(clock() - StartTime) / CLOCKS_PER_SEC;
+    printf("%-24s %u lookups, %u found, %.3f sec (%.1fM lookups/s)\n", szMapName, KEY_MAP_LOOKUPS, (DWORD)nFound, Seconds, (Seconds != 0) ? (KEY_MAP_LOOKUPS / Seconds / 1000000.0) : 0.0);
+    return nFound;
+}
+
+// Compares CASC_MAP with the fixed-key maps on random 16-byte keys.
+// The first half of the keys is inserted to the maps, the second half is used for misses
+static DWORD SpeedKeyMap_Test()
+{
+    CASC_CONCURRENT_MAP<MD5_HASH_SIZE> ConcurrentMap;
+    CASC_FIXED_MAP<MD5_HASH_SIZE> FixedMap;
+    CASC_MAP GenericMap;
+    ULONGLONG RandomValue = 0x0123456789ABCDEFULL;
+    LPBYTE * FoundObjects1 = NULL;
+    LPBYTE * FoundObjects2 = NULL;
+    LPBYTE pbKeys = NULL;
+    DWORD dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+
+    // Allocate the keys and the arrays for lookup results
+    pbKeys = CASC_ALLOC<BYTE>(KEY_MAP_ITEM_COUNT * 2 * MD5_HASH_SIZE);
+    FoundObjects1 = CASC_ALLOC<LPBYTE>(KEY_MAP_LOOKUPS);
+    FoundObjects2 = CASC_ALLOC<LPBYTE>(KEY_MAP_LOOKUPS);
+    if(pbKeys != NULL && FoundObjects1 != NULL && FoundObjects2 != NULL)
+    {
+        // Generate the keys (xorshift64)
+        for(size_t i = 0; i < KEY_MAP_ITEM_COUNT * 2 * MD5_HASH_SIZE; i += sizeof(ULONGLONG))
+        {
+            RandomValue ^= RandomValue << 13;
+            RandomValue ^= RandomValue >> 7;
+            RandomValue ^= RandomValue << 17;
+            memcpy(pbKeys + i, &RandomValue, sizeof(ULONGLONG));
+        }
+
+        // Create the maps. The objects are the keys themselves
+        if(GenericMap.Create(KEY_MAP_ITEM_COUNT, MD5_HASH_SIZE, 0) == ERROR_SUCCESS &&
+           FixedMap.Create(KEY_MAP_ITEM_COUNT, 0) == ERROR_SUCCESS &&
+           ConcurrentMap.Create(KEY_MAP_ITEM_COUNT, 0) == ERROR_SUCCESS)
+        {
+            dwErrCode = ERROR_SUCCESS;
+            for(size_t i = 0; i < KEY_MAP_ITEM_COUNT; i++)
+            {
+                LPBYTE pbKey = pbKeys + i * MD5_HASH_SIZE;
+
+                if(!GenericMap.InsertObject(pbKey, pbKey) || !FixedMap.InsertObject(pbKey, pbKey) || !ConcurrentMap.InsertObject(pbKey, pbKey))
+                {
+                    dwErrCode = ERROR_CAN_NOT_COMPLETE;
+                    break;
+                }
+            }
+        }
+
+        // Measure the lookups. All maps must return the same objects
+        if(dwErrCode == ERROR_SUCCESS)
+        {
+            SpeedKeyMap_Lookup(GenericMap, pbKeys, "CASC_MAP", FoundObjects1);
+            SpeedKeyMap_Lookup(FixedMap, pbKeys, "CASC_FIXED_MAP", FoundObjects2);
+            if(memcmp(FoundObjects1, FoundObjects2, KEY_MAP_LOOKUPS * sizeof(LPBYTE)))
+                dwErrCode = ERROR_CAN_NOT_COMPLETE;
+            SpeedKeyMap_Lookup(ConcurrentMap, pbKeys, "CASC_CONCURRENT_MAP", FoundObjects2);
+            if(memcmp(FoundObjects1, FoundObjects2, KEY_MAP_LOOKUPS * sizeof(LPBYTE)))
+                dwErrCode = ERROR_CAN_NOT_COMPLETE;
+        }
+
+        if(dwErrCode != ERROR_SUCCESS)
+            printf("Error: The key maps returned different results\n");
+    }
+
+    ConcurrentMap.Free();
+    FixedMap.Free();
+    GenericMap.Free();
+    CASC_FREE(FoundObjects2);
+    CASC_FREE(FoundObjects1);
+    CASC_FREE(pbKeys);
+    return dwErrCode;
+}
+#endif  // TEST_KEY_MAP_SPEED
+
+//-----------------------------------------------------------------------------
+// Speed of the sorted key search
+
+#ifdef TEST_KEY_SEARCH_SPEED
+
+#define KEY_SEARCH_ITEM_COUNT   10000000        // Number of items in the synthetic index
+#define KEY_SEARCH_ITEM_LENGTH  0x12            // Length of one item. Same as the entry of an .idx file
+#define KEY_SEARCH_LOOKUPS      0x200000        // Number of lookups. Half of them look for keys that are not there
+
+// Plain binary search for the first item with the key. This is the reference for the kernels
+static LPBYTE SpeedKeySearch_Binary(LPBYTE pbItems, LPBYTE pbKey)
+{
+    size_t nItemCount = KEY_SEARCH_ITEM_COUNT;
+    size_t nFirst = 0;
+
+    while(nItemCount > 0)
+    {
+        size_t nHalf = nItemCount / 2;
+
+        if(memcmp(pbItems + (nFirst + nHalf) * KEY_SEARCH_ITEM_LENGTH, pbKey, CASC_EKEY_SIZE) < 0)
+        {
+            nFirst = nFirst + nHalf + 1;
+            nItemCount = nItemCount - nHalf - 1;
+        }
+        else
+        {
+            nItemCount = nHalf;
+        }
+    }
+
+    if(nFirst < KEY_SEARCH_ITEM_COUNT && !memcmp(pbItems + nFirst * KEY_SEARCH_ITEM_LENGTH, pbKey, CASC_EKEY_SIZE))
+        return pbItems + nFirst * KEY_SEARCH_ITEM_LENGTH;
+    return NULL;
+}
+
+// Measures the search speed, either of the binary search or of CascSearchSortedKeys with the current kernel
+static void SpeedKeySearch_Lookup(LPBYTE pbItems, LPBYTE pbProbes, LPCSTR szKernelName, LPBYTE * FoundItems, bool bBinarySearch)
+{
+    clock_t StartTime = clock();
+    size_t nFound = 0;
+    double Seconds;
+
+    for(size_t i = 0; i < KEY_SEARCH_LOOKUPS; i++)
+    {
+        LPBYTE pbKey = pbProbes + i * CASC_EKEY_SIZE;
+
+        if(bBinarySearch)
+            FoundItems[i] = SpeedKeySearch_Binary(pbItems, pbKey);
+        else
+            FoundItems[i] = CascSearchSortedKeys(pbItems, KEY_SEARCH_ITEM_COUNT, KEY_SEARCH_ITEM_LENGTH, pbKey, CASC_EKEY_SIZE);
+        nFound += (FoundItems[i] != NULL) ? 1 : 0;
+    }
+
+    Seconds = (double)(clock() - StartTime) / CLOCKS_PER_SEC;
+    printf("%-24s %u lookups, %u found, %.3f sec (%.2fM lookups/s)\n", szKernelName, KEY_SEARCH_LOOKUPS, (DWORD)nFound, Seconds, (Seconds != 0) ? (KEY_SEARCH_LOOKUPS / Seconds / 1000000.0) : 0.0);
+}
+
+// Measures one kernel and compares its results with the binary search. Kernels not supported by the CPU are skipped
+static DWORD SpeedKeySearch_Kernel(LPBYTE pbItems, LPBYTE pbProbes, KEY_SEARCH KeySearch, LPCSTR szKernelName, LPBYTE * FoundItems, LPBYTE * ExpectedItems)
+{
+    DWORD dwErrCode = ERROR_SUCCESS;
+
+    if(CascSetKeySearch(KeySearch))
+    {
+        SpeedKeySearch_Lookup(pbItems, pbProbes, szKernelName, FoundItems, false);
+        if(memcmp(FoundItems, ExpectedItems, KEY_SEARCH_LOOKUPS * sizeof(LPBYTE)))
+            dwErrCode = ERROR_CAN_NOT_COMPLETE;
+        CascSetKeySearch(KeySearchBest);
+    }
+    else
+    {
+        printf("%-24s not supported by the CPU\n", szKernelName);
+    }
+    return dwErrCode;
+}
+
+// Compares the kernels of CascSearchSortedKeys on a synthetic index with 9-byte keys.
+// Every 64th item repeats the key of the previous one, so the search must return the first of them
+static DWORD SpeedKeySearch_Test()
+{
+    ULONGLONG RandomValue = 0x0123456789ABCDEFULL;
+    ULONGLONG KeyStep = (ULONGLONG)(-1) / KEY_SEARCH_ITEM_COUNT;
+    ULONGLONG KeyPrefix;
+    LPBYTE * FoundItems1 = NULL;
+    LPBYTE * FoundItems2 = NULL;
+    LPBYTE pbProbes = NULL;
+    LPBYTE pbItems = NULL;
+    DWORD dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+
+    // Allocate the items, the keys to look for and the arrays for lookup results
+    pbItems = CASC_ALLOC<BYTE>((size_t)KEY_SEARCH_ITEM_COUNT * KEY_SEARCH_ITEM_LENGTH);
+    pbProbes = CASC_ALLOC<BYTE>(KEY_SEARCH_LOOKUPS * CASC_EKEY_SIZE);
+    FoundItems1 = CASC_ALLOC<LPBYTE>(KEY_SEARCH_LOOKUPS);
+    FoundItems2 = CASC_ALLOC<LPBYTE>(KEY_SEARCH_LOOKUPS);
+    if(pbItems != NULL && pbProbes != NULL && FoundItems1 != NULL && FoundItems2 != NULL)
+    {
+        // Generate the sorted items. The keys are uniformly distributed (xorshift64)
+        for(size_t i = 0; i < KEY_SEARCH_ITEM_COUNT; i++)
+        {
+            LPBYTE pbItem = pbItems + i * KEY_SEARCH_ITEM_LENGTH;
+
+            RandomValue ^= RandomValue << 13;
+            RandomValue ^= RandomValue >> 7;
+            RandomValue ^= RandomValue << 17;
+
+            if(i != 0 && (i % 64) == 0)
+            {
+                memcpy(pbItem, pbItem - KEY_SEARCH_ITEM_LENGTH, CASC_EKEY_SIZE);
+            }
+            else
+            {
+                KeyPrefix = (i * KeyStep) + (RandomValue % KeyStep);
+                for(size_t j = 0; j < sizeof(ULONGLONG); j++)
+                    pbItem[j] = (BYTE)(KeyPrefix >> (56 - j * 8));
+                pbItem[8] = (BYTE)(RandomValue >> 32);
+            }
+
+            // The rest of the item is the storage offset and size
+            memset(pbItem + CASC_EKEY_SIZE, 0, KEY_SEARCH_ITEM_LENGTH - CASC_EKEY_SIZE);
+            ConvertIntegerToBytes_4((DWORD)i, pbItem + CASC_EKEY_SIZE);
+        }
+
+        // Generate the keys to look for. The odd ones differ in the last key byte
+        for(size_t i = 0; i < KEY_SEARCH_LOOKUPS; i++)
+        {
+            LPBYTE pbProbe = pbProbes + i * CASC_EKEY_SIZE;
+
+            RandomValue ^= RandomValue << 13;
+            RandomValue ^= RandomValue >> 7;
+            RandomValue ^= RandomValue << 17;
+
+            memcpy(pbProbe, pbItems + (RandomValue % KEY_SEARCH_ITEM_COUNT) * KEY_SEARCH_ITEM_LENGTH, CASC_EKEY_SIZE);
+            pbProbe[8] ^= (i & 1) ? 0x5A : 0x00;
+        }
+
+        // Measure the lookups. All kernels must return the same items as the binary search
+        SpeedKeySearch_Lookup(pbItems, pbProbes, "Binary search", FoundItems1, true);
+        dwErrCode = SpeedKeySearch_Kernel(pbItems, pbProbes, KeySearchScalar, "Scalar kernel", FoundItems2, FoundItems1);
+        if(dwErrCode == ERROR_SUCCESS)
+            dwErrCode = SpeedKeySearch_Kernel(pbItems, pbProbes, KeySearchSSE2, "SSE2 kernel", FoundItems2, FoundItems1);
+        if(dwErrCode == ERROR_SUCCESS)
+            dwErrCode = SpeedKeySearch_Kernel(pbItems, pbProbes, KeySearchAVX2, "AVX2 kernel", FoundItems2, FoundItems1);
+
+        if(dwErrCode != ERROR_SUCCESS)
+            printf("Error: The search kernels returned different results\n");
+    }
+
+    CASC_FREE(FoundItems2);
+    CASC_FREE(FoundItems1);
+    CASC_FREE(pbProbes);
+    CASC_FREE(pbItems);
+    return dwErrCode;
+}
+#endif  // TEST_KEY_SEARCH_SPEED
+
 //-----------------------------------------------------------------------------
 // Storage list
 
@@ -1247,14 +1695,31 @@ int main(int argc, char * argv[])
     _CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 #endif  // defined(_MSC_VER) && defined(_DEBUG)
 
+#ifdef TEST_KEY_MAP_SPEED
+    //
+    // Compare the lookup speed of the key maps
+    //
+    dwErrCode = SpeedKeyMap_Test();
+#endif
+
+#ifdef TEST_KEY_SEARCH_SPEED
+    //
+    // Compare the kernels of the sorted key search
+    //
+    dwErrCode = SpeedKeySearch_Test();
+#endif
+
 #ifdef LOAD_STORAGES_PLAYING_SPACE
     {
-        CASC_OPEN_STORAGE_ARGS OpenArgs = {sizeof(CASC_OPEN_STORAGE_ARGS)};
+        CASC_OPEN_STORAGE_ARGS OpenArgs;
         ULONGLONG FileSize = 0;
         HANDLE hStorage;
         HANDLE hFile;
         BYTE Buffer[0x100];
 
+        memset(&OpenArgs, 0, sizeof(CASC_OPEN_STORAGE_ARGS));
+        OpenArgs.Size = sizeof(CASC_OPEN_STORAGE_ARGS);
+
         // Prepare the callbacks
         OpenArgs.PfnProgressCallback = OnlineStorage_OpenCB;
         OpenArgs.dwFlags = CASC_FEATURE_ALLOW_DOWNLOAD;
@@ -1289,6 +1754,18 @@ int main(int argc, char * argv[])
     }
 #endif
 
+#ifdef TEST_RANGE_READS
+    //
+    // Compare range reads with whole-file reads of the example file of each local storage
+    //
+    for(size_t i = 0; i < _countof(StorageInfo1); i++)
+    {
+        dwErrCode = LocalStorage_Test(Storage_ReadRanges, StorageInfo1[i]);
+        if(dwErrCode != ERROR_SUCCESS && dwErrCode != ERROR_FILE_NOT_FOUND)
+            break;
+    }
+#endif
+
 #ifdef LOAD_STORAGES_LOCAL
     //
     // Run the tests for every local storage in my collection